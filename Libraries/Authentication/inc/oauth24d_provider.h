@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "webrtc/rtc_base/sigslot.h"
 #include "webrtc/rtc_base/logging.h"
@@ -9,6 +10,8 @@
 
 #include "ssl_capable_socket.h"
 #include "authentication_provider.h"
+#include "connection_race.h"
+#include "dns_cache.h"
 
 class OAuth24DProvider : public sigslot::has_slots<>,
 	public MessageHandler,
@@ -41,6 +44,9 @@ public:
 
 	const State& state() const;
 
+	// Sets the cache used to resolve the hosts, instead of the process wide one
+	void SetDnsCache(std::shared_ptr<DnsCache> dns_cache);
+
 	// emitted when we have the code response and are awaiting user interaction
 	sigslot::signal1<const CodeData&> SignalCodeComplete;
 
@@ -61,6 +67,9 @@ public:
 	// implement AuthenticationProvider
 	virtual bool Authenticate() override;
 
+	// each authentication shows the user a new code
+	virtual bool IsInteractive() const override;
+
 	// implement MessageHandler
 	virtual void OnMessage(rtc::Message* msg) override;
 
@@ -70,7 +79,8 @@ protected:
 	void SocketOpen(rtc::AsyncSocket* socket);
 	void SocketRead(rtc::AsyncSocket* socket);
 	void SocketClose(rtc::AsyncSocket* socket, int err);
-	void AddressResolve(rtc::AsyncResolverInterface* resolver);
+	void AddressResolve(int error, const std::vector<rtc::IPAddress>& addresses);
+	void RaceComplete(ConnectionRace* race, int error);
 
 	std::string code_uri_;
 	std::string poll_uri_;
@@ -80,9 +90,14 @@ protected:
 	CodeData data_;
 	std::shared_ptr<rtc::Thread> signaling_thread_;
 	std::unique_ptr<SslCapableSocket> socket_;
-	std::unique_ptr<AsyncResolver> resolver_;
+	std::shared_ptr<DnsCache> dns_cache_;
+	int dns_lookup_id_;
+	std::vector<rtc::IPAddress> code_addresses_;
+	std::vector<rtc::IPAddress> poll_addresses_;
+	std::unique_ptr<ConnectionRace> race_;
 
 private:
 	rtc::SocketAddress SocketAddressFromString(const std::string& str);
+	void ResolveHost(const rtc::SocketAddress& host);
 	int ConnectSocket(rtc::SocketAddress addr);
 };
@@ -6,7 +6,7 @@ namespace
 }
 
 OAuth24DProvider::OAuth24DProvider(const std::string& codeUri, const std::string& pollUri) :
-	code_uri_(codeUri), poll_uri_(pollUri), state_(State::NOT_ACTIVE)
+	code_uri_(codeUri), poll_uri_(pollUri), state_(State::NOT_ACTIVE), dns_cache_(DnsCache::Default()), dns_lookup_id_(0)
 {
 	// don't support empty values for these fields
 	if (codeUri.empty() || pollUri.empty())
@@ -24,19 +24,19 @@ OAuth24DProvider::OAuth24DProvider(const std::string& codeUri, const std::string
 	socketThread = socketThread == nullptr ? rtc::ThreadManager::Instance()->WrapCurrentThread() : socketThread;
 
 	signaling_thread_ = std::shared_ptr<rtc::Thread>(socketThread, NullDeleter());
+
+	// race the connections across the resolved addresses, the first connected socket is used
+	race_.reset(new ConnectionRace([this](const rtc::SocketAddress& addr)
+	{
+		return std::unique_ptr<SslCapableSocket>(new SslCapableSocket(addr.family(), addr.port() == 443, signaling_thread_));
+	}));
+
+	race_->SignalDone.connect(this, &OAuth24DProvider::RaceComplete);
 }
 
 OAuth24DProvider::~OAuth24DProvider()
 {
-	if (resolver_.get() != nullptr)
-	{
-		// release the resolver pointer and destroy the resolver
-		auto released = resolver_.release();
-		released->Destroy(true);
-
-		// reset the resolver pointer to nullptr
-		resolver_.reset(nullptr);
-	}
+	dns_cache_->Cancel(dns_lookup_id_);
 }
 
 const OAuth24DProvider::State& OAuth24DProvider::state() const
@@ -44,6 +44,13 @@ const OAuth24DProvider::State& OAuth24DProvider::state() const
 	return state_;
 }
 
+void OAuth24DProvider::SetDnsCache(std::shared_ptr<DnsCache> dns_cache)
+{
+	dns_cache_->Cancel(dns_lookup_id_);
+	dns_lookup_id_ = 0;
+	dns_cache_ = dns_cache;
+}
+
 rtc::SocketAddress OAuth24DProvider::SocketAddressFromString(const std::string& str)
 {
 	// take the hostname, <protocol>://<hostname>[:port]/ 
@@ -63,14 +70,28 @@ rtc::SocketAddress OAuth24DProvider::SocketAddressFromString(const std::string&
 	return rtc::SocketAddress(tempHost, addrPort);
 }
 
+void OAuth24DProvider::ResolveHost(const rtc::SocketAddress& host)
+{
+	// the cache answers without a lookup while the addresses are fresh
+	dns_cache_->Cancel(dns_lookup_id_);
+	dns_lookup_id_ = dns_cache_->Resolve(host.hostname(), [this](int error, const std::vector<rtc::IPAddress>& addresses)
+	{
+		AddressResolve(error, addresses);
+	});
+}
+
 int OAuth24DProvider::ConnectSocket(rtc::SocketAddress addr)
 {
-	socket_.reset(new SslCapableSocket(addr.family(), addr.port() == 443, signaling_thread_));
-	socket_->SignalCloseEvent.connect(this, &OAuth24DProvider::SocketClose);
-	socket_->SignalConnectEvent.connect(this, &OAuth24DProvider::SocketOpen);
-	socket_->SignalReadEvent.connect(this, &OAuth24DProvider::SocketRead);
+	// named hosts are raced across their addresses, literal ones have only the one
+	std::vector<rtc::IPAddress> addresses(1, addr.ipaddr());
+	if (addr.IsUnresolvedIP())
+	{
+		addresses = DnsCache::OrderForConnection(addr == code_host_ ? code_addresses_ : poll_addresses_);
+	}
+
+	race_->Start(addr.hostname(), addr.port(), addresses);
 
-	return socket_->Connect(addr);
+	return 0;
 }
 
 bool OAuth24DProvider::Authenticate()
@@ -83,9 +104,7 @@ bool OAuth24DProvider::Authenticate()
 	if (code_host_.IsUnresolvedIP())
 	{
 		state_ = RESOLVING_CODE;
-		resolver_.reset(new rtc::AsyncResolver());
-		resolver_->SignalDone.connect(this, &OAuth24DProvider::AddressResolve);
-		resolver_->Start(code_host_);
+		ResolveHost(code_host_);
 
 		return true;
 	}
@@ -93,9 +112,7 @@ bool OAuth24DProvider::Authenticate()
 	if (poll_host_.IsUnresolvedIP())
 	{
 		state_ = RESOLVING_POLL;
-		resolver_.reset(new rtc::AsyncResolver());
-		resolver_->SignalDone.connect(this, &OAuth24DProvider::AddressResolve);
-		resolver_->Start(poll_host_);
+		ResolveHost(poll_host_);
 
 		return true;
 	}
@@ -107,6 +124,11 @@ bool OAuth24DProvider::Authenticate()
 	return err != SOCKET_ERROR;
 }
 
+bool OAuth24DProvider::IsInteractive() const
+{
+	return true;
+}
+
 void OAuth24DProvider::OnMessage(rtc::Message* msg)
 {
 	// this indicates it's time to poll again
@@ -243,6 +265,12 @@ void OAuth24DProvider::SocketRead(rtc::AsyncSocket* socket)
 					completionData.accessToken = accessCodeWrapper.asString();
 				}
 
+				auto expiresInWrapper = root.get("expires_in", NULL);
+				if (expiresInWrapper.isIntegral())
+				{
+					completionData.expiresIn = expiresInWrapper.asInt();
+				}
+
 				// emit the event
 				SignalAuthenticationComplete.emit(completionData);
 
@@ -265,41 +293,69 @@ void OAuth24DProvider::SocketClose(rtc::AsyncSocket* socket, int err)
 	return;
 }
 
-void OAuth24DProvider::AddressResolve(rtc::AsyncResolverInterface* resolver)
+void OAuth24DProvider::AddressResolve(int error, const std::vector<rtc::IPAddress>& addresses)
 {
-	// capture the result
-	auto tempHost = resolver->address();
-
-	// release the resolver pointer and destroy the resolver
-	auto released = resolver_.release();
-	released->Destroy(true);
-
-	// reset the resolver pointer to nullptr
-	resolver_.reset(nullptr);
+	dns_lookup_id_ = 0;
 
 	if (state_ != State::RESOLVING_CODE && state_ != State::RESOLVING_POLL)
 	{
 		return;
 	}
 
+	if (error != 0)
+	{
+		LOG(LS_ERROR) << "Unable to resolve " << (state_ == State::RESOLVING_CODE ? code_host_ : poll_host_).hostname();
+
+		state_ = State::NOT_ACTIVE;
+		SignalAuthenticationComplete.emit(AuthenticationProviderResult());
+		return;
+	}
+
+	// the hosts keep their names, the addresses are raced on connection
 	if (state_ == State::RESOLVING_CODE)
 	{
-		code_host_ = tempHost;
+		code_addresses_ = addresses;
 
 		if (poll_host_.IsUnresolvedIP())
 		{
 			state_ = RESOLVING_POLL;
-			resolver_.reset(new rtc::AsyncResolver());
-			resolver_->SignalDone.connect(this, &OAuth24DProvider::AddressResolve);
-			resolver_->Start(poll_host_);
+			ResolveHost(poll_host_);
 			
 			return;
 		}
 	}
+	else
+	{
+		poll_addresses_ = addresses;
+	}
 
-	poll_host_ = tempHost;
 	state_ = State::REQUEST_CODE;
 	
 	// connect the socket to code_host_ to REQUEST_CODE
 	ConnectSocket(code_host_);
+}
+
+void OAuth24DProvider::RaceComplete(ConnectionRace* race, int error)
+{
+	// the next connections start with the addresses which answered
+	for (const auto& failed : race->failed_addresses())
+	{
+		dns_cache_->ReportUnreachable(failed.hostname(), failed.ipaddr());
+	}
+
+	if (error != 0)
+	{
+		LOG(LS_ERROR) << "Unable to connect to " << (state_ == State::REQUEST_CODE ? code_host_ : poll_host_).hostname();
+
+		state_ = State::NOT_ACTIVE;
+		SignalAuthenticationComplete.emit(AuthenticationProviderResult());
+		return;
+	}
+
+	socket_ = race->TakeSocket();
+	socket_->SignalCloseEvent.connect(this, &OAuth24DProvider::SocketClose);
+	socket_->SignalReadEvent.connect(this, &OAuth24DProvider::SocketRead);
+
+	// the socket won the race once connected
+	SocketOpen(socket_.get());
 }
\ No newline at end of file
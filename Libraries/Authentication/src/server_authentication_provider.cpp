@@ -153,6 +153,17 @@ void ServerAuthenticationProvider::SocketRead(rtc::AsyncSocket* socket)
 					completionData.accessToken = token;
 				}
 			}
+
+			// the lifetime may be given as a string, e.g. by azure ad
+			auto expiresInWrapper = root.get("expires_in", NULL);
+			if (expiresInWrapper.isIntegral())
+			{
+				completionData.expiresIn = expiresInWrapper.asInt();
+			}
+			else if (expiresInWrapper.isString())
+			{
+				completionData.expiresIn = atoi(expiresInWrapper.asCString());
+			}
 		}
 
 		// emit the event
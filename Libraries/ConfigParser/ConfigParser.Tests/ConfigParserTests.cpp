@@ -1,13 +1,50 @@
+#include <atomic>
+#include <fstream>
 #include <string>
+#include <thread>
+#include <vector>
 #include <gtest\gtest.h>
 #include <windows.h>
 #include "config_parser.h"
+#include "config_watcher.h"
 
 #pragma comment(lib, "webrtc.lib")
 
 using namespace CppFactory;
 using namespace StreamingToolkit;
 
+namespace
+{
+	// gets a clean temp directory for the watched configuration files
+	std::string GetWatchedConfigPath()
+	{
+		TCHAR buffer[MAX_PATH];
+		GetTempPath(MAX_PATH, buffer);
+		auto path = std::string(buffer) + "ConfigWatcherTests\\";
+		CreateDirectory(path.c_str(), NULL);
+		DeleteFile((path + ConfigParser::kServerConfigPath).c_str());
+		DeleteFile((path + ConfigParser::kNvEncConfigPath).c_str());
+		DeleteFile((path + "webrtcConfig.json").c_str());
+		return path;
+	}
+
+	// writes the watched configuration files, with a frame size of value x value at value fps
+	void WriteWatchedConfig(const std::string& path, int value)
+	{
+		std::ofstream serverConfig(path + ConfigParser::kServerConfigPath, std::ios::trunc);
+		serverConfig << "{ \"serverConfig\": { \"width\": " << value << ", \"height\": " << value << " } }";
+		serverConfig.close();
+
+		std::ofstream webrtcConfig(path + "webrtcConfig.json", std::ios::trunc);
+		webrtcConfig << "{ \"port\": " << value << " }";
+		webrtcConfig.close();
+
+		std::ofstream nvEncConfig(path + ConfigParser::kNvEncConfigPath, std::ios::trunc);
+		nvEncConfig << "{ \"serverFrameCaptureFPS\": " << value << " }";
+		nvEncConfig.close();
+	}
+}
+
 TEST(ConfigParserTests, Config_Get_Absolute_Path_Success)
 {
 	// this logic is the same as in the method we're testing, which isn't ideal
@@ -58,6 +95,9 @@ TEST(ConfigParserTests, Config_Global_Allocation_Success)
 	ASSERT_STREQ("test://test", injectedWebRTCInstance->authentication.code_uri.c_str());
 	ASSERT_STREQ("test://test", injectedWebRTCInstance->authentication.poll_uri.c_str());
 	ASSERT_STREQ("00000000-0000-0000-0000-000000000000", injectedWebRTCInstance->authentication.resource.c_str());
+	ASSERT_STREQ("test.token", injectedWebRTCInstance->authentication.token_cache_path.c_str());
+	ASSERT_FALSE(injectedWebRTCInstance->authentication.encrypt_token_cache);
+	ASSERT_EQ(0.5, injectedWebRTCInstance->authentication.token_renewal);
 
 	//// should be default initialized
 	ASSERT_STREQ("", defaultWebRTCInstance->ice_configuration.c_str());
@@ -85,6 +125,18 @@ TEST(ConfigParserTests, Config_Global_Allocation_Success)
 	ASSERT_TRUE(((uint32_t)1234) == injectedServerInstance->server_config.height);
 	ASSERT_EQ(true, injectedServerInstance->server_config.system_service);
 	ASSERT_TRUE(((uint32_t)5678) == injectedServerInstance->server_config.width);
+	ASSERT_EQ(2, injectedServerInstance->server_config.render_target_pool_size);
+	ASSERT_EQ(3000, injectedServerInstance->server_config.idle_timeout);
+	ASSERT_EQ(1, injectedServerInstance->server_config.keep_alive_fps);
+	ASSERT_EQ(3, injectedServerInstance->server_config.peer_pool_size);
+	ASSERT_EQ(2, injectedServerInstance->server_config.worker_threads);
+	ASSERT_EQ((size_t)1, injectedServerInstance->server_config.network_thread_cores.size());
+	ASSERT_EQ(0, injectedServerInstance->server_config.network_thread_cores[0]);
+	ASSERT_EQ((size_t)2, injectedServerInstance->server_config.worker_thread_cores.size());
+	ASSERT_EQ(3, injectedServerInstance->server_config.worker_thread_cores[1]);
+	ASSERT_EQ(3, injectedServerInstance->server_config.max_encoder_sessions);
+	ASSERT_TRUE(injectedServerInstance->server_config.share_encoder_sessions);
+	ASSERT_EQ(9100, injectedServerInstance->server_config.metrics_port);
 	ASSERT_STREQ(L"test", injectedServerInstance->service_config.display_name.c_str());
 	ASSERT_STREQ(L"test", injectedServerInstance->service_config.name.c_str());
 	ASSERT_STREQ(L"test\\test", injectedServerInstance->service_config.service_account.c_str());
@@ -127,3 +179,192 @@ TEST(ConfigParserTests, Config_URI_Priority_Success)
 	ASSERT_STREQ("test", oldWebRTCInstance->server_uri.c_str());
 	ASSERT_STREQ("test://test", oldWebRTCInstance->authentication.authority_uri.c_str());
 }
+
+TEST(ConfigParserTests, Config_Encoder_Profile_Parse_Success)
+{
+	// get our directory path
+	TCHAR currentDirectory[MAX_PATH];
+	GetModuleFileName(GetModuleHandle("ConfigParser.Tests.dll"), currentDirectory, MAX_PATH);
+	auto wrappedCurrentDirectory = std::string(currentDirectory);
+
+	ConfigParser::ConfigureConfigFactories(wrappedCurrentDirectory.substr(0, wrappedCurrentDirectory.length() - 22));
+
+	// should be parsed from disk (see nvEncConfig.json in the test directory)
+	auto nvEncInstance = Object<NvEncConfig>::Get();
+	ASSERT_EQ((uint32_t)30, nvEncInstance->capture_fps);
+	ASSERT_EQ((uint32_t)3000000, nvEncInstance->profile.bitrate);
+	ASSERT_EQ((uint32_t)120, nvEncInstance->profile.idr_period);
+
+	// invalid values should be fixed at load
+	ASSERT_EQ((uint32_t)3000000, nvEncInstance->profile.min_bitrate);
+
+	// missing values should be defaulted from the bitrate
+	ASSERT_EQ((uint32_t)3000000, nvEncInstance->profile.max_bitrate);
+
+	// overrides should inherit the settings they don't set
+	ASSERT_EQ((size_t)1, nvEncInstance->profile_overrides.size());
+	auto& stereoProfile = ConfigParser::GetEncoderProfile(*nvEncInstance, 2560, 720);
+	ASSERT_EQ(&nvEncInstance->profile_overrides[0].profile, &stereoProfile);
+	ASSERT_EQ((uint32_t)6000000, stereoProfile.bitrate);
+	ASSERT_EQ((uint32_t)1000000, stereoProfile.min_bitrate);
+	ASSERT_EQ((uint32_t)6000000, stereoProfile.max_bitrate);
+	ASSERT_EQ((uint32_t)120, stereoProfile.idr_period);
+
+	// other resolutions should use the base profile
+	ASSERT_EQ(&nvEncInstance->profile, &ConfigParser::GetEncoderProfile(*nvEncInstance, 1280, 720));
+
+	// should be default initialized
+	auto defaultNvEncInstance = Object<NvEncConfig>::Get<1>();
+	ASSERT_EQ((size_t)0, defaultNvEncInstance->profile_overrides.size());
+	ASSERT_EQ((uint32_t)0, defaultNvEncInstance->profile.bitrate);
+}
+
+TEST(ConfigParserTests, Config_Encoder_Profile_Validation_Success)
+{
+	// the default profile should be valid as is
+	auto profile = ConfigParser::GetDefaultEncoderProfile();
+	std::vector<std::string> errors;
+	ASSERT_TRUE(ConfigParser::ValidateEncoderProfile(&profile, &errors));
+	ASSERT_EQ((size_t)0, errors.size());
+	ASSERT_EQ(profile.bitrate, profile.max_bitrate);
+
+	// a missing bitrate should fall back to the default
+	profile = ConfigParser::GetDefaultEncoderProfile();
+	profile.bitrate = 0;
+	profile.min_bitrate = 0;
+	ASSERT_FALSE(ConfigParser::ValidateEncoderProfile(&profile, &errors));
+	ASSERT_EQ((size_t)1, errors.size());
+	ASSERT_EQ(ConfigParser::GetDefaultEncoderProfile().bitrate, profile.bitrate);
+
+	// the bitrate should fit in its bounds
+	errors.clear();
+	profile = ConfigParser::GetDefaultEncoderProfile();
+	profile.max_bitrate = profile.bitrate / 2;
+	ASSERT_FALSE(ConfigParser::ValidateEncoderProfile(&profile, &errors));
+	ASSERT_EQ((size_t)1, errors.size());
+	ASSERT_EQ(profile.bitrate, profile.max_bitrate);
+}
+
+TEST(ConfigParserTests, Config_Watcher_Reload_Success)
+{
+	auto path = GetWatchedConfigPath();
+	WriteWatchedConfig(path, 720);
+
+	// should load the initial snapshot, polling on each call
+	ConfigWatcher watcher(path, "webrtcConfig.json", 0);
+	auto snapshot = watcher.Snapshot();
+	ASSERT_EQ((uint64_t)1, snapshot->version);
+	ASSERT_EQ((uint32_t)720, snapshot->server_config->server_config.width);
+	ASSERT_EQ((uint16_t)720, snapshot->webrtc_config->port);
+	ASSERT_EQ((uint32_t)720, snapshot->nvenc_config->capture_fps);
+
+	// should be notified with both snapshots
+	int notifications = 0;
+	uint32_t previousFps = 0;
+	uint32_t currentFps = 0;
+	int id = watcher.Subscribe([&](const ConfigSnapshot& previous, const ConfigSnapshot& current)
+	{
+		notifications++;
+		previousFps = previous.nvenc_config->capture_fps;
+		currentFps = current.nvenc_config->capture_fps;
+	});
+
+	// nothing changed yet
+	ASSERT_FALSE(watcher.Poll());
+
+	// should publish the changed files
+	WriteWatchedConfig(path, 1080);
+	ASSERT_TRUE(watcher.Poll());
+	ASSERT_EQ((uint64_t)2, watcher.Snapshot()->version);
+	ASSERT_EQ((uint32_t)1080, watcher.Snapshot()->server_config->server_config.height);
+	ASSERT_EQ(1, notifications);
+	ASSERT_EQ((uint32_t)720, previousFps);
+	ASSERT_EQ((uint32_t)1080, currentFps);
+
+	// the snapshots held by the readers should never change
+	ASSERT_EQ((uint32_t)720, snapshot->nvenc_config->capture_fps);
+
+	// should keep the current snapshot when a file is being written
+	std::ofstream serverConfig(path + ConfigParser::kServerConfigPath, std::ios::trunc);
+	serverConfig << "{ \"serverConfig\": { \"width\": ";
+	serverConfig.close();
+	ASSERT_FALSE(watcher.Poll());
+	ASSERT_EQ((uint64_t)2, watcher.Snapshot()->version);
+	ASSERT_EQ(1, notifications);
+
+	// should keep the current snapshot when a value is invalid
+	std::vector<std::string> errors;
+	WriteWatchedConfig(path, 0);
+	ASSERT_FALSE(watcher.Reload(&errors));
+	ASSERT_EQ((size_t)2, errors.size());
+	ASSERT_EQ((uint64_t)2, watcher.Snapshot()->version);
+
+	// should not be notified once unsubscribed
+	watcher.Unsubscribe(id);
+	WriteWatchedConfig(path, 60);
+	ASSERT_TRUE(watcher.Poll());
+	ASSERT_EQ((uint64_t)3, watcher.Snapshot()->version);
+	ASSERT_EQ(1, notifications);
+}
+
+TEST(ConfigParserTests, Config_Watcher_Atomic_Swap_Success)
+{
+	const int kReloads = 200;
+	const int kReaders = 4;
+
+	auto path = GetWatchedConfigPath();
+	WriteWatchedConfig(path, 1);
+	ConfigWatcher watcher(path);
+
+	// readers should always see the files of a single reload, in order
+	auto held = watcher.Snapshot();
+	std::atomic<bool> done(false);
+	std::atomic<int> inconsistentReads(0);
+	std::atomic<int> reads(0);
+	std::vector<std::thread> readers;
+	for (int i = 0; i < kReaders; i++)
+	{
+		readers.push_back(std::thread([&]
+		{
+			uint64_t lastVersion = 0;
+			while (!done.load())
+			{
+				auto snapshot = watcher.Snapshot();
+				uint32_t value = snapshot->nvenc_config->capture_fps;
+				if (snapshot->version < lastVersion ||
+					snapshot->server_config->server_config.width != value ||
+					snapshot->server_config->server_config.height != value ||
+					snapshot->webrtc_config->port != value)
+				{
+					inconsistentReads++;
+				}
+
+				lastVersion = snapshot->version;
+				reads++;
+			}
+
+			// the snapshot held across the swaps should not have changed
+			if (held->nvenc_config->capture_fps != 1 || held->server_config->server_config.width != 1)
+			{
+				inconsistentReads++;
+			}
+		}));
+	}
+
+	for (int value = 2; value <= kReloads + 1; value++)
+	{
+		WriteWatchedConfig(path, value);
+		ASSERT_TRUE(watcher.Reload());
+	}
+
+	done.store(true);
+	for (auto& reader : readers)
+	{
+		reader.join();
+	}
+
+	ASSERT_EQ(0, inconsistentReads.load());
+	ASSERT_LT(0, reads.load());
+	ASSERT_EQ((uint64_t)kReloads + 1, watcher.Snapshot()->version);
+	ASSERT_EQ((uint32_t)kReloads + 1, watcher.Snapshot()->nvenc_config->capture_fps);
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <CppFactory.hpp>
 
 #include "structs.h"
@@ -74,12 +75,47 @@ namespace StreamingToolkit
 		/// <returns>the absolute path</returns>
 		static std::string ConfigParser::GetAbsolutePath(const std::string& file_name);
 
+		/// <summary>
+		/// Gets the encoder profile used when nvEncConfig doesn't set one
+		/// </summary>
+		/// <remarks>
+		/// The bitrates follow the Kush gauge for 1280x720 at 60 fps.
+		/// </remarks>
+		/// <returns>the default profile</returns>
+		static StreamingToolkit::EncoderProfile GetDefaultEncoderProfile();
+
+		/// <summary>
+		/// Validates an encoder profile, resolving its defaulted fields
+		/// </summary>
+		/// <remarks>
+		/// Invalid fields are replaced with valid values, so that the profile is always
+		/// usable. A zero max bitrate defaults to the bitrate.
+		/// </remarks>
+		/// <param name="profile">the profile to validate</param>
+		/// <param name="errors">receives a description of each invalid field, may be null</param>
+		/// <returns>true if no field was invalid</returns>
+		static bool ValidateEncoderProfile(StreamingToolkit::EncoderProfile* profile,
+			std::vector<std::string>* errors);
+
+		/// <summary>
+		/// Gets the encoder profile of a frame resolution
+		/// </summary>
+		/// <param name="config">the encoder configuration</param>
+		/// <param name="width">the frame width, including both eyes in stereo</param>
+		/// <param name="height">the frame height</param>
+		/// <returns>the profile overriden for the resolution, or the default profile</returns>
+		static const StreamingToolkit::EncoderProfile& GetEncoderProfile(const StreamingToolkit::NvEncConfig& config,
+			uint32_t width, uint32_t height);
+
 		ConfigParser() = delete;
 		~ConfigParser() = delete;
 
 	private:
-		static void ParseWebRTCConfig(const std::string& path, StreamingToolkit::WebRTCConfig* webrtcConfig);
-		static void ParseServerConfig(const std::string& path, StreamingToolkit::ServerConfig* serverConfig);
-		static void ParseNvEncConfig(const std::string& path, StreamingToolkit::NvEncConfig* nvEncConfig);
+		friend class ConfigWatcher;
+
+		// each returns false if the file can't be read or parsed, leaving the defaults
+		static bool ParseWebRTCConfig(const std::string& path, StreamingToolkit::WebRTCConfig* webrtcConfig);
+		static bool ParseServerConfig(const std::string& path, StreamingToolkit::ServerConfig* serverConfig);
+		static bool ParseNvEncConfig(const std::string& path, StreamingToolkit::NvEncConfig* nvEncConfig);
 	};
 }
\ No newline at end of file
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "config_parser.h"
+
+namespace StreamingToolkit
+{
+	/// <summary>
+	/// Immutable configuration, as read from disk at a given time
+	/// </summary>
+	struct ConfigSnapshot
+	{
+		/// <summary>
+		/// Increases with each published snapshot, starting at 1
+		/// </summary>
+		uint64_t version;
+
+		std::shared_ptr<const ServerConfig> server_config;
+		std::shared_ptr<const WebRTCConfig> webrtc_config;
+		std::shared_ptr<const NvEncConfig> nvenc_config;
+	};
+
+	/// <summary>
+	/// Watches the configuration files, publishing a new snapshot when they change
+	/// </summary>
+	/// <remarks>
+	/// Snapshots are swapped atomically, so a reader always sees the three configurations
+	/// of a single load, and a snapshot it holds never changes. Reloads are rejected, keeping
+	/// the current snapshot, when a file can't be read or parsed, e.g. while it is being
+	/// written, or when it is invalid.
+	///
+	/// Note: GlobalObject instances keep the values read at startup. Subsystems which can
+	/// change at runtime, e.g. the capacity, the frame rate or the bitrate, should read the
+	/// snapshot or subscribe to its changes instead.
+	/// </remarks>
+	class ConfigWatcher
+	{
+	public:
+		/// <summary>
+		/// Called with the previous and the new snapshot after each reload
+		/// </summary>
+		typedef std::function<void(const ConfigSnapshot& previous, const ConfigSnapshot& current)> Subscriber;
+
+		/// <summary>
+		/// Loads the initial snapshot, which is published even if invalid so that the
+		/// defaults apply as with <see cref="ConfigParser::ConfigureConfigFactories()"/>
+		/// </summary>
+		/// <param name="baseFilePath">a base path to look for configuration files in</param>
+		/// <param name="webrtcConfigName">the name of the webrtc Config file</param>
+		/// <param name="pollIntervalMs">the minimum time between two checks of the files</param>
+		ConfigWatcher(const std::string& baseFilePath,
+			const std::string& webrtcConfigName = "webrtcConfig.json",
+			int pollIntervalMs = 1000);
+
+		/// <summary>
+		/// Gets the current snapshot, from any thread
+		/// </summary>
+		/// <returns>the current snapshot</returns>
+		std::shared_ptr<const ConfigSnapshot> Snapshot() const;
+
+		/// <summary>
+		/// Subscribes to the snapshot changes
+		/// </summary>
+		/// <remarks>
+		/// Subscribers are called on the thread which reloads, and are expected to compare
+		/// the fields they care about.
+		/// </remarks>
+		/// <param name="subscriber">the subscriber</param>
+		/// <returns>the id to unsubscribe with</returns>
+		int Subscribe(const Subscriber& subscriber);
+
+		/// <summary>
+		/// Unsubscribes from the snapshot changes
+		/// </summary>
+		/// <param name="id">the id returned by <see cref="Subscribe"/></param>
+		void Unsubscribe(int id);
+
+		/// <summary>
+		/// Reloads the files if they changed since the last check
+		/// </summary>
+		/// <remarks>
+		/// Expected to be called from a loop, the files are checked once per poll interval.
+		/// A rejected reload is retried once, at the next poll, in case a write completed
+		/// without changing the files' states. Files which stay invalid are then left alone
+		/// until they change again, and the errors are logged once per change.
+		/// </remarks>
+		/// <returns>true if a new snapshot was published</returns>
+		bool Poll();
+
+		/// <summary>
+		/// Reloads the files and publishes them if they are valid
+		/// </summary>
+		/// <param name="errors">receives a description of each error, may be null</param>
+		/// <returns>true if a new snapshot was published</returns>
+		bool Reload(std::vector<std::string>* errors = nullptr);
+
+	private:
+		struct FileState
+		{
+			std::string path;
+			uint64_t last_write_time;
+			uint64_t size;
+		};
+
+		// Parses and validates the files into a snapshot, or returns false.
+		bool Load(ConfigSnapshot* snapshot, std::vector<std::string>* errors);
+
+		// Reads the current states of the files, returning whether any changed.
+		bool UpdateFileStates();
+
+		void Publish(const ConfigSnapshot& snapshot);
+
+		const std::string base_file_path_;
+		const std::string webrtc_config_name_;
+		const int poll_interval_ms_;
+
+		// Serializes the reloads, so that versions increase in notification order.
+		std::mutex reload_mutex_;
+
+		std::shared_ptr<const ConfigSnapshot> snapshot_;
+		std::vector<FileState> file_states_;
+		uint64_t last_poll_ms_;
+
+		// Whether the last rejected change is read again at the next poll.
+		bool retry_pending_;
+
+		// Errors of the last rejected reload, logged once.
+		std::vector<std::string> rejected_errors_;
+
+		std::mutex subscribers_mutex_;
+		std::vector<std::pair<int, Subscriber>> subscribers_;
+		int next_subscriber_id_;
+	};
+}
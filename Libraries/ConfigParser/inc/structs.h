@@ -1,7 +1,9 @@
 #pragma once
 
+#include <memory>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 namespace StreamingToolkit
 {
@@ -27,6 +29,37 @@ namespace StreamingToolkit
 
 		/* Automatically onnect to the signaling server	*/
 		bool			auto_connect;
+
+		/* Max number of render targets kept allocated	*/
+		int				render_target_pool_size;
+
+		/* Time without input before a peer is idle, ms,
+		 * 0 to never idle, e.g. for animated scenes	*/
+		int				idle_timeout;
+
+		/* The frame rate of the idle peers				*/
+		int				keep_alive_fps;
+
+		/* Number of peer connections pre-warmed		*/
+		int				peer_pool_size;
+
+		/* Number of peer connection worker threads		*/
+		int				worker_threads;
+
+		/* Cores the network thread is pinned to		*/
+		std::vector<int> network_thread_cores;
+
+		/* Cores the worker threads are pinned to		*/
+		std::vector<int> worker_thread_cores;
+
+		/* Max concurrent encoder sessions, 0 for any	*/
+		int				max_encoder_sessions;
+
+		/* Shares the sessions of identical encoders	*/
+		bool			share_encoder_sessions;
+
+		/* Port of the metrics endpoint, 0 for none		*/
+		int				metrics_port;
 	} ServerAppConfig;
 
 	/*
@@ -108,6 +141,15 @@ namespace StreamingToolkit
 
 		/*  The uri used for auth code polling			*/
 		std::string		poll_uri;
+
+		/*  The file the tokens are cached in, if any	*/
+		std::string		token_cache_path;
+
+		/*  Encrypts the cached tokens for the user		*/
+		bool			encrypt_token_cache;
+
+		/*  Part of the token lifetime before renewal	*/
+		double			token_renewal;
 	} Authentication;
 
 	/*
@@ -146,6 +188,39 @@ namespace StreamingToolkit
 		std::shared_ptr<WebRTCConfig> webrtc_config;
 	} FullServerConfig;
 
+	/*
+	 * Video encoder profile
+	 */
+	typedef struct
+	{
+		/* The average bitrate							*/
+		uint32_t		bitrate;
+
+		/* The bitrate never gone below					*/
+		uint32_t		min_bitrate;
+
+		/* The bitrate never gone above					*/
+		uint32_t		max_bitrate;
+
+		/* Frames between IDR frames, 0 for infinite	*/
+		uint32_t		idr_period;
+	} EncoderProfile;
+
+	/*
+	 * Video encoder profile of a frame resolution
+	 */
+	typedef struct
+	{
+		/* The video frame width						*/
+		uint32_t		width;
+
+		/* The video frame height						*/
+		uint32_t		height;
+
+		/* Overrides the default profile				*/
+		EncoderProfile	profile;
+	} EncoderProfileOverride;
+
 	/*
 	 * Video encoder configuration
 	 */
@@ -153,5 +228,11 @@ namespace StreamingToolkit
 	{
 		/* Capture frame rate							*/
 		uint32_t		capture_fps;
+
+		/* The default encoder profile					*/
+		EncoderProfile	profile;
+
+		/* The encoder profiles of given resolutions	*/
+		std::vector<EncoderProfileOverride> profile_overrides;
 	} NvEncConfig;
 }
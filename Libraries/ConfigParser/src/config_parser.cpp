@@ -7,6 +7,7 @@
 #include <windows.h>
 
 #include "webrtc/rtc_base/json.h"
+#include "webrtc/rtc_base/logging.h"
 
 using namespace StreamingToolkit;
 
@@ -14,6 +15,59 @@ using namespace StreamingToolkit;
 const char* ConfigParser::kServerConfigPath = "serverConfig.json";
 const char* ConfigParser::kNvEncConfigPath = "nvEncConfig.json";
 
+namespace
+{
+	void AddError(std::vector<std::string>* errors, const std::string& error)
+	{
+		if (errors)
+		{
+			errors->push_back(error);
+		}
+	}
+
+	// reads an array of cpu core indices, skipping the invalid ones
+	void ParseCores(const Json::Value& node, std::vector<int>* cores)
+	{
+		cores->clear();
+		if (!node.isArray())
+		{
+			return;
+		}
+
+		for (Json::ArrayIndex i = 0; i < node.size(); i++)
+		{
+			if (node[i].isInt() && node[i].asInt() >= 0 && node[i].asInt() < 64)
+			{
+				cores->push_back(node[i].asInt());
+			}
+		}
+	}
+
+	// reads the members of a NvencodeSettings node, keeping the profile values of the missing ones
+	void ParseEncoderProfile(const Json::Value& node, StreamingToolkit::EncoderProfile* profile)
+	{
+		if (node.isMember("bitrate"))
+		{
+			profile->bitrate = node.get("bitrate", "").asUInt();
+		}
+
+		if (node.isMember("minBitrate"))
+		{
+			profile->min_bitrate = node.get("minBitrate", "").asUInt();
+		}
+
+		if (node.isMember("maxBitrate"))
+		{
+			profile->max_bitrate = node.get("maxBitrate", "").asUInt();
+		}
+
+		if (node.isMember("idrPeriod"))
+		{
+			profile->idr_period = node.get("idrPeriod", "").asUInt();
+		}
+	}
+}
+
 std::string ConfigParser::GetAbsolutePath(const std::string& file_name)
 {
 	TCHAR buffer[MAX_PATH];
@@ -63,14 +117,20 @@ void ConfigParser::ConfigureConfigFactories(const std::string& baseFilePath, con
 	});
 }
 
-void ConfigParser::ParseWebRTCConfig(const std::string& path, StreamingToolkit::WebRTCConfig* webrtcConfig)
+bool ConfigParser::ParseWebRTCConfig(const std::string& path, StreamingToolkit::WebRTCConfig* webrtcConfig)
 {
 	std::ifstream fileStream(path);
 	Json::Reader reader;
 	Json::Value root = NULL;
+	bool parsed = false;
+
+	// cached tokens are encrypted, and renewed after most of their lifetime by default
+	webrtcConfig->authentication.encrypt_token_cache = true;
+	webrtcConfig->authentication.token_renewal = 0.8;
+
 	if (fileStream.good())
 	{
-		reader.parse(fileStream, root, true);
+		parsed = reader.parse(fileStream, root, true);
 		webrtcConfig->ice_configuration = root.get("iceConfiguration", NULL).asString();
 		if (root.isMember("turnServer"))
 		{
@@ -172,21 +232,57 @@ void ConfigParser::ParseWebRTCConfig(const std::string& path, StreamingToolkit::
 			{
 				webrtcConfig->authentication.poll_uri = authenticationNode.get("pollUri", NULL).asString();
 			}
+
+			if (authenticationNode.isMember("tokenCachePath"))
+			{
+				webrtcConfig->authentication.token_cache_path = authenticationNode.get("tokenCachePath", "").asString();
+			}
+
+			if (authenticationNode.isMember("encryptTokenCache"))
+			{
+				webrtcConfig->authentication.encrypt_token_cache = authenticationNode.get("encryptTokenCache", "").asBool();
+			}
+
+			if (authenticationNode.isMember("tokenRenewal"))
+			{
+				webrtcConfig->authentication.token_renewal = authenticationNode.get("tokenRenewal", "").asDouble();
+			}
 		}
 	}
+
+	return parsed;
 }
 
-void ConfigParser::ParseServerConfig(const std::string& path, StreamingToolkit::ServerConfig* serverConfig)
+bool ConfigParser::ParseServerConfig(const std::string& path, StreamingToolkit::ServerConfig* serverConfig)
 {
 	// we want the systemCapacity default to be -1, which requires an explicit set operation
 	serverConfig->server_config.system_capacity = -1;
 
+	// keeps the render targets of a few disconnected peers by default
+	serverConfig->server_config.render_target_pool_size = 4;
+
+	// never idles by default, since only the input is watched and an animated scene
+	// would drop to the keep-alive rate
+	serverConfig->server_config.idle_timeout = 0;
+	serverConfig->server_config.keep_alive_fps = 1;
+
+	// keeps a peer connection ready for the next peer by default
+	serverConfig->server_config.peer_pool_size = 1;
+
+	// a single worker thread and no encoder session limit by default, as webrtc does
+	serverConfig->server_config.worker_threads = 1;
+	serverConfig->server_config.max_encoder_sessions = 0;
+
+	// the metrics are only served when asked for
+	serverConfig->server_config.metrics_port = 0;
+
 	std::ifstream fileStream(path);
 	Json::Reader reader;
 	Json::Value root = NULL;
+	bool parsed = false;
 	if (fileStream.good())
 	{
-		reader.parse(fileStream, root, true);
+		parsed = reader.parse(fileStream, root, true);
 		if (root.isMember("serverConfig"))
 		{
 			auto serverConfigNode = root.get("serverConfig", NULL);
@@ -219,6 +315,56 @@ void ConfigParser::ParseServerConfig(const std::string& path, StreamingToolkit::
 			{
 				serverConfig->server_config.auto_connect = serverConfigNode.get("autoConnect", "").asBool();
 			}
+
+			if (serverConfigNode.isMember("renderTargetPoolSize"))
+			{
+				serverConfig->server_config.render_target_pool_size = serverConfigNode.get("renderTargetPoolSize", "").asInt();
+			}
+
+			if (serverConfigNode.isMember("idleTimeout"))
+			{
+				serverConfig->server_config.idle_timeout = serverConfigNode.get("idleTimeout", "").asInt();
+			}
+
+			if (serverConfigNode.isMember("keepAliveFps"))
+			{
+				serverConfig->server_config.keep_alive_fps = serverConfigNode.get("keepAliveFps", "").asInt();
+			}
+
+			if (serverConfigNode.isMember("peerPoolSize"))
+			{
+				serverConfig->server_config.peer_pool_size = serverConfigNode.get("peerPoolSize", "").asInt();
+			}
+
+			if (serverConfigNode.isMember("workerThreads"))
+			{
+				serverConfig->server_config.worker_threads = serverConfigNode.get("workerThreads", "").asInt();
+			}
+
+			if (serverConfigNode.isMember("networkThreadCores"))
+			{
+				ParseCores(serverConfigNode["networkThreadCores"], &serverConfig->server_config.network_thread_cores);
+			}
+
+			if (serverConfigNode.isMember("workerThreadCores"))
+			{
+				ParseCores(serverConfigNode["workerThreadCores"], &serverConfig->server_config.worker_thread_cores);
+			}
+
+			if (serverConfigNode.isMember("maxEncoderSessions"))
+			{
+				serverConfig->server_config.max_encoder_sessions = serverConfigNode.get("maxEncoderSessions", "").asInt();
+			}
+
+			if (serverConfigNode.isMember("shareEncoderSessions"))
+			{
+				serverConfig->server_config.share_encoder_sessions = serverConfigNode.get("shareEncoderSessions", "").asBool();
+			}
+
+			if (serverConfigNode.isMember("metricsPort"))
+			{
+				serverConfig->server_config.metrics_port = serverConfigNode.get("metricsPort", "").asInt();
+			}
 		}
 
 		if (root.isMember("serviceConfig"))
@@ -249,20 +395,117 @@ void ConfigParser::ParseServerConfig(const std::string& path, StreamingToolkit::
 			}
 		}
 	}
+
+	return parsed;
+}
+
+StreamingToolkit::EncoderProfile ConfigParser::GetDefaultEncoderProfile()
+{
+	StreamingToolkit::EncoderProfile profile;
+	profile.bitrate = 7741440;
+	profile.min_bitrate = 3870720;
+	profile.max_bitrate = 0;
+	profile.idr_period = 60;
+	return profile;
 }
 
-void ConfigParser::ParseNvEncConfig(const std::string& path, StreamingToolkit::NvEncConfig* nvEncConfig)
+bool ConfigParser::ValidateEncoderProfile(StreamingToolkit::EncoderProfile* profile,
+	std::vector<std::string>* errors)
 {
+	bool valid = true;
+	if (profile->bitrate == 0)
+	{
+		AddError(errors, "bitrate must be set");
+		profile->bitrate = GetDefaultEncoderProfile().bitrate;
+		valid = false;
+	}
+
+	if (profile->min_bitrate > profile->bitrate)
+	{
+		AddError(errors, "minBitrate is above bitrate");
+		profile->min_bitrate = profile->bitrate;
+		valid = false;
+	}
+
+	if (profile->max_bitrate == 0)
+	{
+		profile->max_bitrate = profile->bitrate;
+	}
+	else if (profile->max_bitrate < profile->bitrate)
+	{
+		AddError(errors, "maxBitrate is below bitrate");
+		profile->max_bitrate = profile->bitrate;
+		valid = false;
+	}
+
+	return valid;
+}
+
+const StreamingToolkit::EncoderProfile& ConfigParser::GetEncoderProfile(const StreamingToolkit::NvEncConfig& config,
+	uint32_t width, uint32_t height)
+{
+	for (const auto& profileOverride : config.profile_overrides)
+	{
+		if (profileOverride.width == width && profileOverride.height == height)
+		{
+			return profileOverride.profile;
+		}
+	}
+
+	return config.profile;
+}
+
+bool ConfigParser::ParseNvEncConfig(const std::string& path, StreamingToolkit::NvEncConfig* nvEncConfig)
+{
+	nvEncConfig->profile = GetDefaultEncoderProfile();
+
 	std::ifstream fileStream(path);
 	Json::Reader reader;
 	Json::Value root = NULL;
+	bool parsed = false;
 	if (fileStream.good())
 	{
-		reader.parse(fileStream, root, true);
+		parsed = reader.parse(fileStream, root, true);
 
 		if (root.isMember("serverFrameCaptureFPS"))
 		{
 			nvEncConfig->capture_fps = root.get("serverFrameCaptureFPS", NULL).asInt();
 		}
+
+		if (root.isMember("NvencodeSettings"))
+		{
+			auto settingsNode = root.get("NvencodeSettings", NULL);
+			ParseEncoderProfile(settingsNode, &nvEncConfig->profile);
+
+			// overrides inherit the settings they don't set
+			if (settingsNode.isMember("profiles"))
+			{
+				auto profilesNode = settingsNode.get("profiles", NULL);
+				for (Json::ArrayIndex i = 0; i < profilesNode.size(); i++)
+				{
+					StreamingToolkit::EncoderProfileOverride profileOverride;
+					profileOverride.width = profilesNode[i]["width"].asUInt();
+					profileOverride.height = profilesNode[i]["height"].asUInt();
+					profileOverride.profile = nvEncConfig->profile;
+					ParseEncoderProfile(profilesNode[i], &profileOverride.profile);
+					nvEncConfig->profile_overrides.push_back(profileOverride);
+				}
+			}
+		}
 	}
+
+	// validates once the overrides inherited the settings as written
+	std::vector<std::string> errors;
+	ValidateEncoderProfile(&nvEncConfig->profile, &errors);
+	for (auto& profileOverride : nvEncConfig->profile_overrides)
+	{
+		ValidateEncoderProfile(&profileOverride.profile, &errors);
+	}
+
+	for (const auto& error : errors)
+	{
+		LOG(LS_WARNING) << "Invalid encoder profile in " << path << ": " << error;
+	}
+
+	return parsed;
 }
@@ -0,0 +1,223 @@
+#include "config_watcher.h"
+
+#include <algorithm>
+
+#define WIN32_LEAN_AND_MEAN // exclude rarely used windows content
+
+#include <windows.h>
+
+#include "webrtc/rtc_base/logging.h"
+
+using namespace StreamingToolkit;
+
+ConfigWatcher::ConfigWatcher(const std::string& baseFilePath, const std::string& webrtcConfigName,
+	int pollIntervalMs) :
+	base_file_path_(baseFilePath),
+	webrtc_config_name_(webrtcConfigName),
+	poll_interval_ms_(pollIntervalMs),
+	last_poll_ms_(GetTickCount64()),
+	retry_pending_(false),
+	next_subscriber_id_(0)
+{
+	const std::string names[] = { std::string(ConfigParser::kServerConfigPath), webrtcConfigName,
+		std::string(ConfigParser::kNvEncConfigPath) };
+
+	for (const auto& name : names)
+	{
+		FileState fileState = { baseFilePath + name, 0, 0 };
+		file_states_.push_back(fileState);
+	}
+
+	UpdateFileStates();
+
+	// the initial snapshot keeps the defaults of the missing or invalid values
+	std::vector<std::string> errors;
+	ConfigSnapshot snapshot;
+	if (!Load(&snapshot, &errors))
+	{
+		for (const auto& error : errors)
+		{
+			LOG(LS_WARNING) << "Invalid configuration: " << error;
+		}
+	}
+
+	snapshot.version = 1;
+	std::atomic_store(&snapshot_, std::shared_ptr<const ConfigSnapshot>(new ConfigSnapshot(snapshot)));
+}
+
+std::shared_ptr<const ConfigSnapshot> ConfigWatcher::Snapshot() const
+{
+	return std::atomic_load(&snapshot_);
+}
+
+int ConfigWatcher::Subscribe(const Subscriber& subscriber)
+{
+	std::lock_guard<std::mutex> lock(subscribers_mutex_);
+	int id = next_subscriber_id_++;
+	subscribers_.push_back(std::make_pair(id, subscriber));
+	return id;
+}
+
+void ConfigWatcher::Unsubscribe(int id)
+{
+	std::lock_guard<std::mutex> lock(subscribers_mutex_);
+	subscribers_.erase(std::remove_if(subscribers_.begin(), subscribers_.end(),
+		[id](const std::pair<int, Subscriber>& subscriber) { return subscriber.first == id; }),
+		subscribers_.end());
+}
+
+bool ConfigWatcher::Poll()
+{
+	bool changed = false;
+	{
+		std::lock_guard<std::mutex> lock(reload_mutex_);
+		uint64_t now = GetTickCount64();
+		if (now - last_poll_ms_ < (uint64_t)poll_interval_ms_)
+		{
+			return false;
+		}
+
+		last_poll_ms_ = now;
+		changed = UpdateFileStates();
+		if (!changed && !retry_pending_)
+		{
+			return false;
+		}
+
+		retry_pending_ = false;
+	}
+
+	std::vector<std::string> errors;
+	bool reloaded = Reload(&errors);
+	{
+		std::lock_guard<std::mutex> lock(reload_mutex_);
+		if (reloaded)
+		{
+			rejected_errors_.clear();
+		}
+		else
+		{
+			// a change is read again once, since a write may complete without changing the
+			// write time or size of the files, e.g. when they were locked while being read
+			if (changed || errors != rejected_errors_)
+			{
+				for (const auto& error : errors)
+				{
+					LOG(LS_WARNING) << "Configuration change rejected: " << error;
+				}
+			}
+
+			retry_pending_ = changed;
+			rejected_errors_ = errors;
+			return false;
+		}
+	}
+
+	LOG(LS_INFO) << "Configuration reloaded, version " << Snapshot()->version;
+	return true;
+}
+
+bool ConfigWatcher::Reload(std::vector<std::string>* errors)
+{
+	std::lock_guard<std::mutex> lock(reload_mutex_);
+	ConfigSnapshot snapshot;
+	if (!Load(&snapshot, errors))
+	{
+		return false;
+	}
+
+	Publish(snapshot);
+	return true;
+}
+
+bool ConfigWatcher::Load(ConfigSnapshot* snapshot, std::vector<std::string>* errors)
+{
+	auto serverConfig = std::make_shared<ServerConfig>();
+	auto webrtcConfig = std::make_shared<WebRTCConfig>();
+	auto nvEncConfig = std::make_shared<NvEncConfig>();
+	std::vector<std::string> loadErrors;
+	if (!ConfigParser::ParseServerConfig(base_file_path_ + ConfigParser::kServerConfigPath, serverConfig.get()))
+	{
+		loadErrors.push_back("cannot read " + std::string(ConfigParser::kServerConfigPath));
+	}
+
+	if (!ConfigParser::ParseWebRTCConfig(base_file_path_ + webrtc_config_name_, webrtcConfig.get()))
+	{
+		loadErrors.push_back("cannot read " + webrtc_config_name_);
+	}
+
+	if (!ConfigParser::ParseNvEncConfig(base_file_path_ + ConfigParser::kNvEncConfigPath, nvEncConfig.get()))
+	{
+		loadErrors.push_back("cannot read " + std::string(ConfigParser::kNvEncConfigPath));
+	}
+
+	// the encoder profiles are already made valid by the parser, only the values
+	// which can't be replaced are checked
+	if (serverConfig->server_config.width == 0 || serverConfig->server_config.height == 0)
+	{
+		loadErrors.push_back("the server width and height must be set");
+	}
+
+	if (nvEncConfig->capture_fps == 0)
+	{
+		loadErrors.push_back("serverFrameCaptureFPS must be set");
+	}
+
+	snapshot->version = 0;
+	snapshot->server_config = serverConfig;
+	snapshot->webrtc_config = webrtcConfig;
+	snapshot->nvenc_config = nvEncConfig;
+	if (errors)
+	{
+		errors->insert(errors->end(), loadErrors.begin(), loadErrors.end());
+	}
+
+	return loadErrors.empty();
+}
+
+bool ConfigWatcher::UpdateFileStates()
+{
+	bool changed = false;
+	for (auto& fileState : file_states_)
+	{
+		// a missing file has a zero state, so that it is reloaded once created
+		uint64_t lastWriteTime = 0;
+		uint64_t size = 0;
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if (GetFileAttributesExA(fileState.path.c_str(), GetFileExInfoStandard, &data))
+		{
+			lastWriteTime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+			size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		}
+
+		// the size is compared too since quick writes can share a write time
+		if (lastWriteTime != fileState.last_write_time || size != fileState.size)
+		{
+			fileState.last_write_time = lastWriteTime;
+			fileState.size = size;
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+void ConfigWatcher::Publish(const ConfigSnapshot& snapshot)
+{
+	auto previous = std::atomic_load(&snapshot_);
+	auto current = std::make_shared<ConfigSnapshot>(snapshot);
+	current->version = previous->version + 1;
+	std::atomic_store(&snapshot_, std::shared_ptr<const ConfigSnapshot>(current));
+
+	// copied so that subscribers can subscribe or unsubscribe while notified
+	std::vector<std::pair<int, Subscriber>> subscribers;
+	{
+		std::lock_guard<std::mutex> lock(subscribers_mutex_);
+		subscribers = subscribers_;
+	}
+
+	for (const auto& subscriber : subscribers)
+	{
+		subscriber.second(*previous, *current);
+	}
+}
@@ -35,6 +35,11 @@
 #define DEFAULT_I_QOFFSET 0.f
 #define DEFAULT_B_QOFFSET 1.25f
 
+// Low latency constant frame size profile: a full intra refresh wave is spread
+// over half of the refresh period so that no single frame carries a keyframe.
+#define LOW_LATENCY_CFS_INTRA_REFRESH_PERIOD_SEC 1
+#define LOW_LATENCY_CFS_INTRA_REFRESH_DURATION_DIVISOR 2
+
 typedef struct _EncodeConfig
 {
     int              width;
@@ -77,6 +82,7 @@ typedef struct _EncodeConfig
     int  enableAsyncMode;
     int  preloadedFrameCount;
     int  enableTemporalAQ;
+    int  enableExtQPDeltaMap;   // Per-frame QP delta maps passed to NvEncEncodeFrame.
 }EncodeConfig;
 
 typedef struct _EncodeInputBuffer
@@ -229,6 +235,7 @@ public:
     NVENCSTATUS                                          ValidatePresetGUID(GUID presetCodecGuid, GUID inputCodecGuid);
 	NV_ENC_LOCK_BITSTREAM								 GetLockBitStream();
     static NVENCSTATUS                                   ParseArguments(EncodeConfig *encodeConfig, int argc, char *argv[]);
+    static void                                          SetLowLatencyConstantFrameSizeProfile(EncodeConfig *encodeConfig);
 };
 
 typedef NVENCSTATUS (NVENCAPI *MYPROC)(NV_ENCODE_API_FUNCTION_LIST*); 
@@ -884,7 +884,7 @@ NVENCSTATUS CNvHWEncoder::CreateEncoder(EncodeConfig *pEncCfg)
         }
     }
 
-    if (pEncCfg->qpDeltaMapFile)
+    if (pEncCfg->qpDeltaMapFile || pEncCfg->enableExtQPDeltaMap)
     {
         m_stEncodeConfig.rcParams.enableExtQPDeltaMap = 1;
     }
@@ -1275,6 +1275,37 @@ NV_ENC_LOCK_BITSTREAM CNvHWEncoder::GetLockBitStream()
 	return m_lockBitstreamData;
 }
 
+void CNvHWEncoder::SetLowLatencyConstantFrameSizeProfile(EncodeConfig *encodeConfig)
+{
+    // Expects width, height, fps and bitrate to be already set.
+    int fps = encodeConfig->fps > 0 ? encodeConfig->fps : 60;
+
+    encodeConfig->rcMode = NV_ENC_PARAMS_RC_CBR_LOWDELAY_HQ;
+    encodeConfig->encoderPreset = "lowLatencyHQ";
+    encodeConfig->pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
+
+    // No IDR after the first frame and no B-frames, the intra refresh wave
+    // replaces periodic keyframes.
+    encodeConfig->gopLength = NVENC_INFINITE_GOPLENGTH;
+    encodeConfig->numB = 0;
+    encodeConfig->intraRefreshEnableFlag = 1;
+    encodeConfig->intraRefreshPeriod = fps * LOW_LATENCY_CFS_INTRA_REFRESH_PERIOD_SEC;
+    encodeConfig->intraRefreshDuration = encodeConfig->intraRefreshPeriod / LOW_LATENCY_CFS_INTRA_REFRESH_DURATION_DIVISOR;
+    if (encodeConfig->intraRefreshDuration < 1)
+    {
+        encodeConfig->intraRefreshDuration = 1;
+    }
+
+    // Caps the VBV at a single frame worth of bits so that every frame can be
+    // sent within one frame interval at the target bitrate.
+    encodeConfig->vbvMaxBitrate = encodeConfig->bitrate;
+    encodeConfig->vbvSize = encodeConfig->bitrate / fps;
+
+    // Keeps enough references in the DPB to recover from loss by invalidating
+    // the lost frames or forcing an intra refresh wave instead of an IDR.
+    encodeConfig->invalidateRefFramesEnableFlag = 1;
+}
+
 NVENCSTATUS CNvHWEncoder::ParseArguments(EncodeConfig *encodeConfig, int argc, char *argv[])
 {
     for (int i = 1; i < argc; i++)
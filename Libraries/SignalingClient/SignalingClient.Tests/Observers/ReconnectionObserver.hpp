@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+
+#include "peer_connection_client.h"
+
+using namespace std;
+
+class ReconnectionObserver : public PeerConnectionClientObserver
+{
+public:
+	ReconnectionObserver() : signed_in(0), disconnected(0), peers_connected(0), peers_disconnected(0), evt(false, false) {}
+
+	void OnSignedIn() override
+	{
+		signed_in++;
+		evt.Set();
+	}
+
+	void OnDisconnected() override
+	{
+		disconnected++;
+	}
+
+	void OnPeerConnected(int id, const string& name) override
+	{
+		peers_connected++;
+	}
+
+	void OnPeerDisconnected(int peer_id) override
+	{
+		peers_disconnected++;
+	}
+
+	void OnMessageFromPeer(int peer_id, const string& message) override {}
+
+	void OnMessageSent(int err) override {}
+
+	void OnHeartbeat(int heartbeat_status) override {}
+
+	void OnServerConnectionFailure() override {}
+
+	// Waits for the next sign in
+	bool WaitForSignIn()
+	{
+		return evt.Wait(10000);
+	}
+
+	atomic<int> signed_in;
+	atomic<int> disconnected;
+	atomic<int> peers_connected;
+	atomic<int> peers_disconnected;
+
+private:
+	rtc::Event evt;
+};
@@ -1,12 +1,24 @@
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <thread>
 #include <gtest\gtest.h>
 #include <gmock\gmock.h>
 
+#include "connection_race.h"
+#include "dns_cache.h"
+#include "metrics_endpoint.h"
+#include "metrics_registry.h"
 #include "peer_connection_client.h"
+#include "stream_metrics.h"
+#include "structured_log.h"
+#include "token_manager.h"
 #include "turn_credential_provider.h"
 
 #include "RtcEventLoop.h"
 #include "Observers\NoFailureObserver.hpp"
 #include "Observers\ConnectionObserver.hpp"
+#include "Observers\ReconnectionObserver.hpp"
 
 #pragma comment(lib, "webrtc.lib")
 #pragma comment(lib, "Winmm.lib")
@@ -193,6 +205,383 @@ public:
 	MOCK_METHOD0(Authenticate, bool());
 };
 
+/// <summary>
+/// Stand-in authority, issuing numbered tokens after a short round trip
+/// </summary>
+/// <remarks>
+/// Must be created, used and destroyed on the thread of an RtcEventLoop
+/// </remarks>
+class FakeAuthority : public AuthenticationProvider, public rtc::MessageHandler
+{
+public:
+	FakeAuthority(int expires_in, bool interactive = false) :
+		expires_in_(expires_in),
+		interactive_(interactive),
+		requests_(0)
+	{
+	}
+
+	bool Authenticate() override
+	{
+		requests_++;
+		rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, 100, this);
+		return true;
+	}
+
+	bool IsInteractive() const override
+	{
+		return interactive_;
+	}
+
+	void OnMessage(rtc::Message* msg) override
+	{
+		AuthenticationProviderResult res;
+		res.successFlag = true;
+		res.accessToken = "token" + to_string(requests_);
+		res.expiresIn = expires_in_;
+		SignalAuthenticationComplete.emit(res);
+	}
+
+	int requests() const
+	{
+		return requests_;
+	}
+
+private:
+	int expires_in_;
+	bool interactive_;
+	atomic<int> requests_;
+};
+
+/// <summary>
+/// Stand-in turn credential service, serving numbered credentials over http on the loopback,
+/// and answering 401 to requests bearing the rejected token
+/// </summary>
+/// <remarks>
+/// Must be created, used and destroyed on the thread of an RtcEventLoop
+/// </remarks>
+class FakeTurnCredentialServer : public sigslot::has_slots<>
+{
+public:
+	FakeTurnCredentialServer(int ttl, const string& rejected_token = "") :
+		ttl_(ttl),
+		rejected_token_(rejected_token),
+		requests_(0)
+	{
+		listen_socket_.reset(rtc::Thread::Current()->socketserver()->CreateAsyncSocket(AF_INET, SOCK_STREAM));
+		listen_socket_->SignalReadEvent.connect(this, &FakeTurnCredentialServer::OnAccept);
+		listen_socket_->Bind(rtc::SocketAddress("127.0.0.1", 0));
+		listen_socket_->Listen(5);
+	}
+
+	string uri() const
+	{
+		return "http://127.0.0.1:" + to_string(listen_socket_->GetLocalAddress().port()) + "/turnCreds";
+	}
+
+	int requests() const
+	{
+		return requests_;
+	}
+
+	const vector<string>& tokens() const
+	{
+		return tokens_;
+	}
+
+private:
+	void OnAccept(rtc::AsyncSocket* socket)
+	{
+		auto connection = socket->Accept(nullptr);
+		if (connection != nullptr)
+		{
+			connection->SignalReadEvent.connect(this, &FakeTurnCredentialServer::OnRead);
+			connections_[connection].reset(connection);
+		}
+	}
+
+	void OnRead(rtc::AsyncSocket* socket)
+	{
+		auto& request = pending_[socket];
+
+		char buffer[1024];
+		int bytes;
+		while ((bytes = socket->Recv(buffer, sizeof(buffer), nullptr)) > 0)
+		{
+			request.append(buffer, bytes);
+		}
+
+		// answer once the request is complete
+		if (request.find("\r\n\r\n") == string::npos)
+		{
+			return;
+		}
+
+		const string bearer = "Authorization: Bearer ";
+		auto tokenStart = request.find(bearer);
+		auto token = tokenStart == string::npos ? string() :
+			request.substr(tokenStart + bearer.length(), request.find("\r\n", tokenStart) - tokenStart - bearer.length());
+
+		tokens_.push_back(token);
+		request.clear();
+
+		if (!rejected_token_.empty() && token == rejected_token_)
+		{
+			string rejection = "HTTP/1.1 401 Unauthorized\r\nContent-Length: 0\r\n\r\n";
+			socket->Send(rejection.data(), rejection.length());
+			return;
+		}
+
+		auto body = "{\"username\":\"user" + to_string(++requests_) + "\", \"password\":\"secure123\", \"ttl\":" + to_string(ttl_) + "}";
+		auto response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + to_string(body.length()) + "\r\n\r\n" + body;
+		socket->Send(response.data(), response.length());
+	}
+
+	int ttl_;
+	string rejected_token_;
+	atomic<int> requests_;
+	vector<string> tokens_;
+	unique_ptr<rtc::AsyncSocket> listen_socket_;
+	map<rtc::AsyncSocket*, unique_ptr<rtc::AsyncSocket>> connections_;
+	map<rtc::AsyncSocket*, string> pending_;
+};
+
+/// <summary>
+/// Scrapes a metrics endpoint on the loopback, keeping the whole response
+/// </summary>
+/// <remarks>
+/// Must be created, used and destroyed on the thread of an RtcEventLoop
+/// </remarks>
+class FakeScraper : public sigslot::has_slots<>
+{
+public:
+	FakeScraper(const rtc::SocketAddress& address, const string& path) :
+		request_("GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"),
+		evt_(false, false)
+	{
+		socket_.reset(rtc::Thread::Current()->socketserver()->CreateAsyncSocket(AF_INET, SOCK_STREAM));
+		socket_->SignalConnectEvent.connect(this, &FakeScraper::OnConnect);
+		socket_->SignalReadEvent.connect(this, &FakeScraper::OnRead);
+		socket_->SignalCloseEvent.connect(this, &FakeScraper::OnClose);
+		socket_->Connect(address);
+	}
+
+	// Waits until the endpoint closes the connection
+	bool WaitForResponse()
+	{
+		return evt_.Wait(10000);
+	}
+
+	string response;
+
+private:
+	void OnConnect(rtc::AsyncSocket* socket)
+	{
+		socket->Send(request_.data(), request_.length());
+	}
+
+	void OnRead(rtc::AsyncSocket* socket)
+	{
+		char buffer[1024];
+		int bytes;
+		while ((bytes = socket->Recv(buffer, sizeof(buffer), nullptr)) > 0)
+		{
+			response.append(buffer, bytes);
+		}
+	}
+
+	void OnClose(rtc::AsyncSocket* socket, int err)
+	{
+		OnRead(socket);
+		evt_.Set();
+	}
+
+	string request_;
+	unique_ptr<rtc::AsyncSocket> socket_;
+	rtc::Event evt_;
+};
+
+/// <summary>
+/// Stand-in signaling server on the loopback, issuing resume tokens and holding the hanging gets
+/// </summary>
+/// <remarks>
+/// Must be created, used and destroyed on the thread of an RtcEventLoop. While down, it closes
+/// every connection as soon as it's accepted, as a server restarting behind a load balancer would
+/// </remarks>
+class FakeSignalingServer : public sigslot::has_slots<>
+{
+public:
+	FakeSignalingServer() : next_id_(1), down_(false), attempts_while_down_(0)
+	{
+		listen_socket_.reset(rtc::Thread::Current()->socketserver()->CreateAsyncSocket(AF_INET, SOCK_STREAM));
+		listen_socket_->SignalReadEvent.connect(this, &FakeSignalingServer::OnAccept);
+		listen_socket_->Bind(rtc::SocketAddress("127.0.0.1", 0));
+		listen_socket_->Listen(5);
+	}
+
+	int port() const
+	{
+		return listen_socket_->GetLocalAddress().port();
+	}
+
+	// Drops every connection and refuses the new ones until restored
+	void Drop()
+	{
+		down_ = true;
+		for (auto& connection : connections_)
+		{
+			connection.second->Close();
+		}
+	}
+
+	void Restore()
+	{
+		down_ = false;
+	}
+
+	int attempts_while_down() const
+	{
+		return attempts_while_down_;
+	}
+
+	const string& last_resume_token() const
+	{
+		return last_resume_token_;
+	}
+
+private:
+	void OnAccept(rtc::AsyncSocket* socket)
+	{
+		auto connection = socket->Accept(nullptr);
+		if (connection == nullptr)
+		{
+			return;
+		}
+
+		if (down_)
+		{
+			attempts_while_down_++;
+			connection->Close();
+			delete connection;
+			return;
+		}
+
+		connection->SignalReadEvent.connect(this, &FakeSignalingServer::OnRead);
+		connections_[connection].reset(connection);
+	}
+
+	void OnRead(rtc::AsyncSocket* socket)
+	{
+		auto& request = pending_[socket];
+
+		char buffer[1024];
+		int bytes;
+		while ((bytes = socket->Recv(buffer, sizeof(buffer), nullptr)) > 0)
+		{
+			request.append(buffer, bytes);
+		}
+
+		// answer once the request is complete
+		size_t eoh = request.find("\r\n\r\n");
+		if (eoh == string::npos)
+		{
+			return;
+		}
+
+		string line = request.substr(0, request.find("\r\n"));
+		string token;
+		size_t header = request.find("\r\nResume-Token: ");
+		if (header != string::npos && header < eoh)
+		{
+			size_t begin = header + strlen("\r\nResume-Token: ");
+			token = request.substr(begin, request.find("\r\n", begin) - begin);
+		}
+
+		request.clear();
+
+		// the hanging gets are held, there's nothing to notify
+		if (line.find("GET /sign_in") != 0)
+		{
+			return;
+		}
+
+		// the previous id is given back along with its token
+		int id = next_id_;
+		size_t resume = line.find("&peer_id=");
+		if (resume != string::npos && !token.empty())
+		{
+			last_resume_token_ = token;
+			int previous_id = atoi(&line[resume + strlen("&peer_id=")]);
+			if (token == "token" + to_string(previous_id))
+			{
+				id = previous_id;
+			}
+		}
+
+		if (id == next_id_)
+		{
+			next_id_++;
+		}
+
+		string body = "client,100,1\n";
+		auto response = "HTTP/1.1 200 OK\r\nPragma: " + to_string(id) + "\r\nResume-Token: token" + to_string(id) +
+			"\r\nContent-Type: text/plain\r\nContent-Length: " + to_string(body.length()) + "\r\nConnection: close\r\n\r\n" + body;
+		socket->Send(response.data(), response.length());
+	}
+
+	int next_id_;
+	bool down_;
+	atomic<int> attempts_while_down_;
+	string last_resume_token_;
+	unique_ptr<rtc::AsyncSocket> listen_socket_;
+	map<rtc::AsyncSocket*, unique_ptr<rtc::AsyncSocket>> connections_;
+	map<rtc::AsyncSocket*, string> pending_;
+};
+
+/// <summary>
+/// Stand-in host resolver, answering every lookup with the same result after a short round trip
+/// </summary>
+/// <remarks>
+/// Must be created, used and destroyed on the thread of an RtcEventLoop
+/// </remarks>
+class FakeHostResolver : public HostResolver, public rtc::MessageHandler
+{
+public:
+	FakeHostResolver(const HostResolverResult& result) : result_(result), lookups_(0) {}
+
+	void Resolve(const string& hostname, const Callback& callback) override
+	{
+		lookups_++;
+		pending_.push_back(callback);
+		rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, 100, this);
+	}
+
+	void OnMessage(rtc::Message* msg) override
+	{
+		auto callback = pending_.front();
+		pending_.erase(pending_.begin());
+		callback(result_);
+	}
+
+	int lookups() const
+	{
+		return lookups_;
+	}
+
+private:
+	HostResolverResult result_;
+	vector<Callback> pending_;
+	atomic<int> lookups_;
+};
+
+// Parses an address of the tests
+rtc::IPAddress ParseIP(const string& str)
+{
+	rtc::IPAddress ip;
+	EXPECT_TRUE(rtc::IPFromString(str, &ip));
+	return ip;
+}
+
 /// <summary>
 /// Validate that peer_connection_client can correctly create sockets
 /// </summary>
@@ -479,3 +868,1162 @@ TEST(SignalingClient, TurnCredentialProviderSuccess)
 		// rely on RAII to kill the loop
 	}
 }
+
+/// <summary>
+/// Validate that turn_credential_provider answers from its cache while the credentials are valid
+/// </summary>
+TEST(SignalingClient, TurnCredentialProviderCachesCredentials)
+{
+	rtc::Event block_for_turn(false, false);
+	vector<string> usernames;
+
+	TurnCredentialProvider::CredentialsRetrievedCallback cb([&](const TurnCredentials& result)
+	{
+		EXPECT_TRUE(result.successFlag);
+		EXPECT_EQ(result.ttl, 60);
+
+		usernames.push_back(result.username);
+		block_for_turn.Set();
+	});
+
+	rtc::Thread* loop_thread = nullptr;
+	unique_ptr<FakeTurnCredentialServer> server;
+	shared_ptr<TurnCredentialProvider> client;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+
+			// no authentication provider, the stand-in doesn't need a token
+			server = make_unique<FakeTurnCredentialServer>(60);
+			client = make_shared<TurnCredentialProvider>(server->uri());
+			client->SignalCredentialsRetrieved.connect(&cb, &TurnCredentialProvider::CredentialsRetrievedCallback::Handle);
+
+			ASSERT_FALSE(client->GetCachedCredentials().successFlag);
+			ASSERT_TRUE(client->RequestCredentials());
+		});
+
+		// block test thread waiting for the first retrieval
+		ASSERT_TRUE(block_for_turn.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			auto cached = client->GetCachedCredentials();
+			EXPECT_TRUE(cached.successFlag);
+			EXPECT_STREQ(cached.username.c_str(), "user1");
+
+			// answered right away, without another round trip
+			EXPECT_TRUE(client->RequestCredentials());
+			EXPECT_EQ(client->state(), TurnCredentialProvider::State::NOT_ACTIVE);
+			EXPECT_EQ(usernames.size(), 2U);
+			EXPECT_STREQ(usernames.back().c_str(), "user1");
+			EXPECT_EQ(server->requests(), 1);
+
+			client.reset();
+			server.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that turn_credential_provider refreshes its credentials ahead of their expiry
+/// </summary>
+TEST(SignalingClient, TurnCredentialProviderRefreshesBeforeExpiry)
+{
+	rtc::Event block_for_turn(false, false);
+	vector<string> usernames;
+
+	TurnCredentialProvider::CredentialsRetrievedCallback cb([&](const TurnCredentials& result)
+	{
+		EXPECT_TRUE(result.successFlag);
+
+		usernames.push_back(result.username);
+		block_for_turn.Set();
+	});
+
+	rtc::Thread* loop_thread = nullptr;
+	unique_ptr<FakeTurnCredentialServer> server;
+	shared_ptr<TurnCredentialProvider> client;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+
+			// credentials valid for a second only, refreshed before
+			server = make_unique<FakeTurnCredentialServer>(1);
+			client = make_shared<TurnCredentialProvider>(server->uri());
+			client->SignalCredentialsRetrieved.connect(&cb, &TurnCredentialProvider::CredentialsRetrievedCallback::Handle);
+
+			ASSERT_TRUE(client->RequestCredentials());
+		});
+
+		// block test thread waiting for the retrieval, then the refresh nobody requested
+		ASSERT_TRUE(block_for_turn.Wait(10000));
+		ASSERT_TRUE(block_for_turn.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			ASSERT_GE(usernames.size(), 2U);
+			EXPECT_STREQ(usernames[0].c_str(), "user1");
+			EXPECT_STREQ(usernames[1].c_str(), "user2");
+			EXPECT_GE(server->requests(), 2);
+
+			// the refreshed credentials are the cached ones
+			EXPECT_TRUE(client->GetCachedCredentials().successFlag);
+			EXPECT_STREQ(client->GetCachedCredentials().username.c_str(), usernames.back().c_str());
+
+			client.reset();
+			server.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that turn_credential_provider shares the retrieval in flight between concurrent requests
+/// </summary>
+TEST(SignalingClient, TurnCredentialProviderSharesInflightRequest)
+{
+	rtc::Event block_for_turn(false, false);
+	atomic<int> retrieved(0);
+
+	TurnCredentialProvider::CredentialsRetrievedCallback cb([&](const TurnCredentials& result)
+	{
+		EXPECT_TRUE(result.successFlag);
+		EXPECT_STREQ(result.username.c_str(), "user1");
+
+		retrieved++;
+		block_for_turn.Set();
+	});
+
+	rtc::Thread* loop_thread = nullptr;
+	unique_ptr<FakeTurnCredentialServer> server;
+	shared_ptr<TurnCredentialProvider> client;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+
+			server = make_unique<FakeTurnCredentialServer>(60);
+			client = make_shared<TurnCredentialProvider>(server->uri());
+			client->SignalCredentialsRetrieved.connect(&cb, &TurnCredentialProvider::CredentialsRetrievedCallback::Handle);
+
+			// the later requests join the first one, rather than failing
+			ASSERT_TRUE(client->RequestCredentials());
+			EXPECT_NE(client->state(), TurnCredentialProvider::State::NOT_ACTIVE);
+			ASSERT_TRUE(client->RequestCredentials());
+			ASSERT_TRUE(client->RequestCredentials());
+		});
+
+		// block test thread waiting for the shared retrieval
+		ASSERT_TRUE(block_for_turn.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_EQ(retrieved.load(), 1);
+			EXPECT_EQ(server->requests(), 1);
+
+			client.reset();
+			server.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that token_manager answers from its cache, and shares the acquisition in flight
+/// </summary>
+TEST(SignalingClient, TokenManagerCachesTokens)
+{
+	rtc::Event block_for_token(false, false);
+	vector<string> tokens;
+
+	AuthenticationProvider::AuthenticationCompleteCallback cb([&](const AuthenticationProviderResult& result)
+	{
+		EXPECT_TRUE(result.successFlag);
+		EXPECT_EQ(result.expiresIn, 60);
+
+		tokens.push_back(result.accessToken);
+		block_for_token.Set();
+	});
+
+	rtc::Thread* loop_thread = nullptr;
+	unique_ptr<FakeAuthority> authority;
+	unique_ptr<TokenManager> manager;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+
+			authority = make_unique<FakeAuthority>(60);
+			manager = make_unique<TokenManager>(authority.get());
+			manager->SignalAuthenticationComplete.connect(&cb, &AuthenticationProvider::AuthenticationCompleteCallback::Handle);
+
+			// the later requests join the first one
+			ASSERT_FALSE(manager->GetCachedToken().successFlag);
+			ASSERT_TRUE(manager->Authenticate());
+			ASSERT_TRUE(manager->Authenticate());
+		});
+
+		// block test thread waiting for the shared acquisition
+		ASSERT_TRUE(block_for_token.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_EQ(tokens.size(), 1U);
+			EXPECT_STREQ(manager->GetCachedToken().accessToken.c_str(), "token1");
+
+			// answered right away, without another round trip
+			EXPECT_TRUE(manager->Authenticate());
+			EXPECT_EQ(tokens.size(), 2U);
+			EXPECT_STREQ(tokens.back().c_str(), "token1");
+			EXPECT_EQ(authority->requests(), 1);
+
+			manager.reset();
+			authority.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that token_manager renews its token after part of its lifetime
+/// </summary>
+TEST(SignalingClient, TokenManagerRenewsBeforeExpiry)
+{
+	rtc::Event block_for_token(false, false);
+	vector<string> tokens;
+
+	AuthenticationProvider::AuthenticationCompleteCallback cb([&](const AuthenticationProviderResult& result)
+	{
+		EXPECT_TRUE(result.successFlag);
+
+		tokens.push_back(result.accessToken);
+		block_for_token.Set();
+	});
+
+	rtc::Thread* loop_thread = nullptr;
+	unique_ptr<FakeAuthority> authority;
+	unique_ptr<TokenManager> manager;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+
+			// tokens valid for two seconds, renewed after one
+			authority = make_unique<FakeAuthority>(2);
+			manager = make_unique<TokenManager>(authority.get(), 0.5);
+			manager->SignalAuthenticationComplete.connect(&cb, &AuthenticationProvider::AuthenticationCompleteCallback::Handle);
+
+			ASSERT_TRUE(manager->Authenticate());
+		});
+
+		// block test thread waiting for the acquisition, then the renewal nobody requested
+		ASSERT_TRUE(block_for_token.Wait(10000));
+		ASSERT_TRUE(block_for_token.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			ASSERT_GE(tokens.size(), 2U);
+			EXPECT_STREQ(tokens[0].c_str(), "token1");
+			EXPECT_STREQ(tokens[1].c_str(), "token2");
+			EXPECT_STREQ(manager->GetCachedToken().accessToken.c_str(), tokens.back().c_str());
+
+			manager.reset();
+			authority.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that token_manager doesn't renew the tokens of an interactive provider in the background
+/// </summary>
+TEST(SignalingClient, TokenManagerDoesntRenewInteractiveTokens)
+{
+	rtc::Event block_for_token(false, false);
+	vector<string> tokens;
+
+	AuthenticationProvider::AuthenticationCompleteCallback cb([&](const AuthenticationProviderResult& result)
+	{
+		EXPECT_TRUE(result.successFlag);
+
+		tokens.push_back(result.accessToken);
+		block_for_token.Set();
+	});
+
+	rtc::Thread* loop_thread = nullptr;
+	unique_ptr<FakeAuthority> authority;
+	unique_ptr<TokenManager> manager;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+
+			// tokens valid for two seconds, which would be renewed after one
+			authority = make_unique<FakeAuthority>(2, true);
+			manager = make_unique<TokenManager>(authority.get(), 0.5);
+			manager->SignalAuthenticationComplete.connect(&cb, &AuthenticationProvider::AuthenticationCompleteCallback::Handle);
+
+			ASSERT_TRUE(manager->Authenticate());
+		});
+
+		// block test thread waiting for the acquisition, past the time of the renewal
+		ASSERT_TRUE(block_for_token.Wait(10000));
+		ASSERT_FALSE(block_for_token.Wait(1500));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_EQ(1U, tokens.size());
+			EXPECT_EQ(1, authority->requests());
+
+			manager.reset();
+			authority.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that token_manager persists its tokens encrypted, for the next runs
+/// </summary>
+TEST(SignalingClient, TokenManagerPersistsTokens)
+{
+	const string cache_path = "TokenManagerPersistsTokens.token";
+	remove(cache_path.c_str());
+
+	rtc::Event block_for_token(false, false);
+
+	AuthenticationProvider::AuthenticationCompleteCallback cb([&](const AuthenticationProviderResult& result)
+	{
+		block_for_token.Set();
+	});
+
+	rtc::Thread* loop_thread = nullptr;
+	unique_ptr<FakeAuthority> authority;
+	unique_ptr<TokenManager> manager;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+
+			authority = make_unique<FakeAuthority>(60);
+			manager = make_unique<TokenManager>(authority.get());
+			manager->SignalAuthenticationComplete.connect(&cb, &AuthenticationProvider::AuthenticationCompleteCallback::Handle);
+
+			// nothing cached yet
+			ASSERT_FALSE(manager->SetCacheFile(cache_path, true));
+			ASSERT_TRUE(manager->Authenticate());
+		});
+
+		// block test thread waiting for the acquisition
+		ASSERT_TRUE(block_for_token.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			manager.reset();
+
+			// the token isn't readable from the file
+			ifstream file(cache_path, ios::binary);
+			string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+			file.close();
+			EXPECT_FALSE(contents.empty());
+			EXPECT_EQ(contents.find("token1"), string::npos);
+
+			// a new manager takes the persisted token, without a round trip
+			FakeAuthority next_authority(60);
+			TokenManager next_manager(&next_authority);
+			EXPECT_TRUE(next_manager.SetCacheFile(cache_path, true));
+			EXPECT_STREQ(next_manager.GetCachedToken().accessToken.c_str(), "token1");
+			EXPECT_EQ(next_authority.requests(), 0);
+
+			// invalidating it removes the file
+			next_manager.Invalidate();
+			EXPECT_FALSE(next_manager.GetCachedToken().successFlag);
+			EXPECT_FALSE(ifstream(cache_path).good());
+
+			authority.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that a token rejected by the turn credential service is dropped from the token_manager
+/// and its cache file, so that the next retrieval authenticates again
+/// </summary>
+TEST(SignalingClient, TurnCredentialProviderInvalidatesRejectedToken)
+{
+	const string cache_path = "TurnCredentialProviderInvalidatesRejectedToken.token";
+	remove(cache_path.c_str());
+
+	rtc::Event block_for_turn(false, false);
+	vector<TurnCredentials> results;
+
+	TurnCredentialProvider::CredentialsRetrievedCallback cb([&](const TurnCredentials& result)
+	{
+		results.push_back(result);
+		block_for_turn.Set();
+	});
+
+	rtc::Thread* loop_thread = nullptr;
+	unique_ptr<FakeAuthority> authority;
+	unique_ptr<TokenManager> manager;
+	unique_ptr<FakeTurnCredentialServer> server;
+	shared_ptr<TurnCredentialProvider> client;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+
+			// the service rejects the first token
+			authority = make_unique<FakeAuthority>(60);
+			manager = make_unique<TokenManager>(authority.get());
+			ASSERT_FALSE(manager->SetCacheFile(cache_path, true));
+
+			server = make_unique<FakeTurnCredentialServer>(60, "token1");
+			client = make_shared<TurnCredentialProvider>(server->uri());
+			client->SetAuthenticationProvider(manager.get());
+			client->SignalCredentialsRetrieved.connect(&cb, &TurnCredentialProvider::CredentialsRetrievedCallback::Handle);
+
+			ASSERT_TRUE(client->RequestCredentials());
+		});
+
+		// block test thread waiting for the rejected retrieval
+		ASSERT_TRUE(block_for_turn.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			ASSERT_EQ(results.size(), 1U);
+			EXPECT_FALSE(results[0].successFlag);
+
+			// the rejected token is gone, from memory and from the file
+			EXPECT_FALSE(manager->GetCachedToken().successFlag);
+			EXPECT_FALSE(ifstream(cache_path).good());
+
+			ASSERT_TRUE(client->RequestCredentials());
+		});
+
+		// block test thread waiting for the retrieval with a new token
+		ASSERT_TRUE(block_for_turn.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			ASSERT_EQ(results.size(), 2U);
+			EXPECT_TRUE(results[1].successFlag);
+			EXPECT_EQ(authority->requests(), 2);
+
+			ASSERT_EQ(server->tokens().size(), 2U);
+			EXPECT_STREQ(server->tokens()[0].c_str(), "token1");
+			EXPECT_STREQ(server->tokens()[1].c_str(), "token2");
+
+			client.reset();
+			server.reset();
+			manager.reset();
+			authority.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+
+	remove(cache_path.c_str());
+}
+
+/// <summary>
+/// Validate that dns_cache shares the lookup in flight, and keeps the order of the resolver
+/// </summary>
+TEST(SignalingClient, DnsCacheSharesInflightLookup)
+{
+	rtc::Event block_for_dns(false, false);
+	vector<vector<rtc::IPAddress>> results;
+
+	HostResolverResult result;
+	result.addresses = { ParseIP("10.0.0.1"), ParseIP("10.0.0.2"), ParseIP("fd00::1") };
+
+	rtc::Thread* loop_thread = nullptr;
+	shared_ptr<FakeHostResolver> resolver;
+	shared_ptr<DnsCache> cache;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+
+			resolver = make_shared<FakeHostResolver>(result);
+			cache = make_shared<DnsCache>(resolver);
+
+			auto callback = [&](int error, const vector<rtc::IPAddress>& addresses)
+			{
+				EXPECT_EQ(error, 0);
+
+				results.push_back(addresses);
+				if (results.size() == 2U)
+				{
+					block_for_dns.Set();
+				}
+			};
+
+			// the later lookups join the first one, the cancelled one never calls back
+			cache->Resolve("signal.test", callback);
+			auto cancelled = cache->Resolve("signal.test", callback);
+			cache->Resolve("signal.test", callback);
+			cache->Cancel(cancelled);
+		});
+
+		// block test thread waiting for the shared lookup
+		ASSERT_TRUE(block_for_dns.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_EQ(resolver->lookups(), 1);
+
+			// the clients connecting to the first address get the one the resolver prefers
+			EXPECT_EQ(results.front(), result.addresses);
+
+			// racing the addresses alternates the families, starting with the preferred one
+			auto ordered = DnsCache::OrderForConnection(results.front());
+			ASSERT_EQ(ordered.size(), 3U);
+			EXPECT_EQ(ordered[0], ParseIP("10.0.0.1"));
+			EXPECT_EQ(ordered[1], ParseIP("fd00::1"));
+			EXPECT_EQ(ordered[2], ParseIP("10.0.0.2"));
+
+			// unreachable addresses move to the back
+			vector<rtc::IPAddress> addresses;
+			cache->ReportUnreachable("signal.test", ParseIP("10.0.0.1"));
+			ASSERT_TRUE(cache->Lookup("signal.test", &addresses));
+			EXPECT_EQ(addresses.front(), ParseIP("10.0.0.2"));
+			EXPECT_EQ(addresses.back(), ParseIP("10.0.0.1"));
+
+			cache.reset();
+			resolver.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that dns_cache answers from its cache until the ttl of the result
+/// </summary>
+TEST(SignalingClient, DnsCacheExpiresResults)
+{
+	rtc::Event block_for_dns(false, false);
+	int answers = 0;
+
+	HostResolverResult result;
+	result.addresses = { ParseIP("10.0.0.1") };
+	result.ttl = 1;
+
+	auto callback = [&](int error, const vector<rtc::IPAddress>& addresses)
+	{
+		EXPECT_EQ(error, 0);
+
+		answers++;
+		block_for_dns.Set();
+	};
+
+	rtc::Thread* loop_thread = nullptr;
+	shared_ptr<FakeHostResolver> resolver;
+	shared_ptr<DnsCache> cache;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+
+			resolver = make_shared<FakeHostResolver>(result);
+			cache = make_shared<DnsCache>(resolver);
+			cache->Resolve("signal.test", callback);
+		});
+
+		// block test thread waiting for the lookup
+		ASSERT_TRUE(block_for_dns.Wait(10000));
+
+		// the cached result is answered asynchronously, without a lookup
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			cache->Resolve("signal.test", callback);
+			EXPECT_EQ(answers, 1);
+		});
+
+		ASSERT_TRUE(block_for_dns.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_EQ(answers, 2);
+			EXPECT_EQ(resolver->lookups(), 1);
+		});
+
+		// wait out the ttl
+		rtc::Thread::SleepMs(1500);
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			vector<rtc::IPAddress> addresses;
+			EXPECT_FALSE(cache->Lookup("signal.test", &addresses));
+
+			cache->Resolve("signal.test", callback);
+		});
+
+		ASSERT_TRUE(block_for_dns.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_EQ(answers, 3);
+			EXPECT_EQ(resolver->lookups(), 2);
+
+			cache.reset();
+			resolver.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that dns_cache keeps failed lookups for the negative ttl
+/// </summary>
+TEST(SignalingClient, DnsCacheCachesFailures)
+{
+	rtc::Event block_for_dns(false, false);
+	vector<int> errors;
+
+	HostResolverResult result;
+	result.error = 11001;
+
+	auto callback = [&](int error, const vector<rtc::IPAddress>& addresses)
+	{
+		EXPECT_TRUE(addresses.empty());
+
+		errors.push_back(error);
+		block_for_dns.Set();
+	};
+
+	rtc::Thread* loop_thread = nullptr;
+	shared_ptr<FakeHostResolver> resolver;
+	shared_ptr<DnsCache> cache;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+
+			// keep results for a minute, and failures for a second
+			resolver = make_shared<FakeHostResolver>(result);
+			cache = make_shared<DnsCache>(resolver, 60, 1);
+			cache->Resolve("missing.test", callback);
+		});
+
+		ASSERT_TRUE(block_for_dns.Wait(10000));
+
+		// the failure is answered again without a lookup
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			cache->Resolve("missing.test", callback);
+		});
+
+		ASSERT_TRUE(block_for_dns.Wait(10000));
+
+		// wait out the negative ttl
+		rtc::Thread::SleepMs(1500);
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_EQ(resolver->lookups(), 1);
+			cache->Resolve("missing.test", callback);
+		});
+
+		ASSERT_TRUE(block_for_dns.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_EQ(resolver->lookups(), 2);
+
+			ASSERT_EQ(errors.size(), 3U);
+			EXPECT_EQ(errors[0], 11001);
+			EXPECT_EQ(errors[2], 11001);
+
+			cache.reset();
+			resolver.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that connection_race goes on with the next address once an attempt fails
+/// </summary>
+TEST(SignalingClient, ConnectionRaceFallsBackToNextAddress)
+{
+	rtc::Event block_for_race(false, false);
+	int race_error = -1;
+
+	struct RaceCallback : public sigslot::has_slots<>
+	{
+		RaceCallback(const function<void(ConnectionRace*, int)>& handler) : handler_(handler) {}
+
+		void Handle(ConnectionRace* race, int error)
+		{
+			handler_(race, error);
+		}
+
+		function<void(ConnectionRace*, int)> handler_;
+	};
+
+	RaceCallback cb([&](ConnectionRace* race, int error)
+	{
+		race_error = error;
+		block_for_race.Set();
+	});
+
+	rtc::Thread* loop_thread = nullptr;
+	shared_ptr<rtc::Thread> signaling_thread;
+	unique_ptr<ConnectionRace> race;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+			signaling_thread = shared_ptr<rtc::Thread>(loop_thread, [](rtc::Thread*) {});
+
+			// the IPv6 address refuses right away, the IPv4 one connects
+			race = make_unique<ConnectionRace>([&](const rtc::SocketAddress& addr)
+			{
+				auto mockSocket = make_unique<MockSslCapableSocket>(addr.family(), false, signaling_thread);
+				mockSocket->DelegateToFake();
+
+				if (addr.family() == AF_INET6)
+				{
+					EXPECT_CALL(*mockSocket, Connect(_)).WillOnce(Return(SOCKET_ERROR));
+				}
+
+				return unique_ptr<SslCapableSocket>(move(mockSocket));
+			});
+
+			race->SignalDone.connect(&cb, &RaceCallback::Handle);
+			race->Start("signal.test", 443, DnsCache::OrderForConnection({ ParseIP("fd00::1"), ParseIP("10.0.0.1") }));
+		});
+
+		// block test thread waiting for the race
+		ASSERT_TRUE(block_for_race.Wait(10000));
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_EQ(race_error, 0);
+
+			// the winner keeps the host name, for ssl
+			EXPECT_EQ(race->winner_address().ipaddr(), ParseIP("10.0.0.1"));
+			EXPECT_STREQ(race->winner_address().hostname().c_str(), "signal.test");
+
+			ASSERT_EQ(race->failed_addresses().size(), 1U);
+			EXPECT_EQ(race->failed_addresses().front().ipaddr(), ParseIP("fd00::1"));
+
+			auto socket = race->TakeSocket();
+			EXPECT_EQ(socket->GetState(), rtc::Socket::CS_CONNECTED);
+
+			socket.reset();
+			race.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that peer_connection_client signs back in with its id once the server is back
+/// </summary>
+TEST(SignalingClient, ReconnectResumesSession)
+{
+	ReconnectionObserver obs;
+
+	rtc::Thread* loop_thread = nullptr;
+	unique_ptr<FakeSignalingServer> server;
+	shared_ptr<PeerConnectionClient> client;
+	int first_id = -1;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+			server = make_unique<FakeSignalingServer>();
+
+			client = make_shared<PeerConnectionClient>();
+			client->RegisterObserver(&obs);
+			client->SetReconnectDelays(100, 400);
+			client->Connect("http://127.0.0.1", server->port(), "server");
+		});
+
+		// block test thread waiting for the sign in
+		ASSERT_TRUE(obs.WaitForSignIn());
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			first_id = client->id();
+			server->Drop();
+		});
+
+		// the client keeps trying during the outage
+		rtc::Thread::SleepMs(1000);
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_FALSE(client->is_connected());
+			server->Restore();
+		});
+
+		ASSERT_TRUE(obs.WaitForSignIn());
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			// the same session goes on, without telling about the outage
+			EXPECT_EQ(client->id(), first_id);
+			EXPECT_EQ(obs.signed_in.load(), 2);
+			EXPECT_EQ(obs.disconnected.load(), 0);
+			EXPECT_EQ(server->last_resume_token(), "token" + to_string(first_id));
+
+			// the peers known before the outage aren't notified again
+			EXPECT_EQ(obs.peers_connected.load(), 1);
+			EXPECT_EQ(obs.peers_disconnected.load(), 0);
+
+			client.reset();
+			server.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that peer_connection_client backs off while the server drops its connections
+/// </summary>
+TEST(SignalingClient, ReconnectBacksOff)
+{
+	ReconnectionObserver obs;
+
+	rtc::Thread* loop_thread = nullptr;
+	unique_ptr<FakeSignalingServer> server;
+	shared_ptr<PeerConnectionClient> client;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+			server = make_unique<FakeSignalingServer>();
+
+			client = make_shared<PeerConnectionClient>();
+			client->RegisterObserver(&obs);
+			client->SetReconnectDelays(100, 400);
+			client->Connect("http://127.0.0.1", server->port(), "server");
+		});
+
+		// block test thread waiting for the sign in
+		ASSERT_TRUE(obs.WaitForSignIn());
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			server->Drop();
+		});
+
+		rtc::Thread::SleepMs(3000);
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			// a fixed 100ms delay would take about 30 attempts, the backoff
+			// reaches its 400ms maximum after a few
+			EXPECT_GE(server->attempts_while_down(), 3);
+			EXPECT_LE(server->attempts_while_down(), 20);
+			server->Restore();
+		});
+
+		ASSERT_TRUE(obs.WaitForSignIn());
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_TRUE(client->is_connected());
+			EXPECT_EQ(obs.disconnected.load(), 0);
+
+			client.reset();
+			server.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+}
+
+/// <summary>
+/// Validate that structured_log formats the fields of a record off the logging thread
+/// </summary>
+TEST(SignalingClient, StructuredLogFormatsFields)
+{
+	struct CaptureSink : public StructuredLogSink
+	{
+		void OnLogBatch(const vector<StructuredLogLine>& batch) override
+		{
+			for (const auto& line : batch)
+			{
+				if (line.text.find("structured_log_test") == 0)
+				{
+					lines.push_back(line.text);
+				}
+			}
+		}
+
+		vector<string> lines;
+	};
+
+	auto sink = make_shared<CaptureSink>();
+	StructuredLog::Instance().AddSink(sink);
+
+	string name = "test peer";
+	SLOG(INFO, "structured_log_test").Field("peer_id", 2).Field("name", name).Field("ratio", 0.5);
+	SLOG(LS_SENSITIVE, "structured_log_test").Field("elided", true);
+
+	StructuredLog::Instance().Flush();
+	StructuredLog::Instance().RemoveSink(sink);
+
+	ASSERT_EQ(sink->lines.size(), 1U);
+	EXPECT_STREQ(sink->lines[0].c_str(), "structured_log_test peer_id=2 name=\"test peer\" ratio=0.5");
+}
+
+/// <summary>
+/// Validate that log_rate_limiter lets a few records through a second and counts the others
+/// </summary>
+TEST(SignalingClient, StructuredLogRateLimitsStatements)
+{
+	LogRateLimiter limiter(3);
+	uint32_t suppressed = 0;
+	int allowed = 0;
+
+	for (int i = 0; i < 10; i++)
+	{
+		allowed += limiter.Allow(&suppressed) ? 1 : 0;
+	}
+
+	EXPECT_EQ(allowed, 3);
+	EXPECT_EQ(suppressed, 0U);
+
+	// the next window tells how many were suppressed
+	rtc::Thread::SleepMs(1100);
+	EXPECT_TRUE(limiter.Allow(&suppressed));
+	EXPECT_EQ(suppressed, 7U);
+}
+
+/// <summary>
+/// Validate that log_ring drops records once full rather than blocking
+/// </summary>
+TEST(SignalingClient, StructuredLogRingDropsWhenFull)
+{
+	LogRing ring(4);
+	LogRecord record = {};
+
+	for (int i = 0; i < 4; i++)
+	{
+		record.line = i;
+		EXPECT_TRUE(ring.TryPush(record));
+	}
+
+	EXPECT_FALSE(ring.TryPush(record));
+	EXPECT_EQ(ring.pushed(), 4U);
+
+	// records come out in order, making room for new ones
+	ASSERT_TRUE(ring.TryPop(&record));
+	EXPECT_EQ(record.line, 0);
+	EXPECT_TRUE(ring.TryPush(record));
+
+	for (int i = 1; i < 4; i++)
+	{
+		ASSERT_TRUE(ring.TryPop(&record));
+		EXPECT_EQ(record.line, i);
+	}
+
+	ASSERT_TRUE(ring.TryPop(&record));
+	EXPECT_EQ(record.line, 0);
+	EXPECT_FALSE(ring.TryPop(&record));
+}
+
+/// <summary>
+/// Validate that metrics_registry sums the shards of the threads and renders the text format
+/// </summary>
+TEST(SignalingClient, MetricsRegistryRendersMetrics)
+{
+	MetricsRegistry registry;
+	auto frames = registry.GetCounter("test_frames_total", "Frames sent", { { "peer", "1" } });
+	auto depth = registry.GetGauge("test_queue_depth", "Messages queued");
+	auto latency = registry.GetHistogram("test_latency_seconds", "Latency", { 0.01, 0.1 }, { { "peer", "1" } });
+
+	// the same series is handed out again
+	EXPECT_EQ(registry.GetCounter("test_frames_total", "Frames sent", { { "peer", "1" } }), frames);
+
+	vector<thread> threads;
+	for (int i = 0; i < 8; i++)
+	{
+		threads.emplace_back([&]()
+		{
+			for (int j = 0; j < 10000; j++)
+			{
+				frames->Increment();
+			}
+		});
+	}
+
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+
+	EXPECT_EQ(frames->Value(), 80000);
+
+	depth->Set(3);
+	depth->Add(-1);
+	latency->Observe(0.005);
+	latency->Observe(0.01);
+	latency->Observe(0.05);
+	latency->Observe(1);
+
+	auto text = registry.Scrape();
+	EXPECT_NE(text.find("# TYPE test_frames_total counter\ntest_frames_total{peer=\"1\"} 80000\n"), string::npos);
+	EXPECT_NE(text.find("# HELP test_queue_depth Messages queued\n# TYPE test_queue_depth gauge\ntest_queue_depth 2\n"), string::npos);
+	EXPECT_NE(text.find(
+		"test_latency_seconds_bucket{peer=\"1\",le=\"0.01\"} 2\n"
+		"test_latency_seconds_bucket{peer=\"1\",le=\"0.1\"} 3\n"
+		"test_latency_seconds_bucket{peer=\"1\",le=\"+Inf\"} 4\n"
+		"test_latency_seconds_sum{peer=\"1\"} 1.065\n"
+		"test_latency_seconds_count{peer=\"1\"} 4\n"), string::npos);
+
+	// the series of a peer go away with it, the pointers handed out stay valid
+	registry.RemoveSeries("peer", "1");
+	frames->Increment();
+	text = registry.Scrape();
+	EXPECT_EQ(text.find("test_frames_total"), string::npos);
+	EXPECT_EQ(text.find("test_latency_seconds"), string::npos);
+	EXPECT_NE(text.find("test_queue_depth 2"), string::npos);
+}
+
+/// <summary>
+/// Validate that stream_metrics computes the rates of a peer between two polls of its statistics
+/// </summary>
+TEST(SignalingClient, StreamMetricsComputesRates)
+{
+	int64_t now_us = 1000000;
+	MetricsRegistry registry([&]() { return now_us; });
+	StreamMetrics metrics(&registry, 5);
+
+	for (int i = 0; i < 30; i++)
+	{
+		metrics.OnFrameSubmitted(1000);
+	}
+
+	StreamStatsSample sample = {};
+	sample.bytes_sent = 1000;
+	sample.packets_sent = 10;
+	sample.frames_encoded = 28;
+	sample.avg_encode_ms = 4;
+	sample.rtt_ms = 20;
+	metrics.OnStats(sample);
+
+	// two seconds later, 30 more frames and 250 kB went out
+	for (int i = 0; i < 30; i++)
+	{
+		metrics.OnFrameSubmitted(1000);
+	}
+
+	now_us += 2000000;
+	sample.bytes_sent = 251000;
+	sample.packets_sent = 90;
+	sample.packets_lost = 20;
+	sample.frames_encoded = 58;
+	metrics.OnStats(sample);
+
+	auto text = registry.Scrape();
+	EXPECT_NE(text.find("streaming_peer_fps{peer=\"5\"} 15\n"), string::npos);
+	EXPECT_NE(text.find("streaming_peer_bitrate_bps{peer=\"5\"} 1000000\n"), string::npos);
+	EXPECT_NE(text.find("streaming_peer_packet_loss_ratio{peer=\"5\"} 0.2\n"), string::npos);
+	EXPECT_NE(text.find("streaming_peer_rtt_seconds{peer=\"5\"} 0.02\n"), string::npos);
+	EXPECT_NE(text.find("streaming_peer_encode_seconds{peer=\"5\"} 0.004\n"), string::npos);
+	EXPECT_NE(text.find("streaming_peer_sent_bytes_total{peer=\"5\"} 251000\n"), string::npos);
+	EXPECT_NE(text.find("streaming_peer_frames_dropped_total{peer=\"5\"} 0\n"), string::npos);
+
+	// the frames submitted before the last poll which still aren't encoded were dropped
+	now_us += 1000000;
+	metrics.OnStats(sample);
+	text = registry.Scrape();
+	EXPECT_NE(text.find("streaming_peer_frames_dropped_total{peer=\"5\"} 2\n"), string::npos);
+	EXPECT_NE(text.find("streaming_peer_fps{peer=\"5\"} 0\n"), string::npos);
+}
+
+/// <summary>
+/// Validate that metrics_endpoint serves the scrapes over http from its own thread
+/// </summary>
+TEST(SignalingClient, MetricsEndpointServesScrapes)
+{
+	MetricsRegistry registry;
+	registry.GetCounter("test_scrapes_total", "Scrapes served")->Increment(7);
+
+	MetricsEndpoint endpoint(&registry);
+	ASSERT_TRUE(endpoint.Start(rtc::SocketAddress("127.0.0.1", 0)));
+	EXPECT_NE(endpoint.address().port(), 0);
+
+	rtc::Thread* loop_thread = nullptr;
+	unique_ptr<FakeScraper> metrics_scraper;
+	unique_ptr<FakeScraper> other_scraper;
+
+	// scope for loop guard
+	{
+		RtcEventLoop loop([&]()
+		{
+			loop_thread = rtc::Thread::Current();
+			metrics_scraper = make_unique<FakeScraper>(endpoint.address(), "/metrics");
+			other_scraper = make_unique<FakeScraper>(endpoint.address(), "/");
+		});
+
+		// block test thread waiting for the responses
+		ASSERT_TRUE(metrics_scraper->WaitForResponse());
+		ASSERT_TRUE(other_scraper->WaitForResponse());
+
+		loop_thread->Invoke<void>(RTC_FROM_HERE, [&]()
+		{
+			EXPECT_EQ(metrics_scraper->response.find("HTTP/1.1 200 OK\r\n"), 0U);
+			EXPECT_NE(metrics_scraper->response.find("Content-Type: text/plain; version=0.0.4\r\n"), string::npos);
+			EXPECT_NE(metrics_scraper->response.find("\r\n\r\n# HELP test_scrapes_total Scrapes served\n"), string::npos);
+			EXPECT_NE(metrics_scraper->response.find("test_scrapes_total 7\n"), string::npos);
+			EXPECT_EQ(other_scraper->response.find("HTTP/1.1 404 Not Found\r\n"), 0U);
+
+			metrics_scraper.reset();
+			other_scraper.reset();
+		});
+
+		// rely on RAII to kill the loop
+	}
+
+	endpoint.Stop();
+	EXPECT_TRUE(endpoint.address().IsNil());
+}
@@ -9,9 +9,15 @@
 struct AuthenticationProviderResult
 {
 public:
+	AuthenticationProviderResult() : successFlag(false), expiresIn(0) {}
+
 	bool successFlag;
 	std::string accessToken;
 
+	/// <summary>
+	/// Lifetime of the token in seconds, or 0 if the authority didn't give it
+	/// </summary>
+	int expiresIn;
 };
 
 /// <summary>
@@ -40,6 +46,23 @@ public:
 
 	virtual bool Authenticate() = 0;
 
+	/// <summary>
+	/// Whether authenticating needs the user, e.g. to enter a code, in which case tokens
+	/// shouldn't be renewed in the background
+	/// </summary>
+	virtual bool IsInteractive() const
+	{
+		return false;
+	}
+
+	/// <summary>
+	/// Forgets the token returned by the last authentication, e.g. once rejected by a server,
+	/// so that the next authentication acquires a new one
+	/// </summary>
+	virtual void Invalidate()
+	{
+	}
+
 protected:
 	virtual ~AuthenticationProvider() {}
 };
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "webrtc/rtc_base/messagehandler.h"
+#include "webrtc/rtc_base/sigslot.h"
+#include "webrtc/rtc_base/thread.h"
+
+#include "ssl_capable_socket.h"
+
+/// <summary>
+/// Races connections to the addresses of a host, happy eyeballs style (RFC 8305)
+/// </summary>
+/// <remarks>
+/// Attempts start in the order of the addresses, the next one after a delay or as soon as one fails,
+/// and the first connected socket wins while the others are closed. Pass addresses ordered by
+/// DnsCache::OrderForConnection to alternate families.
+/// </remarks>
+class ConnectionRace : public sigslot::has_slots<>, public rtc::MessageHandler
+{
+public:
+	typedef std::function<std::unique_ptr<SslCapableSocket>(const rtc::SocketAddress& address)> Allocator;
+
+	/// <summary>
+	/// Creates a race, allocating a socket for each attempt
+	/// </summary>
+	ConnectionRace(const Allocator& allocator, int attempt_delay_ms = 250);
+
+	~ConnectionRace();
+
+	/// <summary>
+	/// Starts racing connections to the addresses of the host name, cancelling any race in progress
+	/// </summary>
+	void Start(const std::string& hostname, int port, const std::vector<rtc::IPAddress>& addresses);
+
+	/// <summary>
+	/// Closes all the attempts, SignalDone won't be emitted
+	/// </summary>
+	void Cancel();
+
+	/// <summary>
+	/// Takes the connected socket once the race is won, with its signals disconnected from the race
+	/// </summary>
+	std::unique_ptr<SslCapableSocket> TakeSocket();
+
+	/// <summary>
+	/// Gets the address of the connected socket
+	/// </summary>
+	const rtc::SocketAddress& winner_address() const;
+
+	/// <summary>
+	/// Gets the addresses whose attempt failed, to report them unreachable
+	/// </summary>
+	const std::vector<rtc::SocketAddress>& failed_addresses() const;
+
+	/// <summary>
+	/// Emitted once a socket connected, with a 0 error, or once all the attempts failed
+	/// </summary>
+	sigslot::signal2<ConnectionRace*, int> SignalDone;
+
+	// implement MessageHandler
+	virtual void OnMessage(rtc::Message* msg) override;
+
+private:
+	struct Attempt
+	{
+		rtc::SocketAddress address;
+		std::unique_ptr<SslCapableSocket> socket;
+		bool failed;
+	};
+
+	void StartNextAttempt();
+	void Finish(int error);
+
+	void OnAttemptConnect(rtc::AsyncSocket* socket);
+	void OnAttemptClose(rtc::AsyncSocket* socket, int err);
+
+	Allocator allocator_;
+	const int attempt_delay_ms_;
+	rtc::Thread* thread_;
+
+	std::vector<rtc::SocketAddress> addresses_;
+	size_t next_address_;
+	std::vector<std::unique_ptr<Attempt>> attempts_;
+	std::vector<rtc::SocketAddress> failed_addresses_;
+	bool racing_;
+
+	std::unique_ptr<SslCapableSocket> winner_;
+	rtc::SocketAddress winner_address_;
+};
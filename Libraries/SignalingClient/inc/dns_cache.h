@@ -0,0 +1,161 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "webrtc/rtc_base/ipaddress.h"
+#include "webrtc/rtc_base/messagehandler.h"
+#include "webrtc/rtc_base/nethelpers.h"
+#include "webrtc/rtc_base/sigslot.h"
+#include "webrtc/rtc_base/thread.h"
+
+/// <summary>
+/// Represents the result of a host name lookup
+/// </summary>
+struct HostResolverResult
+{
+	HostResolverResult() : error(0), ttl(0) {}
+
+	int error;
+	std::vector<rtc::IPAddress> addresses;
+
+	/// <summary>
+	/// Lifetime of the result in seconds, or 0 if the resolver doesn't know it
+	/// </summary>
+	int ttl;
+};
+
+/// <summary>
+/// Base class that represents a host name resolver
+/// </summary>
+class HostResolver
+{
+public:
+	typedef std::function<void(const HostResolverResult&)> Callback;
+
+	virtual ~HostResolver() {}
+
+	/// <summary>
+	/// Looks the host name up, calling back on the calling thread
+	/// </summary>
+	virtual void Resolve(const std::string& hostname, const Callback& callback) = 0;
+};
+
+/// <summary>
+/// Resolves host names with the system resolver, through rtc::AsyncResolver
+/// </summary>
+class RtcHostResolver : public HostResolver, public sigslot::has_slots<>
+{
+public:
+	~RtcHostResolver();
+
+	virtual void Resolve(const std::string& hostname, const Callback& callback) override;
+
+private:
+	void OnResolved(rtc::AsyncResolverInterface* resolver);
+
+	std::mutex mutex_;
+	std::map<rtc::AsyncResolverInterface*, Callback> pending_;
+};
+
+/// <summary>
+/// Caches the results of a host resolver, shared by the signaling, turn and authentication clients
+/// </summary>
+/// <remarks>
+/// Results are kept for their ttl, or a default one when the resolver doesn't give it, and failures
+/// for a shorter time. Lookups of a host already being looked up share its result. Addresses keep
+/// the order of the resolver, so that clients connecting to the first one get the address the system
+/// prefers, and addresses reported unreachable move to the back. Clients racing the addresses order
+/// them with OrderForConnection. Thread safe, callbacks run on the thread which asked.
+/// </remarks>
+class DnsCache : public rtc::MessageHandler, public std::enable_shared_from_this<DnsCache>
+{
+public:
+	typedef std::function<void(int error, const std::vector<rtc::IPAddress>& addresses)> Callback;
+
+	/// <summary>
+	/// Gets the process wide cache, used by the clients unless they're given another
+	/// </summary>
+	static std::shared_ptr<DnsCache> Default();
+
+	/// <summary>
+	/// Creates a cache, with ttls in seconds
+	/// </summary>
+	DnsCache(std::shared_ptr<HostResolver> resolver, int default_ttl = 60, int negative_ttl = 5);
+
+	~DnsCache();
+
+	/// <summary>
+	/// Resolves the host name, from the cache if possible
+	/// </summary>
+	/// <remarks>
+	/// The callback always runs asynchronously, on the calling thread, even for cached results
+	/// </remarks>
+	/// <returns>the id of the lookup, to cancel it</returns>
+	int Resolve(const std::string& hostname, const Callback& callback);
+
+	/// <summary>
+	/// Cancels the lookup, its callback won't run
+	/// </summary>
+	void Cancel(int id);
+
+	/// <summary>
+	/// Gets the cached addresses of the host name, without looking it up
+	/// </summary>
+	bool Lookup(const std::string& hostname, std::vector<rtc::IPAddress>* addresses) const;
+
+	/// <summary>
+	/// Moves the address to the back of the addresses of the host name, e.g. once a connection failed
+	/// </summary>
+	void ReportUnreachable(const std::string& hostname, const rtc::IPAddress& address);
+
+	/// <summary>
+	/// Forgets the cached result of the host name
+	/// </summary>
+	void Invalidate(const std::string& hostname);
+
+	/// <summary>
+	/// Orders the addresses for happy eyeballs (RFC 8305), alternating families starting with
+	/// the family of the first address
+	/// </summary>
+	static std::vector<rtc::IPAddress> OrderForConnection(const std::vector<rtc::IPAddress>& addresses);
+
+	// implement MessageHandler
+	virtual void OnMessage(rtc::Message* msg) override;
+
+private:
+	struct Waiter
+	{
+		int id;
+		rtc::Thread* thread;
+		Callback callback;
+	};
+
+	struct Entry
+	{
+		int error;
+		std::vector<rtc::IPAddress> addresses;
+		int64_t expires_at_ms;
+		bool resolving;
+		std::vector<Waiter> waiters;
+	};
+
+	void OnResolved(const std::string& hostname, const HostResolverResult& result);
+
+	// runs the callback on the thread of the waiter, unless cancelled meanwhile
+	void Deliver(const Waiter& waiter, int error, const std::vector<rtc::IPAddress>& addresses);
+
+	std::shared_ptr<HostResolver> resolver_;
+	const int default_ttl_;
+	const int negative_ttl_;
+
+	mutable std::mutex mutex_;
+	std::map<std::string, Entry> entries_;
+	std::set<int> active_;
+	int next_id_;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "metrics_registry.h"
+
+#include "webrtc/rtc_base/asyncsocket.h"
+#include "webrtc/rtc_base/sigslot.h"
+#include "webrtc/rtc_base/socketaddress.h"
+#include "webrtc/rtc_base/thread.h"
+
+/// <summary>
+/// Serves the metrics of a registry over http, for a Prometheus server to scrape
+/// </summary>
+/// <remarks>
+/// Runs on a thread of its own, so that it answers whether or not the process has a UI or
+/// a busy signaling thread. Only GET /metrics is served, each connection being closed once
+/// it's answered
+/// </remarks>
+class MetricsEndpoint : public sigslot::has_slots<>
+{
+public:
+	MetricsEndpoint(MetricsRegistry* registry);
+
+	~MetricsEndpoint();
+
+	/// <summary>
+	/// Starts listening on the address, on any free port if its port is 0
+	/// </summary>
+	bool Start(const rtc::SocketAddress& address);
+
+	void Stop();
+
+	/// <summary>
+	/// Gets the address listened on, once started
+	/// </summary>
+	rtc::SocketAddress address() const;
+
+private:
+	struct Connection
+	{
+		std::unique_ptr<rtc::AsyncSocket> socket;
+		std::string request;
+		std::string response;
+		size_t sent;
+	};
+
+	void OnAccept(rtc::AsyncSocket* socket);
+	void OnRead(rtc::AsyncSocket* socket);
+	void OnWrite(rtc::AsyncSocket* socket);
+	void OnClose(rtc::AsyncSocket* socket, int err);
+
+	// Builds the response of a complete request
+	std::string Respond(const std::string& request) const;
+
+	void Close(rtc::AsyncSocket* socket);
+
+	MetricsRegistry* registry_;
+	std::unique_ptr<rtc::Thread> thread_;
+	std::unique_ptr<rtc::AsyncSocket> listen_socket_;
+	rtc::SocketAddress address_;
+	std::map<rtc::AsyncSocket*, Connection> connections_;
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Labels of a metric series, e.g. { { "peer", "3" } }, rendered in the given order
+typedef std::vector<std::pair<std::string, std::string>> MetricLabels;
+
+/// <summary>
+/// Spreads the updates of the metrics over shards, so that threads seldom share a cache line
+/// </summary>
+class MetricShards
+{
+public:
+	static const int kCount = 16;
+
+	/// <summary>
+	/// Gets the shard of the calling thread, assigned round robin on its first update
+	/// </summary>
+	static int Current();
+};
+
+/// <summary>
+/// Represents a monotonic counter, updated without locks
+/// </summary>
+class Counter
+{
+public:
+	Counter();
+
+	void Increment(int64_t value = 1);
+
+	/// <summary>
+	/// Gets the sum of the shards
+	/// </summary>
+	int64_t Value() const;
+
+private:
+	struct Shard
+	{
+		std::atomic<int64_t> value;
+		char padding[64 - sizeof(std::atomic<int64_t>)];
+	};
+
+	Shard shards_[MetricShards::kCount];
+};
+
+/// <summary>
+/// Represents a value which goes up and down, e.g. a bitrate or a queue depth
+/// </summary>
+class Gauge
+{
+public:
+	Gauge();
+
+	void Set(double value);
+
+	void Add(double value);
+
+	double Value() const;
+
+private:
+	std::atomic<double> value_;
+};
+
+/// <summary>
+/// Represents the distribution of observed values, counted in buckets without locks
+/// </summary>
+class Histogram
+{
+public:
+	/// <summary>
+	/// The values of a histogram, with the cumulative counts of the buckets
+	/// </summary>
+	struct Snapshot
+	{
+		std::vector<double> bounds;
+		std::vector<uint64_t> cumulative_counts;
+		uint64_t count;
+		double sum;
+	};
+
+	/// <summary>
+	/// Creates a histogram, whose buckets hold the values up to each of the ascending bounds,
+	/// the last bucket holding the values above them
+	/// </summary>
+	Histogram(const std::vector<double>& bounds);
+
+	void Observe(double value);
+
+	Snapshot GetSnapshot() const;
+
+	/// <summary>
+	/// Gets count bounds starting at start, each factor times the previous one
+	/// </summary>
+	static std::vector<double> ExponentialBounds(double start, double factor, int count);
+
+private:
+	struct Shard
+	{
+		std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+		std::atomic<uint64_t> count;
+		std::atomic<double> sum;
+		char padding[64 - sizeof(std::unique_ptr<std::atomic<uint64_t>[]>) -
+			sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<double>)];
+	};
+
+	const std::vector<double> bounds_;
+	Shard shards_[MetricShards::kCount];
+};
+
+/// <summary>
+/// Holds the metrics of the process by name and labels, and renders them in the Prometheus text format
+/// </summary>
+/// <remarks>
+/// The metrics are looked up once and then updated through the pointers handed out, which stay
+/// valid after their series are removed. The clock lets the rates derived from the metrics be
+/// tested without waiting
+/// </remarks>
+class MetricsRegistry
+{
+public:
+	// Gets the current time, in microseconds
+	typedef std::function<int64_t()> Clock;
+
+	static MetricsRegistry& Instance();
+
+	/// <summary>
+	/// Creates a registry, on the rtc clock unless another one is given
+	/// </summary>
+	MetricsRegistry(const Clock& clock = nullptr);
+
+	int64_t NowUs() const;
+
+	std::shared_ptr<Counter> GetCounter(const std::string& name, const std::string& help,
+		const MetricLabels& labels = MetricLabels());
+
+	std::shared_ptr<Gauge> GetGauge(const std::string& name, const std::string& help,
+		const MetricLabels& labels = MetricLabels());
+
+	/// <summary>
+	/// Gets a histogram, the bounds of the first series of the name being used for the others
+	/// </summary>
+	std::shared_ptr<Histogram> GetHistogram(const std::string& name, const std::string& help,
+		const std::vector<double>& bounds, const MetricLabels& labels = MetricLabels());
+
+	/// <summary>
+	/// Removes the series having the label, e.g. the ones of a disconnected peer
+	/// </summary>
+	void RemoveSeries(const std::string& label, const std::string& value);
+
+	/// <summary>
+	/// Renders the metrics in the Prometheus text exposition format
+	/// </summary>
+	std::string Scrape() const;
+
+private:
+	enum class MetricType
+	{
+		kCounter,
+		kGauge,
+		kHistogram,
+	};
+
+	struct Series
+	{
+		std::shared_ptr<Counter> counter;
+		std::shared_ptr<Gauge> gauge;
+		std::shared_ptr<Histogram> histogram;
+	};
+
+	struct Family
+	{
+		MetricType type;
+		std::string help;
+		std::vector<double> bounds;
+		std::map<MetricLabels, Series> series;
+	};
+
+	Series* FindOrAddSeries(const std::string& name, const std::string& help, MetricType type,
+		const std::vector<double>& bounds, const MetricLabels& labels);
+
+	Clock clock_;
+	mutable std::mutex mutex_;
+	std::map<std::string, Family> families_;
+};
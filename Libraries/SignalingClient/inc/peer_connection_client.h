@@ -23,6 +23,7 @@
 #include "webrtc/rtc_base/signalthread.h"
 #include "webrtc/rtc_base/sigslot.h"
 
+#include "dns_cache.h"
 #include "ssl_capable_socket.h"
 
 typedef std::map<int, std::string> Peers;
@@ -61,6 +62,7 @@ public:
 		CONNECTED,
 		SIGNING_OUT_WAITING,
 		SIGNING_OUT,
+		RECONNECTING,
 	};
 
 	PeerConnectionClient();
@@ -119,6 +121,22 @@ public:
 
 	void UpdateConnectionState(int id, webrtc::PeerConnectionInterface::IceConnectionState state);
 
+	/// <summary>
+	/// Sets the cache used to resolve the server, instead of the process wide one
+	/// </summary>
+	void SetDnsCache(std::shared_ptr<DnsCache> dns_cache);
+
+	/// <summary>
+	/// Sets the delays between reconnections once the server connection dropped
+	/// </summary>
+	/// <remarks>
+	/// The delay doubles with each failed attempt, up to the maximum, and is jittered
+	/// so that a fleet of servers doesn't reconnect at once after a signaling outage
+	/// </remarks>
+	/// <param name="initial_ms">the delay before the first attempt</param>
+	/// <param name="max_ms">the maximum delay between attempts</param>
+	void SetReconnectDelays(int initial_ms, int max_ms);
+
 protected:
 	void DoConnect();
 
@@ -170,7 +188,13 @@ protected:
 
 	void OnHeartbeatGetClose(rtc::AsyncSocket* socket, int err);
 
-	void OnResolveResult(rtc::AsyncResolverInterface* resolver);
+	// Connects to the first address of the server in the dns cache, resolving it if needed
+	void ResolveAndConnect();
+
+	void OnResolveResult(int error, const std::vector<rtc::IPAddress>& addresses);
+
+	// Closes the sockets and signs back in after the backoff delay, keeping our id to resume with
+	void ScheduleReconnect();
 
 	std::string PrepareRequest(const std::string& method, const std::string& fragment, std::map<std::string, std::string> headers);
 
@@ -178,7 +202,9 @@ protected:
 	std::vector<PeerConnectionClientObserver*> callbacks_;
 	bool server_address_ssl_;
 	rtc::SocketAddress server_address_;
-	rtc::AsyncResolver* resolver_;
+	bool server_address_named_;
+	std::shared_ptr<DnsCache> dns_cache_;
+	int dns_lookup_id_;
 	std::shared_ptr<rtc::Thread> signaling_thread_;
 	std::unique_ptr<SslCapableSocket> control_socket_;
 	std::unique_ptr<SslCapableSocket> capacity_socket_;
@@ -194,6 +220,12 @@ protected:
 	State state_;
 	int my_id_;
 	int heartbeat_tick_ms_;
+	int resume_id_;
+	std::string resume_token_;
+	int reconnect_attempts_;
+	int hanging_get_failures_;
+	int reconnect_delay_ms_;
+	int max_reconnect_delay_ms_;
 
 	struct ScheduledPeerMessage
 	{
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "metrics_registry.h"
+
+/// <summary>
+/// Represents the cumulative statistics of the stream of a peer, as polled from its peer connection
+/// </summary>
+struct StreamStatsSample
+{
+	int64_t bytes_sent;
+	int64_t packets_sent;
+	int64_t packets_lost;
+	int64_t frames_encoded;
+
+	// Frames not rendered for the peer while it was idle
+	int64_t frames_skipped;
+
+	double avg_encode_ms;
+	double rtt_ms;
+};
+
+/// <summary>
+/// Exports the streaming statistics of a peer, labelled with its id
+/// </summary>
+/// <remarks>
+/// The frames are counted from the capturer thread, while the samples come from the thread polling
+/// the statistics. The rates are computed between two samples, on the clock of the registry
+/// </remarks>
+class StreamMetrics
+{
+public:
+	StreamMetrics(MetricsRegistry* registry, int peer_id);
+
+	/// <summary>
+	/// Removes the series of the peer
+	/// </summary>
+	~StreamMetrics();
+
+	/// <summary>
+	/// Counts a frame handed to the encoder of the peer
+	/// </summary>
+	/// <param name="submit_us">the time taken to hand it over</param>
+	void OnFrameSubmitted(int64_t submit_us);
+
+	/// <summary>
+	/// Updates the metrics from the statistics polled at the current time
+	/// </summary>
+	void OnStats(const StreamStatsSample& sample);
+
+	/// <summary>
+	/// Gets the registry the metrics are in
+	/// </summary>
+	MetricsRegistry* registry() const;
+
+private:
+	MetricsRegistry* registry_;
+	std::string peer_id_;
+
+	std::shared_ptr<Counter> frames_submitted_;
+	std::shared_ptr<Counter> frames_encoded_;
+	std::shared_ptr<Counter> frames_dropped_;
+	std::shared_ptr<Counter> frames_skipped_;
+	std::shared_ptr<Counter> bytes_sent_;
+	std::shared_ptr<Counter> packets_sent_;
+	std::shared_ptr<Counter> packets_lost_;
+	std::shared_ptr<Histogram> submit_seconds_;
+	std::shared_ptr<Gauge> fps_;
+	std::shared_ptr<Gauge> bitrate_;
+	std::shared_ptr<Gauge> encode_seconds_;
+	std::shared_ptr<Gauge> rtt_seconds_;
+	std::shared_ptr<Gauge> packet_loss_;
+
+	bool has_sample_;
+	int64_t last_sample_us_;
+	StreamStatsSample last_sample_;
+
+	// Frames submitted as of the last sample, which were encoded by now unless dropped
+	int64_t last_submitted_;
+	int64_t dropped_;
+};
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "webrtc/rtc_base/logging.h"
+
+// Severities below this one are compiled out of the SLOG statements
+#ifndef SLOG_MIN_SEVERITY
+#ifdef _DEBUG
+#define SLOG_MIN_SEVERITY rtc::LS_VERBOSE
+#else
+#define SLOG_MIN_SEVERITY rtc::LS_INFO
+#endif
+#endif
+
+// Logs a structured event, which is formatted and written on the background thread
+// of StructuredLog. The event and the field keys must be string literals.
+//
+// SLOG(INFO, "candidate_received").Field("peer_id", id).Field("length", message.length());
+#define SLOG(sev, event)																	\
+	!(rtc::sev >= SLOG_MIN_SEVERITY && StructuredLog::IsEnabled(rtc::sev)) ? (void)0 :	\
+		StructuredLogVoidify() & StructuredLogStatement(rtc::sev, event, __FILE__, __LINE__)
+
+// Logs a structured event at most per_second times a second from this statement,
+// the next event logged tells how many were suppressed meanwhile
+#define SLOG_RATE_LIMITED(sev, event, per_second)											\
+	!(rtc::sev >= SLOG_MIN_SEVERITY && StructuredLog::IsEnabled(rtc::sev)) ? (void)0 :	\
+		StructuredLogVoidify() & StructuredLogStatement(rtc::sev, event, __FILE__, __LINE__,	\
+			[]() -> LogRateLimiter& { static LogRateLimiter limiter(per_second); return limiter; }())
+
+/// <summary>
+/// Represents a field of a structured log record
+/// </summary>
+struct LogField
+{
+	enum Type : uint8_t
+	{
+		kInteger,
+		kDouble,
+		kString,
+	};
+
+	const char* key;
+	Type type;
+
+	union
+	{
+		int64_t integer;
+		double real;
+		struct
+		{
+			uint16_t offset;
+			uint16_t length;
+			bool truncated;
+		} text;
+	};
+};
+
+/// <summary>
+/// Represents a structured log record, copied as is through the ring of StructuredLog
+/// </summary>
+/// <remarks>
+/// The string values are stored in a buffer of the record, and truncated once it's full
+/// </remarks>
+struct LogRecord
+{
+	static const int kMaxFields = 8;
+	static const size_t kMaxText = 384;
+
+	rtc::LoggingSeverity severity;
+	const char* event;
+	const char* file;
+	int line;
+	uint32_t suppressed;
+	int field_count;
+	LogField fields[kMaxFields];
+	size_t text_length;
+	char text[kMaxText];
+};
+
+/// <summary>
+/// Represents a formatted log line, as given to the sinks
+/// </summary>
+struct StructuredLogLine
+{
+	rtc::LoggingSeverity severity;
+	const char* file;
+	int line;
+	std::string text;
+};
+
+/// <summary>
+/// Base class that represents a destination of the formatted log lines
+/// </summary>
+class StructuredLogSink
+{
+public:
+	virtual ~StructuredLogSink() {}
+
+	/// <summary>
+	/// Receives the lines formatted since the last batch, on the background thread
+	/// </summary>
+	virtual void OnLogBatch(const std::vector<StructuredLogLine>& lines) = 0;
+};
+
+/// <summary>
+/// Limits how many records a log statement writes a second
+/// </summary>
+class LogRateLimiter
+{
+public:
+	LogRateLimiter(int per_second);
+
+	/// <summary>
+	/// Whether a record may be written now, counting the ones which may not
+	/// </summary>
+	/// <param name="suppressed">the records suppressed since the last one written</param>
+	bool Allow(uint32_t* suppressed);
+
+private:
+	const int per_second_;
+	std::atomic<int64_t> window_start_ms_;
+	std::atomic<int> count_;
+	std::atomic<uint32_t> suppressed_;
+};
+
+/// <summary>
+/// Bounded lock free queue of log records, for many producers and a single consumer
+/// </summary>
+class LogRing
+{
+public:
+	/// <summary>
+	/// Creates a ring, of a capacity rounded up to a power of two
+	/// </summary>
+	LogRing(size_t capacity);
+
+	/// <summary>
+	/// Copies the record into the ring, unless it's full
+	/// </summary>
+	bool TryPush(const LogRecord& record);
+
+	/// <summary>
+	/// Copies the oldest record out of the ring, from the consumer thread only
+	/// </summary>
+	bool TryPop(LogRecord* record);
+
+	/// <summary>
+	/// Gets the number of records pushed so far
+	/// </summary>
+	uint64_t pushed() const;
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		LogRecord record;
+	};
+
+	std::unique_ptr<Cell[]> cells_;
+	size_t mask_;
+	std::atomic<size_t> enqueue_pos_;
+	size_t dequeue_pos_;
+	std::atomic<uint64_t> pushed_;
+};
+
+/// <summary>
+/// Process wide structured log, written by a background thread
+/// </summary>
+/// <remarks>
+/// Logging threads only copy their record into a lock free ring, and records are dropped
+/// rather than waited for once it's full. The background thread drains the ring every few
+/// milliseconds, formats the records as "event key=value ..." lines, forwards them to the
+/// webrtc log and hands them in batches to the sinks.
+/// </remarks>
+class StructuredLog
+{
+public:
+	static StructuredLog& Instance();
+
+	/// <summary>
+	/// Whether records of the severity are written
+	/// </summary>
+	static bool IsEnabled(rtc::LoggingSeverity severity);
+
+	/// <summary>
+	/// Sets the lowest severity written, above the one compiled in
+	/// </summary>
+	static void SetMinSeverity(rtc::LoggingSeverity severity);
+
+	/// <summary>
+	/// Creates a log, whose thread starts with the first record
+	/// </summary>
+	StructuredLog(size_t capacity = 1024, bool forward_to_rtc = true);
+
+	~StructuredLog();
+
+	/// <summary>
+	/// Queues the record for the background thread, without blocking
+	/// </summary>
+	void Submit(const LogRecord& record);
+
+	void AddSink(std::shared_ptr<StructuredLogSink> sink);
+
+	void RemoveSink(std::shared_ptr<StructuredLogSink> sink);
+
+	/// <summary>
+	/// Waits until the records submitted so far are written
+	/// </summary>
+	void Flush();
+
+	/// <summary>
+	/// Writes the records left and stops the background thread, e.g. before unloading the module
+	/// </summary>
+	void Shutdown();
+
+	/// <summary>
+	/// Gets the number of records dropped while the ring was full
+	/// </summary>
+	uint64_t dropped() const;
+
+	/// <summary>
+	/// Formats the record as a "event key=value ..." line
+	/// </summary>
+	static std::string Format(const LogRecord& record);
+
+private:
+	void EnsureStarted();
+	void Run();
+	void Drain();
+
+	static std::atomic<int> min_severity_;
+
+	LogRing ring_;
+	const bool forward_to_rtc_;
+	std::atomic<uint64_t> dropped_;
+	uint64_t reported_dropped_;
+
+	std::mutex sinks_mutex_;
+	std::vector<std::shared_ptr<StructuredLogSink>> sinks_;
+
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable drained_;
+	std::atomic<bool> started_;
+	bool running_;
+	bool flush_requested_;
+	uint64_t written_;
+	std::thread thread_;
+};
+
+/// <summary>
+/// Builds a log record in a statement, submitting it at the end of the statement
+/// </summary>
+class StructuredLogStatement
+{
+public:
+	StructuredLogStatement(rtc::LoggingSeverity severity, const char* event, const char* file, int line);
+
+	StructuredLogStatement(rtc::LoggingSeverity severity, const char* event, const char* file, int line,
+		LogRateLimiter& limiter);
+
+	~StructuredLogStatement();
+
+	template <typename T>
+	typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, StructuredLogStatement&>::type
+		Field(const char* key, T value)
+	{
+		return AddInteger(key, static_cast<int64_t>(value));
+	}
+
+	StructuredLogStatement& Field(const char* key, double value);
+
+	StructuredLogStatement& Field(const char* key, const char* value);
+
+	StructuredLogStatement& Field(const char* key, const std::string& value);
+
+private:
+	StructuredLogStatement(const StructuredLogStatement&) = delete;
+	StructuredLogStatement& operator=(const StructuredLogStatement&) = delete;
+
+	LogField* AddField(const char* key, LogField::Type type);
+	StructuredLogStatement& AddInteger(const char* key, int64_t value);
+	StructuredLogStatement& AddString(const char* key, const char* value, size_t length);
+
+	bool allowed_;
+	LogRecord record_;
+};
+
+// Lets the SLOG statements be expressions of the ?: operator, as LOG does
+class StructuredLogVoidify
+{
+public:
+	void operator&(const StructuredLogStatement&) {}
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+
+#include "webrtc/rtc_base/sigslot.h"
+#include "webrtc/rtc_base/messagehandler.h"
+#include "webrtc/rtc_base/thread.h"
+
+#include "authentication_provider.h"
+
+// Caches the tokens of an authentication provider, so that one provider can be
+// shared by the signaling client and the turn credential provider. Tokens are
+// kept until their expiry, optionally persisted to a file encrypted for the
+// current user, and renewed in the background after part of their lifetime, unless
+// the provider is interactive, whose tokens are only acquired once requested.
+// Authenticate answers synchronously while a valid token is cached, and requests
+// made while a token is acquired share its result.
+class TokenManager : public AuthenticationProvider,
+	public sigslot::has_slots<>,
+	public rtc::MessageHandler
+{
+public:
+	// The provider must outlive the token manager
+	TokenManager(AuthenticationProvider* provider, double renewal_ratio = 0.8);
+
+	~TokenManager();
+
+	// Persists the tokens to the file, and takes the token it holds if still valid
+	bool SetCacheFile(const std::string& path, bool encrypt);
+
+	// Gets the cached token, with a false successFlag if none is valid
+	AuthenticationProviderResult GetCachedToken() const;
+
+	// implement AuthenticationProvider
+	virtual bool Authenticate() override;
+	virtual bool IsInteractive() const override;
+
+	// Forgets the cached token and removes the cache file, e.g. once rejected by a server
+	virtual void Invalidate() override;
+
+	// implement MessageHandler
+	virtual void OnMessage(rtc::Message* msg) override;
+
+protected:
+	void OnAuthenticationComplete(const AuthenticationProviderResult& result);
+
+	void ScheduleRenewal(int64_t delay_ms);
+	bool HasValidToken() const;
+
+	bool LoadCacheFile();
+	bool SaveCacheFile() const;
+
+	AuthenticationProvider* provider_;
+	double renewal_ratio_;
+	std::shared_ptr<rtc::Thread> signaling_thread_;
+
+	AuthenticationProviderResult token_;
+
+	// wall clock expiry of the token, in milliseconds since the epoch
+	int64_t expires_at_ms_;
+
+	std::string cache_path_;
+	bool encrypt_cache_;
+
+	// whether a token is being acquired, and whether a requester waits on it
+	bool acquiring_;
+	bool requested_;
+};
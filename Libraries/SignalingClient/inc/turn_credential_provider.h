@@ -2,10 +2,12 @@
 #define WEBRTC_EXTERNAL_JSON
 
 #include "webrtc/rtc_base/sigslot.h"
+#include "webrtc/rtc_base/messagehandler.h"
 #include "webrtc/rtc_base/nethelpers.h"
 #include "webrtc/rtc_base/json.h"
 
 #include "authentication_provider.h"
+#include "dns_cache.h"
 #include "ssl_capable_socket.h"
 
 // forward decl
@@ -17,12 +19,20 @@ public:
 	bool successFlag;
 	std::string username;
 	std::string password;
+
+	// lifetime of the credentials in seconds, as given by the credential service
+	int ttl;
 private:
 	friend TurnCredentialProvider;
-	TurnCredentials() {};
+	TurnCredentials() : successFlag(false), ttl(0) {};
 };
 
-class TurnCredentialProvider : public sigslot::has_slots<>
+// Retrieves turn credentials from a credential service, and caches them for
+// the ttl the service gives. Cached credentials are refreshed in the background
+// ahead of their expiry, so requests are answered from the cache in steady state.
+// Requests made while a retrieval is in flight share its result.
+class TurnCredentialProvider : public sigslot::has_slots<>,
+	public rtc::MessageHandler
 {
 public:
 	enum State
@@ -30,7 +40,8 @@ public:
 		NOT_ACTIVE = 0,
 		RESOLVING,
 		AUTHENTICATING,
-		ACTIVE
+		ACTIVE,
+		CONNECTING
 	};
 
 	TurnCredentialProvider(const std::string& uri);
@@ -38,6 +49,7 @@ public:
 
 	~TurnCredentialProvider();
 
+	// Emitted once a request completes, and whenever the cached credentials are refreshed
 	sigslot::signal1<const TurnCredentials&> SignalCredentialsRetrieved;
 	
 	struct CredentialsRetrievedCallback : public sigslot::has_slots<>
@@ -56,25 +68,57 @@ public:
 
 	void SetAuthenticationProvider(AuthenticationProvider* authProvider);
 
+	// Sets the cache used to resolve the credential service, instead of the process wide one
+	void SetDnsCache(std::shared_ptr<DnsCache> dns_cache);
+
+	// Emits the cached credentials right away if they are still valid, otherwise
+	// retrieves them, or joins the retrieval in flight
 	bool RequestCredentials();
+
+	// Gets the cached credentials, with a false successFlag if none are valid
+	TurnCredentials GetCachedCredentials() const;
 	
 	const State& state() const;
 
 	void OnAuthenticationComplete(const AuthenticationProviderResult& result);
 
+	// implements the MessageHandler interface
+	void OnMessage(rtc::Message* msg) override;
+
 protected:
 	void SocketOpen(rtc::AsyncSocket* socket);
 	void SocketRead(rtc::AsyncSocket* socket);
 	void SocketClose(rtc::AsyncSocket* socket, int err);
-	void AddressResolve(rtc::AsyncResolverInterface* resolver);
+	void AddressResolve(int error, const std::vector<rtc::IPAddress>& addresses);
+
+	bool StartRetrieval();
+	bool ConnectSocket();
+
+	// parses the response once complete, returning false while more data is expected
+	bool TryCompleteResponse(bool closed);
+
+	void CompleteRetrieval(const TurnCredentials& credentials);
+	void ScheduleRefresh(int delay_ms);
+	bool HasValidCredentials() const;
 
 	std::shared_ptr<SslCapableSocket::Factory> async_socket_factory_;
 	std::shared_ptr<rtc::Thread> signaling_thread_;
 	rtc::SocketAddress host_;
+	bool host_named_;
 	std::string fragment_;
 	std::string auth_token_;
 	State state_;
 	std::unique_ptr<SslCapableSocket> socket_;
-	std::unique_ptr<AsyncResolver> resolver_;
+	std::shared_ptr<DnsCache> dns_cache_;
+	int dns_lookup_id_;
 	AuthenticationProvider* auth_provider_;
+
+	// the response read so far, received in place
+	std::string response_;
+
+	TurnCredentials cached_credentials_;
+	int64_t expires_at_ms_;
+
+	// whether a requester waits on the retrieval in flight, rather than only a refresh
+	bool requested_;
 };
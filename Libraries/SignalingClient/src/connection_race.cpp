@@ -0,0 +1,184 @@
+#include "connection_race.h"
+#include "webrtc/rtc_base/logging.h"
+
+namespace
+{
+	// The message id we use when scheduling the next attempt of the race
+	const uint32_t kAttemptScheduleId = 1528U;
+}
+
+ConnectionRace::ConnectionRace(const Allocator& allocator, int attempt_delay_ms) :
+	allocator_(allocator),
+	attempt_delay_ms_(attempt_delay_ms),
+	next_address_(0),
+	racing_(false)
+{
+	thread_ = rtc::Thread::Current();
+	thread_ = thread_ == nullptr ? rtc::ThreadManager::Instance()->WrapCurrentThread() : thread_;
+}
+
+ConnectionRace::~ConnectionRace()
+{
+	Cancel();
+}
+
+void ConnectionRace::Start(const std::string& hostname, int port, const std::vector<rtc::IPAddress>& addresses)
+{
+	Cancel();
+
+	for (const auto& ip : addresses)
+	{
+		// keep the host name, for the server name indication of ssl
+		rtc::SocketAddress address(hostname, port);
+		address.SetResolvedIP(ip);
+		addresses_.push_back(address);
+	}
+
+	racing_ = true;
+	StartNextAttempt();
+}
+
+void ConnectionRace::Cancel()
+{
+	thread_->Clear(this, kAttemptScheduleId);
+	racing_ = false;
+
+	for (auto& attempt : attempts_)
+	{
+		attempt->socket->SignalConnectEvent.disconnect(this);
+		attempt->socket->SignalCloseEvent.disconnect(this);
+		attempt->socket->Close();
+	}
+
+	attempts_.clear();
+	addresses_.clear();
+	failed_addresses_.clear();
+	next_address_ = 0;
+	winner_.reset();
+	winner_address_.Clear();
+}
+
+std::unique_ptr<SslCapableSocket> ConnectionRace::TakeSocket()
+{
+	return std::move(winner_);
+}
+
+const rtc::SocketAddress& ConnectionRace::winner_address() const
+{
+	return winner_address_;
+}
+
+const std::vector<rtc::SocketAddress>& ConnectionRace::failed_addresses() const
+{
+	return failed_addresses_;
+}
+
+void ConnectionRace::OnMessage(rtc::Message* msg)
+{
+	// indicates the delay of the last attempt elapsed, or that it failed
+	if (msg->message_id == kAttemptScheduleId && racing_)
+	{
+		StartNextAttempt();
+	}
+}
+
+void ConnectionRace::StartNextAttempt()
+{
+	if (next_address_ >= addresses_.size())
+	{
+		// the race is lost once every attempt failed
+		for (const auto& attempt : attempts_)
+		{
+			if (!attempt->failed)
+			{
+				return;
+			}
+		}
+
+		Finish(SOCKET_ERROR);
+		return;
+	}
+
+	std::unique_ptr<Attempt> attempt(new Attempt());
+	attempt->address = addresses_[next_address_++];
+	attempt->socket = allocator_(attempt->address);
+	attempt->failed = false;
+
+	attempt->socket->SignalConnectEvent.connect(this, &ConnectionRace::OnAttemptConnect);
+	attempt->socket->SignalCloseEvent.connect(this, &ConnectionRace::OnAttemptClose);
+
+	auto socket = attempt->socket.get();
+	attempts_.push_back(std::move(attempt));
+
+	if (socket->Connect(attempts_.back()->address) == SOCKET_ERROR && socket->GetState() == rtc::Socket::CS_CLOSED)
+	{
+		// go on with the next address right away, without recursing
+		attempts_.back()->failed = true;
+		failed_addresses_.push_back(attempts_.back()->address);
+		thread_->Post(RTC_FROM_HERE, this, kAttemptScheduleId);
+		return;
+	}
+
+	thread_->PostDelayed(RTC_FROM_HERE, attempt_delay_ms_, this, kAttemptScheduleId);
+}
+
+void ConnectionRace::Finish(int error)
+{
+	thread_->Clear(this, kAttemptScheduleId);
+	racing_ = false;
+
+	SignalDone.emit(this, error);
+}
+
+void ConnectionRace::OnAttemptConnect(rtc::AsyncSocket* socket)
+{
+	if (!racing_)
+	{
+		return;
+	}
+
+	for (auto& attempt : attempts_)
+	{
+		if (attempt->socket.get() == socket)
+		{
+			attempt->socket->SignalConnectEvent.disconnect(this);
+			attempt->socket->SignalCloseEvent.disconnect(this);
+			winner_ = std::move(attempt->socket);
+			winner_address_ = attempt->address;
+		}
+		else if (attempt->socket)
+		{
+			attempt->socket->SignalConnectEvent.disconnect(this);
+			attempt->socket->SignalCloseEvent.disconnect(this);
+			attempt->socket->Close();
+		}
+	}
+
+	// only the winner signals, the losers can go
+	attempts_.clear();
+
+	LOG(LS_INFO) << "Connected to " << winner_address_.ToString();
+	Finish(0);
+}
+
+void ConnectionRace::OnAttemptClose(rtc::AsyncSocket* socket, int err)
+{
+	if (!racing_)
+	{
+		return;
+	}
+
+	for (auto& attempt : attempts_)
+	{
+		if (attempt->socket.get() == socket && !attempt->failed)
+		{
+			LOG(LS_WARNING) << "Unable to connect to " << attempt->address.ToString() << ": " << err;
+			attempt->failed = true;
+			failed_addresses_.push_back(attempt->address);
+		}
+	}
+
+	// a failed attempt doesn't wait for the delay
+	thread_->Clear(this, kAttemptScheduleId);
+	thread_->Post(RTC_FROM_HERE, this, kAttemptScheduleId);
+}
@@ -0,0 +1,279 @@
+#include <algorithm>
+
+#include "dns_cache.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/messagequeue.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+namespace
+{
+	// The message id we use when delivering a result to the thread of its waiter
+	const uint32_t kDeliverMessageId = 1527U;
+
+	// The error of lookups which succeeded without any address
+	const int kNoAddressError = -1;
+
+	typedef rtc::TypedMessageData<std::function<void()>> DeliverMessageData;
+}
+
+RtcHostResolver::~RtcHostResolver()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto& pending : pending_)
+	{
+		pending.first->SignalDone.disconnect(this);
+		pending.first->Destroy(false);
+	}
+}
+
+void RtcHostResolver::Resolve(const std::string& hostname, const Callback& callback)
+{
+	auto resolver = new rtc::AsyncResolver();
+	resolver->SignalDone.connect(this, &RtcHostResolver::OnResolved);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		pending_[resolver] = callback;
+	}
+
+	resolver->Start(rtc::SocketAddress(hostname, 0));
+}
+
+void RtcHostResolver::OnResolved(rtc::AsyncResolverInterface* resolver)
+{
+	Callback callback;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto pending = pending_.find(resolver);
+		if (pending == pending_.end())
+		{
+			return;
+		}
+
+		callback = pending->second;
+		pending_.erase(pending);
+	}
+
+	// the system resolver doesn't give the ttl
+	HostResolverResult result;
+	result.error = resolver->GetError();
+	if (result.error == 0)
+	{
+		result.addresses = static_cast<rtc::AsyncResolver*>(resolver)->addresses();
+	}
+
+	resolver->Destroy(false);
+
+	callback(result);
+}
+
+std::shared_ptr<DnsCache> DnsCache::Default()
+{
+	static std::shared_ptr<DnsCache> instance = std::make_shared<DnsCache>(std::make_shared<RtcHostResolver>());
+	return instance;
+}
+
+DnsCache::DnsCache(std::shared_ptr<HostResolver> resolver, int default_ttl, int negative_ttl) :
+	resolver_(resolver),
+	default_ttl_(default_ttl),
+	negative_ttl_(negative_ttl),
+	next_id_(0)
+{
+}
+
+DnsCache::~DnsCache()
+{
+}
+
+int DnsCache::Resolve(const std::string& hostname, const Callback& callback)
+{
+	auto thread = rtc::Thread::Current();
+	thread = thread == nullptr ? rtc::ThreadManager::Instance()->WrapCurrentThread() : thread;
+
+	Waiter waiter;
+	waiter.thread = thread;
+	waiter.callback = callback;
+
+	bool cached = false;
+	bool lookup = false;
+	int error = 0;
+	std::vector<rtc::IPAddress> addresses;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		waiter.id = ++next_id_;
+		active_.insert(waiter.id);
+
+		auto& entry = entries_[hostname];
+		if (!entry.resolving && rtc::TimeMillis() < entry.expires_at_ms)
+		{
+			cached = true;
+			error = entry.error;
+			addresses = entry.addresses;
+		}
+		else
+		{
+			// share the lookup in flight, if any
+			entry.waiters.push_back(waiter);
+			lookup = !entry.resolving;
+			entry.resolving = true;
+		}
+	}
+
+	if (cached)
+	{
+		Deliver(waiter, error, addresses);
+	}
+	else if (lookup)
+	{
+		std::weak_ptr<DnsCache> weak_cache = shared_from_this();
+		resolver_->Resolve(hostname, [weak_cache, hostname](const HostResolverResult& result)
+		{
+			if (auto cache = weak_cache.lock())
+			{
+				cache->OnResolved(hostname, result);
+			}
+		});
+	}
+
+	return waiter.id;
+}
+
+void DnsCache::Cancel(int id)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	active_.erase(id);
+}
+
+bool DnsCache::Lookup(const std::string& hostname, std::vector<rtc::IPAddress>* addresses) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto entry = entries_.find(hostname);
+	if (entry == entries_.end() || entry->second.error != 0 ||
+		rtc::TimeMillis() >= entry->second.expires_at_ms)
+	{
+		return false;
+	}
+
+	*addresses = entry->second.addresses;
+	return !addresses->empty();
+}
+
+void DnsCache::ReportUnreachable(const std::string& hostname, const rtc::IPAddress& address)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto entry = entries_.find(hostname);
+	if (entry == entries_.end())
+	{
+		return;
+	}
+
+	auto& addresses = entry->second.addresses;
+	auto unreachable = std::find(addresses.begin(), addresses.end(), address);
+	if (unreachable != addresses.end())
+	{
+		std::rotate(unreachable, unreachable + 1, addresses.end());
+	}
+}
+
+void DnsCache::Invalidate(const std::string& hostname)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto entry = entries_.find(hostname);
+	if (entry != entries_.end())
+	{
+		entry->second.expires_at_ms = 0;
+	}
+}
+
+std::vector<rtc::IPAddress> DnsCache::OrderForConnection(const std::vector<rtc::IPAddress>& addresses)
+{
+	if (addresses.empty())
+	{
+		return addresses;
+	}
+
+	// the first address keeps its place, it's the one the resolver and the
+	// unreachable reports prefer
+	int first_family = addresses.front().family();
+	std::vector<rtc::IPAddress> first;
+	std::vector<rtc::IPAddress> second;
+	for (const auto& address : addresses)
+	{
+		(address.family() == first_family ? first : second).push_back(address);
+	}
+
+	std::vector<rtc::IPAddress> ordered;
+	for (size_t i = 0; i < (std::max)(first.size(), second.size()); i++)
+	{
+		if (i < first.size())
+		{
+			ordered.push_back(first[i]);
+		}
+
+		if (i < second.size())
+		{
+			ordered.push_back(second[i]);
+		}
+	}
+
+	return ordered;
+}
+
+void DnsCache::OnMessage(rtc::Message* msg)
+{
+	if (msg->message_id == kDeliverMessageId)
+	{
+		std::unique_ptr<DeliverMessageData> data(static_cast<DeliverMessageData*>(msg->pdata));
+		data->data()();
+	}
+}
+
+void DnsCache::OnResolved(const std::string& hostname, const HostResolverResult& result)
+{
+	std::vector<Waiter> waiters;
+	int error;
+	std::vector<rtc::IPAddress> addresses;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto& entry = entries_[hostname];
+		entry.resolving = false;
+		entry.error = result.error != 0 ? result.error : (result.addresses.empty() ? kNoAddressError : 0);
+		entry.addresses = result.addresses;
+
+		// failures are kept for a shorter time
+		int ttl = entry.error != 0 ? negative_ttl_ : (result.ttl > 0 ? result.ttl : default_ttl_);
+		entry.expires_at_ms = rtc::TimeMillis() + ttl * static_cast<int64_t>(1000);
+
+		waiters.swap(entry.waiters);
+		error = entry.error;
+		addresses = entry.addresses;
+	}
+
+	if (error != 0)
+	{
+		LOG(LS_WARNING) << "Unable to resolve " << hostname << ": " << error;
+	}
+
+	for (const auto& waiter : waiters)
+	{
+		Deliver(waiter, error, addresses);
+	}
+}
+
+void DnsCache::Deliver(const Waiter& waiter, int error, const std::vector<rtc::IPAddress>& addresses)
+{
+	std::function<void()> delivery = [this, waiter, error, addresses]()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (active_.erase(waiter.id) == 0)
+			{
+				return;
+			}
+		}
+
+		waiter.callback(error, addresses);
+	};
+
+	waiter.thread->Post(RTC_FROM_HERE, this, kDeliverMessageId, new DeliverMessageData(delivery));
+}
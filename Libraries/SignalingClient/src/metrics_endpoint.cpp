@@ -0,0 +1,220 @@
+#include "metrics_endpoint.h"
+#include "webrtc/rtc_base/logging.h"
+
+namespace
+{
+	// Requests larger than this are answered with an error
+	const size_t kMaxRequestSize = 8192;
+
+	std::string BuildResponse(const char* status, const char* content_type, const std::string& body, bool head)
+	{
+		return std::string("HTTP/1.1 ") + status + "\r\n" +
+			"Content-Type: " + content_type + "\r\n" +
+			"Content-Length: " + std::to_string(body.length()) + "\r\n" +
+			"Connection: close\r\n\r\n" +
+			(head ? "" : body);
+	}
+}
+
+MetricsEndpoint::MetricsEndpoint(MetricsRegistry* registry) :
+	registry_(registry)
+{
+}
+
+MetricsEndpoint::~MetricsEndpoint()
+{
+	Stop();
+}
+
+bool MetricsEndpoint::Start(const rtc::SocketAddress& address)
+{
+	Stop();
+
+	thread_ = rtc::Thread::CreateWithSocketServer();
+	thread_->SetName("metrics_endpoint", this);
+	thread_->Start();
+
+	bool listening = thread_->Invoke<bool>(RTC_FROM_HERE, [&]()
+	{
+		listen_socket_.reset(thread_->socketserver()->CreateAsyncSocket(address.family(), SOCK_STREAM));
+		if (!listen_socket_ ||
+			listen_socket_->Bind(address) == SOCKET_ERROR ||
+			listen_socket_->Listen(16) == SOCKET_ERROR)
+		{
+			LOG(LS_ERROR) << "Unable to listen for metrics scrapes on " << address.ToString();
+			listen_socket_.reset();
+			return false;
+		}
+
+		listen_socket_->SignalReadEvent.connect(this, &MetricsEndpoint::OnAccept);
+		address_ = listen_socket_->GetLocalAddress();
+		return true;
+	});
+
+	if (!listening)
+	{
+		Stop();
+		return false;
+	}
+
+	LOG(LS_INFO) << "Serving metrics on " << address_.ToString();
+	return true;
+}
+
+void MetricsEndpoint::Stop()
+{
+	if (!thread_)
+	{
+		return;
+	}
+
+	thread_->Invoke<void>(RTC_FROM_HERE, [&]()
+	{
+		connections_.clear();
+		listen_socket_.reset();
+	});
+
+	thread_->Stop();
+	thread_.reset();
+	address_.Clear();
+}
+
+rtc::SocketAddress MetricsEndpoint::address() const
+{
+	return address_;
+}
+
+void MetricsEndpoint::OnAccept(rtc::AsyncSocket* socket)
+{
+	auto accepted = socket->Accept(nullptr);
+	if (accepted == nullptr)
+	{
+		return;
+	}
+
+	accepted->SignalReadEvent.connect(this, &MetricsEndpoint::OnRead);
+	accepted->SignalWriteEvent.connect(this, &MetricsEndpoint::OnWrite);
+	accepted->SignalCloseEvent.connect(this, &MetricsEndpoint::OnClose);
+
+	auto& connection = connections_[accepted];
+	connection.socket.reset(accepted);
+	connection.sent = 0;
+}
+
+void MetricsEndpoint::OnRead(rtc::AsyncSocket* socket)
+{
+	auto it = connections_.find(socket);
+	if (it == connections_.end())
+	{
+		return;
+	}
+
+	auto& connection = it->second;
+
+	char buffer[1024];
+	int bytes;
+	while ((bytes = socket->Recv(buffer, sizeof(buffer), nullptr)) > 0)
+	{
+		connection.request.append(buffer, bytes);
+	}
+
+	// answers once, when the headers are complete
+	if (!connection.response.empty())
+	{
+		return;
+	}
+
+	if (connection.request.find("\r\n\r\n") != std::string::npos)
+	{
+		connection.response = Respond(connection.request);
+	}
+	else if (connection.request.length() > kMaxRequestSize)
+	{
+		connection.response = BuildResponse("431 Request Header Fields Too Large", "text/plain", "", false);
+	}
+	else
+	{
+		return;
+	}
+
+	OnWrite(socket);
+}
+
+void MetricsEndpoint::OnWrite(rtc::AsyncSocket* socket)
+{
+	auto it = connections_.find(socket);
+	if (it == connections_.end() || it->second.response.empty())
+	{
+		return;
+	}
+
+	// the rest of a large scrape goes with the next write event
+	auto& connection = it->second;
+	while (connection.sent < connection.response.length())
+	{
+		int bytes = socket->Send(connection.response.data() + connection.sent,
+			connection.response.length() - connection.sent);
+
+		if (bytes <= 0)
+		{
+			if (!socket->IsBlocking())
+			{
+				Close(socket);
+			}
+
+			return;
+		}
+
+		connection.sent += bytes;
+	}
+
+	Close(socket);
+}
+
+void MetricsEndpoint::OnClose(rtc::AsyncSocket* socket, int err)
+{
+	Close(socket);
+}
+
+std::string MetricsEndpoint::Respond(const std::string& request) const
+{
+	// e.g. GET /metrics?name[]=x HTTP/1.1
+	size_t method_end = request.find(' ');
+	size_t path_end = method_end != std::string::npos ? request.find_first_of(" ?", method_end + 1) : std::string::npos;
+	if (path_end == std::string::npos)
+	{
+		return BuildResponse("400 Bad Request", "text/plain", "", false);
+	}
+
+	std::string method = request.substr(0, method_end);
+	std::string path = request.substr(method_end + 1, path_end - method_end - 1);
+	if (method != "GET" && method != "HEAD")
+	{
+		return BuildResponse("405 Method Not Allowed", "text/plain", "", false);
+	}
+
+	if (path != "/metrics")
+	{
+		return BuildResponse("404 Not Found", "text/plain", "", method == "HEAD");
+	}
+
+	return BuildResponse("200 OK", "text/plain; version=0.0.4", registry_->Scrape(), method == "HEAD");
+}
+
+void MetricsEndpoint::Close(rtc::AsyncSocket* socket)
+{
+	auto it = connections_.find(socket);
+	if (it == connections_.end())
+	{
+		return;
+	}
+
+	socket->SignalReadEvent.disconnect(this);
+	socket->SignalWriteEvent.disconnect(this);
+	socket->SignalCloseEvent.disconnect(this);
+	socket->Close();
+
+	// the socket may be signaling, it's deleted with the next message
+	thread_->Dispose(it->second.socket.release());
+	connections_.erase(it);
+}
@@ -0,0 +1,378 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+
+#include "metrics_registry.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+namespace
+{
+	const char* TypeName(int type)
+	{
+		static const char* names[] = { "counter", "gauge", "histogram" };
+		return names[type];
+	}
+
+	void AddDouble(std::atomic<double>* target, double value)
+	{
+		double current = target->load(std::memory_order_relaxed);
+		while (!target->compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	std::string FormatValue(double value)
+	{
+		if (std::isnan(value))
+		{
+			return "NaN";
+		}
+
+		if (std::isinf(value))
+		{
+			return value > 0 ? "+Inf" : "-Inf";
+		}
+
+		char number[32];
+		snprintf(number, sizeof(number), "%.10g", value);
+		return number;
+	}
+
+	void AppendEscaped(std::string* text, const std::string& value)
+	{
+		for (char c : value)
+		{
+			switch (c)
+			{
+			case '\\':
+				text->append("\\\\");
+				break;
+
+			case '"':
+				text->append("\\\"");
+				break;
+
+			case '\n':
+				text->append("\\n");
+				break;
+
+			default:
+				text->push_back(c);
+				break;
+			}
+		}
+	}
+
+	// renders {name="value",...}, with an extra label for the buckets of the histograms
+	std::string FormatLabels(const MetricLabels& labels, const char* extra_name = nullptr,
+		const std::string& extra_value = "")
+	{
+		if (labels.empty() && extra_name == nullptr)
+		{
+			return "";
+		}
+
+		std::string text("{");
+		for (const auto& label : labels)
+		{
+			text.append(label.first);
+			text.append("=\"");
+			AppendEscaped(&text, label.second);
+			text.append("\",");
+		}
+
+		if (extra_name != nullptr)
+		{
+			text.append(extra_name);
+			text.append("=\"");
+			AppendEscaped(&text, extra_value);
+			text.append("\",");
+		}
+
+		text.back() = '}';
+		return text;
+	}
+}
+
+int MetricShards::Current()
+{
+	static std::atomic<int> next_shard(0);
+	thread_local int shard = next_shard.fetch_add(1, std::memory_order_relaxed) % kCount;
+	return shard;
+}
+
+Counter::Counter()
+{
+	for (auto& shard : shards_)
+	{
+		shard.value.store(0, std::memory_order_relaxed);
+	}
+}
+
+void Counter::Increment(int64_t value)
+{
+	shards_[MetricShards::Current()].value.fetch_add(value, std::memory_order_relaxed);
+}
+
+int64_t Counter::Value() const
+{
+	int64_t value = 0;
+	for (const auto& shard : shards_)
+	{
+		value += shard.value.load(std::memory_order_relaxed);
+	}
+
+	return value;
+}
+
+Gauge::Gauge() :
+	value_(0)
+{
+}
+
+void Gauge::Set(double value)
+{
+	value_.store(value, std::memory_order_relaxed);
+}
+
+void Gauge::Add(double value)
+{
+	AddDouble(&value_, value);
+}
+
+double Gauge::Value() const
+{
+	return value_.load(std::memory_order_relaxed);
+}
+
+Histogram::Histogram(const std::vector<double>& bounds) :
+	bounds_(bounds)
+{
+	for (auto& shard : shards_)
+	{
+		// one more bucket for the values above the bounds
+		shard.buckets.reset(new std::atomic<uint64_t>[bounds_.size() + 1]);
+		for (size_t i = 0; i <= bounds_.size(); i++)
+		{
+			shard.buckets[i].store(0, std::memory_order_relaxed);
+		}
+
+		shard.count.store(0, std::memory_order_relaxed);
+		shard.sum.store(0, std::memory_order_relaxed);
+	}
+}
+
+void Histogram::Observe(double value)
+{
+	// a bucket holds the values up to its bound
+	size_t bucket = std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+
+	auto& shard = shards_[MetricShards::Current()];
+	shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	shard.count.fetch_add(1, std::memory_order_relaxed);
+	AddDouble(&shard.sum, value);
+}
+
+Histogram::Snapshot Histogram::GetSnapshot() const
+{
+	Snapshot snapshot;
+	snapshot.bounds = bounds_;
+	snapshot.cumulative_counts.assign(bounds_.size() + 1, 0);
+	snapshot.count = 0;
+	snapshot.sum = 0;
+
+	for (const auto& shard : shards_)
+	{
+		for (size_t i = 0; i <= bounds_.size(); i++)
+		{
+			snapshot.cumulative_counts[i] += shard.buckets[i].load(std::memory_order_relaxed);
+		}
+
+		snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+	}
+
+	for (size_t i = 1; i <= bounds_.size(); i++)
+	{
+		snapshot.cumulative_counts[i] += snapshot.cumulative_counts[i - 1];
+	}
+
+	// the count matches the buckets, even while observations are racing the snapshot
+	snapshot.count = snapshot.cumulative_counts.back();
+	return snapshot;
+}
+
+std::vector<double> Histogram::ExponentialBounds(double start, double factor, int count)
+{
+	std::vector<double> bounds;
+	double bound = start;
+	for (int i = 0; i < count; i++)
+	{
+		bounds.push_back(bound);
+		bound *= factor;
+	}
+
+	return bounds;
+}
+
+MetricsRegistry& MetricsRegistry::Instance()
+{
+	// never destroyed, the metrics may be updated while the module unloads
+	static MetricsRegistry* instance = new MetricsRegistry();
+	return *instance;
+}
+
+MetricsRegistry::MetricsRegistry(const Clock& clock) :
+	clock_(clock)
+{
+	if (!clock_)
+	{
+		clock_ = []() { return rtc::TimeMicros(); };
+	}
+}
+
+int64_t MetricsRegistry::NowUs() const
+{
+	return clock_();
+}
+
+std::shared_ptr<Counter> MetricsRegistry::GetCounter(const std::string& name, const std::string& help,
+	const MetricLabels& labels)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto series = FindOrAddSeries(name, help, MetricType::kCounter, std::vector<double>(), labels);
+	if (series == nullptr)
+	{
+		return std::make_shared<Counter>();
+	}
+
+	if (!series->counter)
+	{
+		series->counter = std::make_shared<Counter>();
+	}
+
+	return series->counter;
+}
+
+std::shared_ptr<Gauge> MetricsRegistry::GetGauge(const std::string& name, const std::string& help,
+	const MetricLabels& labels)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto series = FindOrAddSeries(name, help, MetricType::kGauge, std::vector<double>(), labels);
+	if (series == nullptr)
+	{
+		return std::make_shared<Gauge>();
+	}
+
+	if (!series->gauge)
+	{
+		series->gauge = std::make_shared<Gauge>();
+	}
+
+	return series->gauge;
+}
+
+std::shared_ptr<Histogram> MetricsRegistry::GetHistogram(const std::string& name, const std::string& help,
+	const std::vector<double>& bounds, const MetricLabels& labels)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto series = FindOrAddSeries(name, help, MetricType::kHistogram, bounds, labels);
+	if (series == nullptr)
+	{
+		return std::make_shared<Histogram>(bounds);
+	}
+
+	if (!series->histogram)
+	{
+		series->histogram = std::make_shared<Histogram>(families_[name].bounds);
+	}
+
+	return series->histogram;
+}
+
+MetricsRegistry::Series* MetricsRegistry::FindOrAddSeries(const std::string& name, const std::string& help,
+	MetricType type, const std::vector<double>& bounds, const MetricLabels& labels)
+{
+	auto family = families_.find(name);
+	if (family == families_.end())
+	{
+		Family new_family;
+		new_family.type = type;
+		new_family.help = help;
+		new_family.bounds = bounds;
+		family = families_.insert(std::make_pair(name, std::move(new_family))).first;
+	}
+	else if (family->second.type != type)
+	{
+		// the caller gets a metric of its own, which is never scraped
+		LOG(LS_WARNING) << "Metric " << name << " is already a " << TypeName(static_cast<int>(family->second.type));
+		return nullptr;
+	}
+
+	return &family->second.series[labels];
+}
+
+void MetricsRegistry::RemoveSeries(const std::string& label, const std::string& value)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto& family : families_)
+	{
+		auto& series = family.second.series;
+		for (auto it = series.begin(); it != series.end();)
+		{
+			auto match = std::find(it->first.begin(), it->first.end(), std::make_pair(label, value));
+			it = match != it->first.end() ? series.erase(it) : std::next(it);
+		}
+	}
+}
+
+std::string MetricsRegistry::Scrape() const
+{
+	std::string text;
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	for (const auto& family : families_)
+	{
+		const auto& name = family.first;
+		if (family.second.series.empty())
+		{
+			continue;
+		}
+
+		text.append("# HELP " + name + " " + family.second.help + "\n");
+		text.append("# TYPE " + name + " " + TypeName(static_cast<int>(family.second.type)) + "\n");
+
+		for (const auto& series : family.second.series)
+		{
+			const auto& labels = series.first;
+			switch (family.second.type)
+			{
+			case MetricType::kCounter:
+				text.append(name + FormatLabels(labels) + " " + std::to_string(series.second.counter->Value()) + "\n");
+				break;
+
+			case MetricType::kGauge:
+				text.append(name + FormatLabels(labels) + " " + FormatValue(series.second.gauge->Value()) + "\n");
+				break;
+
+			case MetricType::kHistogram:
+			{
+				auto snapshot = series.second.histogram->GetSnapshot();
+				for (size_t i = 0; i < snapshot.cumulative_counts.size(); i++)
+				{
+					auto bound = i < snapshot.bounds.size() ? FormatValue(snapshot.bounds[i]) : "+Inf";
+					text.append(name + "_bucket" + FormatLabels(labels, "le", bound) + " " +
+						std::to_string(snapshot.cumulative_counts[i]) + "\n");
+				}
+
+				text.append(name + "_sum" + FormatLabels(labels) + " " + FormatValue(snapshot.sum) + "\n");
+				text.append(name + "_count" + FormatLabels(labels) + " " + std::to_string(snapshot.count) + "\n");
+				break;
+			}
+			}
+		}
+	}
+
+	return text;
+}
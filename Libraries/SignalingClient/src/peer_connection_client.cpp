@@ -9,7 +9,9 @@
 */
 
 #include "peer_connection_client.h"
+#include "structured_log.h"
 #include "webrtc/rtc_base/checks.h"
+#include "webrtc/rtc_base/helpers.h"
 #include "webrtc/rtc_base/logging.h"
 #include "webrtc/rtc_base/nethelpers.h"
 #include "webrtc/rtc_base/stringutils.h"
@@ -28,6 +30,12 @@ namespace
 	// Delay between server connection retries, in milliseconds
 	const int kReconnectDelay = 2000;
 
+	// Maximum delay between server connection retries, in milliseconds
+	const int kMaxReconnectDelay = 30000;
+
+	// The message id we use when scheduling a reconnection to the server
+	const uint32_t kReconnectScheduleId = 1529U;
+
 	// The message id we use when scheduling a heartbeat operation
 	const int kHeartbeatScheduleId = 1523U;
 
@@ -44,10 +52,17 @@ PeerConnectionClient::PeerConnectionClient() :
 }
 
 PeerConnectionClient::PeerConnectionClient(std::shared_ptr<SslCapableSocket::Factory> async_socket_factory) :
-	resolver_(NULL),
+	server_address_named_(false),
+	dns_cache_(DnsCache::Default()),
+	dns_lookup_id_(0),
 	state_(NOT_CONNECTED),
 	my_id_(-1),
 	heartbeat_tick_ms_(kHeartbeatDefault),
+	resume_id_(-1),
+	reconnect_attempts_(0),
+	hanging_get_failures_(0),
+	reconnect_delay_ms_(kReconnectDelay),
+	max_reconnect_delay_ms_(kMaxReconnectDelay),
 	server_address_ssl_(false),
 	async_socket_factory_(async_socket_factory)
 {
@@ -63,6 +78,7 @@ PeerConnectionClient::PeerConnectionClient(std::shared_ptr<SslCapableSocket::Fac
 
 PeerConnectionClient::~PeerConnectionClient()
 {
+	dns_cache_->Cancel(dns_lookup_id_);
 }
 
 void PeerConnectionClient::InitSocketSignals()
@@ -147,31 +163,63 @@ void PeerConnectionClient::Connect(const std::string& server, int port,
 	client_name_ = client_name;
 	std::replace(client_name_.begin(), client_name_.end(), ' ', '-');
 
-	if (server_address_.IsUnresolvedIP())
+	// a new session doesn't resume the previous one
+	resume_id_ = -1;
+	resume_token_.clear();
+	reconnect_attempts_ = 0;
+
+	server_address_named_ = server_address_.IsUnresolvedIP();
+	if (server_address_named_)
 	{
 		state_ = RESOLVING;
-		resolver_ = new rtc::AsyncResolver();
-		resolver_->SignalDone.connect(this, &PeerConnectionClient::OnResolveResult);
-		resolver_->Start(server_address_);
 	}
-	else
+
+	ResolveAndConnect();
+}
+
+void PeerConnectionClient::ResolveAndConnect()
+{
+	if (!server_address_named_)
+	{
+		DoConnect();
+		return;
+	}
+
+	// reconnections take the cached addresses, without paying the dns latency again
+	std::vector<rtc::IPAddress> addresses;
+	if (dns_cache_->Lookup(server_address_.hostname(), &addresses))
 	{
+		server_address_.SetResolvedIP(addresses.front());
 		DoConnect();
+		return;
 	}
+
+	dns_cache_->Cancel(dns_lookup_id_);
+	dns_lookup_id_ = dns_cache_->Resolve(server_address_.hostname(),
+		[this](int error, const std::vector<rtc::IPAddress>& addresses)
+	{
+		OnResolveResult(error, addresses);
+	});
 }
 
-void PeerConnectionClient::OnResolveResult(rtc::AsyncResolverInterface* resolver)
+void PeerConnectionClient::OnResolveResult(int error, const std::vector<rtc::IPAddress>& addresses)
 {
-	if (resolver_->GetError() != 0)
+	dns_lookup_id_ = 0;
+
+	if (error != 0 && state_ == RECONNECTING)
+	{
+		// the dns may be down with the server, keep backing off
+		ScheduleReconnect();
+	}
+	else if (error != 0)
 	{
 		std::for_each(callbacks_.rbegin(), callbacks_.rend(), [](PeerConnectionClientObserver* o) { o->OnServerConnectionFailure(); });
-		resolver_->Destroy(false);
-		resolver_ = NULL;
 		state_ = NOT_CONNECTED;
 	}
 	else
 	{
-		server_address_ = resolver_->address();
+		// keep the host name, which the requests and ssl use
+		server_address_.SetResolvedIP(addresses.front());
 		DoConnect();
 	}
 }
@@ -213,15 +261,33 @@ void PeerConnectionClient::DoConnect()
 	std::string clientName = client_name_;
 	std::string hostName = server_address_.hostname();
 
-	onconnect_data_ = PrepareRequest("GET", "/sign_in?peer_name=" + clientName, { { "Host", hostName } });
+	std::string fragment = "/sign_in?peer_name=" + clientName;
+	std::map<std::string, std::string> headers = { { "Host", hostName } };
+
+	// ask for our previous id back, so that the peers keep reaching us
+	if (resume_id_ != -1)
+	{
+		fragment += "&peer_id=" + std::to_string(resume_id_);
+		if (!resume_token_.empty())
+		{
+			headers["Resume-Token"] = resume_token_;
+		}
+	}
+
+	onconnect_data_ = PrepareRequest("GET", fragment, headers);
 
+	bool reconnecting = state_ == RECONNECTING;
 	bool ret = ConnectControlSocket();
 	if (ret)
 	{
 		state_ = SIGNING_IN;
 	}
 
-	if (!ret)
+	if (!ret && reconnecting)
+	{
+		ScheduleReconnect();
+	}
+	else if (!ret)
 	{
 		std::for_each(callbacks_.rbegin(), callbacks_.rend(), [](PeerConnectionClientObserver* o) { o->OnServerConnectionFailure(); });
 	}
@@ -301,6 +367,13 @@ bool PeerConnectionClient::SignOut()
 		return true;
 	}
 
+	// there's nothing to sign out of until the server is back
+	if (state_ == RECONNECTING)
+	{
+		Close();
+		return true;
+	}
+
 	if (hanging_get_->GetState() != rtc::Socket::CS_CLOSED)
 	{
 		hanging_get_->Close();
@@ -351,6 +424,8 @@ bool PeerConnectionClient::Shutdown()
 		capacity_socket_->Close();
 	}
 
+	signaling_thread_->Clear(this, kReconnectScheduleId);
+
 	if (state_ == CONNECTED)
 	{
 		state_ = NOT_CONNECTED;
@@ -375,11 +450,9 @@ void PeerConnectionClient::Close()
 	capacity_data_.clear();
 	onconnect_data_.clear();
 	peers_.clear();
-	if (resolver_ != NULL)
-	{
-		resolver_->Destroy(false);
-		resolver_ = NULL;
-	}
+	dns_cache_->Cancel(dns_lookup_id_);
+	dns_lookup_id_ = 0;
+	signaling_thread_->Clear(this, kReconnectScheduleId);
 
 	my_id_ = -1;
 	state_ = NOT_CONNECTED;
@@ -493,7 +566,7 @@ bool PeerConnectionClient::ReadIntoBuffer(rtc::AsyncSocket* socket, std::string*
 	size_t i = data->find("\r\n\r\n");
 	if (i != std::string::npos)
 	{
-		LOG(INFO) << "Headers received";
+		SLOG(LS_VERBOSE, "http_headers_received").Field("bytes", data->length());
 		if (GetHeaderValue(*data, i, "\r\nContent-Length: ", content_length))
 		{
 			size_t total_response_size = (i + 4) + *content_length;
@@ -542,6 +615,23 @@ void PeerConnectionClient::OnRead(rtc::AsyncSocket* socket)
 				my_id_ = static_cast<int>(peer_id);
 				RTC_DCHECK(my_id_ != -1);
 
+				// The server may give a token to sign back in with the same id.
+				std::string resume_token;
+				GetHeaderValue(control_data_, eoh, "\r\nResume-Token: ", &resume_token);
+				resume_token_ = resume_token;
+
+				if (resume_id_ != -1)
+				{
+					LOG(INFO) << (resume_id_ == my_id_ ? "Resumed the session as " : "Unable to resume the session, signed in as ") << my_id_;
+				}
+
+				resume_id_ = -1;
+				reconnect_attempts_ = 0;
+
+				// After a reconnection, only the changes since the outage are notified.
+				Peers previous_peers;
+				previous_peers.swap(peers_);
+
 				// The body of the response will be a list of already connected peers.
 				if (content_length)
 				{
@@ -560,14 +650,31 @@ void PeerConnectionClient::OnRead(rtc::AsyncSocket* socket)
 						if (ParseEntry(control_data_.substr(pos, eol - pos),
 							&name, &id, &connected) && id != my_id_)
 						{
-							peers_[id] = name;
-							std::for_each(callbacks_.rbegin(), callbacks_.rend(), [&](PeerConnectionClientObserver* o) { o->OnPeerConnected(id, name); });
+							auto previous = previous_peers.find(id);
+							if (previous != previous_peers.end())
+							{
+								// keeps the connection state of the peer
+								peers_[id] = previous->second;
+							}
+							else
+							{
+								peers_[id] = name;
+								std::for_each(callbacks_.rbegin(), callbacks_.rend(), [&](PeerConnectionClientObserver* o) { o->OnPeerConnected(id, name); });
+							}
 						}
 
 						pos = eol + 1;
 					}
 				}
 
+				for (const auto& peer : previous_peers)
+				{
+					if (peers_.find(peer.first) == peers_.end())
+					{
+						std::for_each(callbacks_.rbegin(), callbacks_.rend(), [&](PeerConnectionClientObserver* o) { o->OnPeerDisconnected(peer.first); });
+					}
+				}
+
 				RTC_DCHECK(is_connected());
 				std::for_each(callbacks_.rbegin(), callbacks_.rend(), [](PeerConnectionClientObserver* o) { o->OnSignedIn(); });
 			}
@@ -594,6 +701,14 @@ void PeerConnectionClient::OnRead(rtc::AsyncSocket* socket)
 				control_socket_->Close();
 				control_socket_->Connect(server_address_);
 			}
+			else if (state_ == SIGNING_IN && resume_id_ != -1)
+			{
+				// the server doesn't take our previous id any longer, sign in afresh
+				LOG(WARNING) << "Unable to resume the session as " << resume_id_;
+				resume_id_ = -1;
+				resume_token_.clear();
+				ScheduleReconnect();
+			}
 			else
 			{
 				Close();
@@ -620,12 +735,13 @@ void PeerConnectionClient::OnRead(rtc::AsyncSocket* socket)
 
 void PeerConnectionClient::OnHangingGetRead(rtc::AsyncSocket* socket)
 {
-	LOG(INFO) << __FUNCTION__;
+	SLOG(LS_VERBOSE, "hanging_get_read").Field("peer_id", my_id_);
 	size_t content_length = 0;
 	if (ReadIntoBuffer(socket, &notification_data_, &content_length))
 	{
 		size_t peer_id = 0, eoh = 0;
 		int status = ParseServerResponse(notification_data_, content_length, &peer_id, &eoh);
+		hanging_get_failures_ = 0;
 
 		if (status == 200)
 		{
@@ -792,10 +908,24 @@ void PeerConnectionClient::OnClose(rtc::AsyncSocket* socket, int err)
 		{
 			if (state_ == CONNECTED)
 			{
-				hanging_get_->Close();
-				hanging_get_->Connect(server_address_);
+				// the server dropping the hanging get twice in a row, without
+				// any notification in between, went away
+				if (notification_data_.empty() && ++hanging_get_failures_ > 1)
+				{
+					ScheduleReconnect();
+				}
+				else
+				{
+					hanging_get_->Close();
+					hanging_get_->Connect(server_address_);
+				}
 			}
 		}
+		else if (socket == control_socket_.get() && state_ == SIGNING_IN && control_data_.empty())
+		{
+			// the server went away before answering the sign in
+			ScheduleReconnect();
+		}
 		else
 		{
 			std::for_each(callbacks_.rbegin(), callbacks_.rend(), [&](PeerConnectionClientObserver* o) { o->OnMessageSent(err); });
@@ -803,10 +933,17 @@ void PeerConnectionClient::OnClose(rtc::AsyncSocket* socket, int err)
 	}
 	else
 	{
-		if (socket == control_socket_.get())
+		if ((state_ == SIGNING_IN || state_ == CONNECTED) &&
+			(socket == control_socket_.get() || socket == hanging_get_.get()))
 		{
-			LOG(WARNING) << "Connection refused; retrying in 2 seconds";
-			rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, kReconnectDelay, this, 0);
+			// the retry goes on with the next address of the server, if it has several
+			if (server_address_named_)
+			{
+				dns_cache_->ReportUnreachable(server_address_.hostname(), server_address_.ipaddr());
+			}
+
+			LOG(WARNING) << "Connection refused";
+			ScheduleReconnect();
 		}
 		else
 		{
@@ -835,18 +972,70 @@ void PeerConnectionClient::OnMessage(rtc::Message* msg)
 
 		heartbeat_get_->Connect(server_address_);
 	}
-	else
+	else if (msg->message_id == kReconnectScheduleId)
 	{
-		// default case - other than the heartbeat message, there is only one other message ("retry")
-		DoConnect();
+		// the client may have been closed meanwhile
+		if (state_ == RECONNECTING)
+		{
+			ResolveAndConnect();
+		}
 	}
 }
 
+void PeerConnectionClient::ScheduleReconnect()
+{
+	// keep our id, to sign back in with it
+	if (my_id_ != -1)
+	{
+		resume_id_ = my_id_;
+	}
+
+	my_id_ = -1;
+	control_socket_->Close();
+	hanging_get_->Close();
+	heartbeat_get_->Close();
+	capacity_socket_->Close();
+	onconnect_data_.clear();
+	control_data_.clear();
+	notification_data_.clear();
+	hanging_get_failures_ = 0;
+	state_ = RECONNECTING;
+
+	// exponential backoff with equal jitter, so that the servers which lost the
+	// signaling server together don't come back together
+	int delay = reconnect_delay_ms_;
+	for (int i = 0; i < reconnect_attempts_ && delay < max_reconnect_delay_ms_; i++)
+	{
+		delay *= 2;
+	}
+
+	delay = (std::min)(delay, max_reconnect_delay_ms_);
+	delay = delay / 2 + static_cast<int>(rtc::CreateRandomId() % (delay / 2 + 1));
+	reconnect_attempts_++;
+
+	LOG(WARNING) << "Server connection lost; reconnecting in " << delay << "ms";
+	signaling_thread_->Clear(this, kReconnectScheduleId);
+	signaling_thread_->PostDelayed(RTC_FROM_HERE, delay, this, kReconnectScheduleId);
+}
+
 const std::string& PeerConnectionClient::authorization_header() const
 {
 	return authorization_header_;
 }
 
+void PeerConnectionClient::SetDnsCache(std::shared_ptr<DnsCache> dns_cache)
+{
+	dns_cache_->Cancel(dns_lookup_id_);
+	dns_lookup_id_ = 0;
+	dns_cache_ = dns_cache;
+}
+
+void PeerConnectionClient::SetReconnectDelays(int initial_ms, int max_ms)
+{
+	reconnect_delay_ms_ = (std::max)(initial_ms, 1);
+	max_reconnect_delay_ms_ = (std::max)(max_ms, reconnect_delay_ms_);
+}
+
 void PeerConnectionClient::SetAuthorizationHeader(const std::string& value)
 {
 	authorization_header_ = value;
@@ -0,0 +1,110 @@
+#include <algorithm>
+
+#include "stream_metrics.h"
+
+namespace
+{
+	// the part of a cumulative total reached since the previous sample, all of it if the total restarted
+	int64_t Delta(int64_t value, int64_t previous)
+	{
+		return value >= previous ? value - previous : value;
+	}
+}
+
+StreamMetrics::StreamMetrics(MetricsRegistry* registry, int peer_id) :
+	registry_(registry),
+	peer_id_(std::to_string(peer_id)),
+	has_sample_(false),
+	last_sample_us_(0),
+	last_sample_(),
+	last_submitted_(0),
+	dropped_(0)
+{
+	MetricLabels labels = { { "peer", peer_id_ } };
+
+	frames_submitted_ = registry_->GetCounter("streaming_peer_frames_submitted_total",
+		"Frames handed to the encoder of the peer", labels);
+	frames_encoded_ = registry_->GetCounter("streaming_peer_frames_encoded_total",
+		"Frames encoded for the peer", labels);
+	frames_dropped_ = registry_->GetCounter("streaming_peer_frames_dropped_total",
+		"Frames handed to the encoder of the peer which were never encoded", labels);
+	frames_skipped_ = registry_->GetCounter("streaming_peer_frames_skipped_total",
+		"Frames not rendered while the peer was idle", labels);
+	bytes_sent_ = registry_->GetCounter("streaming_peer_sent_bytes_total",
+		"Bytes sent to the peer", labels);
+	packets_sent_ = registry_->GetCounter("streaming_peer_packets_sent_total",
+		"Video packets sent to the peer", labels);
+	packets_lost_ = registry_->GetCounter("streaming_peer_packets_lost_total",
+		"Video packets the peer reported lost", labels);
+	submit_seconds_ = registry_->GetHistogram("streaming_peer_encoder_submit_seconds",
+		"Time taken to hand a frame to the encoder of the peer",
+		Histogram::ExponentialBounds(0.0005, 2, 10), labels);
+	fps_ = registry_->GetGauge("streaming_peer_fps",
+		"Frames encoded a second for the peer, since the previous poll", labels);
+	bitrate_ = registry_->GetGauge("streaming_peer_bitrate_bps",
+		"Bits sent a second to the peer, since the previous poll", labels);
+	encode_seconds_ = registry_->GetGauge("streaming_peer_encode_seconds",
+		"Average time taken to encode a frame for the peer", labels);
+	rtt_seconds_ = registry_->GetGauge("streaming_peer_rtt_seconds",
+		"Round trip time to the peer", labels);
+	packet_loss_ = registry_->GetGauge("streaming_peer_packet_loss_ratio",
+		"Video packets lost over the ones sent to the peer, since the previous poll", labels);
+}
+
+StreamMetrics::~StreamMetrics()
+{
+	registry_->RemoveSeries("peer", peer_id_);
+}
+
+void StreamMetrics::OnFrameSubmitted(int64_t submit_us)
+{
+	frames_submitted_->Increment();
+	submit_seconds_->Observe(submit_us / 1e6);
+}
+
+void StreamMetrics::OnStats(const StreamStatsSample& sample)
+{
+	int64_t now_us = registry_->NowUs();
+	int64_t bytes = Delta(sample.bytes_sent, last_sample_.bytes_sent);
+	int64_t packets = Delta(sample.packets_sent, last_sample_.packets_sent);
+	int64_t lost = Delta(sample.packets_lost, last_sample_.packets_lost);
+	int64_t frames = Delta(sample.frames_encoded, last_sample_.frames_encoded);
+
+	frames_encoded_->Increment(frames);
+	frames_skipped_->Increment(Delta(sample.frames_skipped, last_sample_.frames_skipped));
+	bytes_sent_->Increment(bytes);
+	packets_sent_->Increment(packets);
+	packets_lost_->Increment(lost);
+
+	encode_seconds_->Set(sample.avg_encode_ms / 1000);
+	rtt_seconds_->Set(sample.rtt_ms / 1000);
+
+	// the rates need two samples
+	int64_t elapsed_us = now_us - last_sample_us_;
+	if (has_sample_ && elapsed_us > 0)
+	{
+		fps_->Set(frames * 1e6 / elapsed_us);
+		bitrate_->Set(bytes * 8 * 1e6 / elapsed_us);
+		packet_loss_->Set(packets + lost > 0 ? static_cast<double>(lost) / (packets + lost) : 0);
+	}
+
+	// the frames in flight at the previous sample had a whole poll to come out of the encoder,
+	// the ones which didn't were dropped
+	int64_t submitted = frames_submitted_->Value();
+	if (has_sample_)
+	{
+		int64_t dropped = (std::max)(last_submitted_ - sample.frames_encoded, dropped_);
+		frames_dropped_->Increment(dropped - dropped_);
+		dropped_ = dropped;
+	}
+
+	has_sample_ = true;
+	last_sample_us_ = now_us;
+	last_sample_ = sample;
+	last_submitted_ = submitted;
+}
+
+MetricsRegistry* StreamMetrics::registry() const
+{
+	return registry_;
+}
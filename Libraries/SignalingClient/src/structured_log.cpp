@@ -0,0 +1,499 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "structured_log.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+namespace
+{
+	// Delay between two drains of the ring, in milliseconds
+	const int kDrainInterval = 20;
+
+	// whether a string value must be quoted to be read back
+	bool NeedsQuotes(const char* value, size_t length)
+	{
+		if (length == 0)
+		{
+			return true;
+		}
+
+		for (size_t i = 0; i < length; i++)
+		{
+			if (value[i] == ' ' || value[i] == '=' || value[i] == '"' || value[i] == '\r' || value[i] == '\n')
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void AppendQuoted(std::string* line, const char* value, size_t length)
+	{
+		line->push_back('"');
+		for (size_t i = 0; i < length; i++)
+		{
+			switch (value[i])
+			{
+			case '"':
+				line->append("\\\"");
+				break;
+
+			case '\r':
+				line->append("\\r");
+				break;
+
+			case '\n':
+				line->append("\\n");
+				break;
+
+			default:
+				line->push_back(value[i]);
+				break;
+			}
+		}
+
+		line->push_back('"');
+	}
+}
+
+LogRateLimiter::LogRateLimiter(int per_second) :
+	per_second_(per_second),
+	window_start_ms_(0),
+	count_(0),
+	suppressed_(0)
+{
+}
+
+bool LogRateLimiter::Allow(uint32_t* suppressed)
+{
+	// a new window every second, racing threads only let a few more records through
+	int64_t now = rtc::TimeMillis();
+	int64_t window_start = window_start_ms_.load(std::memory_order_relaxed);
+	if (now - window_start >= 1000 &&
+		window_start_ms_.compare_exchange_strong(window_start, now, std::memory_order_relaxed))
+	{
+		count_.store(0, std::memory_order_relaxed);
+	}
+
+	if (count_.fetch_add(1, std::memory_order_relaxed) >= per_second_)
+	{
+		suppressed_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	*suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+	return true;
+}
+
+LogRing::LogRing(size_t capacity) :
+	enqueue_pos_(0),
+	dequeue_pos_(0),
+	pushed_(0)
+{
+	size_t size = 2;
+	while (size < capacity)
+	{
+		size *= 2;
+	}
+
+	cells_.reset(new Cell[size]);
+	mask_ = size - 1;
+	for (size_t i = 0; i < size; i++)
+	{
+		cells_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+bool LogRing::TryPush(const LogRecord& record)
+{
+	// each cell tells whether it's free for the position, see Vyukov's bounded queue
+	Cell* cell;
+	size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		cell = &cells_[pos & mask_];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+		if (difference == 0)
+		{
+			if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (difference < 0)
+		{
+			return false;
+		}
+		else
+		{
+			pos = enqueue_pos_.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->record = record;
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	pushed_.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool LogRing::TryPop(LogRecord* record)
+{
+	Cell* cell = &cells_[dequeue_pos_ & mask_];
+	if (cell->sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+	{
+		return false;
+	}
+
+	*record = cell->record;
+	cell->sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+	dequeue_pos_++;
+	return true;
+}
+
+uint64_t LogRing::pushed() const
+{
+	return pushed_.load(std::memory_order_relaxed);
+}
+
+std::atomic<int> StructuredLog::min_severity_(rtc::LS_INFO);
+
+StructuredLog& StructuredLog::Instance()
+{
+	// never destroyed, its thread mustn't be joined while the module unloads
+	static StructuredLog* instance = new StructuredLog();
+	return *instance;
+}
+
+bool StructuredLog::IsEnabled(rtc::LoggingSeverity severity)
+{
+	return severity >= min_severity_.load(std::memory_order_relaxed);
+}
+
+void StructuredLog::SetMinSeverity(rtc::LoggingSeverity severity)
+{
+	min_severity_.store(severity, std::memory_order_relaxed);
+}
+
+StructuredLog::StructuredLog(size_t capacity, bool forward_to_rtc) :
+	ring_(capacity),
+	forward_to_rtc_(forward_to_rtc),
+	dropped_(0),
+	reported_dropped_(0),
+	started_(false),
+	running_(false),
+	flush_requested_(false),
+	written_(0)
+{
+}
+
+StructuredLog::~StructuredLog()
+{
+	Shutdown();
+}
+
+void StructuredLog::Submit(const LogRecord& record)
+{
+	EnsureStarted();
+
+	if (!ring_.TryPush(record))
+	{
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void StructuredLog::AddSink(std::shared_ptr<StructuredLogSink> sink)
+{
+	std::lock_guard<std::mutex> lock(sinks_mutex_);
+	sinks_.push_back(sink);
+}
+
+void StructuredLog::RemoveSink(std::shared_ptr<StructuredLogSink> sink)
+{
+	std::lock_guard<std::mutex> lock(sinks_mutex_);
+	sinks_.erase(std::remove(sinks_.begin(), sinks_.end(), sink), sinks_.end());
+}
+
+void StructuredLog::Flush()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (!running_)
+	{
+		return;
+	}
+
+	uint64_t target = ring_.pushed();
+	flush_requested_ = true;
+	wake_.notify_one();
+	drained_.wait(lock, [&]() { return written_ >= target || !running_; });
+}
+
+void StructuredLog::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!running_)
+		{
+			return;
+		}
+
+		running_ = false;
+		wake_.notify_one();
+	}
+
+	thread_.join();
+	started_.store(false, std::memory_order_release);
+}
+
+uint64_t StructuredLog::dropped() const
+{
+	return dropped_.load(std::memory_order_relaxed);
+}
+
+std::string StructuredLog::Format(const LogRecord& record)
+{
+	std::string line(record.event);
+	char number[32];
+
+	for (int i = 0; i < record.field_count; i++)
+	{
+		const auto& field = record.fields[i];
+		line.push_back(' ');
+		line.append(field.key);
+		line.push_back('=');
+
+		switch (field.type)
+		{
+		case LogField::kInteger:
+			line.append(std::to_string(field.integer));
+			break;
+
+		case LogField::kDouble:
+			snprintf(number, sizeof(number), "%g", field.real);
+			line.append(number);
+			break;
+
+		case LogField::kString:
+		{
+			const char* value = record.text + field.text.offset;
+			if (NeedsQuotes(value, field.text.length) || field.text.truncated)
+			{
+				AppendQuoted(&line, value, field.text.length);
+			}
+			else
+			{
+				line.append(value, field.text.length);
+			}
+
+			if (field.text.truncated)
+			{
+				line.append("...");
+			}
+
+			break;
+		}
+		}
+	}
+
+	if (record.suppressed > 0)
+	{
+		line.append(" suppressed=" + std::to_string(record.suppressed));
+	}
+
+	return line;
+}
+
+void StructuredLog::EnsureStarted()
+{
+	if (started_.load(std::memory_order_acquire))
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!running_)
+	{
+		running_ = true;
+		thread_ = std::thread(&StructuredLog::Run, this);
+		started_.store(true, std::memory_order_release);
+	}
+}
+
+void StructuredLog::Run()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (running_)
+	{
+		wake_.wait_for(lock, std::chrono::milliseconds(kDrainInterval),
+			[&]() { return flush_requested_ || !running_; });
+
+		flush_requested_ = false;
+
+		// logging threads never wait for the lock, only flushes do
+		lock.unlock();
+		Drain();
+		lock.lock();
+
+		drained_.notify_all();
+	}
+
+	// writes what was logged until the shutdown
+	lock.unlock();
+	Drain();
+	lock.lock();
+	drained_.notify_all();
+}
+
+void StructuredLog::Drain()
+{
+	std::vector<StructuredLogLine> lines;
+	LogRecord record;
+	uint64_t popped = 0;
+
+	uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+	if (dropped != reported_dropped_)
+	{
+		StructuredLogLine line;
+		line.severity = rtc::LS_WARNING;
+		line.file = __FILE__;
+		line.line = __LINE__;
+		line.text = "log_records_dropped count=" + std::to_string(dropped - reported_dropped_);
+		lines.push_back(line);
+		reported_dropped_ = dropped;
+	}
+
+	while (ring_.TryPop(&record))
+	{
+		popped++;
+
+		StructuredLogLine line;
+		line.severity = record.severity;
+		line.file = record.file;
+		line.line = record.line;
+		line.text = Format(record);
+		lines.push_back(std::move(line));
+	}
+
+	if (!lines.empty())
+	{
+		if (forward_to_rtc_)
+		{
+			for (const auto& line : lines)
+			{
+				if (rtc::LogMessage::Loggable(line.severity))
+				{
+					rtc::LogMessage(line.file, line.line, line.severity).stream() << line.text;
+				}
+			}
+		}
+
+		std::vector<std::shared_ptr<StructuredLogSink>> sinks;
+		{
+			std::lock_guard<std::mutex> lock(sinks_mutex_);
+			sinks = sinks_;
+		}
+
+		for (const auto& sink : sinks)
+		{
+			sink->OnLogBatch(lines);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	written_ += popped;
+}
+
+StructuredLogStatement::StructuredLogStatement(rtc::LoggingSeverity severity, const char* event,
+	const char* file, int line) :
+	allowed_(true)
+{
+	record_.severity = severity;
+	record_.event = event;
+	record_.file = file;
+	record_.line = line;
+	record_.suppressed = 0;
+	record_.field_count = 0;
+	record_.text_length = 0;
+}
+
+StructuredLogStatement::StructuredLogStatement(rtc::LoggingSeverity severity, const char* event,
+	const char* file, int line, LogRateLimiter& limiter) :
+	StructuredLogStatement(severity, event, file, line)
+{
+	allowed_ = limiter.Allow(&record_.suppressed);
+}
+
+StructuredLogStatement::~StructuredLogStatement()
+{
+	if (allowed_)
+	{
+		StructuredLog::Instance().Submit(record_);
+	}
+}
+
+StructuredLogStatement& StructuredLogStatement::Field(const char* key, double value)
+{
+	auto field = AddField(key, LogField::kDouble);
+	if (field != nullptr)
+	{
+		field->real = value;
+	}
+
+	return *this;
+}
+
+StructuredLogStatement& StructuredLogStatement::Field(const char* key, const char* value)
+{
+	return AddString(key, value, value != nullptr ? strlen(value) : 0);
+}
+
+StructuredLogStatement& StructuredLogStatement::Field(const char* key, const std::string& value)
+{
+	return AddString(key, value.data(), value.length());
+}
+
+LogField* StructuredLogStatement::AddField(const char* key, LogField::Type type)
+{
+	// the fields of suppressed records are never written
+	if (!allowed_ || record_.field_count == LogRecord::kMaxFields)
+	{
+		return nullptr;
+	}
+
+	auto field = &record_.fields[record_.field_count++];
+	field->key = key;
+	field->type = type;
+	return field;
+}
+
+StructuredLogStatement& StructuredLogStatement::AddInteger(const char* key, int64_t value)
+{
+	auto field = AddField(key, LogField::kInteger);
+	if (field != nullptr)
+	{
+		field->integer = value;
+	}
+
+	return *this;
+}
+
+StructuredLogStatement& StructuredLogStatement::AddString(const char* key, const char* value, size_t length)
+{
+	auto field = AddField(key, LogField::kString);
+	if (field != nullptr)
+	{
+		size_t available = LogRecord::kMaxText - record_.text_length;
+		size_t copied = (std::min)(length, available);
+		memcpy(record_.text + record_.text_length, value, copied);
+
+		field->text.offset = static_cast<uint16_t>(record_.text_length);
+		field->text.length = static_cast<uint16_t>(copied);
+		field->text.truncated = copied < length;
+		record_.text_length += copied;
+	}
+
+	return *this;
+}
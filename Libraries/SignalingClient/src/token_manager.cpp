@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include "token_manager.h"
+#include "webrtc/rtc_base/json.h"
+#include "webrtc/rtc_base/logging.h"
+
+#ifdef WIN32
+#include "webrtc/rtc_base/win32.h"
+#include <wincrypt.h>
+
+#pragma comment(lib, "Crypt32.lib")
+#endif
+
+namespace
+{
+	// null deleter to conform rtc::Thread* to std::shared_ptr interface safely
+	struct NullDeleter { template<typename T> void operator()(T*) {} };
+
+	// The message id we use when scheduling a renewal of the cached token
+	const uint32_t kRenewalScheduleId = 1526U;
+
+	// Delay between renewal retries while the cached token is still valid, in milliseconds
+	const int kRenewalRetryDelay = 10000;
+
+	// Lifetime of tokens for which the authority gives none, in seconds
+	const int kDefaultLifetime = 3600;
+
+	int64_t NowMs()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	// encrypts or decrypts data for the current user
+	bool ProtectData(const std::string& data, bool protect, std::string* result)
+	{
+#ifdef WIN32
+		DATA_BLOB input;
+		input.cbData = static_cast<DWORD>(data.length());
+		input.pbData = reinterpret_cast<BYTE*>(const_cast<char*>(data.data()));
+
+		DATA_BLOB output = { 0, nullptr };
+		auto succeeded = protect ?
+			CryptProtectData(&input, L"StreamingToolkit token", nullptr, nullptr, nullptr, CRYPTPROTECT_UI_FORBIDDEN, &output) :
+			CryptUnprotectData(&input, nullptr, nullptr, nullptr, nullptr, CRYPTPROTECT_UI_FORBIDDEN, &output);
+
+		if (!succeeded)
+		{
+			LOG(LS_ERROR) << "Unable to " << (protect ? "encrypt" : "decrypt") << " the token cache: " << GetLastError();
+			return false;
+		}
+
+		result->assign(reinterpret_cast<char*>(output.pbData), output.cbData);
+		LocalFree(output.pbData);
+		return true;
+#else // WIN32
+		LOG(LS_ERROR) << "Token cache encryption isn't supported on this platform";
+		return false;
+#endif // WIN32
+	}
+}
+
+TokenManager::TokenManager(AuthenticationProvider* provider, double renewal_ratio) :
+	provider_(provider),
+	renewal_ratio_(renewal_ratio),
+	expires_at_ms_(0),
+	encrypt_cache_(false),
+	acquiring_(false),
+	requested_(false)
+{
+	// configure the thread which will be used for renewal. it's just some representation of
+	// the current thread (wrapped or existing)
+	auto renewalThread = rtc::Thread::Current();
+	renewalThread = renewalThread == nullptr ? rtc::ThreadManager::Instance()->WrapCurrentThread() : renewalThread;
+	signaling_thread_ = std::shared_ptr<rtc::Thread>(renewalThread, NullDeleter());
+
+	provider_->SignalAuthenticationComplete.connect(this, &TokenManager::OnAuthenticationComplete);
+}
+
+TokenManager::~TokenManager()
+{
+	provider_->SignalAuthenticationComplete.disconnect(this);
+}
+
+bool TokenManager::SetCacheFile(const std::string& path, bool encrypt)
+{
+	cache_path_ = path;
+	encrypt_cache_ = encrypt;
+
+	// a token we already hold is persisted, otherwise the file may have one
+	if (HasValidToken())
+	{
+		return SaveCacheFile();
+	}
+
+	if (!LoadCacheFile() || !HasValidToken())
+	{
+		return false;
+	}
+
+	// renew the loaded token after the same part of its remaining lifetime
+	ScheduleRenewal(static_cast<int64_t>((expires_at_ms_ - NowMs()) * renewal_ratio_));
+	return true;
+}
+
+AuthenticationProviderResult TokenManager::GetCachedToken() const
+{
+	return HasValidToken() ? token_ : AuthenticationProviderResult();
+}
+
+void TokenManager::Invalidate()
+{
+	token_ = AuthenticationProviderResult();
+	expires_at_ms_ = 0;
+	signaling_thread_->Clear(this, kRenewalScheduleId);
+
+	if (!cache_path_.empty())
+	{
+		std::remove(cache_path_.c_str());
+	}
+
+	provider_->Invalidate();
+}
+
+bool TokenManager::Authenticate()
+{
+	// answer from the cache, which is renewed ahead of its expiry
+	if (HasValidToken())
+	{
+		SignalAuthenticationComplete.emit(token_);
+		return true;
+	}
+
+	requested_ = true;
+
+	// share the acquisition in flight, if any
+	if (acquiring_)
+	{
+		return true;
+	}
+
+	// the provider may complete synchronously
+	acquiring_ = true;
+	if (!provider_->Authenticate())
+	{
+		acquiring_ = false;
+		requested_ = false;
+		return false;
+	}
+
+	return true;
+}
+
+bool TokenManager::IsInteractive() const
+{
+	return provider_->IsInteractive();
+}
+
+void TokenManager::OnMessage(rtc::Message* msg)
+{
+	// indicates this message is to renew the cached token
+	if (msg->message_id == kRenewalScheduleId)
+	{
+		// an acquisition in flight renews it already
+		if (acquiring_)
+		{
+			return;
+		}
+
+		acquiring_ = true;
+		if (!provider_->Authenticate())
+		{
+			acquiring_ = false;
+
+			if (HasValidToken())
+			{
+				ScheduleRenewal(kRenewalRetryDelay);
+			}
+		}
+	}
+}
+
+void TokenManager::OnAuthenticationComplete(const AuthenticationProviderResult& result)
+{
+	acquiring_ = false;
+
+	auto requested = requested_;
+	requested_ = false;
+
+	if (result.successFlag && !result.accessToken.empty())
+	{
+		auto lifetime = result.expiresIn > 0 ? result.expiresIn : kDefaultLifetime;
+
+		token_ = result;
+		token_.expiresIn = lifetime;
+		expires_at_ms_ = NowMs() + lifetime * static_cast<int64_t>(1000);
+
+		if (!cache_path_.empty())
+		{
+			SaveCacheFile();
+		}
+
+		ScheduleRenewal(static_cast<int64_t>(lifetime * static_cast<int64_t>(1000) * renewal_ratio_));
+
+		SignalAuthenticationComplete.emit(token_);
+	}
+	else if (HasValidToken())
+	{
+		// the renewal failed, the cache is still served until its expiry
+		LOG(LS_WARNING) << "Unable to renew the token, retrying";
+		ScheduleRenewal(kRenewalRetryDelay);
+	}
+	else if (requested)
+	{
+		SignalAuthenticationComplete.emit(result);
+	}
+}
+
+void TokenManager::ScheduleRenewal(int64_t delay_ms)
+{
+	signaling_thread_->Clear(this, kRenewalScheduleId);
+
+	// a zero ratio disables the renewal, as do interactive providers since the user
+	// would be prompted again without having asked for it
+	if (renewal_ratio_ > 0 && !provider_->IsInteractive())
+	{
+		// long lifetimes exceed the delays which can be posted
+		delay_ms = (std::min)(delay_ms, static_cast<int64_t>((std::numeric_limits<int>::max)()));
+		signaling_thread_->PostDelayed(RTC_FROM_HERE, static_cast<int>(delay_ms), this, kRenewalScheduleId);
+	}
+}
+
+bool TokenManager::HasValidToken() const
+{
+	return token_.successFlag && NowMs() < expires_at_ms_;
+}
+
+bool TokenManager::LoadCacheFile()
+{
+	std::ifstream file(cache_path_, std::ios::binary);
+	if (!file.good())
+	{
+		return false;
+	}
+
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+
+	std::string data = buffer.str();
+	if (encrypt_cache_ && !ProtectData(buffer.str(), false, &data))
+	{
+		return false;
+	}
+
+	Json::Reader reader;
+	Json::Value root;
+	if (!reader.parse(data, root, false) || !root.isObject() ||
+		!root["accessToken"].isString() || !root["expiresAt"].isNumeric())
+	{
+		LOG(LS_WARNING) << "Ignoring the invalid token cache " << cache_path_;
+		return false;
+	}
+
+	token_.successFlag = true;
+	token_.accessToken = root["accessToken"].asString();
+	token_.expiresIn = root["expiresIn"].isIntegral() ? root["expiresIn"].asInt() : kDefaultLifetime;
+	expires_at_ms_ = static_cast<int64_t>(root["expiresAt"].asDouble());
+	return true;
+}
+
+bool TokenManager::SaveCacheFile() const
+{
+	Json::Value root;
+	root["accessToken"] = token_.accessToken;
+	root["expiresIn"] = token_.expiresIn;
+	root["expiresAt"] = static_cast<double>(expires_at_ms_);
+
+	Json::FastWriter writer;
+	std::string data = writer.write(root);
+	if (encrypt_cache_ && !ProtectData(writer.write(root), true, &data))
+	{
+		return false;
+	}
+
+	std::ofstream file(cache_path_, std::ios::binary | std::ios::trunc);
+	file.write(data.data(), data.length());
+	if (!file.good())
+	{
+		LOG(LS_ERROR) << "Unable to write the token cache " << cache_path_;
+		return false;
+	}
+
+	return true;
+}
@@ -1,9 +1,36 @@
+#include <algorithm>
+#include <limits>
+
 #include "turn_credential_provider.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
 
 namespace
 {
 	// null deleter to conform rtc::Thread* to std::shared_ptr interface safely
 	struct NullDeleter { template<typename T> void operator()(T*) {} };
+
+	// The message id we use when scheduling a refresh of the cached credentials
+	const uint32_t kRefreshScheduleId = 1524U;
+
+	// The message id we use when scheduling the timeout of a retrieval
+	const uint32_t kTimeoutScheduleId = 1525U;
+
+	// Time after which a retrieval without response fails, in milliseconds
+	const int kRetrievalTimeout = 10000;
+
+	// Part of the ttl after which cached credentials are refreshed
+	const double kRefreshRatio = 0.8;
+
+	// Delay between refresh retries while the cached credentials are still valid, in milliseconds
+	const int kRefreshRetryDelay = 5000;
+
+	// Ttl of credentials for which the service gives none, in seconds
+	const int kDefaultTtl = 300;
+
+	// Size of the reads of the response, and limit of the whole response
+	const size_t kReadSize = 4096;
+	const size_t kMaxResponseSize = 0xffff;
 }
 
 TurnCredentialProvider::TurnCredentialProvider(const std::string& uri) :
@@ -13,7 +40,12 @@ TurnCredentialProvider::TurnCredentialProvider(const std::string& uri) :
 
 TurnCredentialProvider::TurnCredentialProvider(const std::string& uri, std::shared_ptr<SslCapableSocket::Factory> async_socket_factory) :
 	state_(State::NOT_ACTIVE),
-	async_socket_factory_(async_socket_factory)
+	async_socket_factory_(async_socket_factory),
+	auth_provider_(nullptr),
+	dns_cache_(DnsCache::Default()),
+	dns_lookup_id_(0),
+	expires_at_ms_(0),
+	requested_(false)
 {
 	// take the hostname, <protocol>://<hostname>[:port]/ 
 	auto tempAuthHost = uri.substr(uri.find_first_of("://") + 3);
@@ -25,13 +57,23 @@ TurnCredentialProvider::TurnCredentialProvider(const std::string& uri, std::shar
 	}
 
 	tempAuthHost = tempAuthHost.substr(0, firstSlash);
-	tempAuthHost = tempAuthHost.substr(0, tempAuthHost.find_first_of(":"));
 
 	// take the /path?whaterver uri fragment
 	fragment_ = tempFragment;
 
-	auto authorityPort = std::string("https://").compare(uri.substr(0, 8)) == 0 ? 443 : 80;
+	auto useSsl = std::string("https://").compare(uri.substr(0, 8)) == 0;
+	auto authorityPort = useSsl ? 443 : 80;
+
+	// take the explicit port, if any
+	auto portStart = tempAuthHost.find_first_of(":");
+	if (portStart != tempAuthHost.npos)
+	{
+		authorityPort = atoi(tempAuthHost.substr(portStart + 1).c_str());
+		tempAuthHost = tempAuthHost.substr(0, portStart);
+	}
+
 	host_ = rtc::SocketAddress(tempAuthHost, authorityPort);
+	host_named_ = host_.IsUnresolvedIP();
 
 	// configure the thread which will be used for socket signalling. it's just some representation of
 	// the current thread (wrapped or existing)
@@ -39,7 +81,7 @@ TurnCredentialProvider::TurnCredentialProvider(const std::string& uri, std::shar
 	socketThread = socketThread == nullptr ? rtc::ThreadManager::Instance()->WrapCurrentThread() : socketThread;
 	signaling_thread_ = std::shared_ptr<rtc::Thread>(socketThread, NullDeleter());
 	
-	socket_ = async_socket_factory_->Allocate(host_.family(), authorityPort == 443, signaling_thread_);
+	socket_ = async_socket_factory_->Allocate(host_.family(), useSsl, signaling_thread_);
 
 	socket_->SignalConnectEvent.connect(this, &TurnCredentialProvider::SocketOpen);
 	socket_->SignalReadEvent.connect(this, &TurnCredentialProvider::SocketRead);
@@ -48,6 +90,8 @@ TurnCredentialProvider::TurnCredentialProvider(const std::string& uri, std::shar
 
 TurnCredentialProvider::~TurnCredentialProvider()
 {
+	dns_cache_->Cancel(dns_lookup_id_);
+
 	if (auth_provider_ != nullptr)
 	{
 		auth_provider_->SignalAuthenticationComplete.disconnect(this);
@@ -60,42 +104,42 @@ void TurnCredentialProvider::SetAuthenticationProvider(AuthenticationProvider* a
 	auth_provider_->SignalAuthenticationComplete.connect(this, &TurnCredentialProvider::OnAuthenticationComplete);
 }
 
+void TurnCredentialProvider::SetDnsCache(std::shared_ptr<DnsCache> dns_cache)
+{
+	dns_cache_->Cancel(dns_lookup_id_);
+	dns_lookup_id_ = 0;
+	dns_cache_ = dns_cache;
+}
+
 bool TurnCredentialProvider::RequestCredentials()
 {
-	if (state_ != State::NOT_ACTIVE)
+	// answer from the cache, which is refreshed ahead of its expiry
+	if (HasValidCredentials())
 	{
-		return false;
+		SignalCredentialsRetrieved.emit(cached_credentials_);
+		return true;
 	}
 
-	if (socket_->GetState() != rtc::Socket::CS_CLOSED)
-	{
-		if (0 != socket_->Close())
-		{
-			return false;
-		}
-	}
+	requested_ = true;
 
-	// if we need to resolve the ip we do that before connecting
-	if (host_.IsUnresolvedIP())
+	// share the retrieval in flight, if any
+	if (state_ != State::NOT_ACTIVE)
 	{
-		state_ = RESOLVING;
-		resolver_.reset(new rtc::AsyncResolver());
-		resolver_->SignalDone.connect(this, &TurnCredentialProvider::AddressResolve);
-		resolver_->Start(host_);
-
 		return true;
 	}
-	else if (auth_token_.empty())
-	{
-		state_ = AUTHENTICATING;
-		return auth_provider_->Authenticate();
-	}
-	else
+
+	if (!StartRetrieval())
 	{
-		// connect the socket 
-		int err = socket_->Connect(host_);
-		return err != SOCKET_ERROR;
+		requested_ = false;
+		return false;
 	}
+
+	return true;
+}
+
+TurnCredentials TurnCredentialProvider::GetCachedCredentials() const
+{
+	return HasValidCredentials() ? cached_credentials_ : TurnCredentials();
 }
 
 const TurnCredentialProvider::State& TurnCredentialProvider::state() const
@@ -103,19 +147,56 @@ const TurnCredentialProvider::State& TurnCredentialProvider::state() const
 	return state_;
 }
 
+void TurnCredentialProvider::OnMessage(rtc::Message* msg)
+{
+	// indicates this message is to refresh the cached credentials
+	if (msg->message_id == kRefreshScheduleId)
+	{
+		// a retrieval in flight refreshes them already
+		if (state_ != State::NOT_ACTIVE)
+		{
+			return;
+		}
+
+		if (!StartRetrieval())
+		{
+			CompleteRetrieval(TurnCredentials());
+		}
+	}
+	// indicates the retrieval in flight got no response in time
+	else if (msg->message_id == kTimeoutScheduleId)
+	{
+		if (state_ == State::NOT_ACTIVE)
+		{
+			return;
+		}
+
+		LOG(LS_ERROR) << "Turn credential retrieval timed out";
+
+		dns_cache_->Cancel(dns_lookup_id_);
+		dns_lookup_id_ = 0;
+
+		CompleteRetrieval(TurnCredentials());
+	}
+}
 
 void TurnCredentialProvider::SocketOpen(rtc::AsyncSocket* socket)
 {
-	if (state_ != State::NOT_ACTIVE)
+	if (state_ != State::CONNECTING)
 	{
 		return;
 	}
 
 	// format the request
 	std::string data = "GET " + fragment_ + " HTTP/1.1\r\n"
-		"Host: " + host_.hostname() + "\r\n"
-		"Authorization: Bearer " + auth_token_ + "\r\n"
-		"\r\n";
+		"Host: " + host_.hostname() + "\r\n";
+
+	if (!auth_token_.empty())
+	{
+		data += "Authorization: Bearer " + auth_token_ + "\r\n";
+	}
+
+	data += "\r\n";
 
 	// send it 
 	auto sent = socket_->Send(data.c_str(), data.length());
@@ -126,115 +207,95 @@ void TurnCredentialProvider::SocketOpen(rtc::AsyncSocket* socket)
 
 void TurnCredentialProvider::SocketRead(rtc::AsyncSocket* socket)
 {
-	if (state_ == State::ACTIVE)
+	if (state_ != State::ACTIVE)
 	{
-		TurnCredentials completionData;
-		completionData.successFlag = false;
-
-		// parse response 
-		std::string data;
-		char buffer[0xffff];
-		do
-		{
-			int bytes = socket_->Recv(buffer, sizeof(buffer), nullptr);
-			if (bytes <= 0)
-			{
-				break;
-			}
-
-			data.append(buffer, bytes);
-		} while (true);
-		
-		size_t bodyStart = data.find("\r\n\r\n");
-
-		// if we didn't have a body, something is up.
-		// we want to ignore that data
-		if (data.empty() ||
-			bodyStart == std::string::npos)
-		{
-			return;
-		}
+		return;
+	}
 
-		Json::Reader reader;
-		Json::Value root = NULL;
+	// receive in place, at the end of the response read so far
+	do
+	{
+		auto offset = response_.length();
+		response_.resize(offset + kReadSize);
 
-		// read the response 
-		if (reader.parse(data.substr(bodyStart), root, true))
+		int bytes = socket_->Recv(&response_[offset], kReadSize, nullptr);
+		response_.resize(offset + (bytes > 0 ? bytes : 0));
+		if (bytes <= 0)
 		{
-			auto usernameWrapper = root.get("username", NULL);
-			auto passwordWrapper = root.get("password", NULL);
-			if (usernameWrapper != NULL && passwordWrapper != NULL)
-			{
-				auto username = usernameWrapper.asString();
-				auto password = passwordWrapper.asString();
-
-				// if we have values, success
-				if (!username.empty() && !password.empty())
-				{
-					completionData.successFlag = true;
-					completionData.username = username;
-					completionData.password = password;
-				}
-			}
+			break;
 		}
+	} while (response_.length() < kMaxResponseSize);
 
-		// emit the event
-		SignalCredentialsRetrieved.emit(completionData);
-
-		// after emission, we can close our socket 
-		// note: we don't really mind if this fails, it doesn't matter until 
-		// we try another request, at which point we'll handle the error on that call 
-		socket_->Close();
-
-		// after emission, we're totally done, and move to a NOT_ACTIVE state to allow 
-		// more authentication requests to be triggered 
-		state_ = State::NOT_ACTIVE;
+	if (response_.length() >= kMaxResponseSize)
+	{
+		LOG(LS_ERROR) << "Turn credential response is too large";
+		CompleteRetrieval(TurnCredentials());
+		return;
 	}
+
+	TryCompleteResponse(false);
 }
 
 void TurnCredentialProvider::SocketClose(rtc::AsyncSocket* socket, int err)
 {
-	state_ = State::NOT_ACTIVE;
+	// the server closed before we had the whole response
+	if (state_ == State::ACTIVE)
+	{
+		TryCompleteResponse(true);
+	}
+	// we failed to connect, the next retrieval tries the next address
+	else if (state_ == State::CONNECTING)
+	{
+		if (host_named_)
+		{
+			dns_cache_->ReportUnreachable(host_.hostname(), host_.ipaddr());
+		}
+
+		CompleteRetrieval(TurnCredentials());
+	}
 }
 
-void TurnCredentialProvider::AddressResolve(rtc::AsyncResolverInterface* resolver)
+void TurnCredentialProvider::AddressResolve(int error, const std::vector<rtc::IPAddress>& addresses)
 {
-	// capture the result
-	auto tempHost = resolver->address();
-
-	// release the resolver pointer and destroy the resolver
-	auto released = resolver_.release();
-	released->Destroy(true);
-
-	// reset the resolver pointer to nullptr
-	resolver_.reset(nullptr);
+	dns_lookup_id_ = 0;
 
 	if (state_ != State::RESOLVING)
 	{
 		return;
 	}
 
-	host_ = tempHost;
+	if (error != 0)
+	{
+		LOG(LS_ERROR) << "Unable to resolve " << host_.hostname();
+		CompleteRetrieval(TurnCredentials());
+		return;
+	}
+
+	// keep the hostname for the host header
+	host_.SetResolvedIP(addresses.front());
 
-	if (auth_token_.empty())
+	if (auth_token_.empty() && auth_provider_ != nullptr)
 	{
 		state_ = AUTHENTICATING;
 		if (!auth_provider_->Authenticate())
 		{
-			return;
+			CompleteRetrieval(TurnCredentials());
 		}
 	}
-	else
+	else if (!ConnectSocket())
 	{
-		state_ = State::NOT_ACTIVE;
-	
-		// connect the socket 
-		int err = socket_->Connect(host_);
+		CompleteRetrieval(TurnCredentials());
 	}
 }
 
 void TurnCredentialProvider::OnAuthenticationComplete(const AuthenticationProviderResult& result)
 {
+	// keep the renewed tokens of a shared provider for the later retrievals
+	if (result.successFlag)
+	{
+		auth_token_ = result.accessToken;
+	}
+
 	if (state_ != State::AUTHENTICATING)
 	{
 		return;
@@ -242,13 +303,212 @@ void TurnCredentialProvider::OnAuthenticationComplete(const AuthenticationProvid
 
 	if (!result.successFlag)
 	{
+		CompleteRetrieval(TurnCredentials());
 		return;
 	}
 
-	auth_token_ = result.accessToken;
+	if (!ConnectSocket())
+	{
+		CompleteRetrieval(TurnCredentials());
+	}
+}
+
+bool TurnCredentialProvider::StartRetrieval()
+{
+	if (socket_->GetState() != rtc::Socket::CS_CLOSED)
+	{
+		if (0 != socket_->Close())
+		{
+			return false;
+		}
+	}
 
-	state_ = State::NOT_ACTIVE;
+	response_.clear();
+	signaling_thread_->Clear(this, kTimeoutScheduleId);
+	signaling_thread_->PostDelayed(RTC_FROM_HERE, kRetrievalTimeout, this, kTimeoutScheduleId);
+
+	// if we need to resolve the ip we do that before connecting, the cache
+	// keeps the addresses for their ttl
+	if (host_named_)
+	{
+		state_ = RESOLVING;
+		dns_cache_->Cancel(dns_lookup_id_);
+		dns_lookup_id_ = dns_cache_->Resolve(host_.hostname(),
+			[this](int error, const std::vector<rtc::IPAddress>& addresses)
+		{
+			AddressResolve(error, addresses);
+		});
+
+		return true;
+	}
+	else if (auth_token_.empty() && auth_provider_ != nullptr)
+	{
+		state_ = AUTHENTICATING;
+		if (!auth_provider_->Authenticate())
+		{
+			state_ = State::NOT_ACTIVE;
+			return false;
+		}
+
+		return true;
+	}
+	else
+	{
+		return ConnectSocket();
+	}
+}
+
+bool TurnCredentialProvider::ConnectSocket()
+{
+	state_ = State::CONNECTING;
 
 	// connect the socket 
 	int err = socket_->Connect(host_);
-}
\ No newline at end of file
+	if (err == SOCKET_ERROR)
+	{
+		state_ = State::NOT_ACTIVE;
+		return false;
+	}
+
+	return true;
+}
+
+bool TurnCredentialProvider::TryCompleteResponse(bool closed)
+{
+	size_t eoh = response_.find("\r\n\r\n");
+
+	// if we didn't have a body, something is up.
+	// we wait for the rest, unless the server is done
+	if (eoh == std::string::npos)
+	{
+		if (closed)
+		{
+			CompleteRetrieval(TurnCredentials());
+		}
+
+		return closed;
+	}
+
+	size_t bodyStart = eoh + 4;
+	size_t bodyLength = response_.length() - bodyStart;
+
+	const char kContentLength[] = "\r\nContent-Length: ";
+	size_t contentLengthStart = response_.find(kContentLength);
+	bool hasContentLength = contentLengthStart != std::string::npos && contentLengthStart < eoh;
+	if (hasContentLength)
+	{
+		size_t contentLength = atoi(&response_[contentLengthStart + sizeof(kContentLength) - 1]);
+		if (bodyLength < contentLength && !closed)
+		{
+			return false;
+		}
+
+		bodyLength = (std::min)(bodyLength, contentLength);
+	}
+
+	int status = -1;
+	size_t statusStart = response_.find(' ');
+	if (statusStart != std::string::npos && statusStart < eoh)
+	{
+		status = atoi(&response_[statusStart + 1]);
+	}
+
+	Json::Reader reader;
+	Json::Value root;
+
+	// parse the body where it was received
+	const char* body = response_.data() + bodyStart;
+	bool parsed = reader.parse(body, body + bodyLength, root, false);
+
+	// without a length, the body may still be arriving
+	if (!parsed && !hasContentLength && !closed)
+	{
+		return false;
+	}
+
+	TurnCredentials completionData;
+	if (status == 200 && parsed && root.isObject() &&
+		root["username"].isString() && root["password"].isString())
+	{
+		auto username = root["username"].asString();
+		auto password = root["password"].asString();
+
+		// if we have values, success
+		if (!username.empty() && !password.empty())
+		{
+			completionData.successFlag = true;
+			completionData.username = username;
+			completionData.password = password;
+			completionData.ttl = root["ttl"].isIntegral() ? root["ttl"].asInt() : kDefaultTtl;
+		}
+	}
+	else if (status == 401)
+	{
+		// the token was rejected, we drop it at its source and authenticate
+		// again on the next retrieval, rather than being handed it back
+		auth_token_.clear();
+
+		if (auth_provider_ != nullptr)
+		{
+			auth_provider_->Invalidate();
+		}
+	}
+
+	CompleteRetrieval(completionData);
+	return true;
+}
+
+void TurnCredentialProvider::CompleteRetrieval(const TurnCredentials& credentials)
+{
+	signaling_thread_->Clear(this, kTimeoutScheduleId);
+	response_.clear();
+
+	// we can close our socket
+	// note: we don't really mind if this fails, it doesn't matter until 
+	// we try another request, at which point we'll handle the error on that call 
+	socket_->Close();
+
+	// we're totally done, and move to a NOT_ACTIVE state before emission
+	// to allow more requests to be triggered from the handlers
+	state_ = State::NOT_ACTIVE;
+
+	auto requested = requested_;
+	requested_ = false;
+
+	if (credentials.successFlag)
+	{
+		cached_credentials_ = credentials;
+		expires_at_ms_ = rtc::TimeMillis() + credentials.ttl * static_cast<int64_t>(1000);
+
+		// credentials without a ttl aren't cached
+		if (credentials.ttl > 0)
+		{
+			// computed on 64 bits, long ttls overflowing the delay in milliseconds
+			auto delay_ms = static_cast<int64_t>(credentials.ttl * static_cast<int64_t>(1000) * kRefreshRatio);
+			ScheduleRefresh(static_cast<int>((std::min)(delay_ms, static_cast<int64_t>((std::numeric_limits<int>::max)()))));
+		}
+
+		SignalCredentialsRetrieved.emit(credentials);
+	}
+	else if (HasValidCredentials())
+	{
+		// the refresh failed, the cache is still served until its expiry
+		LOG(LS_WARNING) << "Unable to refresh the turn credentials, retrying";
+		ScheduleRefresh(kRefreshRetryDelay);
+	}
+	else if (requested)
+	{
+		SignalCredentialsRetrieved.emit(credentials);
+	}
+}
+
+void TurnCredentialProvider::ScheduleRefresh(int delay_ms)
+{
+	signaling_thread_->Clear(this, kRefreshScheduleId);
+	signaling_thread_->PostDelayed(RTC_FROM_HERE, delay_ms, this, kRefreshScheduleId);
+}
+
+bool TurnCredentialProvider::HasValidCredentials() const
+{
+	return cached_credentials_.successFlag && rtc::TimeMillis() < expires_at_ms_;
+}
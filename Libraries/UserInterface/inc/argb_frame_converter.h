@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/api/video/video_rotation.h"
+
+// Converts decoded frames to ARGB on the CPU, when they cannot be converted
+// by a shader. The ARGB buffer and the buffer used for rotations are kept
+// between frames and only reallocated when the frames get larger.
+class ArgbFrameConverter
+{
+public:
+	ArgbFrameConverter();
+
+	~ArgbFrameConverter();
+
+	// Converts and rotates the frame as specified by its rotation.
+	void Convert(const webrtc::I420BufferInterface& buffer, webrtc::VideoRotation rotation);
+
+	const uint8_t* data() const
+	{
+		return argb_.get();
+	}
+
+	int width() const
+	{
+		return width_;
+	}
+
+	int height() const
+	{
+		return height_;
+	}
+
+	int stride() const
+	{
+		return width_ * 4;
+	}
+
+private:
+	std::unique_ptr<uint8_t[]> argb_;
+	size_t argb_capacity_;
+	rtc::scoped_refptr<webrtc::I420Buffer> rotated_buffer_;
+	int width_;
+	int height_;
+};
@@ -21,16 +21,25 @@
 
 //#define UNITY_UV_STARTS_AT_TOP
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
 
-#include <d2d1.h>
+#include <d2d1_1.h>
 #include <d2d1helper.h>
+#include <d3d11.h>
 #include <dwrite.h>
+#include <dxgi1_2.h>
 #include <wincodec.h>
 
+#include "argb_frame_converter.h"
+#include "depth_codec.h"
+#include "frame_stamp.h"
+#include "i420_texture_renderer.h"
 #include "main_window.h"
+#include "triple_buffer.h"
 
 #include "webrtc/api/mediastreaminterface.h"
 #include "webrtc/api/video/video_frame.h"
@@ -86,11 +95,31 @@ public:
 	
 	void SetConnectButtonState(bool enabled);
 
+	// Measures the glass to glass latency using the stamps drawn into the
+	// frames by the server. The send function is used to request stamped
+	// frames and to report the latency distribution over the data channel.
+	void EnableGlassToGlassMode(const std::function<void(const std::string&)>& send_func);
+
+	// Receives the depth of each frame, e.g. for positional reprojection, with
+	// the prediction timestamp of the frame. The send function is used to
+	// request the depth band, which is cropped from the presented frames. The
+	// depth function is called by the decoding thread.
+	void EnableDepthStreaming(const std::function<void(const std::string&)>& send_func,
+		const std::function<void(const DepthFrame&, int64_t)>& depth_func);
+
 	class ClientVideoRenderer : public VideoRenderer
 	{
 	public:
+		// When converting on the GPU, the frames are kept as I420 until they
+		// are uploaded by the UI thread. Otherwise, they are converted to ARGB
+		// on the decoding thread. In both cases, the decoding thread publishes
+		// the frames to the UI thread without waiting for it.
 		ClientVideoRenderer(HWND wnd, int width, int height,
-			webrtc::VideoTrackInterface* track_to_render);
+			webrtc::VideoTrackInterface* track_to_render,
+			bool convert_on_gpu = false,
+			const std::function<void(const std::string&)>& glass_to_glass_send_func = nullptr,
+			const std::function<void(const std::string&)>& depth_send_func = nullptr,
+			const std::function<void(const DepthFrame&, int64_t)>& depth_func = nullptr);
 
 		virtual ~ClientVideoRenderer();
 
@@ -112,9 +141,31 @@ public:
 			return bmi_;
 		}
 
+		// Returns the frame taken by the last call to UpdateImage, or NULL when
+		// converting on the GPU.
 		const uint8_t* image() const
 		{
-			return image_.get();
+			return converted_frames_.front().data();
+		}
+
+		bool convert_on_gpu() const
+		{
+			return convert_on_gpu_;
+		}
+
+		// Takes the latest converted frame, if a new one was decoded. Only
+		// called by the UI thread.
+		bool UpdateImage();
+
+		// Returns the latest frame not uploaded yet, when converting on the
+		// GPU. Only called by the UI thread.
+		rtc::scoped_refptr<webrtc::I420BufferInterface> TakePendingFrame(webrtc::VideoRotation* rotation);
+
+		// Returns the number of decoded frames replaced by a newer one before
+		// the UI thread took them.
+		uint64_t dropped_frames() const
+		{
+			return convert_on_gpu_ ? pending_frames_.dropped() : converted_frames_.dropped();
 		}
 
 		const int fps() const
@@ -130,6 +181,14 @@ public:
 	protected:
 		void SetSize(int width, int height);
 
+		void UpdateGlassToGlassStats(const uint8_t* data_y, int stride_y,
+			int width, int height, int64_t present_us);
+
+		// Reads the depth band of a frame and returns the color only.
+		rtc::scoped_refptr<webrtc::I420BufferInterface> TakeDepthBand(
+			const rtc::scoped_refptr<webrtc::I420BufferInterface>& buffer,
+			int64_t prediction_timestamp);
+
 		enum
 		{
 			SET_SIZE,
@@ -138,14 +197,30 @@ public:
 
 		HWND wnd_;
 		BITMAPINFO bmi_;
-		std::unique_ptr<uint8_t[]> image_;
 		CRITICAL_SECTION buffer_lock_;
+		const bool convert_on_gpu_;
+
+		struct PendingFrame
+		{
+			rtc::scoped_refptr<webrtc::I420BufferInterface> buffer;
+			webrtc::VideoRotation rotation;
+		};
+
+		TripleBuffer<PendingFrame> pending_frames_;
+		TripleBuffer<ArgbFrameConverter> converted_frames_;
 		rtc::scoped_refptr<webrtc::VideoTrackInterface> rendered_track_;
 		ULONGLONG time_tick_;
 		int frame_counter_;
-		int fps_;
+		std::atomic<int> fps_;
 		int latency_total_;
-		int latency_;
+		std::atomic<int> latency_;
+		std::function<void(const std::string&)> glass_to_glass_send_func_;
+		std::unique_ptr<GlassToGlassStats> glass_to_glass_stats_;
+		int64_t last_stamp_request_us_;
+		std::function<void(const std::string&)> depth_send_func_;
+		std::function<void(const DepthFrame&, int64_t)> depth_func_;
+		DepthFrame depth_frame_;
+		int64_t last_depth_request_us_;
 	};
 
 	// A little helper class to make sure we always to proper locking and
@@ -190,6 +265,14 @@ protected:
 
 	void HandleTabbing();
 
+	bool CreateDeviceResources();
+
+	bool CreateBackBufferTargets();
+
+	void ResizeBackBuffers(UINT width, UINT height);
+
+	bool UpdateFrameBitmap(const uint8_t* image, int width, int height);
+
 private:
 	HWND edit1_;
 	HWND edit2_;
@@ -201,8 +284,17 @@ private:
 	HWND auth_uri_label_;
 	HWND auth_code_;
 	HWND auth_code_label_;
-	ID2D1Factory* direct2d_factory_;
-	ID2D1HwndRenderTarget* render_target_;
+	ID3D11Device* d3d_device_;
+	ID3D11DeviceContext* d3d_context_;
+	IDXGISwapChain1* swap_chain_;
+	ID3D11RenderTargetView* back_buffer_view_;
+	ID2D1Factory1* direct2d_factory_;
+	ID2D1Device* direct2d_device_;
+	ID2D1DeviceContext* render_target_;
+	ID2D1Bitmap1* target_bitmap_;
+	ID2D1Bitmap* frame_bitmap_;
+	std::unique_ptr<I420TextureRenderer> i420_renderer_;
+	webrtc::VideoRotation frame_rotation_;
 	IDWriteFactory* dwrite_factory_;
 	IDWriteTextFormat* text_format_;
 	ID2D1SolidColorBrush* brush_;
@@ -212,6 +304,9 @@ private:
 	bool auto_call_;
 	bool connect_button_state_;
 	WCHAR fps_text_[64];
+	std::function<void(const std::string&)> glass_to_glass_send_func_;
+	std::function<void(const std::string&)> depth_send_func_;
+	std::function<void(const DepthFrame&, int64_t)> depth_func_;
 
 	int width_;
 	int height_;
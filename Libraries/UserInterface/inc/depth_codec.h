@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Depth buffer formats which can be streamed.
+enum class DepthFormat
+{
+	// DXGI_FORMAT_D24_UNORM_S8_UINT, the stencil is dropped.
+	kD24S8,
+
+	// DXGI_FORMAT_D32_FLOAT.
+	kD32Float
+};
+
+// Depth of a frame, quantized to 16 bits at a reduced resolution.
+struct DepthFrame
+{
+	int width;
+	int height;
+
+	// Depth buffer values, 0 at the near plane and 65535 at the far plane.
+	std::vector<uint16_t> data;
+};
+
+// Streams the depth buffer with the color, in the same video frame, so that
+// clients can do positional reprojection with the depth of the exact frame.
+// The depth is downscaled and quantized to 16 bits, then each sample is split
+// into three 8 bit grey levels drawn in a band below the color: a coarse
+// level, and two phase shifted triangle waves which refine it. Unlike a split
+// into high and low bytes, an error of a few levels caused by the encoder
+// only moves the decoded depth by a few quantization steps. A marker drawn in
+// the last macroblock column of the band tells the client it is there.
+class DepthCodec
+{
+public:
+	// Data channel message type enabling the depth band, with a "1" or "0"
+	// body.
+	static const char* kEnableMessageType;
+
+	// Data channel message sent by the client to request the depth band.
+	static const char* kRequestMessage;
+
+	// Color pixels per depth sample, along each axis.
+	static const int kDownscale = 4;
+
+	// Period of the triangle waves, in quantization steps. The coarse level
+	// must be within half of it, about 6 luma levels.
+	static const int kPeriod = 4096;
+
+	// Returns the height of the band holding the depth of a frame, rounded
+	// up to whole macroblocks so that the encoder doesn't mix it with the
+	// color.
+	static int GetBandHeight(int height);
+
+	// Returns the height of the color in a frame with a depth band.
+	static bool GetColorHeight(int frame_height, int* color_height);
+
+	// Quantizes a depth buffer value, in [0, 1].
+	static uint16_t Quantize(float depth);
+
+	static float Dequantize(uint16_t depth);
+
+	// Converts a quantized depth to the distance from the eye, for a
+	// standard perspective projection with the given near and far planes.
+	static float ToViewDepth(uint16_t depth, float near_plane, float far_plane);
+
+	// Splits a quantized depth into its grey levels.
+	static void EncodeSample(uint16_t depth, uint8_t levels[3]);
+
+	static uint16_t DecodeSample(const uint8_t levels[3]);
+
+	// Downscales and quantizes a mapped depth buffer, keeping the nearest
+	// depth of each block so that foreground edges aren't eroded.
+	static bool Downscale(const uint8_t* data, int stride, DepthFormat format,
+		int width, int height, DepthFrame* depth);
+
+	// Draws the depth band of a RGBA or BGRA frame. The data points to the
+	// first row below the color, and width and height are the ones of the
+	// color.
+	static bool WriteRGBA(const DepthFrame& depth, uint8_t* data, int stride, int width, int height);
+
+	// Returns whether a decoded frame holds a depth band, by looking for the
+	// marker drawn next to the tiles. Since the band layout only depends on
+	// the frame size, it tells apart the frames sent before the band was
+	// enabled. The data points to the first row below the color.
+	static bool HasBand(const uint8_t* data_y, int stride_y, int width, int height);
+
+	// Reads the depth band from the luma plane of a decoded frame. The data
+	// points to the first row below the color.
+	static bool ReadI420(const uint8_t* data_y, int stride_y, int width, int height, DepthFrame* depth);
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Timestamp and frame counter embedded in a rendered frame.
+struct FrameStamp
+{
+	// Wall clock time when the frame was rendered, in microseconds.
+	int64_t timestamp_us;
+
+	// Server side frame counter, used to detect dropped frames.
+	uint32_t frame_counter;
+};
+
+// Draws and reads a frame stamp as a grid of black and white blocks in the
+// top left corner of a frame. Blocks are large enough to survive encoding,
+// and a sync word plus a CRC reject frames without a valid stamp.
+class FrameStampCodec
+{
+public:
+	// Size in pixels of a single bit.
+	static const int kBlockSize = 8;
+
+	static const int kBlocksPerRow = 32;
+
+	static const int kRows = 4;
+
+	// Size in pixels of the stamp area.
+	static const int kWidth = kBlockSize * kBlocksPerRow;
+
+	static const int kHeight = kBlockSize * kRows;
+
+	// Returns the clock used for the stamps, the server and the client must
+	// share it or be synchronized.
+	static int64_t Now();
+
+	// Draws the stamp into a RGBA or BGRA frame.
+	static bool WriteRGBA(const FrameStamp& stamp, uint8_t* data, int stride, int width, int height);
+
+	// Draws the stamp into an I420 frame.
+	static bool WriteI420(const FrameStamp& stamp, uint8_t* data_y, int stride_y,
+		uint8_t* data_u, int stride_u, uint8_t* data_v, int stride_v, int width, int height);
+
+	// Reads the stamp from the luma plane of a decoded frame.
+	static bool ReadI420(const uint8_t* data_y, int stride_y, int width, int height, FrameStamp* stamp);
+};
+
+// Glass to glass latency distribution reported by the client.
+struct GlassToGlassReport
+{
+	// Number of stamped frames presented.
+	uint32_t frames;
+
+	// Number of frames skipped according to the frame counters.
+	uint32_t dropped;
+
+	// Number of frames presented without a readable stamp.
+	uint32_t unstamped;
+
+	int64_t min_us;
+	int64_t p50_us;
+	int64_t p95_us;
+	int64_t p99_us;
+	int64_t max_us;
+};
+
+// Collects the latency of presented frames and builds the periodic reports
+// sent to the server over the data channel. Not thread safe, frames and
+// reports are expected on the rendering thread.
+class GlassToGlassStats
+{
+public:
+	// Data channel message type of the reports.
+	static const char* kReportMessageType;
+
+	// Data channel message sent by the client to request stamped frames.
+	static const char* kRequestMessage;
+
+	explicit GlassToGlassStats(int64_t report_interval_us = 1000000);
+
+	void AddFrame(const FrameStamp& stamp, int64_t present_us);
+
+	void AddUnstampedFrame();
+
+	bool IsReportDue(int64_t now_us) const;
+
+	// Computes the report of the current interval and starts a new one.
+	GlassToGlassReport TakeReport(int64_t now_us);
+
+	// Formats a report as a data channel message.
+	static std::string ToMessage(const GlassToGlassReport& report);
+
+	// Parses the body of a report message.
+	static bool ParseReport(const std::string& body, GlassToGlassReport* report);
+
+private:
+	const int64_t report_interval_us_;
+	int64_t interval_start_us_;
+	std::vector<int64_t> latencies_us_;
+	uint32_t dropped_;
+	uint32_t unstamped_;
+	bool has_last_counter_;
+	uint32_t last_counter_;
+};
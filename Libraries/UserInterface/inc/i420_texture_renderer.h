@@ -0,0 +1,70 @@
+#pragma once
+
+#include <d3d11.h>
+#include <wrl/client.h>
+
+#include "webrtc/api/video/video_frame_buffer.h"
+#include "webrtc/api/video/video_rotation.h"
+
+// Renders I420 frames with Direct3D. The Y, U and V planes are written into
+// persistent textures, only recreated when the frame size changes, and are
+// converted to RGB by a pixel shader while drawing.
+class I420TextureRenderer
+{
+public:
+	I420TextureRenderer();
+
+	~I420TextureRenderer();
+
+	// Creates the shaders. Returns false if the device doesn't support them,
+	// the frames should then be converted on the CPU.
+	bool Initialize(ID3D11Device* device);
+
+	// Writes the planes of a frame into the textures.
+	bool UpdateFrame(ID3D11DeviceContext* context, const webrtc::I420BufferInterface& buffer);
+
+	// Draws the last frame into the render target, rotated as specified by
+	// the frame rotation.
+	void Render(ID3D11DeviceContext* context, ID3D11RenderTargetView* target,
+		const D3D11_VIEWPORT& viewport, webrtc::VideoRotation rotation, bool flip_vertical);
+
+	bool has_frame() const
+	{
+		return has_frame_;
+	}
+
+	int width() const
+	{
+		return width_;
+	}
+
+	int height() const
+	{
+		return height_;
+	}
+
+private:
+	enum Plane
+	{
+		PLANE_Y,
+		PLANE_U,
+		PLANE_V,
+		PLANE_COUNT
+	};
+
+	bool CreateTextures(int width, int height);
+
+	bool WritePlane(ID3D11DeviceContext* context, Plane plane, const uint8_t* data,
+		int stride, int width, int height);
+
+	Microsoft::WRL::ComPtr<ID3D11Device> device_;
+	Microsoft::WRL::ComPtr<ID3D11VertexShader> vertex_shader_;
+	Microsoft::WRL::ComPtr<ID3D11PixelShader> pixel_shader_;
+	Microsoft::WRL::ComPtr<ID3D11SamplerState> sampler_;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> transform_buffer_;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> textures_[PLANE_COUNT];
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> texture_views_[PLANE_COUNT];
+	int width_;
+	int height_;
+	bool has_frame_;
+};
@@ -4,7 +4,9 @@
 #include <memory>
 #include <string>
 
+#include "argb_frame_converter.h"
 #include "main_window.h"
+#include "triple_buffer.h"
 #include "webrtc/api/mediastreaminterface.h"
 #include "webrtc/api/video/video_frame.h"
 #include "webrtc/rtc_base/win32.h"
@@ -75,9 +77,21 @@ public:
 			return bmi_;
 		}
 
+		// Returns the frame taken by the last call to UpdateImage.
 		virtual const uint8_t* image() const override
 		{
-			return image_.get();
+			return converted_frames_.front().data();
+		}
+
+		// Takes the latest converted frame, if a new one was rendered. Only
+		// called by the UI thread.
+		bool UpdateImage();
+
+		// Returns the number of frames replaced by a newer one before the UI
+		// thread took them.
+		uint64_t dropped_frames() const
+		{
+			return converted_frames_.dropped();
 		}
 
 	protected:
@@ -91,8 +105,11 @@ public:
 
 		HWND wnd_;
 		BITMAPINFO bmi_;
-		std::unique_ptr<uint8_t[]> image_;
 		CRITICAL_SECTION buffer_lock_;
+
+		// Frames are converted on the capture thread and published to the UI
+		// thread without waiting for it.
+		TripleBuffer<ArgbFrameConverter> converted_frames_;
 		rtc::scoped_refptr<webrtc::VideoTrackInterface> rendered_track_;
 	};
 
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// Lock free exchange of the latest value between a single producer thread and
+// a single consumer thread, such as a decoding thread and a UI thread. The
+// producer writes into its back buffer and publishes it without ever waiting
+// for the consumer, the consumer takes the latest published buffer. Values
+// published again before the consumer took them are counted as dropped.
+//
+// The buffers are reused, so values holding memory (e.g. frame buffers) are
+// only reallocated when they need to grow.
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() :
+		back_(0),
+		middle_(1),
+		front_(2),
+		published_(0),
+		dropped_(0),
+		consumed_(0)
+	{
+	}
+
+	// Returns the buffer written by the producer. Only called by the producer.
+	T& back()
+	{
+		return buffers_[back_];
+	}
+
+	// Makes the back buffer available to the consumer. Only called by the
+	// producer, never blocks.
+	void Publish()
+	{
+		uint8_t previous = middle_.exchange(
+			static_cast<uint8_t>(back_ | kFreshBit), std::memory_order_acq_rel);
+		back_ = previous & kIndexMask;
+		published_.fetch_add(1, std::memory_order_relaxed);
+		if (previous & kFreshBit)
+		{
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Takes the latest published buffer, if any was published since the last
+	// call. Only called by the consumer, never blocks.
+	bool Update()
+	{
+		if (!(middle_.load(std::memory_order_relaxed) & kFreshBit))
+		{
+			return false;
+		}
+
+		uint8_t previous = middle_.exchange(front_, std::memory_order_acq_rel);
+		front_ = previous & kIndexMask;
+		consumed_++;
+		return true;
+	}
+
+	// Returns the buffer taken by the last update. Only called by the consumer.
+	T& front()
+	{
+		return buffers_[front_];
+	}
+
+	const T& front() const
+	{
+		return buffers_[front_];
+	}
+
+	// Returns the number of published buffers.
+	uint64_t published() const
+	{
+		return published_.load(std::memory_order_relaxed);
+	}
+
+	// Returns the number of published buffers replaced before the consumer
+	// took them.
+	uint64_t dropped() const
+	{
+		return dropped_.load(std::memory_order_relaxed);
+	}
+
+	// Returns the number of buffers taken by the consumer. Only called by
+	// the consumer.
+	uint64_t consumed() const
+	{
+		return consumed_;
+	}
+
+private:
+	static const uint8_t kIndexMask = 0x3;
+	static const uint8_t kFreshBit = 0x4;
+
+	T buffers_[3];
+
+	// Owned by the producer.
+	uint8_t back_;
+
+	// Index of the buffer exchanged between the threads, with a bit telling
+	// if it was published since the consumer last took it.
+	std::atomic<uint8_t> middle_;
+
+	// Owned by the consumer.
+	uint8_t front_;
+
+	std::atomic<uint64_t> published_;
+	std::atomic<uint64_t> dropped_;
+	uint64_t consumed_;
+};
@@ -0,0 +1,58 @@
+#include "stdafx.h"
+
+#include "argb_frame_converter.h"
+#include "libyuv/convert_argb.h"
+#include "libyuv/rotate.h"
+
+ArgbFrameConverter::ArgbFrameConverter() :
+	argb_capacity_(0),
+	width_(0),
+	height_(0)
+{
+}
+
+ArgbFrameConverter::~ArgbFrameConverter()
+{
+}
+
+void ArgbFrameConverter::Convert(const webrtc::I420BufferInterface& buffer, webrtc::VideoRotation rotation)
+{
+	const webrtc::I420BufferInterface* source = &buffer;
+	if (rotation != webrtc::kVideoRotation_0)
+	{
+		bool transpose = rotation == webrtc::kVideoRotation_90 || rotation == webrtc::kVideoRotation_270;
+		int rotated_width = transpose ? buffer.height() : buffer.width();
+		int rotated_height = transpose ? buffer.width() : buffer.height();
+		if (!rotated_buffer_ || rotated_buffer_->width() != rotated_width ||
+			rotated_buffer_->height() != rotated_height)
+		{
+			rotated_buffer_ = webrtc::I420Buffer::Create(rotated_width, rotated_height);
+		}
+
+		libyuv::I420Rotate(buffer.DataY(), buffer.StrideY(),
+			buffer.DataU(), buffer.StrideU(),
+			buffer.DataV(), buffer.StrideV(),
+			rotated_buffer_->MutableDataY(), rotated_buffer_->StrideY(),
+			rotated_buffer_->MutableDataU(), rotated_buffer_->StrideU(),
+			rotated_buffer_->MutableDataV(), rotated_buffer_->StrideV(),
+			buffer.width(), buffer.height(),
+			static_cast<libyuv::RotationMode>(rotation));
+
+		source = rotated_buffer_.get();
+	}
+
+	width_ = source->width();
+	height_ = source->height();
+	size_t size = static_cast<size_t>(stride()) * height_;
+	if (size > argb_capacity_)
+	{
+		argb_.reset(new uint8_t[size]);
+		argb_capacity_ = size;
+	}
+
+	libyuv::I420ToARGB(source->DataY(), source->StrideY(),
+		source->DataU(), source->StrideU(),
+		source->DataV(), source->StrideV(),
+		argb_.get(), stride(),
+		width_, height_);
+}
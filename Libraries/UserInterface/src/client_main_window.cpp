@@ -13,10 +13,10 @@
 #include <math.h>
 
 #include "client_main_window.h"
-#include "libyuv/convert_argb.h"
-#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/common_video/include/video_frame_buffer.h"
 #include "webrtc/rtc_base/arraysize.h"
 #include "webrtc/rtc_base/checks.h"
+#include "webrtc/rtc_base/keep_ref_until_done.h"
 #include "webrtc/rtc_base/logging.h"
 
 using namespace DirectX;
@@ -34,6 +34,16 @@ const char kNoIncomingStream[]	= "(no incoming video)";
 const WCHAR kFontName[]			= L"Verdana";
 const FLOAT kFontSize			= 20;
 
+const int64_t kStampRequestIntervalUs = 1000000;
+
+const int64_t kDepthRequestIntervalUs = 1000000;
+
+#ifdef UNITY_UV_STARTS_AT_TOP
+const bool kFlipVertical = true;
+#else // UNITY_UV_STARTS_AT_TOP
+const bool kFlipVertical = false;
+#endif // UNITY_UV_STARTS_AT_TOP
+
 void CalculateWindowSizeForText(HWND wnd, const wchar_t* text, size_t* width,
 	size_t* height)
 {
@@ -92,8 +102,16 @@ ClientMainWindow::ClientMainWindow(
 		auth_code_label_(NULL),
 		auth_uri_(NULL),
 		auth_uri_label_(NULL),
+		d3d_device_(NULL),
+		d3d_context_(NULL),
+		swap_chain_(NULL),
+		back_buffer_view_(NULL),
 		direct2d_factory_(NULL),
+		direct2d_device_(NULL),
 		render_target_(NULL),
+		target_bitmap_(NULL),
+		frame_bitmap_(NULL),
+		frame_rotation_(webrtc::kVideoRotation_0),
 		dwrite_factory_(NULL),
 		text_format_(NULL),
 		brush_(NULL),
@@ -116,8 +134,16 @@ ClientMainWindow::ClientMainWindow(
 ClientMainWindow::~ClientMainWindow()
 {
 	RTC_DCHECK(!IsWindow());
-	SAFE_RELEASE(direct2d_factory_);
+	i420_renderer_.reset();
+	SAFE_RELEASE(frame_bitmap_);
+	SAFE_RELEASE(target_bitmap_);
 	SAFE_RELEASE(render_target_);
+	SAFE_RELEASE(direct2d_device_);
+	SAFE_RELEASE(direct2d_factory_);
+	SAFE_RELEASE(back_buffer_view_);
+	SAFE_RELEASE(swap_chain_);
+	SAFE_RELEASE(d3d_context_);
+	SAFE_RELEASE(d3d_device_);
 	SAFE_RELEASE(dwrite_factory_);
 	SAFE_RELEASE(text_format_);
 	SAFE_RELEASE(brush_);
@@ -139,16 +165,14 @@ bool ClientMainWindow::Create()
 		CW_USEDEFAULT, CW_USEDEFAULT, width_, height_,
 		NULL, NULL, GetModuleHandle(NULL), this);
 
-	// Creates a Direct2D factory.
-	HRESULT hr = S_OK;
-	hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, &direct2d_factory_);
-	if (FAILED(hr))
+	// Creates the Direct3D and Direct2D resources.
+	if (!CreateDeviceResources())
 	{
 		return false;
 	}
 
 	// Create a DirectWrite factory.
-	hr = DWriteCreateFactory(
+	HRESULT hr = DWriteCreateFactory(
 		DWRITE_FACTORY_TYPE_SHARED,
 		__uuidof(dwrite_factory_),
 		reinterpret_cast<IUnknown **>(&dwrite_factory_)
@@ -176,22 +200,6 @@ bool ClientMainWindow::Create()
 		return false;
 	}
 
-	RECT rc;
-	GetClientRect(wnd_, &rc);
-	D2D1_SIZE_U size = { rc.right - rc.left, rc.bottom - rc.top };
-
-	// Create a Direct2D render target.
-	hr = direct2d_factory_->CreateHwndRenderTarget(
-		D2D1::RenderTargetProperties(),
-		D2D1::HwndRenderTargetProperties(wnd_, size),
-		&render_target_
-	);
-
-	if (FAILED(hr))
-	{
-		return false;
-	}
-
 	// Creates a solid color brush.
 	hr = render_target_->CreateSolidColorBrush(
 		D2D1::ColorF(D2D1::ColorF::White, 1.0f),
@@ -302,48 +310,76 @@ void ClientMainWindow::OnPaint()
 	VideoRenderer* remote_renderer = remote_video_renderer_.get();
 	if (current_ui_ == STREAMING && remote_renderer)
 	{
-		AutoLock<VideoRenderer> remote_lock(remote_renderer);
-		const BITMAPINFO& bmi = remote_renderer->bmi();
-		int height = abs(bmi.bmiHeader.biHeight);
-		int width = bmi.bmiHeader.biWidth;
-		const uint8_t* image = remote_renderer->image();
-		const int fps = ((ClientVideoRenderer*)remote_renderer)->fps();
-		if (image != NULL)
+		ClientVideoRenderer* renderer = static_cast<ClientVideoRenderer*>(remote_renderer);
+		bool has_frame = false;
+		int fps = 0;
+		if (renderer->convert_on_gpu() && i420_renderer_)
+		{
+			rtc::scoped_refptr<webrtc::I420BufferInterface> frame =
+				renderer->TakePendingFrame(&frame_rotation_);
+
+			fps = renderer->fps();
+			if (frame)
+			{
+				i420_renderer_->UpdateFrame(d3d_context_, *frame);
+			}
+
+			if (i420_renderer_->has_frame())
+			{
+				D3D11_VIEWPORT viewport =
+				{
+					0.0f,
+					0.0f,
+					static_cast<FLOAT>(rc.right - rc.left),
+					static_cast<FLOAT>(rc.bottom - rc.top),
+					0.0f,
+					1.0f
+				};
+
+				i420_renderer_->Render(d3d_context_, back_buffer_view_, viewport, frame_rotation_, kFlipVertical);
+				has_frame = true;
+			}
+		}
+		else
+		{
+			// Only copies into the persistent bitmap when a new frame was
+			// converted, repaints reuse it.
+			if (renderer->UpdateImage())
+			{
+				const BITMAPINFO& bmi = remote_renderer->bmi();
+				UpdateFrameBitmap(remote_renderer->image(), bmi.bmiHeader.biWidth, abs(bmi.bmiHeader.biHeight));
+			}
+
+			fps = renderer->fps();
+			has_frame = frame_bitmap_ != NULL;
+		}
+
+		if (has_frame)
 		{
-			// Initializes the bitmap properties.
-			D2D1_BITMAP_PROPERTIES bitmapProps;
-			bitmapProps.dpiX = 0;
-			bitmapProps.dpiY = 0;
-			bitmapProps.pixelFormat.format = DXGI_FORMAT_B8G8R8A8_UNORM;
-			bitmapProps.pixelFormat.alphaMode = D2D1_ALPHA_MODE_IGNORE;
-
-			// Creates the bitmap.
-			ID2D1Bitmap* bitmap = NULL;
-			D2D1_SIZE_U size = { width, height };
-			render_target_->CreateBitmap(size, image, width * 4, bitmapProps, &bitmap);
-			
 			// Starts rendering.
 			render_target_->BeginDraw();
 
+			if (frame_bitmap_ && !renderer->convert_on_gpu())
+			{
 #ifdef UNITY_UV_STARTS_AT_TOP
-			render_target_->SetTransform(
-				D2D1::Matrix3x2F::Scale(
-					1.0f,
-					-1.0f,
-					D2D1::Point2F((desRect.right - desRect.left) / 2, (desRect.bottom - desRect.top) / 2))
-			);
+				render_target_->SetTransform(
+					D2D1::Matrix3x2F::Scale(
+						1.0f,
+						-1.0f,
+						D2D1::Point2F((desRect.right - desRect.left) / 2, (desRect.bottom - desRect.top) / 2))
+				);
 #endif // UNITY_UV_STARTS_AT_TOP
 
-			// Renders the video frame.
-			render_target_->DrawBitmap(bitmap, desRect);
-
-			// Draws the fps info.
-			wsprintf(fps_text_, L"FPS: %d", fps);
+				// Renders the video frame.
+				render_target_->DrawBitmap(frame_bitmap_, desRect);
 
 #ifdef UNITY_UV_STARTS_AT_TOP
-			render_target_->SetTransform(D2D1::Matrix3x2F::Identity());
+				render_target_->SetTransform(D2D1::Matrix3x2F::Identity());
 #endif // UNITY_UV_STARTS_AT_TOP
+			}
 
+			// Draws the fps info.
+			wsprintf(fps_text_, L"FPS: %d", fps);
 			render_target_->DrawText(
 				fps_text_,
 				ARRAYSIZE(fps_text_) - 1,
@@ -352,30 +388,37 @@ void ClientMainWindow::OnPaint()
 				brush_
 			);
 
-			// Ends rendering.
+			// Ends rendering, without waiting for the vertical blank on the
+			// UI thread.
 			render_target_->EndDraw();
-
-			// Releases the bitmap.
-			SAFE_RELEASE(bitmap);
+			swap_chain_->Present(0, 0);
 		}
 		else
 		{
-			// We're still waiting for the video stream to be initialized.
-			HBRUSH brush = ::CreateSolidBrush(RGB(0, 0, 0));
-			::FillRect(ps.hdc, &rc, brush);
-			::DeleteObject(brush);
-
-			HGDIOBJ old_font = ::SelectObject(ps.hdc, GetDefaultFont());
-			::SetTextColor(ps.hdc, RGB(0xff, 0xff, 0xff));
-			::SetBkMode(ps.hdc, TRANSPARENT);
-
+			// We're still waiting for the video stream to be initialized. The
+			// swap chain owns the window content, so GDI can't draw over it.
 			std::string text(kConnecting);
 			text += kNoIncomingStream;
+			std::wstring wide_text(text.begin(), text.end());
 
-			::DrawTextA(ps.hdc, text.c_str(), -1, &rc,
-				DT_SINGLELINE | DT_CENTER | DT_VCENTER);
+			render_target_->BeginDraw();
+			render_target_->Clear(D2D1::ColorF(D2D1::ColorF::Black));
 
-			::SelectObject(ps.hdc, old_font);
+			text_format_->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_CENTER);
+			text_format_->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER);
+			render_target_->DrawText(
+				wide_text.c_str(),
+				static_cast<UINT32>(wide_text.length()),
+				text_format_,
+				desRect,
+				brush_
+			);
+
+			text_format_->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_LEADING);
+			text_format_->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_NEAR);
+
+			render_target_->EndDraw();
+			swap_chain_->Present(0, 0);
 		}
 	}
 	else
@@ -424,7 +467,176 @@ void ClientMainWindow::OnDefaultAction()
 
 VideoRenderer* ClientMainWindow::AllocateVideoRenderer(HWND wnd, int width, int height, webrtc::VideoTrackInterface* track)
 {
-	return new ClientVideoRenderer(wnd, width, height, track);
+	return new ClientVideoRenderer(wnd, width, height, track, i420_renderer_ != nullptr,
+		glass_to_glass_send_func_, depth_send_func_, depth_func_);
+}
+
+bool ClientMainWindow::CreateDeviceResources()
+{
+	// Creates the Direct3D device, falling back to WARP without a GPU.
+	UINT flags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
+	HRESULT hr = D3D11CreateDevice(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, flags, NULL, 0,
+		D3D11_SDK_VERSION, &d3d_device_, NULL, &d3d_context_);
+
+	if (FAILED(hr))
+	{
+		hr = D3D11CreateDevice(NULL, D3D_DRIVER_TYPE_WARP, NULL, flags, NULL, 0,
+			D3D11_SDK_VERSION, &d3d_device_, NULL, &d3d_context_);
+	}
+
+	if (FAILED(hr))
+	{
+		return false;
+	}
+
+	ComPtr<IDXGIDevice> dxgi_device;
+	ComPtr<IDXGIAdapter> dxgi_adapter;
+	ComPtr<IDXGIFactory2> dxgi_factory;
+	hr = d3d_device_->QueryInterface(IID_PPV_ARGS(&dxgi_device));
+	if (SUCCEEDED(hr))
+	{
+		hr = dxgi_device->GetAdapter(&dxgi_adapter);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		hr = dxgi_adapter->GetParent(IID_PPV_ARGS(&dxgi_factory));
+	}
+
+	// Creates the swap chain, sized to the window.
+	if (SUCCEEDED(hr))
+	{
+		DXGI_SWAP_CHAIN_DESC1 swap_chain_desc = { 0 };
+		swap_chain_desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		swap_chain_desc.SampleDesc.Count = 1;
+		swap_chain_desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+		swap_chain_desc.BufferCount = 2;
+		swap_chain_desc.SwapEffect = DXGI_SWAP_EFFECT_DISCARD;
+		hr = dxgi_factory->CreateSwapChainForHwnd(d3d_device_, wnd_, &swap_chain_desc,
+			NULL, NULL, &swap_chain_);
+	}
+
+	// Creates the Direct2D device context used for drawing the fps info.
+	if (SUCCEEDED(hr))
+	{
+		hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, &direct2d_factory_);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		hr = direct2d_factory_->CreateDevice(dxgi_device.Get(), &direct2d_device_);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		hr = direct2d_device_->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, &render_target_);
+	}
+
+	if (FAILED(hr) || !CreateBackBufferTargets())
+	{
+		return false;
+	}
+
+	// Frames are converted on the CPU if the shaders aren't supported.
+	i420_renderer_.reset(new I420TextureRenderer());
+	if (!i420_renderer_->Initialize(d3d_device_))
+	{
+		LOG(LS_WARNING) << "Converting the video frames on the CPU.";
+		i420_renderer_.reset();
+	}
+
+	return true;
+}
+
+bool ClientMainWindow::CreateBackBufferTargets()
+{
+	ComPtr<ID3D11Texture2D> back_buffer;
+	HRESULT hr = swap_chain_->GetBuffer(0, IID_PPV_ARGS(&back_buffer));
+	if (SUCCEEDED(hr))
+	{
+		hr = d3d_device_->CreateRenderTargetView(back_buffer.Get(), NULL, &back_buffer_view_);
+	}
+
+	// Keeps the desktop dpi, like a window render target.
+	FLOAT dpiX, dpiY;
+	direct2d_factory_->GetDesktopDpi(&dpiX, &dpiY);
+	ComPtr<IDXGISurface> surface;
+	if (SUCCEEDED(hr))
+	{
+		hr = back_buffer.As(&surface);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		D2D1_BITMAP_PROPERTIES1 bitmapProps = D2D1::BitmapProperties1(
+			D2D1_BITMAP_OPTIONS_TARGET | D2D1_BITMAP_OPTIONS_CANNOT_DRAW,
+			D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE),
+			dpiX,
+			dpiY);
+
+		hr = render_target_->CreateBitmapFromDxgiSurface(surface.Get(), &bitmapProps, &target_bitmap_);
+	}
+
+	if (FAILED(hr))
+	{
+		return false;
+	}
+
+	render_target_->SetDpi(dpiX, dpiY);
+	render_target_->SetTarget(target_bitmap_);
+	return true;
+}
+
+void ClientMainWindow::ResizeBackBuffers(UINT width, UINT height)
+{
+	if (width == 0 || height == 0)
+	{
+		return;
+	}
+
+	// The swap chain buffers must not be referenced while resizing.
+	render_target_->SetTarget(NULL);
+	SAFE_RELEASE(target_bitmap_);
+	SAFE_RELEASE(back_buffer_view_);
+	d3d_context_->OMSetRenderTargets(0, NULL, NULL);
+	d3d_context_->Flush();
+
+	HRESULT hr = swap_chain_->ResizeBuffers(0, width, height, DXGI_FORMAT_UNKNOWN, 0);
+	if (FAILED(hr) || !CreateBackBufferTargets())
+	{
+		LOG(LS_ERROR) << "Failed to resize the swap chain: " << hr;
+	}
+}
+
+bool ClientMainWindow::UpdateFrameBitmap(const uint8_t* image, int width, int height)
+{
+	// The bitmap is only recreated when the frame size changes.
+	if (frame_bitmap_)
+	{
+		D2D1_SIZE_U size = frame_bitmap_->GetPixelSize();
+		if (size.width != static_cast<UINT32>(width) || size.height != static_cast<UINT32>(height))
+		{
+			SAFE_RELEASE(frame_bitmap_);
+		}
+	}
+
+	if (!frame_bitmap_)
+	{
+		// Initializes the bitmap properties.
+		D2D1_BITMAP_PROPERTIES bitmapProps;
+		bitmapProps.dpiX = 0;
+		bitmapProps.dpiY = 0;
+		bitmapProps.pixelFormat.format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		bitmapProps.pixelFormat.alphaMode = D2D1_ALPHA_MODE_IGNORE;
+
+		D2D1_SIZE_U size = { static_cast<UINT32>(width), static_cast<UINT32>(height) };
+		if (FAILED(render_target_->CreateBitmap(size, bitmapProps, &frame_bitmap_)))
+		{
+			return false;
+		}
+	}
+
+	return SUCCEEDED(frame_bitmap_->CopyFromMemory(NULL, image, width * 4));
 }
 
 void ClientMainWindow::OnMessage(UINT msg, WPARAM wp, LPARAM lp, LRESULT* result, bool* retCode)
@@ -445,12 +657,11 @@ void ClientMainWindow::OnMessage(UINT msg, WPARAM wp, LPARAM lp, LRESULT* result
 			break;
 
 		case WM_SIZE:
-			if (current_ui_ == STREAMING && render_target_)
+			if (current_ui_ == STREAMING && swap_chain_)
 			{
 				RECT rc;
 				GetClientRect(wnd_, &rc);
-				D2D1_SIZE_U size = { rc.right - rc.left, rc.bottom - rc.top };
-				render_target_->Resize(size);
+				ResizeBackBuffers(rc.right - rc.left, rc.bottom - rc.top);
 				SignalClientWindowMessage.emit(msg, wp, lp);
 			}
 			
@@ -758,18 +969,47 @@ void ClientMainWindow::SetConnectButtonState(bool enabled)
 	connect_button_state_ = enabled;
 }
 
+void ClientMainWindow::EnableGlassToGlassMode(const std::function<void(const std::string&)>& send_func)
+{
+	glass_to_glass_send_func_ = send_func;
+}
+
+void ClientMainWindow::EnableDepthStreaming(const std::function<void(const std::string&)>& send_func,
+	const std::function<void(const DepthFrame&, int64_t)>& depth_func)
+{
+	depth_send_func_ = send_func;
+	depth_func_ = depth_func;
+}
+
 //
 // ClientMainWindow::VideoRenderer
 //
 
 ClientMainWindow::ClientVideoRenderer::ClientVideoRenderer(HWND wnd, int width, int height,
-    webrtc::VideoTrackInterface* track_to_render) :
+    webrtc::VideoTrackInterface* track_to_render,
+	bool convert_on_gpu,
+	const std::function<void(const std::string&)>& glass_to_glass_send_func,
+	const std::function<void(const std::string&)>& depth_send_func,
+	const std::function<void(const DepthFrame&, int64_t)>& depth_func) :
 		wnd_(wnd),
+		convert_on_gpu_(convert_on_gpu),
 		rendered_track_(track_to_render),
 		time_tick_(0),
 		frame_counter_(0),
-		latency_total_(0)
+		fps_(0),
+		latency_total_(0),
+		latency_(0),
+		glass_to_glass_send_func_(glass_to_glass_send_func),
+		last_stamp_request_us_(0),
+		depth_send_func_(depth_send_func),
+		depth_func_(depth_func),
+		last_depth_request_us_(0)
 {
+	if (glass_to_glass_send_func_)
+	{
+		glass_to_glass_stats_.reset(new GlassToGlassStats());
+	}
+
 	::InitializeCriticalSection(&buffer_lock_);
 	ZeroMemory(&bmi_, sizeof(bmi_));
 	bmi_.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
@@ -790,9 +1030,7 @@ ClientMainWindow::ClientVideoRenderer::~ClientVideoRenderer()
 
 void ClientMainWindow::ClientVideoRenderer::SetSize(int width, int height)
 {
-	AutoLock<VideoRenderer> lock(this);
-
-	if (width == bmi_.bmiHeader.biWidth && height == bmi_.bmiHeader.biHeight)
+	if (width == bmi_.bmiHeader.biWidth && height == -bmi_.bmiHeader.biHeight)
 	{
 		return;
 	}
@@ -800,31 +1038,68 @@ void ClientMainWindow::ClientVideoRenderer::SetSize(int width, int height)
 	bmi_.bmiHeader.biWidth = width;
 	bmi_.bmiHeader.biHeight = -height;
 	bmi_.bmiHeader.biSizeImage = width * height * (bmi_.bmiHeader.biBitCount >> 3);
-	image_.reset(new uint8_t[bmi_.bmiHeader.biSizeImage]);
 }
 
-void ClientMainWindow::ClientVideoRenderer::OnFrame(const webrtc::VideoFrame& video_frame)
+bool ClientMainWindow::ClientVideoRenderer::UpdateImage()
+{
+	if (!converted_frames_.Update())
+	{
+		return false;
+	}
+
+	SetSize(converted_frames_.front().width(), converted_frames_.front().height());
+	return true;
+}
+
+rtc::scoped_refptr<webrtc::I420BufferInterface> ClientMainWindow::ClientVideoRenderer::TakePendingFrame(
+	webrtc::VideoRotation* rotation)
 {
-	AutoLock<VideoRenderer> lock(this);
+	if (!pending_frames_.Update())
+	{
+		return nullptr;
+	}
+
+	// Releases the frame so that the decoder can reuse it.
+	PendingFrame& frame = pending_frames_.front();
+	rtc::scoped_refptr<webrtc::I420BufferInterface> buffer = frame.buffer;
+	frame.buffer = nullptr;
+	*rotation = frame.rotation;
+	return buffer;
+}
 
-	rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer(
-		video_frame.video_frame_buffer());
+void ClientMainWindow::ClientVideoRenderer::OnFrame(const webrtc::VideoFrame& video_frame)
+{
+	rtc::scoped_refptr<webrtc::I420BufferInterface> buffer(
+		video_frame.video_frame_buffer()->ToI420());
 
-	if (video_frame.rotation() != webrtc::kVideoRotation_0) 
+	if (depth_func_)
 	{
-		buffer = webrtc::I420Buffer::Rotate(*buffer, video_frame.rotation());
+		buffer = TakeDepthBand(buffer, video_frame.prediction_timestamp());
 	}
 
-	SetSize(buffer->width(), buffer->height());
+	if (convert_on_gpu_)
+	{
+		// Only keeps a reference, the planes are uploaded by the UI thread.
+		PendingFrame& frame = pending_frames_.back();
+		frame.buffer = buffer;
+		frame.rotation = video_frame.rotation();
+		pending_frames_.Publish();
+
+		// Releases the dropped frame, if any, now returned as back buffer.
+		pending_frames_.back().buffer = nullptr;
+	}
+	else
+	{
+		converted_frames_.back().Convert(*buffer, video_frame.rotation());
+		converted_frames_.Publish();
+	}
 
-	RTC_DCHECK(image_.get() != NULL);
-	libyuv::I420ToARGB(buffer->GetI420()->DataY(), buffer->GetI420()->StrideY(),
-		buffer->GetI420()->DataU(), buffer->GetI420()->StrideU(),
-		buffer->GetI420()->DataV(), buffer->GetI420()->StrideV(),
-		image_.get(),
-		bmi_.bmiHeader.biWidth *
-		bmi_.bmiHeader.biBitCount / 8,
-		buffer->width(), buffer->height());
+	// The stamp is read once the frame is ready to be presented.
+	if (glass_to_glass_stats_)
+	{
+		UpdateGlassToGlassStats(buffer->DataY(), buffer->StrideY(),
+			buffer->width(), buffer->height(), FrameStampCodec::Now());
+	}
 
 	InvalidateRect(wnd_, NULL, TRUE);
 
@@ -841,3 +1116,62 @@ void ClientMainWindow::ClientVideoRenderer::OnFrame(const webrtc::VideoFrame& vi
 		time_tick_ = GetTickCount64();
 	}
 }
+
+rtc::scoped_refptr<webrtc::I420BufferInterface> ClientMainWindow::ClientVideoRenderer::TakeDepthBand(
+	const rtc::scoped_refptr<webrtc::I420BufferInterface>& buffer, int64_t prediction_timestamp)
+{
+	int color_height = 0;
+	if (DepthCodec::GetColorHeight(buffer->height(), &color_height))
+	{
+		const uint8_t* band_y = buffer->DataY() + color_height * buffer->StrideY();
+		if (DepthCodec::HasBand(band_y, buffer->StrideY(), buffer->width(), color_height) &&
+			DepthCodec::ReadI420(band_y, buffer->StrideY(), buffer->width(), color_height, &depth_frame_))
+		{
+			depth_func_(depth_frame_, prediction_timestamp);
+
+			// Wraps the color rows without copying them.
+			return webrtc::WrapI420Buffer(buffer->width(), color_height,
+				buffer->DataY(), buffer->StrideY(),
+				buffer->DataU(), buffer->StrideU(),
+				buffer->DataV(), buffer->StrideV(),
+				rtc::KeepRefUntilDone(buffer));
+		}
+	}
+
+	// Keeps requesting the depth band until the server sends it.
+	int64_t now_us = FrameStampCodec::Now();
+	if (depth_send_func_ && now_us - last_depth_request_us_ >= kDepthRequestIntervalUs)
+	{
+		depth_send_func_(DepthCodec::kRequestMessage);
+		last_depth_request_us_ = now_us;
+	}
+
+	return buffer;
+}
+
+void ClientMainWindow::ClientVideoRenderer::UpdateGlassToGlassStats(const uint8_t* data_y,
+	int stride_y, int width, int height, int64_t present_us)
+{
+	FrameStamp stamp;
+	if (FrameStampCodec::ReadI420(data_y, stride_y, width, height, &stamp))
+	{
+		glass_to_glass_stats_->AddFrame(stamp, present_us);
+	}
+	else
+	{
+		glass_to_glass_stats_->AddUnstampedFrame();
+
+		// Keeps requesting stamped frames until the server sends them.
+		if (present_us - last_stamp_request_us_ >= kStampRequestIntervalUs)
+		{
+			glass_to_glass_send_func_(GlassToGlassStats::kRequestMessage);
+			last_stamp_request_us_ = present_us;
+		}
+	}
+
+	if (glass_to_glass_stats_->IsReportDue(present_us))
+	{
+		glass_to_glass_send_func_(GlassToGlassStats::ToMessage(
+			glass_to_glass_stats_->TakeReport(present_us)));
+	}
+}
@@ -0,0 +1,298 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#include "depth_codec.h"
+
+namespace
+{
+	const int kMaxDepth = 65535;
+
+	const int kMacroblockSize = 16;
+
+	// Grey levels per sample: the coarse level and the two triangle waves.
+	const int kLevels = 3;
+
+	// Luma range of the grey levels after the RGB to YUV conversion.
+	const int kLumaBlack = 16;
+	const int kLumaRange = 219;
+
+	// The marker is a 2x2 checkerboard filling the last macroblock column
+	// of the band, white in its top left and bottom right quadrants.
+	const int kMarkerQuadrant = kMacroblockSize / 2;
+
+	int GetMarkerX(int width)
+	{
+		return (width / kMacroblockSize - 1) * kMacroblockSize;
+	}
+
+	bool IsMarkerWhite(int x, int y)
+	{
+		return (x < kMarkerQuadrant) == (y < kMarkerQuadrant);
+	}
+
+	int GetDepthSize(int size)
+	{
+		return (size + DepthCodec::kDownscale - 1) / DepthCodec::kDownscale;
+	}
+
+	// Triangle wave of period 1, 0 at 0 and 1 at 0.5.
+	double Triangle(double t)
+	{
+		double phase = t - std::floor(t);
+		return 1.0 - std::fabs(2.0 * phase - 1.0);
+	}
+
+	uint8_t ToLevel(double value)
+	{
+		return static_cast<uint8_t>(std::lround((std::min)((std::max)(value, 0.0), 1.0) * 255));
+	}
+
+	bool FitsBand(int width, int height)
+	{
+		return width >= kMacroblockSize && height > 0 &&
+			GetDepthSize(width) * kLevels <= GetMarkerX(width);
+	}
+}
+
+const char* DepthCodec::kEnableMessageType = "depth-streaming";
+
+const char* DepthCodec::kRequestMessage = "{  \"type\":\"depth-streaming\",  \"body\":\"1\"}";
+
+const int DepthCodec::kDownscale;
+
+const int DepthCodec::kPeriod;
+
+int DepthCodec::GetBandHeight(int height)
+{
+	return (GetDepthSize(height) + kMacroblockSize - 1) / kMacroblockSize * kMacroblockSize;
+}
+
+bool DepthCodec::GetColorHeight(int frame_height, int* color_height)
+{
+	// The frame height strictly increases with the color height.
+	for (int height = frame_height - kMacroblockSize; height > 0; height--)
+	{
+		int band_height = GetBandHeight(height);
+		if (height + band_height == frame_height)
+		{
+			*color_height = height;
+			return true;
+		}
+
+		if (height + band_height < frame_height)
+		{
+			break;
+		}
+	}
+
+	return false;
+}
+
+uint16_t DepthCodec::Quantize(float depth)
+{
+	return static_cast<uint16_t>(std::lround((std::min)((std::max)(depth, 0.0f), 1.0f) * kMaxDepth));
+}
+
+float DepthCodec::Dequantize(uint16_t depth)
+{
+	return depth / static_cast<float>(kMaxDepth);
+}
+
+float DepthCodec::ToViewDepth(uint16_t depth, float near_plane, float far_plane)
+{
+	return near_plane * far_plane / (far_plane - Dequantize(depth) * (far_plane - near_plane));
+}
+
+void DepthCodec::EncodeSample(uint16_t depth, uint8_t levels[3])
+{
+	levels[0] = ToLevel(static_cast<double>(depth) / kMaxDepth);
+	levels[1] = ToLevel(Triangle(static_cast<double>(depth) / kPeriod));
+	levels[2] = ToLevel(Triangle((depth - kPeriod / 4.0) / kPeriod));
+}
+
+uint16_t DepthCodec::DecodeSample(const uint8_t levels[3])
+{
+	double coarse = levels[0] / 255.0 * kMaxDepth;
+	double wave_a = levels[1] / 255.0;
+	double wave_b = levels[2] / 255.0;
+
+	// The two waves trace the sides of a square, one quarter period each.
+	// The side is given by the larger coordinate, which keeps the decoding
+	// continuous at the corners.
+	double s = wave_a + wave_b - 1.0;
+	double t = wave_a - wave_b;
+	double quarter;
+	double offset;
+	if (std::fabs(s) >= std::fabs(t))
+	{
+		quarter = s < 0 ? 0 : 2;
+		offset = s < 0 ? t + 0.5 : 0.5 - t;
+	}
+	else
+	{
+		quarter = t > 0 ? 1 : 3;
+		offset = t > 0 ? s + 0.5 : 0.5 - s;
+	}
+
+	// Unwraps the phase to the period nearest to the coarse level.
+	double phase = (quarter + (std::min)((std::max)(offset, 0.0), 1.0)) * kPeriod / 4.0;
+	double depth = phase + kPeriod * std::floor((coarse - phase) / kPeriod + 0.5);
+	return static_cast<uint16_t>((std::min)((std::max)(std::lround(depth), 0L), static_cast<long>(kMaxDepth)));
+}
+
+bool DepthCodec::Downscale(const uint8_t* data, int stride, DepthFormat format,
+	int width, int height, DepthFrame* depth)
+{
+	if (!data || !depth || width <= 0 || height <= 0)
+	{
+		return false;
+	}
+
+	depth->width = GetDepthSize(width);
+	depth->height = GetDepthSize(height);
+	depth->data.assign(depth->width * depth->height, kMaxDepth);
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t* row = data + y * stride;
+		uint16_t* depth_row = &depth->data[(y / kDownscale) * depth->width];
+		for (int x = 0; x < width; x++)
+		{
+			float value;
+			if (format == DepthFormat::kD24S8)
+			{
+				uint32_t packed;
+				memcpy(&packed, row + x * 4, sizeof(packed));
+				value = (packed & 0xFFFFFF) / 16777215.0f;
+			}
+			else
+			{
+				memcpy(&value, row + x * 4, sizeof(value));
+			}
+
+			uint16_t& sample = depth_row[x / kDownscale];
+			sample = (std::min)(sample, Quantize(value));
+		}
+	}
+
+	return true;
+}
+
+bool DepthCodec::WriteRGBA(const DepthFrame& depth, uint8_t* data, int stride, int width, int height)
+{
+	if (!data || !FitsBand(width, height) ||
+		depth.width != GetDepthSize(width) || depth.height != GetDepthSize(height))
+	{
+		return false;
+	}
+
+	// The rest of the band is kept black, which costs almost no bits.
+	int band_height = GetBandHeight(height);
+	for (int y = 0; y < band_height; y++)
+	{
+		memset(data + y * stride, 0, width * 4);
+	}
+
+	// Each level is drawn in its own tile, side by side.
+	for (int y = 0; y < depth.height; y++)
+	{
+		uint8_t* row = data + y * stride;
+		for (int x = 0; x < depth.width; x++)
+		{
+			uint8_t levels[kLevels];
+			EncodeSample(depth.data[y * depth.width + x], levels);
+			for (int i = 0; i < kLevels; i++)
+			{
+				uint8_t* pixel = row + (i * depth.width + x) * 4;
+				pixel[0] = levels[i];
+				pixel[1] = levels[i];
+				pixel[2] = levels[i];
+				pixel[3] = 255;
+			}
+		}
+	}
+
+	for (int y = 0; y < kMacroblockSize; y++)
+	{
+		uint8_t* pixel = data + y * stride + GetMarkerX(width) * 4;
+		for (int x = 0; x < kMacroblockSize; x++, pixel += 4)
+		{
+			uint8_t level = IsMarkerWhite(x, y) ? 255 : 0;
+			pixel[0] = level;
+			pixel[1] = level;
+			pixel[2] = level;
+			pixel[3] = 255;
+		}
+	}
+
+	return true;
+}
+
+bool DepthCodec::HasBand(const uint8_t* data_y, int stride_y, int width, int height)
+{
+	if (!data_y || !FitsBand(width, height))
+	{
+		return false;
+	}
+
+	// Compares the average luma of each quadrant, which is robust to the
+	// ringing left by the encoder around the edges.
+	int sums[2][2] = {};
+	for (int y = 0; y < kMacroblockSize; y++)
+	{
+		const uint8_t* row = data_y + y * stride_y + GetMarkerX(width);
+		for (int x = 0; x < kMacroblockSize; x++)
+		{
+			sums[y / kMarkerQuadrant][x / kMarkerQuadrant] += row[x];
+		}
+	}
+
+	// Whites must be above the upper quarter of the luma range and blacks
+	// below the lower one.
+	const int pixels = kMarkerQuadrant * kMarkerQuadrant;
+	for (int y = 0; y < 2; y++)
+	{
+		for (int x = 0; x < 2; x++)
+		{
+			int level = (sums[y][x] / pixels - kLumaBlack) * 4 / kLumaRange;
+			if (IsMarkerWhite(x * kMarkerQuadrant, y * kMarkerQuadrant) ? level < 3 : level > 0)
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool DepthCodec::ReadI420(const uint8_t* data_y, int stride_y, int width, int height, DepthFrame* depth)
+{
+	if (!data_y || !depth || !FitsBand(width, height))
+	{
+		return false;
+	}
+
+	depth->width = GetDepthSize(width);
+	depth->height = GetDepthSize(height);
+	depth->data.resize(depth->width * depth->height);
+	for (int y = 0; y < depth->height; y++)
+	{
+		const uint8_t* row = data_y + y * stride_y;
+		for (int x = 0; x < depth->width; x++)
+		{
+			// Expands the video range luma back to the grey levels.
+			uint8_t levels[kLevels];
+			for (int i = 0; i < kLevels; i++)
+			{
+				int luma = row[i * depth->width + x] - kLumaBlack;
+				levels[i] = ToLevel(static_cast<double>(luma) / kLumaRange);
+			}
+
+			depth->data[y * depth->width + x] = DecodeSample(levels);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,289 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+#include "frame_stamp.h"
+
+namespace
+{
+	// Marks the start of a stamp.
+	const uint16_t kSyncWord = 0x3D5A;
+
+	// Sync word, timestamp, frame counter and CRC.
+	const int kStampBytes = 16;
+
+	const int kStampBits = FrameStampCodec::kBlocksPerRow * FrameStampCodec::kRows;
+
+	// Luma levels of the blocks, in video range so they survive conversions.
+	const uint8_t kLumaOne = 235;
+	const uint8_t kLumaZero = 16;
+	const uint8_t kLumaThreshold = 128;
+	const uint8_t kChromaNeutral = 128;
+
+	static_assert(kStampBytes * 8 == kStampBits, "Stamp bytes must fill the stamp blocks.");
+
+	// CRC-16-CCITT.
+	uint16_t Crc16(const uint8_t* data, size_t size)
+	{
+		uint16_t crc = 0xFFFF;
+		for (size_t i = 0; i < size; i++)
+		{
+			crc ^= static_cast<uint16_t>(data[i]) << 8;
+			for (int bit = 0; bit < 8; bit++)
+			{
+				crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+			}
+		}
+
+		return crc;
+	}
+
+	void WriteBigEndian(uint8_t* data, uint64_t value, int size)
+	{
+		for (int i = size - 1; i >= 0; i--)
+		{
+			data[i] = static_cast<uint8_t>(value & 0xFF);
+			value >>= 8;
+		}
+	}
+
+	uint64_t ReadBigEndian(const uint8_t* data, int size)
+	{
+		uint64_t value = 0;
+		for (int i = 0; i < size; i++)
+		{
+			value = (value << 8) | data[i];
+		}
+
+		return value;
+	}
+
+	void EncodeStamp(const FrameStamp& stamp, uint8_t* bytes)
+	{
+		WriteBigEndian(bytes, kSyncWord, 2);
+		WriteBigEndian(bytes + 2, static_cast<uint64_t>(stamp.timestamp_us), 8);
+		WriteBigEndian(bytes + 10, stamp.frame_counter, 4);
+		WriteBigEndian(bytes + 14, Crc16(bytes + 2, 12), 2);
+	}
+
+	bool GetBit(const uint8_t* bytes, int index)
+	{
+		return ((bytes[index / 8] >> (7 - index % 8)) & 1) != 0;
+	}
+
+	bool FitsStamp(int width, int height)
+	{
+		return width >= FrameStampCodec::kWidth && height >= FrameStampCodec::kHeight;
+	}
+
+	// Nearest-rank percentile of sorted latencies.
+	int64_t Percentile(const std::vector<int64_t>& sorted, int percentile)
+	{
+		size_t rank = (sorted.size() * percentile + 99) / 100;
+		return sorted[rank > 0 ? rank - 1 : 0];
+	}
+}
+
+int64_t FrameStampCodec::Now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool FrameStampCodec::WriteRGBA(const FrameStamp& stamp, uint8_t* data, int stride, int width, int height)
+{
+	if (!data || !FitsStamp(width, height))
+	{
+		return false;
+	}
+
+	uint8_t bytes[kStampBytes];
+	EncodeStamp(stamp, bytes);
+	for (int i = 0; i < kStampBits; i++)
+	{
+		uint8_t value = GetBit(bytes, i) ? 255 : 0;
+		int block_x = (i % kBlocksPerRow) * kBlockSize;
+		int block_y = (i / kBlocksPerRow) * kBlockSize;
+		for (int y = block_y; y < block_y + kBlockSize; y++)
+		{
+			uint8_t* pixel = data + y * stride + block_x * 4;
+			for (int x = 0; x < kBlockSize; x++, pixel += 4)
+			{
+				pixel[0] = value;
+				pixel[1] = value;
+				pixel[2] = value;
+				pixel[3] = 255;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool FrameStampCodec::WriteI420(const FrameStamp& stamp, uint8_t* data_y, int stride_y,
+	uint8_t* data_u, int stride_u, uint8_t* data_v, int stride_v, int width, int height)
+{
+	if (!data_y || !data_u || !data_v || !FitsStamp(width, height))
+	{
+		return false;
+	}
+
+	uint8_t bytes[kStampBytes];
+	EncodeStamp(stamp, bytes);
+	for (int i = 0; i < kStampBits; i++)
+	{
+		uint8_t value = GetBit(bytes, i) ? kLumaOne : kLumaZero;
+		int block_x = (i % kBlocksPerRow) * kBlockSize;
+		int block_y = (i / kBlocksPerRow) * kBlockSize;
+		for (int y = block_y; y < block_y + kBlockSize; y++)
+		{
+			memset(data_y + y * stride_y + block_x, value, kBlockSize);
+		}
+	}
+
+	// Keeps the blocks grey.
+	for (int y = 0; y < kHeight / 2; y++)
+	{
+		memset(data_u + y * stride_u, kChromaNeutral, kWidth / 2);
+		memset(data_v + y * stride_v, kChromaNeutral, kWidth / 2);
+	}
+
+	return true;
+}
+
+bool FrameStampCodec::ReadI420(const uint8_t* data_y, int stride_y, int width, int height, FrameStamp* stamp)
+{
+	if (!data_y || !stamp || !FitsStamp(width, height))
+	{
+		return false;
+	}
+
+	// Samples the center of each block, edges are blurred by the encoder.
+	const int margin = kBlockSize / 4;
+	const int sample_size = kBlockSize - 2 * margin;
+	uint8_t bytes[kStampBytes] = { 0 };
+	for (int i = 0; i < kStampBits; i++)
+	{
+		int block_x = (i % kBlocksPerRow) * kBlockSize + margin;
+		int block_y = (i / kBlocksPerRow) * kBlockSize + margin;
+		int sum = 0;
+		for (int y = block_y; y < block_y + sample_size; y++)
+		{
+			const uint8_t* row = data_y + y * stride_y + block_x;
+			for (int x = 0; x < sample_size; x++)
+			{
+				sum += row[x];
+			}
+		}
+
+		if (sum / (sample_size * sample_size) >= kLumaThreshold)
+		{
+			bytes[i / 8] |= 1 << (7 - i % 8);
+		}
+	}
+
+	if (ReadBigEndian(bytes, 2) != kSyncWord ||
+		ReadBigEndian(bytes + 14, 2) != Crc16(bytes + 2, 12))
+	{
+		return false;
+	}
+
+	stamp->timestamp_us = static_cast<int64_t>(ReadBigEndian(bytes + 2, 8));
+	stamp->frame_counter = static_cast<uint32_t>(ReadBigEndian(bytes + 10, 4));
+	return true;
+}
+
+const char* GlassToGlassStats::kReportMessageType = "latency-report";
+
+const char* GlassToGlassStats::kRequestMessage = "{  \"type\":\"glass-to-glass\",  \"body\":\"1\"}";
+
+GlassToGlassStats::GlassToGlassStats(int64_t report_interval_us) :
+	report_interval_us_(report_interval_us),
+	interval_start_us_(-1),
+	dropped_(0),
+	unstamped_(0),
+	has_last_counter_(false),
+	last_counter_(0)
+{
+}
+
+void GlassToGlassStats::AddFrame(const FrameStamp& stamp, int64_t present_us)
+{
+	if (interval_start_us_ < 0)
+	{
+		interval_start_us_ = present_us;
+	}
+
+	if (has_last_counter_ && stamp.frame_counter > last_counter_ + 1)
+	{
+		dropped_ += stamp.frame_counter - last_counter_ - 1;
+	}
+
+	has_last_counter_ = true;
+	last_counter_ = stamp.frame_counter;
+	latencies_us_.push_back(present_us - stamp.timestamp_us);
+}
+
+void GlassToGlassStats::AddUnstampedFrame()
+{
+	unstamped_++;
+}
+
+bool GlassToGlassStats::IsReportDue(int64_t now_us) const
+{
+	return interval_start_us_ >= 0 && now_us - interval_start_us_ >= report_interval_us_;
+}
+
+GlassToGlassReport GlassToGlassStats::TakeReport(int64_t now_us)
+{
+	GlassToGlassReport report = { 0 };
+	report.frames = static_cast<uint32_t>(latencies_us_.size());
+	report.dropped = dropped_;
+	report.unstamped = unstamped_;
+	if (!latencies_us_.empty())
+	{
+		std::sort(latencies_us_.begin(), latencies_us_.end());
+		report.min_us = latencies_us_.front();
+		report.p50_us = Percentile(latencies_us_, 50);
+		report.p95_us = Percentile(latencies_us_, 95);
+		report.p99_us = Percentile(latencies_us_, 99);
+		report.max_us = latencies_us_.back();
+	}
+
+	// Keeps the capacity for the next interval.
+	latencies_us_.clear();
+	dropped_ = 0;
+	unstamped_ = 0;
+	interval_start_us_ = now_us;
+	return report;
+}
+
+std::string GlassToGlassStats::ToMessage(const GlassToGlassReport& report)
+{
+	std::ostringstream message;
+	message << "{  \"type\":\"" << kReportMessageType << "\",  \"body\":\"" <<
+		report.frames << "," << report.dropped << "," << report.unstamped << "," <<
+		report.min_us << "," << report.p50_us << "," << report.p95_us << "," <<
+		report.p99_us << "," << report.max_us << "\"}";
+
+	return message.str();
+}
+
+bool GlassToGlassStats::ParseReport(const std::string& body, GlassToGlassReport* report)
+{
+	std::istringstream stream(body);
+	char separator[7];
+	stream >> report->frames >> separator[0] >> report->dropped >> separator[1] >>
+		report->unstamped >> separator[2] >> report->min_us >> separator[3] >>
+		report->p50_us >> separator[4] >> report->p95_us >> separator[5] >>
+		report->p99_us >> separator[6] >> report->max_us;
+
+	if (stream.fail())
+	{
+		return false;
+	}
+
+	return std::all_of(separator, separator + 7, [](char c) { return c == ','; });
+}
@@ -0,0 +1,317 @@
+#include "stdafx.h"
+
+#include <d3dcompiler.h>
+
+#include "i420_texture_renderer.h"
+#include "webrtc/rtc_base/logging.h"
+
+#pragma comment(lib, "d3d11.lib")
+#pragma comment(lib, "d3dcompiler.lib")
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+// Draws a triangle covering the viewport, the frame coordinates are computed
+// from the screen coordinates so that rotations don't need another pass.
+const char kVertexShader[] =
+	"cbuffer TransformBuffer : register(b0)\n"
+	"{\n"
+	"	float4 uvTransform;\n"
+	"	float4 uvOffset;\n"
+	"};\n"
+	"struct PixelShaderInput\n"
+	"{\n"
+	"	float4 position : SV_POSITION;\n"
+	"	float2 textureUV : TEXCOORD0;\n"
+	"};\n"
+	"PixelShaderInput main(uint id : SV_VertexID)\n"
+	"{\n"
+	"	PixelShaderInput output;\n"
+	"	float2 uv = float2((id << 1) & 2, id & 2);\n"
+	"	output.position = float4(uv * float2(2, -2) + float2(-1, 1), 0, 1);\n"
+	"	output.textureUV = float2(dot(uv, uvTransform.xy), dot(uv, uvTransform.zw)) + uvOffset.xy;\n"
+	"	return output;\n"
+	"}\n";
+
+// Converts using the same BT.601 limited range coefficients as
+// libyuv::I420ToARGB, so both paths render the same colors.
+const char kPixelShader[] =
+	"Texture2D yPlane : register(t0);\n"
+	"Texture2D uPlane : register(t1);\n"
+	"Texture2D vPlane : register(t2);\n"
+	"SamplerState linearSampler : register(s0);\n"
+	"struct PixelShaderInput\n"
+	"{\n"
+	"	float4 position : SV_POSITION;\n"
+	"	float2 textureUV : TEXCOORD0;\n"
+	"};\n"
+	"float4 main(PixelShaderInput input) : SV_Target\n"
+	"{\n"
+	"	float y = 1.164383 * (yPlane.Sample(linearSampler, input.textureUV).r - 0.062745);\n"
+	"	float u = uPlane.Sample(linearSampler, input.textureUV).r - 0.501961;\n"
+	"	float v = vPlane.Sample(linearSampler, input.textureUV).r - 0.501961;\n"
+	"	float3 rgb = float3(\n"
+	"		y + 1.596027 * v,\n"
+	"		y - 0.391762 * u - 0.812968 * v,\n"
+	"		y + 2.017232 * u);\n"
+	"	return float4(saturate(rgb), 1);\n"
+	"}\n";
+
+struct TransformBuffer
+{
+	// Maps the screen coordinates to the frame coordinates.
+	float uv_transform[4];
+	float uv_offset[4];
+};
+
+static_assert(sizeof(TransformBuffer) % 16 == 0, "Constant buffers must be 16 bytes aligned.");
+
+HRESULT CompileShader(const char* source, size_t size, const char* target, ID3DBlob** blob)
+{
+	ComPtr<ID3DBlob> errors;
+	HRESULT hr = D3DCompile(source, size, nullptr, nullptr, nullptr, "main", target,
+		D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, blob, &errors);
+
+	if (FAILED(hr) && errors)
+	{
+		LOG(LS_ERROR) << "Failed to compile shader: " <<
+			static_cast<const char*>(errors->GetBufferPointer());
+	}
+
+	return hr;
+}
+
+// The rotation is the clockwise rotation to apply to the frame for rendering.
+TransformBuffer GetTransform(webrtc::VideoRotation rotation, bool flip_vertical)
+{
+	// Frame coordinates as x = a * u + b * v + c and y = d * u + e * v + f.
+	float a, b, c, d, e, f;
+	switch (rotation)
+	{
+		case webrtc::kVideoRotation_90:
+			a = 0; b = 1; c = 0;
+			d = -1; e = 0; f = 1;
+			break;
+
+		case webrtc::kVideoRotation_180:
+			a = -1; b = 0; c = 1;
+			d = 0; e = -1; f = 1;
+			break;
+
+		case webrtc::kVideoRotation_270:
+			a = 0; b = -1; c = 1;
+			d = 1; e = 0; f = 0;
+			break;
+
+		default:
+			a = 1; b = 0; c = 0;
+			d = 0; e = 1; f = 0;
+			break;
+	}
+
+	// Replaces v with 1 - v.
+	if (flip_vertical)
+	{
+		c += b;
+		b = -b;
+		f += e;
+		e = -e;
+	}
+
+	TransformBuffer transform = { { a, b, d, e }, { c, f, 0, 0 } };
+	return transform;
+}
+}
+
+I420TextureRenderer::I420TextureRenderer() :
+	width_(0),
+	height_(0),
+	has_frame_(false)
+{
+}
+
+I420TextureRenderer::~I420TextureRenderer()
+{
+}
+
+bool I420TextureRenderer::Initialize(ID3D11Device* device)
+{
+	// SV_VertexID requires feature level 10.
+	if (!device || device->GetFeatureLevel() < D3D_FEATURE_LEVEL_10_0)
+	{
+		return false;
+	}
+
+	device_ = device;
+
+	ComPtr<ID3DBlob> vertex_shader;
+	HRESULT hr = CompileShader(kVertexShader, sizeof(kVertexShader) - 1, "vs_4_0", &vertex_shader);
+	if (SUCCEEDED(hr))
+	{
+		hr = device_->CreateVertexShader(vertex_shader->GetBufferPointer(),
+			vertex_shader->GetBufferSize(), nullptr, &vertex_shader_);
+	}
+
+	ComPtr<ID3DBlob> pixel_shader;
+	if (SUCCEEDED(hr))
+	{
+		hr = CompileShader(kPixelShader, sizeof(kPixelShader) - 1, "ps_4_0", &pixel_shader);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		hr = device_->CreatePixelShader(pixel_shader->GetBufferPointer(),
+			pixel_shader->GetBufferSize(), nullptr, &pixel_shader_);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		D3D11_SAMPLER_DESC sampler_desc = {};
+		sampler_desc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+		sampler_desc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+		sampler_desc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+		sampler_desc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+		sampler_desc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+		sampler_desc.MaxLOD = D3D11_FLOAT32_MAX;
+		hr = device_->CreateSamplerState(&sampler_desc, &sampler_);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		D3D11_BUFFER_DESC buffer_desc = {};
+		buffer_desc.ByteWidth = sizeof(TransformBuffer);
+		buffer_desc.Usage = D3D11_USAGE_DEFAULT;
+		buffer_desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		hr = device_->CreateBuffer(&buffer_desc, nullptr, &transform_buffer_);
+	}
+
+	if (FAILED(hr))
+	{
+		LOG(LS_WARNING) << "Failed to initialize the I420 texture renderer: " << hr;
+		return false;
+	}
+
+	return true;
+}
+
+bool I420TextureRenderer::UpdateFrame(ID3D11DeviceContext* context, const webrtc::I420BufferInterface& buffer)
+{
+	if ((buffer.width() != width_ || buffer.height() != height_) &&
+		!CreateTextures(buffer.width(), buffer.height()))
+	{
+		return false;
+	}
+
+	int chroma_width = (width_ + 1) / 2;
+	int chroma_height = (height_ + 1) / 2;
+	has_frame_ =
+		WritePlane(context, PLANE_Y, buffer.DataY(), buffer.StrideY(), width_, height_) &&
+		WritePlane(context, PLANE_U, buffer.DataU(), buffer.StrideU(), chroma_width, chroma_height) &&
+		WritePlane(context, PLANE_V, buffer.DataV(), buffer.StrideV(), chroma_width, chroma_height);
+
+	return has_frame_;
+}
+
+void I420TextureRenderer::Render(ID3D11DeviceContext* context, ID3D11RenderTargetView* target,
+	const D3D11_VIEWPORT& viewport, webrtc::VideoRotation rotation, bool flip_vertical)
+{
+	if (!has_frame_)
+	{
+		return;
+	}
+
+	TransformBuffer transform = GetTransform(rotation, flip_vertical);
+	context->UpdateSubresource(transform_buffer_.Get(), 0, nullptr, &transform, 0, 0);
+
+	// The whole state is set since Direct2D shares the device context.
+	ID3D11ShaderResourceView* views[PLANE_COUNT] =
+	{
+		texture_views_[PLANE_Y].Get(),
+		texture_views_[PLANE_U].Get(),
+		texture_views_[PLANE_V].Get()
+	};
+
+	context->OMSetRenderTargets(1, &target, nullptr);
+	context->OMSetBlendState(nullptr, nullptr, 0xffffffff);
+	context->OMSetDepthStencilState(nullptr, 0);
+	context->RSSetState(nullptr);
+	context->RSSetViewports(1, &viewport);
+	context->IASetInputLayout(nullptr);
+	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	context->VSSetShader(vertex_shader_.Get(), nullptr, 0);
+	context->VSSetConstantBuffers(0, 1, transform_buffer_.GetAddressOf());
+	context->GSSetShader(nullptr, nullptr, 0);
+	context->PSSetShader(pixel_shader_.Get(), nullptr, 0);
+	context->PSSetShaderResources(0, PLANE_COUNT, views);
+	context->PSSetSamplers(0, 1, sampler_.GetAddressOf());
+	context->Draw(3, 0);
+
+	// Unbinds the planes so that they can be written by the next frame.
+	ID3D11ShaderResourceView* null_views[PLANE_COUNT] = { nullptr };
+	context->PSSetShaderResources(0, PLANE_COUNT, null_views);
+}
+
+bool I420TextureRenderer::CreateTextures(int width, int height)
+{
+	has_frame_ = false;
+	width_ = 0;
+	height_ = 0;
+	for (int plane = 0; plane < PLANE_COUNT; plane++)
+	{
+		D3D11_TEXTURE2D_DESC texture_desc = {};
+		texture_desc.Width = plane == PLANE_Y ? width : (width + 1) / 2;
+		texture_desc.Height = plane == PLANE_Y ? height : (height + 1) / 2;
+		texture_desc.MipLevels = 1;
+		texture_desc.ArraySize = 1;
+		texture_desc.Format = DXGI_FORMAT_R8_UNORM;
+		texture_desc.SampleDesc.Count = 1;
+		texture_desc.Usage = D3D11_USAGE_DYNAMIC;
+		texture_desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		texture_desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+		texture_views_[plane].Reset();
+		textures_[plane].Reset();
+		HRESULT hr = device_->CreateTexture2D(&texture_desc, nullptr, &textures_[plane]);
+		if (SUCCEEDED(hr))
+		{
+			hr = device_->CreateShaderResourceView(textures_[plane].Get(), nullptr, &texture_views_[plane]);
+		}
+
+		if (FAILED(hr))
+		{
+			LOG(LS_ERROR) << "Failed to create the I420 plane textures: " << hr;
+			return false;
+		}
+	}
+
+	width_ = width;
+	height_ = height;
+	return true;
+}
+
+bool I420TextureRenderer::WritePlane(ID3D11DeviceContext* context, Plane plane,
+	const uint8_t* data, int stride, int width, int height)
+{
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(context->Map(textures_[plane].Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+	{
+		return false;
+	}
+
+	uint8_t* dest = static_cast<uint8_t*>(mapped.pData);
+	if (mapped.RowPitch == static_cast<UINT>(stride))
+	{
+		memcpy(dest, data, stride * (height - 1) + width);
+	}
+	else
+	{
+		for (int y = 0; y < height; y++)
+		{
+			memcpy(dest + y * mapped.RowPitch, data + y * stride, width);
+		}
+	}
+
+	context->Unmap(textures_[plane].Get(), 0);
+	return true;
+}
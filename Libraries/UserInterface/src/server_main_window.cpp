@@ -3,8 +3,6 @@
 
 #include <math.h>
 
-#include "libyuv/convert_argb.h"
-#include "webrtc/api/video/i420_buffer.h"
 #include "webrtc/rtc_base/arraysize.h"
 #include "webrtc/rtc_base/checks.h"
 #include "webrtc/rtc_base/logging.h"
@@ -201,7 +199,7 @@ void ServerMainWindow::OnPaint()
 	VideoRenderer* local_renderer = local_video_renderer_.get();
 	if (current_ui_ == STREAMING && local_renderer)
 	{
-		AutoLock<VideoRenderer> local_lock(local_renderer);
+		static_cast<ServerVideoRenderer*>(local_renderer)->UpdateImage();
 		const BITMAPINFO& bmi = local_renderer->bmi();
 		int height = abs(bmi.bmiHeader.biHeight);
 		int width = bmi.bmiHeader.biWidth;
@@ -588,9 +586,7 @@ ServerMainWindow::ServerVideoRenderer::~ServerVideoRenderer()
 
 void ServerMainWindow::ServerVideoRenderer::SetSize(int width, int height)
 {
-	AutoLock<VideoRenderer> lock(this);
-
-	if (width == bmi_.bmiHeader.biWidth && height == bmi_.bmiHeader.biHeight)
+	if (width == bmi_.bmiHeader.biWidth && height == -bmi_.bmiHeader.biHeight)
 	{
 		return;
 	}
@@ -598,31 +594,24 @@ void ServerMainWindow::ServerVideoRenderer::SetSize(int width, int height)
 	bmi_.bmiHeader.biWidth = width;
 	bmi_.bmiHeader.biHeight = -height;
 	bmi_.bmiHeader.biSizeImage = width * height * (bmi_.bmiHeader.biBitCount >> 3);
-	image_.reset(new uint8_t[bmi_.bmiHeader.biSizeImage]);
 }
 
-void ServerMainWindow::ServerVideoRenderer::OnFrame(const webrtc::VideoFrame& video_frame)
+bool ServerMainWindow::ServerVideoRenderer::UpdateImage()
 {
-	AutoLock<VideoRenderer> lock(this);
-
-	rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer(
-		video_frame.video_frame_buffer());
-
-	if (video_frame.rotation() != webrtc::kVideoRotation_0)
+	if (!converted_frames_.Update())
 	{
-		buffer = webrtc::I420Buffer::Rotate(*buffer, video_frame.rotation());
+		return false;
 	}
 
-	SetSize(buffer->width(), buffer->height());
+	SetSize(converted_frames_.front().width(), converted_frames_.front().height());
+	return true;
+}
 
-	RTC_DCHECK(image_.get() != NULL);
-	libyuv::I420ToARGB(buffer->GetI420()->DataY(), buffer->GetI420()->StrideY(),
-		buffer->GetI420()->DataU(), buffer->GetI420()->StrideU(),
-		buffer->GetI420()->DataV(), buffer->GetI420()->StrideV(),
-		image_.get(),
-		bmi_.bmiHeader.biWidth *
-		bmi_.bmiHeader.biBitCount / 8,
-		buffer->width(), buffer->height());
+void ServerMainWindow::ServerVideoRenderer::OnFrame(const webrtc::VideoFrame& video_frame)
+{
+	converted_frames_.back().Convert(*video_frame.video_frame_buffer()->ToI420(),
+		video_frame.rotation());
 
+	converted_frames_.Publish();
 	InvalidateRect(wnd_, NULL, TRUE);
 }
\ No newline at end of file
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <string.h>
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <thread>
@@ -28,6 +29,14 @@
 
 #include "libyuv/convert.h"
 
+#include "frame_recording.h"
+#include "frame_source.h"
+#include "frame_stamp.h"
+#include "latency_tracer.h"
+
+// from SignalingClient
+#include "stream_metrics.h"
+
 using namespace webrtc;
 
 namespace StreamingToolkit
@@ -63,6 +72,30 @@ namespace StreamingToolkit
 		bool IsScreencast() const override;
 		bool GetPreferredFourccs(std::vector<uint32_t>* fourccs) override;
 
+		// Records every sent frame and its prediction timestamp, the recorder
+		// must be opened in I420 format with the capture size.
+		void SetFrameRecorder(std::shared_ptr<FrameRecorder> recorder);
+
+		// Sets the peer id used to key the latency tracer events.
+		void SetTracePeerId(int32_t peer_id);
+
+		// Id of the next frame, as reported to the latency tracer.
+		int64_t trace_frame_id() const;
+
+		// Counts the sent frames and times their hand-off to the encoder.
+		void SetStreamMetrics(std::shared_ptr<StreamMetrics> metrics);
+
+		// Draws a timestamp and frame counter into every sent frame, so that
+		// clients can measure the glass to glass latency.
+		void SetFrameStampEnabled(bool enabled);
+
+		// Sends the frames as the given source, e.g. the source of another
+		// capturer rendering the same view, so that their peers can share an
+		// encoder session. Capturers are sources of their own by default.
+		void SetFrameSource(const FrameSource& source);
+
+		const FrameSource& frame_source() const;
+
 		void AddOrUpdateSink(rtc::VideoSinkInterface<VideoFrame>* sink,
 			const rtc::VideoSinkWants& wants) override;
 
@@ -73,11 +106,23 @@ namespace StreamingToolkit
 	protected:
 		virtual void SendFrame(webrtc::VideoFrame video_frame);
 
+		// Frames need I420 content for the software encoder or for recording.
+		bool ShouldConvertToI420() const;
+
 		Clock* const clock_;
 		bool use_software_encoder_;
 		bool running_;
 		rtc::VideoSinkInterface<VideoFrame>* sink_;
 		SinkWantsObserver* sink_wants_observer_;
+		std::shared_ptr<FrameRecorder> frame_recorder_;
+
+		// Set and read from the render, capture and conductor threads.
+		std::atomic<int32_t> trace_peer_id_;
+		std::atomic<int64_t> trace_frame_id_;
+
+		std::atomic<bool> frame_stamp_enabled_;
+		FrameSource frame_source_;
+		std::shared_ptr<StreamMetrics> stream_metrics_;
 		rtc::CriticalSection lock_;
 	};
 }
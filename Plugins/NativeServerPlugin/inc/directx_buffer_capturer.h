@@ -10,16 +10,26 @@
 
 #pragma once
 
+#include <atomic>
 #include <d3d11_4.h>
+#include <memory>
+#include <thread>
 #include <wrl\client.h>
 #include <wrl\wrappers\corewrappers.h>
 
 #include "macros.h"
 #include "buffer_capturer.h"
+#include "depth_codec.h"
+#include "gpu_timer.h"
+#include "shared_texture_bridge.h"
 
 // For unit tests.
 FOWARD_DECLARE(BufferCapturerTests, CaptureFrameUsingDirectXBufferCapturer);
 FOWARD_DECLARE(BufferCapturerTests, CaptureFrameStereoUsingDirectXBufferCapturer);
+FOWARD_DECLARE(BufferCapturerTests, CaptureFrameFromTextureArrayUsingDirectXBufferCapturer);
+FOWARD_DECLARE(BufferCapturerTests, MeasuresStereoCopyGpuTime);
+FOWARD_DECLARE(BufferCapturerTests, CaptureFrameWithDepthUsingDirectXBufferCapturer);
+FOWARD_DECLARE(BufferCapturerTests, CaptureFrameThroughSharedTexturesUsingDirectXBufferCapturer);
 
 namespace StreamingToolkit
 {
@@ -27,26 +37,86 @@ namespace StreamingToolkit
 	class DirectXBufferCapturer : public BufferCapturer
 	{
 	public:
-		explicit DirectXBufferCapturer(ID3D11Device* d3d_device);
+		// With shared textures, the frames are copied from the given device to
+		// a capture device of its own, and read back by a capture thread.
+		explicit DirectXBufferCapturer(ID3D11Device* d3d_device, bool use_shared_textures = false);
 
-		virtual ~DirectXBufferCapturer() {}
+		virtual ~DirectXBufferCapturer();
 
+		cricket::CaptureState Start(const cricket::VideoFormat& capture_format) override;
+
+		void Stop() override;
+
+		// Sends a mono frame, a side by side stereo frame or a texture array
+		// with one slice per eye, such as rendered in a single stereo pass.
 		void SendFrame(ID3D11Texture2D* frame_buffer, int64_t prediction_time_stamp = -1);
 
 		void SendFrame(ID3D11Texture2D* left_frame_buffer, ID3D11Texture2D* right_frame_buffer, int64_t prediction_time_stamp = -1);
 
+		// Sends a frame with its depth buffer, of the same size, which is drawn
+		// in a band below the color while depth streaming is enabled. The depth
+		// buffer must be D24_UNORM_S8_UINT or D32_FLOAT. Not supported with
+		// shared textures, which only send the color.
+		void SendFrameWithDepth(ID3D11Texture2D* frame_buffer, ID3D11Texture2D* depth_buffer, int64_t prediction_time_stamp = -1);
+
+		void SetDepthEnabled(bool enabled);
+
+		// GPU time of the copies into the staging frame buffer.
+		GpuTimerStats GetCopyGpuStats() const;
+
+		bool use_shared_textures() const
+		{
+			return shared_textures_ != nullptr;
+		}
+
+		// Lock hold times of the shared textures, when used.
+		SharedTextureStats GetSharedTextureStats() const;
+
 	private:
-		void UpdateStagingBuffer(ID3D11Texture2D* frame_buffer);
+		// Sends the frames published to the shared textures.
+		void CaptureThread();
+
+		void SendStagingFrame(int64_t render_time_us, int64_t prediction_time_stamp);
+
+		// Leaves the given number of rows below the frame for the depth band.
+		void UpdateStagingBuffer(ID3D11Texture2D* frame_buffer, UINT band_height = 0);
 
 		void UpdateStagingBuffer(ID3D11Texture2D* left_frame_buffer, ID3D11Texture2D* right_frame_buffer);
 
+		void StampStagingBuffer(int64_t render_time_us);
+
+		void UpdateStagingDepthBuffer(ID3D11Texture2D* depth_buffer);
+
+		// Draws the depth band below the color of the staging frame buffer.
+		void WriteDepthBand(UINT color_height);
+
+		// Blanks the depth band, marker included, so that clients don't use
+		// the depth of a previous frame.
+		void ClearDepthBand(UINT color_height);
+
+		// Declared first, since it creates the capture device.
+		std::unique_ptr<SharedTextureBridge> shared_textures_;
+		std::atomic<bool> capturing_;
+		std::thread capture_thread_;
 		Microsoft::WRL::ComPtr<ID3D11Device> d3d_device_;
 		Microsoft::WRL::ComPtr<ID3D11DeviceContext> d3d_context_;
 		Microsoft::WRL::ComPtr<ID3D11Texture2D> staging_frame_buffer_;
 		D3D11_TEXTURE2D_DESC staging_frame_buffer_desc_;
 
+		// Rows of the staging frame buffer holding the color, above the depth band.
+		UINT staging_color_height_;
+		GpuTimer copy_timer_;
+		std::atomic<bool> depth_enabled_;
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> staging_depth_buffer_;
+		D3D11_TEXTURE2D_DESC staging_depth_buffer_desc_;
+		DepthFrame depth_frame_;
+
 		// For unit tests.
 		FRIEND_TEST(BufferCapturerTests, CaptureFrameUsingDirectXBufferCapturer);
 		FRIEND_TEST(BufferCapturerTests, CaptureFrameStereoUsingDirectXBufferCapturer);
+		FRIEND_TEST(BufferCapturerTests, CaptureFrameFromTextureArrayUsingDirectXBufferCapturer);
+		FRIEND_TEST(BufferCapturerTests, MeasuresStereoCopyGpuTime);
+		FRIEND_TEST(BufferCapturerTests, CaptureFrameWithDepthUsingDirectXBufferCapturer);
+		FRIEND_TEST(BufferCapturerTests, CaptureFrameThroughSharedTexturesUsingDirectXBufferCapturer);
 	};
 }
@@ -8,11 +8,15 @@
 class DirectXMultiPeerConductor : public MultiPeerConductor
 {
 public:
-	DirectXMultiPeerConductor(shared_ptr<FullServerConfig> config, ID3D11Device* d3d_device);
+	// With shared textures, each peer reads its frames back on a capture
+	// device of its own rather than on the given one.
+	DirectXMultiPeerConductor(shared_ptr<FullServerConfig> config, ID3D11Device* d3d_device,
+		bool use_shared_textures = false);
 
 private:
-	// Handles creation of a new peer entry in connected_peers_ if needed
-	scoped_refptr<PeerConductor> SafeAllocatePeerMapEntry(int peer_id) override;
+	// Creates a DirectX peer conductor not assigned to a peer yet
+	scoped_refptr<PeerConductor> AllocatePeerConductor() override;
 
 	ComPtr<ID3D11Device> d3d_device_;
+	const bool use_shared_textures_;
 };
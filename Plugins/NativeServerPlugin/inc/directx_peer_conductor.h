@@ -13,17 +13,36 @@ public:
 		shared_ptr<WebRTCConfig> webrtc_config,
 		scoped_refptr<PeerConnectionFactoryInterface> peer_factory,
 		const function<void(const string&)>& send_func,
-		ID3D11Device* d3d_device);
+		ID3D11Device* d3d_device,
+		bool use_shared_textures = false);
 
 	void SendFrame(ID3D11Texture2D* frame_buffer, int64_t prediction_time_stamp = -1);
 
 	void SendFrame(ID3D11Texture2D* left_frame_buffer, ID3D11Texture2D* right_frame_buffer, int64_t prediction_time_stamp = -1);
 
+	void SendFrameWithDepth(ID3D11Texture2D* frame_buffer, ID3D11Texture2D* depth_buffer, int64_t prediction_time_stamp = -1);
+
+	// Stamps the sent frames for glass to glass latency measurements.
+	void SetFrameStampEnabled(bool enabled);
+
+	// Streams the depth buffer in a band below the color.
+	void SetDepthEnabled(bool enabled);
+
+	// GPU time spent copying the sent frames for capture.
+	GpuTimerStats GetCopyGpuStats() const;
+
+	// Lock hold times of the textures shared with the capture device.
+	SharedTextureStats GetSharedTextureStats() const;
+
 protected:
 	// Provide the same buffer capturer for each single video track
 	virtual unique_ptr<cricket::VideoCapturer> AllocateVideoCapturer() override;
 
+	// Traces the frames of a pre-warmed capturer with the id of its peer.
+	virtual void OnAssigned() override;
+
 private:
 	ID3D11Device* d3d_device_;
+	const bool use_shared_textures_;
 	DirectXBufferCapturer* capturer_;
 };
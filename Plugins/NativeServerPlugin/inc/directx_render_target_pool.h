@@ -0,0 +1,34 @@
+#pragma once
+
+#include <d3d11.h>
+#include <memory>
+#include <wrl\client.h>
+
+#include "render_target_pool.h"
+
+namespace StreamingToolkit
+{
+	// Color and depth stencil buffers a peer is rendered to. Stereo render
+	// targets hold both eyes side by side.
+	struct DirectXRenderTarget
+	{
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+		Microsoft::WRL::ComPtr<ID3D11RenderTargetView> render_target_view;
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> depth_stencil_texture;
+		Microsoft::WRL::ComPtr<ID3D11DepthStencilView> depth_stencil_view;
+
+		// Video memory of both buffers.
+		size_t bytes;
+	};
+
+	typedef RenderTargetPool<DirectXRenderTarget> DirectXRenderTargetPool;
+
+	// Creates the pool of the render targets of the peers, allocated on the
+	// given device with a D24S8 depth stencil buffer.
+	std::unique_ptr<DirectXRenderTargetPool> CreateDirectXRenderTargetPool(
+		ID3D11Device* device, size_t high_water_mark);
+
+	// Returns the key of the render target of a peer, with the width of a
+	// single eye.
+	RenderTargetKey GetDirectXRenderTargetKey(int width, int height, bool stereo);
+}
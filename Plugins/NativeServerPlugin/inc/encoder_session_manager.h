@@ -0,0 +1,159 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include "structs.h"
+#include "webrtc/api/video_codecs/video_encoder.h"
+#include "webrtc/media/engine/webrtcvideoencoderfactory.h"
+
+namespace StreamingToolkit
+{
+	class EncoderSession;
+	class SharedSessionEncoder;
+
+	// Frames and encode parameters under which two encoders produce the same
+	// stream.
+	struct EncoderSessionKey
+	{
+		// Id of the FrameSource of the frames, 0 if unknown.
+		int64_t source_id;
+		int width;
+		int height;
+		int max_framerate;
+		uint32_t max_bitrate_kbps;
+
+		bool operator==(const EncoderSessionKey& other) const
+		{
+			return source_id == other.source_id && width == other.width && height == other.height &&
+				max_framerate == other.max_framerate && max_bitrate_kbps == other.max_bitrate_kbps;
+		}
+	};
+
+	// Usage of the encoder sessions.
+	struct EncoderSessionStats
+	{
+		// Sessions open, each holding an encoder, e.g. an NVENC session.
+		size_t sessions;
+
+		// Limit of the open sessions, 0 if unlimited.
+		size_t max_sessions;
+
+		// Highest number of sessions open at once.
+		size_t peak_sessions;
+
+		// Encoders sending the stream of a session.
+		size_t encoders;
+
+		// Encoders waiting for a session, which send no frames meanwhile.
+		size_t queued;
+
+		bool share_sessions;
+	};
+
+	// Hands out the encoders of the peers, limiting the sessions open at once,
+	// since consumer GPUs cap the concurrent NVENC sessions. Encoders beyond
+	// the limit are queued, in order, until a session closes. When sharing is
+	// enabled, encoders take their session at their first frame, and those
+	// sent the frames of the same FrameSource with identical parameters are
+	// attached to the same session, which encodes the frames of its first
+	// encoder only and sends the stream to all of them. Frames of no known
+	// source are never shared. Thread safe, encoders are driven from the
+	// worker threads.
+	class EncoderSessionManager : public std::enable_shared_from_this<EncoderSessionManager>
+	{
+	public:
+		typedef std::function<std::unique_ptr<webrtc::VideoEncoder>()> Allocator;
+
+		// Called when the usage changes, on the thread of the encoder which
+		// changed it.
+		typedef std::function<void(const EncoderSessionStats&)> UsageCallback;
+
+		// Creates the H.264 encoders of the webrtc build, i.e. NVENC when
+		// supported by the device.
+		static std::unique_ptr<webrtc::VideoEncoder> CreateH264Encoder();
+
+		// A zero max_sessions doesn't limit the sessions.
+		EncoderSessionManager(const Allocator& allocator, size_t max_sessions, bool share_sessions);
+
+		// Creates an encoder for webrtc, which gets a session once initialized.
+		webrtc::VideoEncoder* CreateEncoder();
+
+		void SetUsageCallback(const UsageCallback& callback);
+
+		// Sets the encoder profiles, the sessions forcing an IDR frame every
+		// idr_period frames of the profile of their resolution. Applies to
+		// the open sessions as well.
+		void SetEncoderConfig(std::shared_ptr<const NvEncConfig> config);
+
+		EncoderSessionStats GetStats() const;
+
+	private:
+		friend class SharedSessionEncoder;
+
+		// Attaches the encoder to a session, or queues it if none is left, in
+		// which case it returns WEBRTC_VIDEO_CODEC_OK with a null session.
+		int32_t Acquire(SharedSessionEncoder* encoder, int64_t source_id, const webrtc::VideoCodec& codec_settings,
+			int32_t number_of_cores, size_t max_payload_size, std::shared_ptr<EncoderSession>* session);
+
+		// Opens a session for the encoder, out of the lock since allocating
+		// and initializing an encoder is slow.
+		int32_t Open(SharedSessionEncoder* encoder, const EncoderSessionKey& key,
+			const webrtc::VideoCodec& codec_settings, int32_t number_of_cores, size_t max_payload_size,
+			std::shared_ptr<EncoderSession>* session);
+
+		// Detaches the encoder from its session, if any, closing the session
+		// once no encoder is left, and removes it from the queue. Detaching
+		// and closing are done out of the lock, since both wait for the
+		// session threads.
+		void Release(SharedSessionEncoder* encoder, std::shared_ptr<EncoderSession> session);
+
+		void NotifyUsage(const EncoderSessionStats& stats);
+
+		EncoderSessionStats GetStatsLocked() const;
+
+		// Gets the IDR period of the sessions with the key, 0 if unset.
+		uint32_t GetIdrPeriodLocked(const EncoderSessionKey& key) const;
+
+		const Allocator allocator_;
+		const size_t max_sessions_;
+		const bool share_sessions_;
+
+		mutable std::mutex mutex_;
+		std::vector<std::shared_ptr<EncoderSession>> sessions_;
+
+		// Keys of the sessions being opened, and the number of sessions being
+		// closed, which count toward the limit.
+		std::vector<EncoderSessionKey> opening_;
+		size_t closing_;
+		std::list<SharedSessionEncoder*> queue_;
+		size_t peak_sessions_;
+		std::shared_ptr<const NvEncConfig> encoder_config_;
+
+		std::mutex callback_mutex_;
+		UsageCallback usage_callback_;
+	};
+
+	// Creates the encoders of a peer connection factory from a shared
+	// EncoderSessionManager. Peer connection factories take the ownership of
+	// their encoder factory, so each needs its own.
+	class SharedSessionEncoderFactory : public cricket::WebRtcVideoEncoderFactory
+	{
+	public:
+		explicit SharedSessionEncoderFactory(std::shared_ptr<EncoderSessionManager> manager);
+
+		webrtc::VideoEncoder* CreateVideoEncoder(const cricket::VideoCodec& codec) override;
+
+		const std::vector<cricket::VideoCodec>& supported_codecs() const override;
+
+		void DestroyVideoEncoder(webrtc::VideoEncoder* encoder) override;
+
+	private:
+		std::shared_ptr<EncoderSessionManager> manager_;
+		std::vector<cricket::VideoCodec> supported_codecs_;
+	};
+}
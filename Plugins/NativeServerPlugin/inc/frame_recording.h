@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "webrtc/api/video/video_frame.h"
+#include "webrtc/rtc_base/criticalsection.h"
+
+#include "memory_mapped_file.h"
+
+namespace StreamingToolkit
+{
+	// Frame recording file layout:
+	//   FrameRecordingHeader
+	//   FrameRecordingEntry + payload (repeated)
+	// I420 payloads are tightly packed Y, U and V planes, H.264 payloads are
+	// Annex B access units.
+	enum class FrameRecordingFormat : uint32_t
+	{
+		kI420 = 0,
+		kH264 = 1
+	};
+
+#pragma pack(push, 1)
+	struct FrameRecordingHeader
+	{
+		char magic[4];
+		uint32_t version;
+		FrameRecordingFormat format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t fps;
+		uint64_t reserved;
+	};
+
+	struct FrameRecordingEntry
+	{
+		uint32_t payload_size;
+		uint32_t flags;
+		int64_t capture_time_ms;
+		int64_t prediction_timestamp;
+	};
+#pragma pack(pop)
+
+	static_assert(sizeof(FrameRecordingHeader) == 32, "Unexpected frame recording header size");
+	static_assert(sizeof(FrameRecordingEntry) == 24, "Unexpected frame recording entry size");
+
+	const char kFrameRecordingMagic[4] = { '3', 'D', 'S', 'R' };
+	const uint32_t kFrameRecordingVersion = 1;
+	const uint32_t kFrameRecordingKeyFrameFlag = 0x1;
+
+	// A single recorded frame, pointing into the memory mapped recording.
+	struct RecordedFrame
+	{
+		const uint8_t* data;
+		size_t size;
+		bool key_frame;
+		int64_t capture_time_ms;
+		int64_t prediction_timestamp;
+	};
+
+	// Records frames and their prediction timestamps to a frame recording file.
+	class FrameRecorder
+	{
+	public:
+		FrameRecorder();
+
+		~FrameRecorder();
+
+		bool Open(const std::string& path, FrameRecordingFormat format, int width, int height, int fps);
+
+		void Close();
+
+		bool IsOpen() const;
+
+		// Records an I420 frame, the frame is skipped if its size doesn't match.
+		bool RecordFrame(const webrtc::VideoFrame& video_frame);
+
+		// Records an encoded H.264 access unit.
+		bool RecordEncodedFrame(const uint8_t* data, size_t size, bool key_frame,
+			int64_t capture_time_ms, int64_t prediction_timestamp);
+
+		size_t frame_count() const;
+
+	private:
+		bool WriteEntry(const FrameRecordingEntry& entry);
+
+		FILE* file_;
+		FrameRecordingFormat format_;
+		int width_;
+		int height_;
+		size_t frame_count_;
+		int64_t first_capture_time_ms_;
+		rtc::CriticalSection lock_;
+	};
+
+	// Reads a frame recording, or a raw H.264 elementary stream, through a
+	// memory mapping so that frames can be replayed without copies.
+	class FrameRecordingReader
+	{
+	public:
+		FrameRecordingReader();
+
+		// Opens a frame recording written by FrameRecorder.
+		bool Open(const std::string& path);
+
+		// Opens an Annex B elementary stream, such as the video test runner
+		// output, timestamps are synthesized from the frame rate.
+		bool OpenH264ElementaryStream(const std::string& path, int width, int height, int fps);
+
+		FrameRecordingFormat format() const;
+
+		int width() const;
+
+		int height() const;
+
+		int fps() const;
+
+		size_t frame_count() const;
+
+		const RecordedFrame& frame(size_t index) const;
+
+		// Hints the OS to page in the given frame ahead of its use.
+		void Prefetch(size_t index) const;
+
+	private:
+		MemoryMappedFile file_;
+		FrameRecordingFormat format_;
+		int width_;
+		int height_;
+		int fps_;
+		std::vector<RecordedFrame> frames_;
+	};
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/api/video/video_frame_buffer.h"
+
+namespace StreamingToolkit
+{
+	// Source of video frames, e.g. a capturer, whose frame buffers can be
+	// traced back to it by the encoders. Encoder sessions are only shared by
+	// the peers sent the frames of the same source. Copies are the same
+	// source, e.g. for capturers sending the same view to spectators.
+	class FrameSource
+	{
+	public:
+		// Creates a source of its own.
+		FrameSource();
+
+		FrameSource(const FrameSource& other);
+
+		FrameSource& operator=(const FrameSource& other);
+
+		int64_t id() const;
+
+		// Creates a frame buffer of the source, thread safe.
+		rtc::scoped_refptr<webrtc::I420Buffer> CreateI420Buffer(int width, int height) const;
+
+		// Gets the id of the source of the buffer, or 0 if it wasn't created
+		// by a source, e.g. once scaled by webrtc.
+		static int64_t GetSourceId(const webrtc::VideoFrameBuffer* buffer);
+
+	private:
+		std::atomic<int64_t> id_;
+	};
+}
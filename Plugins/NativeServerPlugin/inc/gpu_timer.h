@@ -0,0 +1,74 @@
+#pragma once
+
+#include <d3d11.h>
+#include <stdint.h>
+#include <wrl\client.h>
+
+namespace StreamingToolkit
+{
+	// GPU durations measured over the last frames, in microseconds.
+	struct GpuTimerStats
+	{
+		// Number of measurements in the window.
+		size_t count;
+
+		int64_t last_us;
+		int64_t average_us;
+		int64_t max_us;
+
+		// Number of measurements lost since the timer was created, because
+		// the GPU was too far behind or the timestamps were disjoint.
+		uint64_t dropped;
+	};
+
+	// Measures the GPU time of a sequence of commands with timestamp queries.
+	// The queries of the last frames are kept in flight and read back without
+	// flushing, so measuring never stalls the pipeline. Must be used on the
+	// thread of the device context.
+	class GpuTimer
+	{
+	public:
+		// Number of frames whose queries can be in flight.
+		static const int kQueryFrames = 4;
+
+		// Number of measurements kept for the stats.
+		static const int kWindowSize = 120;
+
+		explicit GpuTimer(ID3D11Device* device);
+
+		// Starts measuring the commands issued on the context.
+		void Begin(ID3D11DeviceContext* context);
+
+		// Stops measuring and reads back the completed measurements.
+		void End(ID3D11DeviceContext* context);
+
+		GpuTimerStats GetStats() const;
+
+	private:
+		struct QueryFrame
+		{
+			Microsoft::WRL::ComPtr<ID3D11Query> disjoint;
+			Microsoft::WRL::ComPtr<ID3D11Query> begin;
+			Microsoft::WRL::ComPtr<ID3D11Query> end;
+			bool pending;
+		};
+
+		// Reads back the oldest measurements which completed.
+		void ReadBack(ID3D11DeviceContext* context);
+
+		void AddMeasurement(int64_t duration_us);
+
+		QueryFrame frames_[kQueryFrames];
+		bool valid_;
+
+		// Frame being measured, and oldest frame not read back yet.
+		int current_;
+		int oldest_;
+
+		int64_t window_[kWindowSize];
+		size_t window_count_;
+		size_t window_next_;
+		int64_t last_us_;
+		uint64_t dropped_;
+	};
+}
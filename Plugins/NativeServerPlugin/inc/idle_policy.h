@@ -0,0 +1,85 @@
+#pragma once
+
+#include <mutex>
+#include <stdint.h>
+
+namespace StreamingToolkit
+{
+	struct IdlePolicyParams
+	{
+		// Time without input after which a peer is idle, 0 to never idle.
+		int idle_timeout_ms;
+
+		// Rate at which the last frame is repeated to idle peers.
+		int keep_alive_fps;
+	};
+
+	struct IdlePolicyStats
+	{
+		bool idle;
+
+		// Number of times the peer went idle.
+		uint64_t idle_periods;
+
+		// Time spent idle, not counting the current period.
+		int64_t idle_time_us;
+
+		// Frames repeated to keep the stream alive.
+		uint64_t keep_alive_frames;
+
+		// Frames which would have been rendered and encoded at the full rate
+		// while idle.
+		uint64_t skipped_frames;
+	};
+
+	// Decides when to send frames to a peer, so that a peer which sent no
+	// input for a while stops costing render and encoder time. Active peers
+	// get new frames at the full rate. Idle ones get their last frame repeated
+	// at the keep-alive rate, which keeps the stream and its bandwidth
+	// estimation alive for almost no bits, until the next input brings them
+	// back to the full rate. Only the input is watched, so idling suits the
+	// scenes which change with the input only, it's off by default. Thread
+	// safe.
+	class IdlePolicy
+	{
+	public:
+		enum class FrameAction
+		{
+			// No frame is due.
+			kNone,
+
+			// A new frame is due.
+			kRender,
+
+			// The last frame is due again.
+			kRepeat
+		};
+
+		static IdlePolicyParams DefaultParams();
+
+		explicit IdlePolicy(const IdlePolicyParams& params = DefaultParams());
+
+		void SetParams(const IdlePolicyParams& params);
+
+		// Records an input from the client, which resumes the full rate
+		// immediately.
+		void OnInput(int64_t time_us);
+
+		// Returns the frame due at the given time, for the given full rate.
+		FrameAction GetFrameAction(int64_t time_us, int full_fps);
+
+		bool IsIdle() const;
+
+		IdlePolicyStats GetStats() const;
+
+	private:
+		mutable std::mutex mutex_;
+		IdlePolicyParams params_;
+		bool started_;
+		bool idle_;
+		int64_t last_input_us_;
+		int64_t idle_since_us_;
+		int64_t next_frame_us_;
+		IdlePolicyStats stats_;
+	};
+}
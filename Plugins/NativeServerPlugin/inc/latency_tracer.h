@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "webrtc/rtc_base/criticalsection.h"
+
+namespace StreamingToolkit
+{
+	// Server pipeline stages, in frame order.
+	enum class TraceStage : uint8_t
+	{
+		kRenderSubmit = 0,
+		kStagingCopy,
+		kMap,
+		kColorConvert,
+		kEncoderSubmit,
+		kBitstreamReady,
+		kRtpSend,
+		kCount
+	};
+
+	// A single timed stage of a frame.
+	struct TraceEvent
+	{
+		int64_t begin_us;
+		int64_t end_us;
+		int64_t frame_id;
+		int32_t peer_id;
+		uint32_t thread_id;
+		TraceStage stage;
+	};
+
+	// Rolling latency percentiles of a stage, in microseconds.
+	struct StageLatencyStats
+	{
+		TraceStage stage;
+		size_t count;
+		int64_t p50_us;
+		int64_t p95_us;
+		int64_t p99_us;
+	};
+
+	// Records per-stage frame timings into fixed size per-thread ring buffers.
+	// Recording never allocates or locks once a thread has its buffer, the
+	// exports walk all buffers off the hot path.
+	class LatencyTracer
+	{
+	public:
+		// Number of events kept per thread, must be a power of two.
+		static const size_t kEventsPerThread = 4096;
+
+		static LatencyTracer& Instance();
+
+		void SetEnabled(bool enabled);
+
+		bool IsEnabled() const;
+
+		// Window used for the rolling percentiles, in milliseconds.
+		void SetStatsWindowMs(int64_t window_ms);
+
+		void Record(int32_t peer_id, TraceStage stage, int64_t frame_id, int64_t begin_us, int64_t end_us);
+
+		// Returns the percentiles of every stage seen for the peer in the window.
+		std::vector<StageLatencyStats> GetStageStats(int32_t peer_id) const;
+
+		// Returns the ids of the peers seen in the window.
+		std::vector<int32_t> GetPeerIds() const;
+
+		// Exports all buffered events in the Chrome trace event format.
+		std::string ExportChromeTrace() const;
+
+		bool WriteChromeTrace(const std::string& path) const;
+
+		// Drops all buffered events.
+		void Clear();
+
+		static const char* StageName(TraceStage stage);
+
+	private:
+		struct ThreadBuffer
+		{
+			uint32_t thread_id;
+			std::atomic<uint64_t> write_index;
+			std::atomic<uint64_t> clear_index;
+			TraceEvent events[kEventsPerThread];
+		};
+
+		LatencyTracer();
+
+		ThreadBuffer* GetThreadBuffer();
+
+		void CollectEvents(int64_t since_us, std::vector<TraceEvent>* events) const;
+
+		std::atomic<bool> enabled_;
+		std::atomic<int64_t> stats_window_us_;
+		rtc::CriticalSection lock_;
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+	};
+
+	// Records the enclosing scope as a stage of a frame.
+	class ScopedTraceEvent
+	{
+	public:
+		ScopedTraceEvent(int32_t peer_id, TraceStage stage, int64_t frame_id);
+
+		~ScopedTraceEvent();
+
+	private:
+		const int32_t peer_id_;
+		const TraceStage stage_;
+		const int64_t frame_id_;
+		const int64_t begin_us_;
+	};
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace StreamingToolkit
+{
+	// Durations during which a lock was held, over the last frames, in
+	// microseconds.
+	struct LockHoldStats
+	{
+		// Number of measurements in the window.
+		size_t count;
+
+		int64_t last_us;
+		int64_t average_us;
+		int64_t max_us;
+	};
+
+	// Keeps the lock hold times of the last frames. Not thread safe.
+	class LockHoldWindow
+	{
+	public:
+		// Number of measurements kept for the stats.
+		static const int kWindowSize = 120;
+
+		LockHoldWindow();
+
+		void Add(int64_t duration_us);
+
+		LockHoldStats GetStats() const;
+
+	private:
+		int64_t window_[kWindowSize];
+		size_t count_;
+		size_t next_;
+		int64_t last_us_;
+	};
+}
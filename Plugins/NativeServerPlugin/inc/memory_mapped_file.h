@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace StreamingToolkit
+{
+	// Read-only memory mapping of a whole file.
+	class MemoryMappedFile
+	{
+	public:
+		MemoryMappedFile();
+
+		~MemoryMappedFile();
+
+		// Maps the file, returns false if the file can't be opened or is empty.
+		bool Open(const std::string& path);
+
+		void Close();
+
+		bool IsOpen() const;
+
+		const uint8_t* data() const;
+
+		size_t size() const;
+
+		// Hints the OS to page in the given range ahead of its use.
+		void Prefetch(size_t offset, size_t length) const;
+
+	private:
+		MemoryMappedFile(const MemoryMappedFile&) = delete;
+		MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+#ifdef _WIN32
+		void* file_handle_;
+		void* mapping_handle_;
+#else // _WIN32
+		int file_descriptor_;
+#endif // _WIN32
+		const uint8_t* data_;
+		size_t size_;
+	};
+}
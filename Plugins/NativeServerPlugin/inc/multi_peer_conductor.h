@@ -8,7 +8,10 @@
 #include <wrl\client.h>
 
 #include "peer_conductor.h"
+#include "peer_conductor_pool.h"
+#include "peer_factory_topology.h"
 #include "main_window.h"
+#include "metrics_endpoint.h"
 #include "peer_connection_client.h"
 
 #include "webrtc/rtc_base/sigslot.h"
@@ -38,6 +41,11 @@ public:
 
 	void SetDataChannelMessageHandler(const function<void(int, const string&)>& data_channel_handler);
 
+	// Changes the maximum number of peers, counting the connected ones against
+	// it, and reports the remaining capacity to the signalling server. A value
+	// below 1 stops reporting the capacity.
+	void SetMaxCapacity(int max_capacity);
+
 	virtual void OnSignedIn() override;
 
 	virtual void OnDisconnected() override;
@@ -83,9 +91,23 @@ public:
 	// Handles connection event from the signalling_client_
 	void HandleSignalConnect();
 
+	// Pre-warms the peers of the pool in the background, one per message of
+	// the current thread.
+	void FillPeerPool();
+
+	PeerConductorPoolStats GetPeerPoolStats() const;
+
+	// Gets the usage of the encoder sessions, empty if the peer connection
+	// factory was given.
+	EncoderSessionStats GetEncoderSessionStats() const;
+
+	// Sets the encoder profiles whose IDR period the encoder sessions apply,
+	// ignored if the peer connection factory was given.
+	void SetEncoderConfig(shared_ptr<const NvEncConfig> config);
+
 protected:
 	MultiPeerConductor(shared_ptr<FullServerConfig> config,
-		scoped_refptr<PeerConnectionFactoryInterface> peer_factory = webrtc::CreatePeerConnectionFactory());
+		scoped_refptr<PeerConnectionFactoryInterface> peer_factory = nullptr);
 	~MultiPeerConductor();
 
 	struct MessageEntry
@@ -95,13 +117,47 @@ protected:
 		MessageEntry(int p, const string& s) : peer(p), message(s) {}
 	};
 
-	// Handles creation of a new peer entry in connected_peers_ if needed
-	virtual scoped_refptr<PeerConductor> SafeAllocatePeerMapEntry(int peer_id) = 0;
+	// Message ids of the current thread.
+	static const uint32_t kSendMessageId = 0;
+	static const uint32_t kFillPeerPoolMessageId = 1;
+	static const uint32_t kEncoderUsageMessageId = 2;
+	static const uint32_t kMetricsMessageId = 3;
+
+	// Delay between two polls of the metrics.
+	static const int kMetricsIntervalMs = 1000;
+
+	// Handles creation of a new peer entry in connected_peers_ if needed,
+	// taking a pre-warmed peer if any
+	virtual scoped_refptr<PeerConductor> SafeAllocatePeerMapEntry(int peer_id);
+
+	// Creates a peer conductor not assigned to a peer yet
+	virtual scoped_refptr<PeerConductor> AllocatePeerConductor() = 0;
+
+	// Gets the factory of the next peer, spreading the peers over the worker
+	// threads
+	scoped_refptr<PeerConnectionFactoryInterface> NextPeerFactory();
+
+	// Caps the capacity by the encoder sessions left, if they are limited
+	int CapByEncoderSessions(int capacity) const;
+
+	// Reports the capacity to the signalling server, unless it is -1
+	void ReportCapacity(int capacity);
+
+	// Updates the metrics of the process and polls the ones of the peers
+	void PollMetrics();
 
 	int max_capacity_;
 	int cur_capacity_;
+	int reported_capacity_;
+
+	// The id we signed in with, to tell a resumed session from a new one
+	int signed_in_id_;
+	Thread* signaling_thread_;
 	PeerConnectionClient signalling_client_;
 	shared_ptr<FullServerConfig> config_;
+
+	// Outlives the peers and the factory, whose threads it owns.
+	unique_ptr<PeerFactoryTopology> topology_;
 	scoped_refptr<PeerConnectionFactoryInterface> peer_factory_;
 	map<int, scoped_refptr<PeerConductor>> connected_peers_;
 	map<int, PeerConnectionInterface::IceConnectionState> connected_peer_states_;
@@ -109,4 +165,9 @@ protected:
 	atomic_bool should_process_queue_;
 	function<void(int, const string&)> data_channel_handler_;
 	MainWindow* main_window_;
+	PeerConductorPool peer_pool_;
+
+	// Serves the metrics for scraping, if a port is configured.
+	unique_ptr<MetricsEndpoint> metrics_endpoint_;
+	bool polling_metrics_;
 };
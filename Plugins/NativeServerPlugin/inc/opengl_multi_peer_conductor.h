@@ -10,5 +10,7 @@ class OpenGLMultiPeerConductor : public MultiPeerConductor
 public:
 	OpenGLMultiPeerConductor(shared_ptr<FullServerConfig> config);
 
-	scoped_refptr<PeerConductor> SafeAllocatePeerMapEntry(int peer_id) override;
+private:
+	// Creates an OpenGL peer conductor not assigned to a peer yet
+	scoped_refptr<PeerConductor> AllocatePeerConductor() override;
 };
@@ -16,10 +16,16 @@ public:
 
 	void SendFrame(GLubyte* color_buffer, int width, int height);
 
+	// Stamps the sent frames for glass to glass latency measurements.
+	void SetFrameStampEnabled(bool enabled);
+
 protected:
 	// Provide the same buffer capturer for each single video track
 	virtual unique_ptr<cricket::VideoCapturer> AllocateVideoCapturer() override;
 
+	// Traces the frames of a pre-warmed capturer with the id of its peer.
+	virtual void OnAssigned() override;
+
 private:
 	OpenGLBufferCapturer* capturer_;
 };
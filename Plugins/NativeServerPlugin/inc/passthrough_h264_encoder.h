@@ -0,0 +1,99 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "webrtc/api/video/video_frame_buffer.h"
+#include "webrtc/api/video_codecs/video_encoder.h"
+#include "webrtc/media/engine/webrtcvideoencoderfactory.h"
+#include "webrtc/rtc_base/callback.h"
+
+namespace StreamingToolkit
+{
+	// Native frame buffer carrying an already encoded H.264 access unit.
+	class EncodedFrameBuffer : public webrtc::VideoFrameBuffer
+	{
+	public:
+		// The data must stay valid until no_longer_used is called.
+		EncodedFrameBuffer(int width, int height, const uint8_t* data, size_t size,
+			bool key_frame, const rtc::Callback0<void>& no_longer_used);
+
+		~EncodedFrameBuffer() override;
+
+		Type type() const override;
+
+		int width() const override;
+
+		int height() const override;
+
+		// Encoded buffers can't be converted, returns a black frame.
+		rtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override;
+
+		const uint8_t* data() const;
+
+		size_t size() const;
+
+		bool key_frame() const;
+
+		// Lets the encoder report its stages to the latency tracer.
+		void SetTraceInfo(int32_t peer_id, int64_t frame_id);
+
+		int32_t trace_peer_id() const;
+
+		int64_t trace_frame_id() const;
+
+	private:
+		const int width_;
+		const int height_;
+		const uint8_t* const data_;
+		const size_t size_;
+		const bool key_frame_;
+		int32_t trace_peer_id_;
+		int64_t trace_frame_id_;
+		rtc::Callback0<void> no_longer_used_cb_;
+	};
+
+	// Encoder that forwards EncodedFrameBuffer access units to the packetizer,
+	// so replayed sessions don't need an encoder at all.
+	class PassthroughH264Encoder : public webrtc::VideoEncoder
+	{
+	public:
+		PassthroughH264Encoder();
+
+		int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+			int32_t number_of_cores, size_t max_payload_size) override;
+
+		int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback* callback) override;
+
+		int32_t Release() override;
+
+		int32_t Encode(const webrtc::VideoFrame& frame,
+			const webrtc::CodecSpecificInfo* codec_specific_info,
+			const std::vector<webrtc::FrameType>* frame_types) override;
+
+		int32_t SetChannelParameters(uint32_t packet_loss, int64_t rtt) override;
+
+		const char* ImplementationName() const override;
+
+	private:
+		webrtc::EncodedImageCallback* encoded_image_callback_;
+		bool key_frame_requested_;
+	};
+
+	// Creates PassthroughH264Encoder instances, to be given to
+	// webrtc::CreatePeerConnectionFactory for replayed sessions.
+	class PassthroughVideoEncoderFactory : public cricket::WebRtcVideoEncoderFactory
+	{
+	public:
+		PassthroughVideoEncoderFactory();
+
+		webrtc::VideoEncoder* CreateVideoEncoder(const cricket::VideoCodec& codec) override;
+
+		const std::vector<cricket::VideoCodec>& supported_codecs() const override;
+
+		void DestroyVideoEncoder(webrtc::VideoEncoder* encoder) override;
+
+	private:
+		std::vector<cricket::VideoCodec> supported_codecs_;
+	};
+}
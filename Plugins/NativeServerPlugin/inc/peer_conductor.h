@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "buffer_capturer.h"
+#include "idle_policy.h"
 
 // from ConfigParser
 #include "structs.h"
@@ -87,8 +88,19 @@ public:
 
 	virtual void OnStateChange() override;
 
+	// Creates the peer connection if it wasn't pre-warmed, and the offer if
+	// required.
 	void AllocatePeerConnection(bool create_offer = false);
 
+	// Creates the peer connection ahead of the connection of a peer, with its
+	// video source, track and data channel, and starts gathering its host and
+	// STUN candidates, so that only the offer or answer is left to do once the
+	// peer connects. The peer is then assigned with Assign().
+	void Prewarm();
+
+	// Assigns a pre-warmed conductor to a connecting peer.
+	void Assign(int id, const string& name, const function<void(const string&)>& send_func);
+
 	bool HandlePeerMessage(const string& message);
 
 	virtual const bool IsConnected() const;
@@ -99,19 +111,53 @@ public:
 
 	const vector<scoped_refptr<webrtc::MediaStreamInterface>> Streams() const;
 
+	// Decides when frames are sent, every data channel message counting as
+	// an input from the client.
+	IdlePolicy* idle_policy();
+
+	// Bounds the bitrate of the video encoder, which the bandwidth
+	// estimation then picks within, to the ones of the given profile.
+	void SetEncoderProfile(const EncoderProfile& profile);
+
+	// Polls the statistics of the peer connection into the metrics of the
+	// peer, asynchronously.
+	void PollStats();
+
 protected:
 	// Allocates a buffer capturer for a single video track
 	virtual unique_ptr<cricket::VideoCapturer> AllocateVideoCapturer() = 0;
 
+	// Called once a pre-warmed conductor is assigned to a peer.
+	virtual void OnAssigned() {}
+
+	void ApplyEncoderProfile();
+
+	// Metrics of the peer, null until it's assigned.
+	shared_ptr<StreamMetrics> stream_metrics() const;
+
+	// Number of candidates gathered by a pre-warmed peer connection.
+	static const int kIceCandidatePoolSize = 4;
+
 	scoped_refptr<PeerConnectionInterface> peer_connection_;
 
 private:
+	void CreatePeerConnection(bool prewarm);
+
+	void CreateDataChannel();
+
 	int id_;
 	string name_;
 	shared_ptr<WebRTCConfig> webrtc_config_;
 	scoped_refptr<PeerConnectionFactoryInterface> peer_factory_;
 	function<void(const string&)> send_func_;
 	vector<scoped_refptr<webrtc::MediaStreamInterface>> peer_streams_;
+	IdlePolicy idle_policy_;
+	unique_ptr<EncoderProfile> encoder_profile_;
+	scoped_refptr<DataChannelInterface> data_channel_;
+	shared_ptr<StreamMetrics> stream_metrics_;
+
+	// Pre-warmed and not used for an offer or answer yet.
+	bool warm_;
 
 	// Names used for a IceCandidate JSON object.
 	const char* kCandidateSdpMidName = "sdpMid";
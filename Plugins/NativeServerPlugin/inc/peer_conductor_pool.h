@@ -0,0 +1,66 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <stdint.h>
+
+#include "peer_conductor.h"
+
+namespace StreamingToolkit
+{
+	// Usage of the pre-warmed peer conductors.
+	struct PeerConductorPoolStats
+	{
+		// Pre-warmed conductors waiting for a peer.
+		size_t warm;
+
+		uint64_t prewarmed;
+
+		// Connecting peers which got a pre-warmed conductor.
+		uint64_t hits;
+
+		// Connecting peers which found the pool empty.
+		uint64_t misses;
+	};
+
+	// Keeps peer conductors pre-warmed ahead of the connections, so that a
+	// connecting peer doesn't wait for its peer connection, video source and
+	// data channel to be created nor for its candidates to be gathered. The
+	// pool is filled one conductor at a time, so that a refill can be spread
+	// between frames. Not thread safe, expected to be used on the signaling
+	// thread.
+	class PeerConductorPool
+	{
+	public:
+		// Creates a conductor not assigned to a peer yet.
+		typedef std::function<scoped_refptr<PeerConductor>()> Allocator;
+
+		PeerConductorPool(const Allocator& allocator, size_t size);
+
+		// Takes the least recently pre-warmed conductor, or returns nullptr if
+		// the pool is empty.
+		scoped_refptr<PeerConductor> Acquire();
+
+		// Pre-warms a conductor if the pool isn't full, returning whether more
+		// are needed.
+		bool FillOne();
+
+		// Frees the pre-warmed conductors, e.g. once the factory is released.
+		void Clear();
+
+		PeerConductorPoolStats GetStats() const;
+
+		size_t size() const
+		{
+			return size_;
+		}
+
+	private:
+		const Allocator allocator_;
+		const size_t size_;
+		std::deque<scoped_refptr<PeerConductor>> warm_;
+		uint64_t prewarmed_;
+		uint64_t hits_;
+		uint64_t misses_;
+	};
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "encoder_session_manager.h"
+#include "structs.h"
+
+#include "webrtc/api/peerconnectioninterface.h"
+#include "webrtc/rtc_base/thread.h"
+
+namespace StreamingToolkit
+{
+	// Owns the threads of the peer connection factories, rather than letting
+	// each factory create its own. One factory is created per worker thread,
+	// all sharing the network thread, the signaling thread and, when limited
+	// or shared, the encoder sessions, and the peers are spread over them in
+	// turn. Threads can be
+	// pinned to cores, e.g. to keep the render and capture threads apart from
+	// the packetization. Created and used on the signaling thread.
+	class PeerFactoryTopology
+	{
+	public:
+		// Creates the threads and the factories from the server app config,
+		// with the current thread as the signaling thread.
+		explicit PeerFactoryTopology(const ServerAppConfig& config,
+			const EncoderSessionManager::Allocator& encoder_allocator = &EncoderSessionManager::CreateH264Encoder);
+
+		// Stops the threads, the factories must not be used anymore.
+		~PeerFactoryTopology();
+
+		// Gets the factory of the next peer, or nullptr if none could be created.
+		rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> NextFactory();
+
+		const std::vector<rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>>& factories() const;
+
+		std::shared_ptr<EncoderSessionManager> encoder_sessions() const;
+
+	private:
+		// Restricts the thread to the given cores, if any.
+		static void PinThread(rtc::Thread* thread, const std::vector<int>& cores);
+
+		std::shared_ptr<EncoderSessionManager> encoder_sessions_;
+		std::unique_ptr<rtc::Thread> network_thread_;
+		std::vector<std::unique_ptr<rtc::Thread>> worker_threads_;
+		std::vector<rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>> factories_;
+		size_t next_factory_;
+	};
+}
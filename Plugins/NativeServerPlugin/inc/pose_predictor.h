@@ -0,0 +1,80 @@
+#pragma once
+
+#include <deque>
+#include <stdint.h>
+
+namespace StreamingToolkit
+{
+	// Stereo camera pose sent by a client, with the matrices in the layout of
+	// the camera-transform-stereo-prediction message.
+	struct StereoPose
+	{
+		float projection_left[4][4];
+		float view_left[4][4];
+		float projection_right[4][4];
+		float view_right[4][4];
+
+		// Time the pose was predicted for, in client ticks.
+		int64_t timestamp;
+	};
+
+	// Extrapolates the poses of a client to the time the rendered frame will
+	// be displayed, so that network jitter doesn't turn into judder. Keeps a
+	// short history of received poses and assumes constant angular and linear
+	// velocities of the head over the prediction horizon.
+	//
+	// The horizon covers the time the latest pose waited on the server plus
+	// the latency of the rest of the pipeline, which is learned from the
+	// display errors reported by the client. Not thread safe.
+	class PosePredictor
+	{
+	public:
+		// Client timestamps are in 100 ns ticks, as Windows::Foundation::DateTime.
+		static const int64_t kTicksPerMicrosecond = 10;
+
+		PosePredictor(size_t history_size = 8, int64_t max_horizon_us = 100000);
+
+		// Adds a pose received at the given server time. Returns false if the
+		// pose is older than the latest one.
+		bool AddSample(const StereoPose& pose, int64_t receive_time_us);
+
+		// Predicts the pose displayed for a frame rendered now. The predicted
+		// pose is stamped with its timestamp in the client time base. Returns
+		// false if no pose was received.
+		bool Predict(int64_t now_us, StereoPose* pose) const;
+
+		// Adjusts the pipeline latency by the error reported by the client, the
+		// time between the timestamp of a displayed frame and the newest pose
+		// of the client at that time.
+		void AddDisplayError(int64_t error_us);
+
+		// Drops the history, e.g. after the client stopped sending poses.
+		void Reset();
+
+		int64_t latency_us() const
+		{
+			return latency_us_;
+		}
+
+		size_t size() const
+		{
+			return history_.size();
+		}
+
+	private:
+		struct Sample
+		{
+			StereoPose pose;
+			int64_t receive_time_us;
+		};
+
+		// Returns the oldest sample within the velocity window, or the previous
+		// one, if any.
+		const Sample* GetVelocitySample() const;
+
+		const size_t history_size_;
+		const int64_t max_horizon_us_;
+		int64_t latency_us_;
+		std::deque<Sample> history_;
+	};
+}
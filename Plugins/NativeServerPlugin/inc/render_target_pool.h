@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <stdint.h>
+
+namespace StreamingToolkit
+{
+	// Describes the render targets which can be used for one another.
+	struct RenderTargetKey
+	{
+		int width;
+		int height;
+		bool stereo;
+
+		// Native color format, e.g. a DXGI_FORMAT.
+		int format;
+
+		bool operator==(const RenderTargetKey& other) const
+		{
+			return width == other.width && height == other.height &&
+				stereo == other.stereo && format == other.format;
+		}
+	};
+
+	// Residency of the pooled render targets.
+	struct RenderTargetPoolStats
+	{
+		// Render targets held by the peers.
+		size_t in_use;
+
+		// Render targets kept for the next peers.
+		size_t idle;
+
+		// Highest number of render targets resident at once.
+		size_t peak_resident;
+
+		// Memory of the resident render targets.
+		uint64_t resident_bytes;
+
+		uint64_t allocations;
+		uint64_t reuses;
+
+		// Idle render targets freed to stay under the high-water mark.
+		uint64_t evictions;
+	};
+
+	// Keeps the render targets of the disconnected peers for the next ones,
+	// so that a reconnecting peer doesn't cost a texture allocation, which
+	// stalls the renderer and fragments the video memory. Released render
+	// targets stay idle as long as the resident ones are under the high-water
+	// mark, beyond which the least recently released are freed. The render
+	// targets in use are never freed, so the mark is exceeded while more peers
+	// are connected. The Target type must have a `bytes` member holding its
+	// size. Not thread safe.
+	template <typename Target>
+	class RenderTargetPool
+	{
+	public:
+		typedef std::function<std::unique_ptr<Target>(const RenderTargetKey&)> Allocator;
+
+		RenderTargetPool(const Allocator& allocator, size_t high_water_mark) :
+			allocator_(allocator),
+			high_water_mark_(high_water_mark),
+			in_use_(0),
+			peak_resident_(0),
+			resident_bytes_(0),
+			allocations_(0),
+			reuses_(0),
+			evictions_(0)
+		{
+		}
+
+		// Takes the most recently released render target matching the key, or
+		// allocates one. Returns nullptr if the allocation failed.
+		std::unique_ptr<Target> Acquire(const RenderTargetKey& key)
+		{
+			for (auto it = idle_.rbegin(); it != idle_.rend(); ++it)
+			{
+				if (it->key == key)
+				{
+					std::unique_ptr<Target> target = std::move(it->target);
+					idle_.erase(std::next(it).base());
+					in_use_++;
+					reuses_++;
+					return target;
+				}
+			}
+
+			// Makes room first, so that the allocation doesn't add to the
+			// idle render targets of other sizes.
+			Trim(high_water_mark_ > 0 ? high_water_mark_ - 1 : 0);
+			std::unique_ptr<Target> target = allocator_(key);
+			if (target)
+			{
+				in_use_++;
+				allocations_++;
+				resident_bytes_ += target->bytes;
+				peak_resident_ = (std::max)(peak_resident_, in_use_ + idle_.size());
+			}
+
+			return target;
+		}
+
+		// Returns the render target of a disconnected peer, acquired with the
+		// same key.
+		void Release(const RenderTargetKey& key, std::unique_ptr<Target> target)
+		{
+			if (!target)
+			{
+				return;
+			}
+
+			in_use_--;
+			IdleTarget idle;
+			idle.key = key;
+			idle.target = std::move(target);
+			idle_.push_back(std::move(idle));
+			Trim(high_water_mark_);
+		}
+
+		RenderTargetPoolStats GetStats() const
+		{
+			RenderTargetPoolStats stats;
+			stats.in_use = in_use_;
+			stats.idle = idle_.size();
+			stats.peak_resident = peak_resident_;
+			stats.resident_bytes = resident_bytes_;
+			stats.allocations = allocations_;
+			stats.reuses = reuses_;
+			stats.evictions = evictions_;
+			return stats;
+		}
+
+		size_t high_water_mark() const
+		{
+			return high_water_mark_;
+		}
+
+	private:
+		struct IdleTarget
+		{
+			RenderTargetKey key;
+			std::unique_ptr<Target> target;
+		};
+
+		// Frees the least recently released render targets until no more
+		// than the given number are resident.
+		void Trim(size_t max_resident)
+		{
+			while (!idle_.empty() && in_use_ + idle_.size() > max_resident)
+			{
+				resident_bytes_ -= idle_.front().target->bytes;
+				idle_.pop_front();
+				evictions_++;
+			}
+		}
+
+		const Allocator allocator_;
+		const size_t high_water_mark_;
+
+		// Ordered from the least to the most recently released.
+		std::list<IdleTarget> idle_;
+
+		size_t in_use_;
+		size_t peak_resident_;
+		uint64_t resident_bytes_;
+		uint64_t allocations_;
+		uint64_t reuses_;
+		uint64_t evictions_;
+	};
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "macros.h"
+#include "buffer_capturer.h"
+#include "frame_recording.h"
+
+// For unit tests.
+FOWARD_DECLARE(BufferCapturerTests, ReplayFramesUsingReplayBufferCapturer);
+
+namespace StreamingToolkit
+{
+	// Replays a frame recording or an H.264 elementary stream at a fixed rate,
+	// without rendering or GPU encoding. H.264 recordings require the peer
+	// connection factory to use PassthroughVideoEncoderFactory.
+	class ReplayBufferCapturer : public BufferCapturer
+	{
+	public:
+		// The reader may be shared between capturers. A zero fps replays at the
+		// recorded capture times. Starting fails if the reader has no frames.
+		ReplayBufferCapturer(std::shared_ptr<FrameRecordingReader> reader, int fps = 0, bool loop = true);
+
+		virtual ~ReplayBufferCapturer();
+
+		cricket::CaptureState Start(const cricket::VideoFormat& capture_format) override;
+
+		void Stop() override;
+
+		bool GetPreferredFourccs(std::vector<uint32_t>* fourccs) override;
+
+	private:
+		void ReplayThread();
+
+		webrtc::VideoFrame CreateFrame(size_t index, int64_t timestamp_us);
+
+		std::shared_ptr<FrameRecordingReader> reader_;
+		const int fps_;
+		const bool loop_;
+		std::atomic<bool> replaying_;
+		std::thread replay_thread_;
+
+		// For unit tests.
+		FRIEND_TEST(BufferCapturerTests, ReplayFramesUsingReplayBufferCapturer);
+	};
+}
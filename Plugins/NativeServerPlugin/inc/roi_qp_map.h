@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingToolkit
+{
+	// Point the user looks at, normalized to the viewport of an eye, with
+	// (0.5, 0.5) being the view center.
+	struct GazePoint
+	{
+		float x;
+		float y;
+	};
+
+	// Shape of the quality falloff around the gaze point. Distances are
+	// normalized to the viewport height of an eye, so the region of interest
+	// keeps its shape at any resolution or aspect ratio.
+	struct RoiQpMapParams
+	{
+		// Radius of the region encoded at full quality.
+		float full_quality_radius;
+
+		// Radius beyond which the quality is the lowest.
+		float falloff_radius;
+
+		// QP delta applied beyond the falloff radius, on top of the QP chosen
+		// by the rate control.
+		int8_t max_qp_delta;
+	};
+
+	// Generates the per-macroblock QP delta maps of foveated encoding: the
+	// macroblocks around the gaze point keep the QP chosen by the rate
+	// control and the QP rises linearly with the distance beyond, so the
+	// periphery of the frame, which the user can't see at full acuity, costs
+	// less bits. Stereo frames are expected side by side, with a gaze point
+	// per eye. Maps are only regenerated when the gaze or the layout changes.
+	// The H.264 encoder of the peers can't take the maps, so they're only
+	// evaluated by the video test runner. Not thread safe.
+	class RoiQpMap
+	{
+	public:
+		// Size in pixels of a H.264 macroblock.
+		static const int kMacroblockSize = 16;
+
+		static RoiQpMapParams DefaultParams();
+
+		explicit RoiQpMap(const RoiQpMapParams& params = DefaultParams());
+
+		// Sets the gaze point of each eye, only the left one is used in mono.
+		void SetGaze(const GazePoint& left, const GazePoint& right);
+
+		// Gaze points back to the view centers.
+		void ResetGaze();
+
+		// Returns the map of a frame, one signed QP delta per macroblock in
+		// raster scan order, as expected by NV_ENC_PIC_PARAMS::qpDeltaMap.
+		std::shared_ptr<const std::vector<int8_t>> Generate(int width, int height, bool stereo);
+
+		const RoiQpMapParams& params() const
+		{
+			return params_;
+		}
+
+		static int GetMacroblockCount(int width, int height);
+
+	private:
+		// QP delta at the given normalized distance from the gaze point.
+		int8_t GetQpDelta(float distance) const;
+
+		const RoiQpMapParams params_;
+		GazePoint gaze_[2];
+		bool dirty_;
+		int width_;
+		int height_;
+		bool stereo_;
+		std::shared_ptr<const std::vector<int8_t>> map_;
+	};
+}
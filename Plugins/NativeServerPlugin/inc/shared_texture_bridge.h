@@ -0,0 +1,118 @@
+#pragma once
+
+#include <condition_variable>
+#include <d3d11.h>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <wrl\client.h>
+
+#include "lock_hold_stats.h"
+
+namespace StreamingToolkit
+{
+	struct SharedTextureStats
+	{
+		// Time the renderer's device holds a slot to copy a frame into it.
+		LockHoldStats producer_hold;
+
+		// Time the capture device holds a slot to copy a frame out of it.
+		LockHoldStats consumer_hold;
+
+		// Frames sent by the renderer.
+		uint64_t published;
+
+		// Frames superseded by a newer one before they were captured, or which
+		// couldn't be copied.
+		uint64_t dropped;
+	};
+
+	// Hands the frames rendered on a device, e.g. Unity's one, over to a
+	// capture device through a ring of textures shared with keyed mutexes.
+	// The renderer's context only issues a GPU copy into a free slot, while
+	// the readback runs on the capture device, so mapping the frames never
+	// stalls the renderer nor contends for its immediate context. A single
+	// capture device per adapter is shared by the bridges of all the peers.
+	class SharedTextureBridge
+	{
+	public:
+		// Enough slots for the renderer to always find one which is neither
+		// being read nor the latest frame.
+		static const int kSlotCount = 3;
+
+		// Uses the capture device of the adapter of the renderer's one,
+		// creating it for the first bridge.
+		static std::unique_ptr<SharedTextureBridge> Create(ID3D11Device* producer_device);
+
+		ID3D11Device* consumer_device() const
+		{
+			return consumer_device_.Get();
+		}
+
+		// Copies a frame into a free slot, on the renderer's context. The frame
+		// is either a mono or side by side stereo texture, a texture array with
+		// one slice per eye, or the left eye when a right one is given. Returns
+		// false if the frame was dropped.
+		bool Publish(ID3D11Texture2D* left_frame_buffer, ID3D11Texture2D* right_frame_buffer,
+			int64_t render_time_us, int64_t prediction_time_stamp);
+
+		// Waits for a frame newer than the last acquired one and locks its slot
+		// for the capture device. Stereo frames are side by side.
+		bool Acquire(int timeout_ms, ID3D11Texture2D** frame_buffer,
+			int64_t* render_time_us, int64_t* prediction_time_stamp);
+
+		// Unlocks the acquired slot, once the copies out of it are issued.
+		void Release();
+
+		SharedTextureStats GetStats() const;
+
+	private:
+		enum class SlotState
+		{
+			kFree,
+			kWriting,
+			kPublished,
+			kReading
+		};
+
+		struct Slot
+		{
+			Microsoft::WRL::ComPtr<ID3D11Texture2D> producer_texture;
+			Microsoft::WRL::ComPtr<IDXGIKeyedMutex> producer_mutex;
+			Microsoft::WRL::ComPtr<ID3D11Texture2D> consumer_texture;
+			Microsoft::WRL::ComPtr<IDXGIKeyedMutex> consumer_mutex;
+			D3D11_TEXTURE2D_DESC desc;
+
+			// Key the keyed mutex was last released with.
+			UINT64 key;
+
+			SlotState state;
+			uint64_t sequence;
+			int64_t render_time_us;
+			int64_t prediction_time_stamp;
+		};
+
+		SharedTextureBridge(ID3D11Device* producer_device, ID3D11Device* consumer_device);
+
+		// Takes a free slot, or the oldest frame not acquired yet.
+		Slot* TakeSlotForWriting();
+
+		// Recreates the shared textures of a slot if the frame size changed.
+		bool UpdateSlot(Slot* slot, UINT width, UINT height, DXGI_FORMAT format);
+
+		Microsoft::WRL::ComPtr<ID3D11Device> producer_device_;
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> producer_context_;
+		Microsoft::WRL::ComPtr<ID3D11Device> consumer_device_;
+		Slot slots_[kSlotCount];
+		mutable std::mutex lock_;
+		std::condition_variable published_cond_;
+		uint64_t sequence_;
+		uint64_t acquired_sequence_;
+		Slot* reading_slot_;
+		int64_t reading_since_us_;
+		LockHoldWindow producer_hold_;
+		LockHoldWindow consumer_hold_;
+		uint64_t published_;
+		uint64_t dropped_;
+	};
+}
@@ -11,7 +11,10 @@ namespace StreamingToolkit
 		clock_(webrtc::Clock::GetRealTimeClock()),
 		running_(false),
 		sink_(nullptr),
-		sink_wants_observer_(nullptr)
+		sink_wants_observer_(nullptr),
+		trace_peer_id_(-1),
+		trace_frame_id_(0),
+		frame_stamp_enabled_(false)
 	{
 		use_software_encoder_ = webrtc::H264EncoderImpl::CheckDeviceNVENCCapability() != NVENCSTATUS::NV_ENC_SUCCESS;
 		set_enable_video_adapter(false);
@@ -70,6 +73,49 @@ namespace StreamingToolkit
 		return false;
 	}
 
+	void BufferCapturer::SetFrameRecorder(std::shared_ptr<FrameRecorder> recorder)
+	{
+		rtc::CritScope cs(&lock_);
+		frame_recorder_ = recorder;
+	}
+
+	void BufferCapturer::SetTracePeerId(int32_t peer_id)
+	{
+		trace_peer_id_ = peer_id;
+	}
+
+	int64_t BufferCapturer::trace_frame_id() const
+	{
+		return trace_frame_id_;
+	}
+
+	void BufferCapturer::SetStreamMetrics(std::shared_ptr<StreamMetrics> metrics)
+	{
+		rtc::CritScope cs(&lock_);
+		stream_metrics_ = metrics;
+	}
+
+	void BufferCapturer::SetFrameStampEnabled(bool enabled)
+	{
+		frame_stamp_enabled_ = enabled;
+	}
+
+	void BufferCapturer::SetFrameSource(const FrameSource& source)
+	{
+		frame_source_ = source;
+	}
+
+	const FrameSource& BufferCapturer::frame_source() const
+	{
+		return frame_source_;
+	}
+
+	bool BufferCapturer::ShouldConvertToI420() const
+	{
+		rtc::CritScope cs(&lock_);
+		return use_software_encoder_ || frame_recorder_;
+	}
+
 	bool BufferCapturer::GetPreferredFourccs(std::vector<uint32_t>* fourccs)
 	{
 		fourccs->push_back(cricket::FOURCC_H264);
@@ -84,13 +130,38 @@ namespace StreamingToolkit
 			return;
 		}
 
-		if (sink_)
+		std::shared_ptr<FrameRecorder> recorder;
+		std::shared_ptr<StreamMetrics> metrics;
 		{
-			sink_->OnFrame(video_frame);
+			rtc::CritScope cs(&lock_);
+			recorder = frame_recorder_;
+			metrics = stream_metrics_;
 		}
-		else
+
+		if (recorder)
+		{
+			recorder->RecordFrame(video_frame);
+		}
+
+		int64_t submit_start_us = metrics ? metrics->registry()->NowUs() : 0;
 		{
-			OnFrame(video_frame, video_frame.width(), video_frame.height());
+			// Covers the hand-off to the encoder, up to its input queue.
+			ScopedTraceEvent trace(trace_peer_id_, TraceStage::kEncoderSubmit, trace_frame_id_);
+			if (sink_)
+			{
+				sink_->OnFrame(video_frame);
+			}
+			else
+			{
+				OnFrame(video_frame, video_frame.width(), video_frame.height());
+			}
 		}
+
+		if (metrics)
+		{
+			metrics->OnFrameSubmitted(metrics->registry()->NowUs() - submit_start_us);
+		}
+
+		trace_frame_id_++;
 	}
 };
@@ -6,8 +6,19 @@
 using namespace Microsoft::WRL;
 using namespace StreamingToolkit;
 
-DirectXBufferCapturer::DirectXBufferCapturer(ID3D11Device* d3d_device) :
-	d3d_device_(d3d_device)
+namespace
+{
+	// Lets the capture thread check for stop requests while no frame is sent.
+	const int kSharedTextureTimeoutMs = 100;
+}
+
+DirectXBufferCapturer::DirectXBufferCapturer(ID3D11Device* d3d_device, bool use_shared_textures) :
+	shared_textures_(use_shared_textures ? SharedTextureBridge::Create(d3d_device) : nullptr),
+	capturing_(false),
+	d3d_device_(shared_textures_ ? shared_textures_->consumer_device() : d3d_device),
+	staging_color_height_(0),
+	copy_timer_(d3d_device_.Get()),
+	depth_enabled_(false)
 {
 	// Gets the device context.
 	d3d_device_->GetImmediateContext(&d3d_context_);
@@ -21,6 +32,36 @@ DirectXBufferCapturer::DirectXBufferCapturer(ID3D11Device* d3d_device) :
 #endif // MULTITHREAD_PROTECTION
 }
 
+DirectXBufferCapturer::~DirectXBufferCapturer()
+{
+	capturing_ = false;
+	if (capture_thread_.joinable())
+	{
+		capture_thread_.join();
+	}
+}
+
+cricket::CaptureState DirectXBufferCapturer::Start(const cricket::VideoFormat& capture_format)
+{
+	cricket::CaptureState state = BufferCapturer::Start(capture_format);
+	if (shared_textures_ && !capturing_.exchange(true))
+	{
+		capture_thread_ = std::thread(&DirectXBufferCapturer::CaptureThread, this);
+	}
+
+	return state;
+}
+
+void DirectXBufferCapturer::Stop()
+{
+	BufferCapturer::Stop();
+	capturing_ = false;
+	if (capture_thread_.joinable())
+	{
+		capture_thread_.join();
+	}
+}
+
 void DirectXBufferCapturer::SendFrame(ID3D11Texture2D* frame_buffer, int64_t prediction_time_stamp)
 {
 	// The video capturer hasn't started since there is no active connection.
@@ -29,88 +70,163 @@ void DirectXBufferCapturer::SendFrame(ID3D11Texture2D* frame_buffer, int64_t pre
 		return;
 	}
 
-	// Updates staging frame buffer.
-	UpdateStagingBuffer(frame_buffer);
-
-	// Creates webrtc frame buffer.
-	D3D11_TEXTURE2D_DESC desc;
-	staging_frame_buffer_->GetDesc(&desc);
-	rtc::scoped_refptr<webrtc::I420Buffer> buffer = 
-		webrtc::I420Buffer::Create(desc.Width, desc.Height);
+	int64_t render_time_us = frame_stamp_enabled_ ? FrameStampCodec::Now() : 0;
 
-	// For software encoder, converting to supported video format.
-	if (use_software_encoder_)
+	// Only issues a GPU copy on the renderer's context.
+	if (shared_textures_)
 	{
-		D3D11_MAPPED_SUBRESOURCE mapped;
-		if (SUCCEEDED(d3d_context_.Get()->Map(
-			staging_frame_buffer_.Get(), 0, D3D11_MAP_READ, 0, &mapped)))
-		{
-			libyuv::ABGRToI420(
-				(uint8_t*)mapped.pData,
-				desc.Width * 4,
-				buffer.get()->MutableDataY(),
-				buffer.get()->StrideY(),
-				buffer.get()->MutableDataU(),
-				buffer.get()->StrideU(),
-				buffer.get()->MutableDataV(),
-				buffer.get()->StrideV(),
-				desc.Width,
-				desc.Height);
+		shared_textures_->Publish(frame_buffer, nullptr, render_time_us, prediction_time_stamp);
+		return;
+	}
 
-			d3d_context_->Unmap(staging_frame_buffer_.Get(), 0);
-		}
+	// Updates staging frame buffer.
+	{
+		ScopedTraceEvent trace(trace_peer_id_, TraceStage::kStagingCopy, trace_frame_id_);
+		copy_timer_.Begin(d3d_context_.Get());
+		UpdateStagingBuffer(frame_buffer);
+		copy_timer_.End(d3d_context_.Get());
 	}
 
-	// Updates time stamp.
-	auto time_stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
-		std::chrono::system_clock::now().time_since_epoch()).count();
+	SendStagingFrame(render_time_us, prediction_time_stamp);
+}
 
-	// Creates video frame buffer.
-	auto frame = webrtc::VideoFrame(buffer, kVideoRotation_0, time_stamp);
-	frame.set_ntp_time_ms(clock_->CurrentNtpInMilliseconds());
-	frame.set_rotation(VideoRotation::kVideoRotation_0);
-	frame.set_prediction_timestamp(prediction_time_stamp);
+void DirectXBufferCapturer::SendFrame(ID3D11Texture2D* left_frame_buffer, ID3D11Texture2D* right_frame_buffer, int64_t prediction_time_stamp)
+{
+	// The video capturer hasn't started since there is no active connection.
+	if (!running_)
+	{
+		return;
+	}
 
-	// For hardware encoder, setting the video frame buffer.
-	if (!use_software_encoder_)
+	int64_t render_time_us = frame_stamp_enabled_ ? FrameStampCodec::Now() : 0;
+	if (shared_textures_)
 	{
-		D3D11_MAPPED_SUBRESOURCE mapped;
-		if (SUCCEEDED(d3d_context_.Get()->Map(
-			staging_frame_buffer_.Get(), 0, D3D11_MAP_READ, 0, &mapped)))
-		{
-			frame.set_frame_buffer((uint8_t*)mapped.pData);
-			d3d_context_->Unmap(staging_frame_buffer_.Get(), 0);
-		}
+		shared_textures_->Publish(left_frame_buffer, right_frame_buffer, render_time_us, prediction_time_stamp);
+		return;
 	}
 
-	// Sending video frame.
-	BufferCapturer::SendFrame(frame);
+	// Updates staging frame buffer.
+	{
+		ScopedTraceEvent trace(trace_peer_id_, TraceStage::kStagingCopy, trace_frame_id_);
+		copy_timer_.Begin(d3d_context_.Get());
+		UpdateStagingBuffer(left_frame_buffer, right_frame_buffer);
+		copy_timer_.End(d3d_context_.Get());
+	}
+
+	SendStagingFrame(render_time_us, prediction_time_stamp);
 }
 
-void DirectXBufferCapturer::SendFrame(ID3D11Texture2D* left_frame_buffer, ID3D11Texture2D* right_frame_buffer, int64_t prediction_time_stamp)
+void DirectXBufferCapturer::SendFrameWithDepth(ID3D11Texture2D* frame_buffer, ID3D11Texture2D* depth_buffer, int64_t prediction_time_stamp)
 {
+	if (!depth_enabled_ || !depth_buffer || shared_textures_)
+	{
+		SendFrame(frame_buffer, prediction_time_stamp);
+		return;
+	}
+
 	// The video capturer hasn't started since there is no active connection.
 	if (!running_)
 	{
 		return;
 	}
 
-	// Updates staging frame buffer.
-	UpdateStagingBuffer(left_frame_buffer, right_frame_buffer);
+	int64_t render_time_us = frame_stamp_enabled_ ? FrameStampCodec::Now() : 0;
+
+	// Copies the color and the depth of the same frame, so that they share
+	// the timestamps of a single video frame.
+	D3D11_TEXTURE2D_DESC desc;
+	frame_buffer->GetDesc(&desc);
+	{
+		ScopedTraceEvent trace(trace_peer_id_, TraceStage::kStagingCopy, trace_frame_id_);
+		copy_timer_.Begin(d3d_context_.Get());
+		UpdateStagingBuffer(frame_buffer, DepthCodec::GetBandHeight(desc.Height));
+		UpdateStagingDepthBuffer(depth_buffer);
+		copy_timer_.End(d3d_context_.Get());
+	}
+
+	WriteDepthBand(desc.Height);
+	SendStagingFrame(render_time_us, prediction_time_stamp);
+}
+
+void DirectXBufferCapturer::SetDepthEnabled(bool enabled)
+{
+	depth_enabled_ = enabled;
+}
+
+GpuTimerStats DirectXBufferCapturer::GetCopyGpuStats() const
+{
+	return copy_timer_.GetStats();
+}
+
+SharedTextureStats DirectXBufferCapturer::GetSharedTextureStats() const
+{
+	SharedTextureStats stats = {};
+	if (shared_textures_)
+	{
+		stats = shared_textures_->GetStats();
+	}
+
+	return stats;
+}
+
+void DirectXBufferCapturer::CaptureThread()
+{
+	while (capturing_)
+	{
+		ID3D11Texture2D* frame_buffer = nullptr;
+		int64_t render_time_us = 0;
+		int64_t prediction_time_stamp = -1;
+		if (!shared_textures_->Acquire(kSharedTextureTimeoutMs, &frame_buffer,
+			&render_time_us, &prediction_time_stamp))
+		{
+			continue;
+		}
+
+		// The slot is released as soon as the copy is issued, the keyed mutex
+		// ordering it before the next write on the GPU.
+		{
+			ScopedTraceEvent trace(trace_peer_id_, TraceStage::kStagingCopy, trace_frame_id_);
+			copy_timer_.Begin(d3d_context_.Get());
+			UpdateStagingBuffer(frame_buffer);
+			copy_timer_.End(d3d_context_.Get());
+		}
+
+		shared_textures_->Release();
+		if (running_)
+		{
+			SendStagingFrame(render_time_us, prediction_time_stamp);
+		}
+	}
+}
+
+void DirectXBufferCapturer::SendStagingFrame(int64_t render_time_us, int64_t prediction_time_stamp)
+{
+	if (frame_stamp_enabled_)
+	{
+		StampStagingBuffer(render_time_us);
+	}
 
 	// Creates webrtc frame buffer.
 	D3D11_TEXTURE2D_DESC desc;
 	staging_frame_buffer_->GetDesc(&desc);
-	rtc::scoped_refptr<webrtc::I420Buffer> buffer =
-		webrtc::I420Buffer::Create(desc.Width, desc.Height);
+	rtc::scoped_refptr<webrtc::I420Buffer> buffer = 
+		frame_source_.CreateI420Buffer(desc.Width, desc.Height);
 
-	// For software encoder, converting to supported video format.
-	if (use_software_encoder_)
+	// For software encoder or recording, converting to supported video format.
+	if (ShouldConvertToI420())
 	{
 		D3D11_MAPPED_SUBRESOURCE mapped;
-		if (SUCCEEDED(d3d_context_.Get()->Map(
-			staging_frame_buffer_.Get(), 0, D3D11_MAP_READ, 0, &mapped)))
+		HRESULT hr;
+		{
+			// Waits for the staging copy to complete on the GPU.
+			ScopedTraceEvent trace(trace_peer_id_, TraceStage::kMap, trace_frame_id_);
+			hr = d3d_context_.Get()->Map(
+				staging_frame_buffer_.Get(), 0, D3D11_MAP_READ, 0, &mapped);
+		}
+
+		if (SUCCEEDED(hr))
 		{
+			ScopedTraceEvent trace(trace_peer_id_, TraceStage::kColorConvert, trace_frame_id_);
 			libyuv::ABGRToI420(
 				(uint8_t*)mapped.pData,
 				desc.Width * 4,
@@ -141,8 +257,14 @@ void DirectXBufferCapturer::SendFrame(ID3D11Texture2D* left_frame_buffer, ID3D11
 	if (!use_software_encoder_)
 	{
 		D3D11_MAPPED_SUBRESOURCE mapped;
-		if (SUCCEEDED(d3d_context_.Get()->Map(
-			staging_frame_buffer_.Get(), 0, D3D11_MAP_READ, 0, &mapped)))
+		HRESULT hr;
+		{
+			ScopedTraceEvent trace(trace_peer_id_, TraceStage::kMap, trace_frame_id_);
+			hr = d3d_context_.Get()->Map(
+				staging_frame_buffer_.Get(), 0, D3D11_MAP_READ, 0, &mapped);
+		}
+
+		if (SUCCEEDED(hr))
 		{
 			frame.set_frame_buffer((uint8_t*)mapped.pData);
 			d3d_context_->Unmap(staging_frame_buffer_.Get(), 0);
@@ -153,44 +275,68 @@ void DirectXBufferCapturer::SendFrame(ID3D11Texture2D* left_frame_buffer, ID3D11
 	BufferCapturer::SendFrame(frame);
 }
 
-void DirectXBufferCapturer::UpdateStagingBuffer(ID3D11Texture2D* frame_buffer)
+void DirectXBufferCapturer::UpdateStagingBuffer(ID3D11Texture2D* frame_buffer, UINT band_height)
 {
 	D3D11_TEXTURE2D_DESC desc;
 	frame_buffer->GetDesc(&desc);
 
+	// Texture arrays hold one eye per slice and are packed side by side.
+	UINT width = desc.ArraySize == 2 ? desc.Width * 2 : desc.Width;
+	UINT height = desc.Height + band_height;
+	staging_color_height_ = desc.Height;
+
 	// Lazily initializes the staging frame buffer.
 	if (!staging_frame_buffer_)
 	{
 		staging_frame_buffer_desc_ = { 0 };
 		staging_frame_buffer_desc_.ArraySize = 1;
 		staging_frame_buffer_desc_.Format = desc.Format;
-		staging_frame_buffer_desc_.Width = desc.Width;
-		staging_frame_buffer_desc_.Height = desc.Height;
+		staging_frame_buffer_desc_.Width = width;
+		staging_frame_buffer_desc_.Height = height;
 		staging_frame_buffer_desc_.MipLevels = 1;
 		staging_frame_buffer_desc_.SampleDesc.Count = 1;
-		staging_frame_buffer_desc_.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		staging_frame_buffer_desc_.CPUAccessFlags = D3D11_CPU_ACCESS_READ | D3D11_CPU_ACCESS_WRITE;
 		staging_frame_buffer_desc_.Usage = D3D11_USAGE_STAGING;
 		d3d_device_->CreateTexture2D(
 			&staging_frame_buffer_desc_, nullptr, &staging_frame_buffer_);
 	}
 	// Resizes if needed.
-	else if (staging_frame_buffer_desc_.Width != desc.Width || 
-		staging_frame_buffer_desc_.Height != desc.Height)
+	else if (staging_frame_buffer_desc_.Width != width || 
+		staging_frame_buffer_desc_.Height != height)
 	{
-		staging_frame_buffer_desc_.Width = desc.Width;
-		staging_frame_buffer_desc_.Height = desc.Height;
+		staging_frame_buffer_desc_.Width = width;
+		staging_frame_buffer_desc_.Height = height;
 		d3d_device_->CreateTexture2D(&staging_frame_buffer_desc_, nullptr,
 			&staging_frame_buffer_);
 	}
 
-	// Copies the frame buffer to the staging one.		
-	d3d_context_->CopyResource(staging_frame_buffer_.Get(), frame_buffer);
+	if (desc.ArraySize == 2)
+	{
+		// Copies each eye slice next to the other.
+		for (UINT slice = 0; slice < 2; slice++)
+		{
+			d3d_context_->CopySubresourceRegion(staging_frame_buffer_.Get(), 0, desc.Width * slice, 0, 0,
+				frame_buffer, D3D11CalcSubresource(0, slice, desc.MipLevels), nullptr);
+		}
+	}
+	else if (band_height > 0)
+	{
+		d3d_context_->CopySubresourceRegion(staging_frame_buffer_.Get(), 0, 0, 0, 0,
+			frame_buffer, 0, nullptr);
+	}
+	else
+	{
+		// Copies the frame buffer, e.g. a side by side stereo frame, to the
+		// staging one in a single copy.
+		d3d_context_->CopyResource(staging_frame_buffer_.Get(), frame_buffer);
+	}
 }
 
 void DirectXBufferCapturer::UpdateStagingBuffer(ID3D11Texture2D* left_frame_buffer, ID3D11Texture2D* right_frame_buffer)
 {
 	D3D11_TEXTURE2D_DESC desc;
 	left_frame_buffer->GetDesc(&desc);
+	staging_color_height_ = desc.Height;
 
 	// Lazily initializes the staging frame buffer.
 	if (!staging_frame_buffer_)
@@ -202,7 +348,7 @@ void DirectXBufferCapturer::UpdateStagingBuffer(ID3D11Texture2D* left_frame_buff
 		staging_frame_buffer_desc_.Height = desc.Height;
 		staging_frame_buffer_desc_.MipLevels = 1;
 		staging_frame_buffer_desc_.SampleDesc.Count = 1;
-		staging_frame_buffer_desc_.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		staging_frame_buffer_desc_.CPUAccessFlags = D3D11_CPU_ACCESS_READ | D3D11_CPU_ACCESS_WRITE;
 		staging_frame_buffer_desc_.Usage = D3D11_USAGE_STAGING;
 		d3d_device_->CreateTexture2D(
 			&staging_frame_buffer_desc_, nullptr, &staging_frame_buffer_);
@@ -224,3 +370,121 @@ void DirectXBufferCapturer::UpdateStagingBuffer(ID3D11Texture2D* left_frame_buff
 	d3d_context_->CopySubresourceRegion(staging_frame_buffer_.Get(), 0, desc.Width, 0, 0,
 		right_frame_buffer, 0, 0);
 }
+
+void DirectXBufferCapturer::StampStagingBuffer(int64_t render_time_us)
+{
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (SUCCEEDED(d3d_context_.Get()->Map(
+		staging_frame_buffer_.Get(), 0, D3D11_MAP_READ_WRITE, 0, &mapped)))
+	{
+		// The stamp goes in the color, never in the depth band below it.
+		FrameStamp stamp = { render_time_us, static_cast<uint32_t>(trace_frame_id_) };
+		FrameStampCodec::WriteRGBA(stamp, (uint8_t*)mapped.pData, mapped.RowPitch,
+			staging_frame_buffer_desc_.Width, staging_color_height_);
+
+		d3d_context_->Unmap(staging_frame_buffer_.Get(), 0);
+	}
+}
+
+void DirectXBufferCapturer::UpdateStagingDepthBuffer(ID3D11Texture2D* depth_buffer)
+{
+	D3D11_TEXTURE2D_DESC desc;
+	depth_buffer->GetDesc(&desc);
+
+	// Lazily initializes the staging depth buffer, or resizes it if needed.
+	if (!staging_depth_buffer_ ||
+		staging_depth_buffer_desc_.Width != desc.Width ||
+		staging_depth_buffer_desc_.Height != desc.Height ||
+		staging_depth_buffer_desc_.Format != desc.Format)
+	{
+		staging_depth_buffer_desc_ = { 0 };
+		staging_depth_buffer_desc_.ArraySize = 1;
+		staging_depth_buffer_desc_.Format = desc.Format;
+		staging_depth_buffer_desc_.Width = desc.Width;
+		staging_depth_buffer_desc_.Height = desc.Height;
+		staging_depth_buffer_desc_.MipLevels = 1;
+		staging_depth_buffer_desc_.SampleDesc.Count = 1;
+		staging_depth_buffer_desc_.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		staging_depth_buffer_desc_.Usage = D3D11_USAGE_STAGING;
+		d3d_device_->CreateTexture2D(
+			&staging_depth_buffer_desc_, nullptr, &staging_depth_buffer_);
+	}
+
+	d3d_context_->CopyResource(staging_depth_buffer_.Get(), depth_buffer);
+}
+
+void DirectXBufferCapturer::WriteDepthBand(UINT color_height)
+{
+	DepthFormat format;
+	switch (staging_depth_buffer_desc_.Format)
+	{
+	case DXGI_FORMAT_D24_UNORM_S8_UINT:
+	case DXGI_FORMAT_R24G8_TYPELESS:
+		format = DepthFormat::kD24S8;
+		break;
+
+	case DXGI_FORMAT_D32_FLOAT:
+	case DXGI_FORMAT_R32_TYPELESS:
+		format = DepthFormat::kD32Float;
+		break;
+
+	default:
+		LOG(LS_WARNING) << "Unsupported depth buffer format " << staging_depth_buffer_desc_.Format;
+		ClearDepthBand(color_height);
+		return;
+	}
+
+	// The depth buffer must cover the color, e.g. both eyes side by side.
+	if (staging_depth_buffer_desc_.Width != staging_frame_buffer_desc_.Width ||
+		staging_depth_buffer_desc_.Height != color_height)
+	{
+		LOG(LS_WARNING) << "The depth buffer size doesn't match the frame size.";
+		ClearDepthBand(color_height);
+		return;
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	HRESULT hr;
+	{
+		ScopedTraceEvent trace(trace_peer_id_, TraceStage::kMap, trace_frame_id_);
+		hr = d3d_context_->Map(staging_depth_buffer_.Get(), 0, D3D11_MAP_READ, 0, &mapped);
+	}
+
+	if (FAILED(hr))
+	{
+		ClearDepthBand(color_height);
+		return;
+	}
+
+	bool downscaled = DepthCodec::Downscale((uint8_t*)mapped.pData, mapped.RowPitch, format,
+		staging_depth_buffer_desc_.Width, staging_depth_buffer_desc_.Height, &depth_frame_);
+
+	d3d_context_->Unmap(staging_depth_buffer_.Get(), 0);
+	if (!downscaled)
+	{
+		ClearDepthBand(color_height);
+		return;
+	}
+
+	if (SUCCEEDED(d3d_context_->Map(
+		staging_frame_buffer_.Get(), 0, D3D11_MAP_READ_WRITE, 0, &mapped)))
+	{
+		DepthCodec::WriteRGBA(depth_frame_, (uint8_t*)mapped.pData + color_height * mapped.RowPitch,
+			mapped.RowPitch, staging_frame_buffer_desc_.Width, color_height);
+
+		d3d_context_->Unmap(staging_frame_buffer_.Get(), 0);
+	}
+}
+
+void DirectXBufferCapturer::ClearDepthBand(UINT color_height)
+{
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (color_height < staging_frame_buffer_desc_.Height && SUCCEEDED(d3d_context_->Map(
+		staging_frame_buffer_.Get(), 0, D3D11_MAP_READ_WRITE, 0, &mapped)))
+	{
+		memset((uint8_t*)mapped.pData + color_height * mapped.RowPitch, 0,
+			(staging_frame_buffer_desc_.Height - color_height) * mapped.RowPitch);
+
+		d3d_context_->Unmap(staging_frame_buffer_.Get(), 0);
+	}
+}
@@ -6,14 +6,17 @@ DirectXPeerConductor::DirectXPeerConductor(int id,
 	shared_ptr<WebRTCConfig> webrtc_config,
 	scoped_refptr<PeerConnectionFactoryInterface> peer_factory,
 	const function<void(const string&)>& send_func,
-	ID3D11Device* d3d_device) : PeerConductor(
+	ID3D11Device* d3d_device,
+	bool use_shared_textures) : PeerConductor(
 		id,
 		name,
 		webrtc_config,
 		peer_factory,
 		send_func
 	),
-	d3d_device_(d3d_device)
+	d3d_device_(d3d_device),
+	use_shared_textures_(use_shared_textures),
+	capturer_(nullptr)
 {
 }
 
@@ -21,6 +24,8 @@ void DirectXPeerConductor::SendFrame(ID3D11Texture2D* frame_buffer, int64_t pred
 {
 	if (capturer_)
 	{
+		// Covers the whole capture, from the renderer handing over the frame.
+		ScopedTraceEvent trace(Id(), TraceStage::kRenderSubmit, capturer_->trace_frame_id());
 		capturer_->SendFrame(frame_buffer, prediction_time_stamp);
 	}
 }
@@ -29,13 +34,72 @@ void DirectXPeerConductor::SendFrame(ID3D11Texture2D* left_frame_buffer, ID3D11T
 {
 	if (capturer_)
 	{
+		ScopedTraceEvent trace(Id(), TraceStage::kRenderSubmit, capturer_->trace_frame_id());
 		capturer_->SendFrame(left_frame_buffer, right_frame_buffer, prediction_time_stamp);
 	}
 }
 
+void DirectXPeerConductor::SendFrameWithDepth(ID3D11Texture2D* frame_buffer, ID3D11Texture2D* depth_buffer, int64_t prediction_time_stamp)
+{
+	if (capturer_)
+	{
+		ScopedTraceEvent trace(Id(), TraceStage::kRenderSubmit, capturer_->trace_frame_id());
+		capturer_->SendFrameWithDepth(frame_buffer, depth_buffer, prediction_time_stamp);
+	}
+}
+
+void DirectXPeerConductor::SetFrameStampEnabled(bool enabled)
+{
+	if (capturer_)
+	{
+		capturer_->SetFrameStampEnabled(enabled);
+	}
+}
+
+void DirectXPeerConductor::SetDepthEnabled(bool enabled)
+{
+	if (capturer_)
+	{
+		capturer_->SetDepthEnabled(enabled);
+	}
+}
+
+GpuTimerStats DirectXPeerConductor::GetCopyGpuStats() const
+{
+	GpuTimerStats stats = {};
+	if (capturer_)
+	{
+		stats = capturer_->GetCopyGpuStats();
+	}
+
+	return stats;
+}
+
+SharedTextureStats DirectXPeerConductor::GetSharedTextureStats() const
+{
+	SharedTextureStats stats = {};
+	if (capturer_)
+	{
+		stats = capturer_->GetSharedTextureStats();
+	}
+
+	return stats;
+}
+
 unique_ptr<cricket::VideoCapturer> DirectXPeerConductor::AllocateVideoCapturer()
 {
-	unique_ptr<DirectXBufferCapturer> owned_ptr(new DirectXBufferCapturer(d3d_device_));
+	unique_ptr<DirectXBufferCapturer> owned_ptr(new DirectXBufferCapturer(d3d_device_, use_shared_textures_));
 	capturer_ = owned_ptr.get();
+	capturer_->SetTracePeerId(Id());
+	capturer_->SetStreamMetrics(stream_metrics());
 	return owned_ptr;
 }
+
+void DirectXPeerConductor::OnAssigned()
+{
+	if (capturer_)
+	{
+		capturer_->SetTracePeerId(Id());
+		capturer_->SetStreamMetrics(stream_metrics());
+	}
+}
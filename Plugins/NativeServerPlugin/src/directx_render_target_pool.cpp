@@ -0,0 +1,81 @@
+#include "pch.h"
+
+#include "directx_render_target_pool.h"
+#include "webrtc/rtc_base/logging.h"
+
+using namespace Microsoft::WRL;
+
+namespace StreamingToolkit
+{
+	namespace
+	{
+		// Bytes per pixel of the color and depth stencil formats.
+		const int kBytesPerPixel = 4;
+
+		std::unique_ptr<DirectXRenderTarget> CreateRenderTarget(
+			ID3D11Device* device, const RenderTargetKey& key)
+		{
+			std::unique_ptr<DirectXRenderTarget> target(new DirectXRenderTarget());
+			int width = key.stereo ? key.width << 1 : key.width;
+
+			// Creates the render texture and its view.
+			D3D11_TEXTURE2D_DESC tex_desc = { 0 };
+			tex_desc.ArraySize = 1;
+			tex_desc.Format = static_cast<DXGI_FORMAT>(key.format);
+			tex_desc.Width = width;
+			tex_desc.Height = key.height;
+			tex_desc.MipLevels = 1;
+			tex_desc.SampleDesc.Count = 1;
+			tex_desc.Usage = D3D11_USAGE_DEFAULT;
+			tex_desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+			if (FAILED(device->CreateTexture2D(&tex_desc, nullptr, &target->texture)) ||
+				FAILED(device->CreateRenderTargetView(target->texture.Get(), nullptr, &target->render_target_view)))
+			{
+				return nullptr;
+			}
+
+			// Creates the depth stencil texture and its view.
+			tex_desc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+			tex_desc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+			D3D11_DEPTH_STENCIL_VIEW_DESC dsv_desc = {};
+			dsv_desc.Format = tex_desc.Format;
+			dsv_desc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+			if (FAILED(device->CreateTexture2D(&tex_desc, nullptr, &target->depth_stencil_texture)) ||
+				FAILED(device->CreateDepthStencilView(target->depth_stencil_texture.Get(), &dsv_desc, &target->depth_stencil_view)))
+			{
+				return nullptr;
+			}
+
+			target->bytes = static_cast<size_t>(width) * key.height * kBytesPerPixel * 2;
+			return target;
+		}
+	}
+
+	std::unique_ptr<DirectXRenderTargetPool> CreateDirectXRenderTargetPool(
+		ID3D11Device* device, size_t high_water_mark)
+	{
+		ComPtr<ID3D11Device> device_ref(device);
+		return std::unique_ptr<DirectXRenderTargetPool>(new DirectXRenderTargetPool(
+			[device_ref](const RenderTargetKey& key)
+		{
+			std::unique_ptr<DirectXRenderTarget> target = CreateRenderTarget(device_ref.Get(), key);
+			if (!target)
+			{
+				LOG(LS_ERROR) << "Failed to create a " << key.width << "x" << key.height <<
+					(key.stereo ? " stereo" : "") << " render target.";
+			}
+
+			return target;
+		}, high_water_mark));
+	}
+
+	RenderTargetKey GetDirectXRenderTargetKey(int width, int height, bool stereo)
+	{
+		RenderTargetKey key;
+		key.width = width;
+		key.height = height;
+		key.stereo = stereo;
+		key.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		return key;
+	}
+}
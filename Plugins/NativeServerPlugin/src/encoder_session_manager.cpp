@@ -0,0 +1,798 @@
+#include "pch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <thread>
+
+#include "config_parser.h"
+#include "encoder_session_manager.h"
+#include "frame_source.h"
+#include "webrtc/media/base/codec.h"
+#include "webrtc/media/base/mediaconstants.h"
+#include "webrtc/modules/include/module_common_types.h"
+#include "webrtc/modules/video_coding/codecs/h264/include/h264.h"
+#include "webrtc/modules/video_coding/include/video_codec_interface.h"
+#include "webrtc/modules/video_coding/include/video_error_codes.h"
+#include "webrtc/rtc_base/logging.h"
+
+namespace StreamingToolkit
+{
+	// Encoder shared by the encoders of identical streams.
+	class EncoderSession : public webrtc::EncodedImageCallback
+	{
+	public:
+		EncoderSession(const EncoderSessionKey& key, std::unique_ptr<webrtc::VideoEncoder> encoder);
+
+		int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+			int32_t number_of_cores, size_t max_payload_size);
+
+		// Releases the encoder, before the session is counted as closed.
+		void Close();
+
+		void Attach(SharedSessionEncoder* encoder);
+
+		// Returns the number of encoders left.
+		size_t Detach(SharedSessionEncoder* encoder);
+
+		size_t encoder_count() const;
+
+		const EncoderSessionKey& key() const;
+
+		// Forces an IDR frame every idr_period frames, 0 to leave it to the
+		// encoder.
+		void SetIdrPeriod(uint32_t idr_period);
+
+		// Encodes the frames of the first encoder, the frames of the others
+		// are dropped but their key frame requests are kept. The images are
+		// delivered once the encoder is unlocked, so that their callbacks can
+		// drive the session.
+		int32_t Encode(SharedSessionEncoder* from, const webrtc::VideoFrame& frame,
+			const webrtc::CodecSpecificInfo* codec_specific_info,
+			const std::vector<webrtc::FrameType>* frame_types);
+
+		// Encodes at the lowest bitrate requested by the encoders, so that
+		// the stream fits the slowest peer.
+		int32_t SetRates(SharedSessionEncoder* from, uint32_t bitrate_bps, uint32_t framerate);
+
+		int32_t SetChannelParameters(SharedSessionEncoder* from, uint32_t packet_loss, int64_t rtt);
+
+		// Copies the image for Encode to deliver, the encoders of the webrtc
+		// build calling back from their Encode, under encode_mutex_.
+		Result OnEncodedImage(const webrtc::EncodedImage& encoded_image,
+			const webrtc::CodecSpecificInfo* codec_specific_info,
+			const webrtc::RTPFragmentationHeader* fragmentation) override;
+
+	private:
+		// Image encoded by the session, owning its data.
+		struct PendingImage
+		{
+			webrtc::EncodedImage image;
+			std::vector<uint8_t> data;
+			bool has_codec_specific_info;
+			webrtc::CodecSpecificInfo codec_specific_info;
+			std::unique_ptr<webrtc::RTPFragmentationHeader> fragmentation;
+		};
+
+		// Sends the images to the encoders attached, without the locks.
+		void Deliver(const std::vector<std::unique_ptr<PendingImage>>& images);
+
+		const EncoderSessionKey key_;
+
+		// Never held with encoders_mutex_, nor while delivering.
+		std::mutex encode_mutex_;
+		std::unique_ptr<webrtc::VideoEncoder> encoder_;
+		uint32_t bitrate_bps_;
+		uint32_t framerate_;
+		uint32_t frames_since_key_frame_;
+		std::vector<std::unique_ptr<PendingImage>> pending_images_;
+
+		mutable std::mutex encoders_mutex_;
+		std::vector<SharedSessionEncoder*> encoders_;
+		std::map<SharedSessionEncoder*, uint32_t> bitrates_;
+
+		// Encoders being delivered an image, with the delivering thread, which
+		// detaching waits for.
+		std::vector<std::pair<SharedSessionEncoder*, std::thread::id>> deliveries_;
+		std::condition_variable delivered_;
+
+		std::atomic<bool> key_frame_requested_;
+		std::atomic<uint32_t> idr_period_;
+	};
+
+	// Encoder given to webrtc, sending the stream of its session.
+	class SharedSessionEncoder : public webrtc::VideoEncoder
+	{
+	public:
+		explicit SharedSessionEncoder(std::shared_ptr<EncoderSessionManager> manager);
+
+		~SharedSessionEncoder() override;
+
+		int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+			int32_t number_of_cores, size_t max_payload_size) override;
+
+		int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback* callback) override;
+
+		int32_t Release() override;
+
+		int32_t Encode(const webrtc::VideoFrame& frame,
+			const webrtc::CodecSpecificInfo* codec_specific_info,
+			const std::vector<webrtc::FrameType>* frame_types) override;
+
+		int32_t SetChannelParameters(uint32_t packet_loss, int64_t rtt) override;
+
+		int32_t SetRateAllocation(const webrtc::BitrateAllocation& allocation, uint32_t framerate) override;
+
+		const char* ImplementationName() const override;
+
+		// Sends an image encoded by the session.
+		webrtc::EncodedImageCallback::Result Deliver(const webrtc::EncodedImage& encoded_image,
+			const webrtc::CodecSpecificInfo* codec_specific_info,
+			const webrtc::RTPFragmentationHeader* fragmentation);
+
+	private:
+		// Takes a session for the frames of the source if one is left,
+		// returning false while queued.
+		bool TryAcquire(int64_t source_id, int32_t* result);
+
+		void ReleaseSession();
+
+		std::shared_ptr<EncoderSessionManager> manager_;
+		std::shared_ptr<EncoderSession> session_;
+		std::atomic<webrtc::EncodedImageCallback*> encoded_image_callback_;
+		bool initialized_;
+		webrtc::VideoCodec codec_settings_;
+		int32_t number_of_cores_;
+		size_t max_payload_size_;
+		uint32_t bitrate_bps_;
+		uint32_t framerate_;
+	};
+
+	EncoderSession::EncoderSession(const EncoderSessionKey& key, std::unique_ptr<webrtc::VideoEncoder> encoder) :
+		key_(key),
+		encoder_(std::move(encoder)),
+		bitrate_bps_(0),
+		framerate_(0),
+		frames_since_key_frame_(0),
+		key_frame_requested_(false),
+		idr_period_(0)
+	{
+	}
+
+	int32_t EncoderSession::InitEncode(const webrtc::VideoCodec* codec_settings,
+		int32_t number_of_cores, size_t max_payload_size)
+	{
+		std::lock_guard<std::mutex> lock(encode_mutex_);
+		int32_t result = encoder_->InitEncode(codec_settings, number_of_cores, max_payload_size);
+		if (result == WEBRTC_VIDEO_CODEC_OK)
+		{
+			encoder_->RegisterEncodeCompleteCallback(this);
+		}
+
+		return result;
+	}
+
+	void EncoderSession::Close()
+	{
+		std::lock_guard<std::mutex> lock(encode_mutex_);
+		if (encoder_)
+		{
+			encoder_->Release();
+			encoder_.reset();
+		}
+	}
+
+	void EncoderSession::Attach(SharedSessionEncoder* encoder)
+	{
+		std::lock_guard<std::mutex> lock(encoders_mutex_);
+		encoders_.push_back(encoder);
+
+		// The joining peer can't decode the stream before the next key frame.
+		if (encoders_.size() > 1)
+		{
+			key_frame_requested_ = true;
+		}
+	}
+
+	size_t EncoderSession::Detach(SharedSessionEncoder* encoder)
+	{
+		std::unique_lock<std::mutex> lock(encoders_mutex_);
+		encoders_.erase(std::remove(encoders_.begin(), encoders_.end(), encoder), encoders_.end());
+		bitrates_.erase(encoder);
+
+		// Waits for a delivery to the encoder on another thread, so that the
+		// encoder stays valid until it completes. A delivery on this thread
+		// is the caller, e.g. a callback releasing its encoder.
+		auto thread_id = std::this_thread::get_id();
+		delivered_.wait(lock, [this, encoder, thread_id]()
+		{
+			return std::find_if(deliveries_.begin(), deliveries_.end(),
+				[encoder, thread_id](const std::pair<SharedSessionEncoder*, std::thread::id>& delivery)
+			{
+				return delivery.first == encoder && delivery.second != thread_id;
+			}) == deliveries_.end();
+		});
+
+		return encoders_.size();
+	}
+
+	size_t EncoderSession::encoder_count() const
+	{
+		std::lock_guard<std::mutex> lock(encoders_mutex_);
+		return encoders_.size();
+	}
+
+	const EncoderSessionKey& EncoderSession::key() const
+	{
+		return key_;
+	}
+
+	void EncoderSession::SetIdrPeriod(uint32_t idr_period)
+	{
+		idr_period_ = idr_period;
+	}
+
+	int32_t EncoderSession::Encode(SharedSessionEncoder* from, const webrtc::VideoFrame& frame,
+		const webrtc::CodecSpecificInfo* codec_specific_info,
+		const std::vector<webrtc::FrameType>* frame_types)
+	{
+		bool key_frame = false;
+		if (frame_types)
+		{
+			for (auto frame_type : *frame_types)
+			{
+				key_frame |= frame_type == webrtc::kVideoFrameKey;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(encoders_mutex_);
+			if (encoders_.empty() || encoders_.front() != from)
+			{
+				key_frame_requested_ = key_frame_requested_ || key_frame;
+				return WEBRTC_VIDEO_CODEC_OK;
+			}
+		}
+
+		int32_t result;
+		std::vector<std::unique_ptr<PendingImage>> images;
+		{
+			std::lock_guard<std::mutex> lock(encode_mutex_);
+			if (!encoder_)
+			{
+				return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+			}
+
+			uint32_t idr_period = idr_period_;
+			bool idr_due = idr_period > 0 && frames_since_key_frame_ >= idr_period;
+			if (!key_frame_requested_.exchange(false) && !idr_due && !key_frame)
+			{
+				frames_since_key_frame_++;
+				result = encoder_->Encode(frame, codec_specific_info, frame_types);
+			}
+			else
+			{
+				frames_since_key_frame_ = 1;
+
+				std::vector<webrtc::FrameType> key_frame_types(
+					frame_types && !frame_types->empty() ? frame_types->size() : 1, webrtc::kVideoFrameKey);
+
+				result = encoder_->Encode(frame, codec_specific_info, &key_frame_types);
+			}
+
+			images.swap(pending_images_);
+		}
+
+		Deliver(images);
+		return result;
+	}
+
+	int32_t EncoderSession::SetRates(SharedSessionEncoder* from, uint32_t bitrate_bps, uint32_t framerate)
+	{
+		uint32_t min_bitrate_bps = bitrate_bps;
+		{
+			std::lock_guard<std::mutex> lock(encoders_mutex_);
+			bitrates_[from] = bitrate_bps;
+			for (const auto& bitrate : bitrates_)
+			{
+				min_bitrate_bps = (std::min)(min_bitrate_bps, bitrate.second);
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(encode_mutex_);
+		if (!encoder_)
+		{
+			return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+		}
+
+		if (min_bitrate_bps == bitrate_bps_ && framerate == framerate_)
+		{
+			return WEBRTC_VIDEO_CODEC_OK;
+		}
+
+		bitrate_bps_ = min_bitrate_bps;
+		framerate_ = framerate;
+		webrtc::BitrateAllocation allocation;
+		allocation.SetBitrate(0, 0, min_bitrate_bps);
+		return encoder_->SetRateAllocation(allocation, framerate);
+	}
+
+	int32_t EncoderSession::SetChannelParameters(SharedSessionEncoder* from, uint32_t packet_loss, int64_t rtt)
+	{
+		{
+			std::lock_guard<std::mutex> lock(encoders_mutex_);
+			if (encoders_.empty() || encoders_.front() != from)
+			{
+				return WEBRTC_VIDEO_CODEC_OK;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(encode_mutex_);
+		return encoder_ ? encoder_->SetChannelParameters(packet_loss, rtt) : WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+	}
+
+	webrtc::EncodedImageCallback::Result EncoderSession::OnEncodedImage(const webrtc::EncodedImage& encoded_image,
+		const webrtc::CodecSpecificInfo* codec_specific_info,
+		const webrtc::RTPFragmentationHeader* fragmentation)
+	{
+		// The encoder reuses its buffers once Encode returns.
+		std::unique_ptr<PendingImage> pending(new PendingImage());
+		pending->data.assign(encoded_image._buffer, encoded_image._buffer + encoded_image._length);
+		pending->image = encoded_image;
+		pending->image._buffer = pending->data.data();
+		pending->image._size = pending->data.size();
+		pending->has_codec_specific_info = codec_specific_info != nullptr;
+		if (codec_specific_info)
+		{
+			pending->codec_specific_info = *codec_specific_info;
+		}
+
+		if (fragmentation)
+		{
+			pending->fragmentation.reset(new webrtc::RTPFragmentationHeader());
+			pending->fragmentation->CopyFrom(*fragmentation);
+		}
+
+		pending_images_.push_back(std::move(pending));
+		return Result(Result::OK);
+	}
+
+	void EncoderSession::Deliver(const std::vector<std::unique_ptr<PendingImage>>& images)
+	{
+		if (images.empty())
+		{
+			return;
+		}
+
+		// Delivered without the locks, since webrtc may call back into the
+		// session, e.g. to set its rates.
+		std::vector<SharedSessionEncoder*> encoders;
+		{
+			std::lock_guard<std::mutex> lock(encoders_mutex_);
+			encoders = encoders_;
+		}
+
+		for (auto encoder : encoders)
+		{
+			// Skips the encoders detached meanwhile, the others being kept
+			// valid until their delivery completes.
+			auto delivery = std::make_pair(encoder, std::this_thread::get_id());
+			{
+				std::lock_guard<std::mutex> lock(encoders_mutex_);
+				if (std::find(encoders_.begin(), encoders_.end(), encoder) == encoders_.end())
+				{
+					continue;
+				}
+
+				deliveries_.push_back(delivery);
+			}
+
+			for (const auto& pending : images)
+			{
+				encoder->Deliver(pending->image,
+					pending->has_codec_specific_info ? &pending->codec_specific_info : nullptr,
+					pending->fragmentation.get());
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(encoders_mutex_);
+				deliveries_.erase(std::find(deliveries_.begin(), deliveries_.end(), delivery));
+			}
+
+			delivered_.notify_all();
+		}
+	}
+
+	SharedSessionEncoder::SharedSessionEncoder(std::shared_ptr<EncoderSessionManager> manager) :
+		manager_(manager),
+		encoded_image_callback_(nullptr),
+		initialized_(false),
+		number_of_cores_(1),
+		max_payload_size_(0),
+		bitrate_bps_(0),
+		framerate_(0)
+	{
+	}
+
+	SharedSessionEncoder::~SharedSessionEncoder()
+	{
+		Release();
+	}
+
+	int32_t SharedSessionEncoder::InitEncode(const webrtc::VideoCodec* codec_settings,
+		int32_t number_of_cores, size_t max_payload_size)
+	{
+		if (!codec_settings)
+		{
+			return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
+		}
+
+		// A new resolution or rate may belong to another session.
+		ReleaseSession();
+		codec_settings_ = *codec_settings;
+		number_of_cores_ = number_of_cores;
+		max_payload_size_ = max_payload_size;
+		initialized_ = true;
+
+		// Shared sessions are taken at the first frame, once its source is
+		// known.
+		int32_t result = WEBRTC_VIDEO_CODEC_OK;
+		if (!manager_->share_sessions_)
+		{
+			TryAcquire(0, &result);
+		}
+
+		return result;
+	}
+
+	int32_t SharedSessionEncoder::RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback* callback)
+	{
+		encoded_image_callback_ = callback;
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t SharedSessionEncoder::Release()
+	{
+		ReleaseSession();
+		encoded_image_callback_ = nullptr;
+		initialized_ = false;
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t SharedSessionEncoder::Encode(const webrtc::VideoFrame& frame,
+		const webrtc::CodecSpecificInfo* codec_specific_info,
+		const std::vector<webrtc::FrameType>* frame_types)
+	{
+		if (!initialized_ || !encoded_image_callback_)
+		{
+			return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+		}
+
+		// Queued encoders drop their frames until a session closes.
+		int32_t result = WEBRTC_VIDEO_CODEC_OK;
+		if (!session_ && !TryAcquire(FrameSource::GetSourceId(frame.video_frame_buffer().get()), &result))
+		{
+			return result;
+		}
+
+		return session_->Encode(this, frame, codec_specific_info, frame_types);
+	}
+
+	int32_t SharedSessionEncoder::SetChannelParameters(uint32_t packet_loss, int64_t rtt)
+	{
+		return session_ ? session_->SetChannelParameters(this, packet_loss, rtt) : WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t SharedSessionEncoder::SetRateAllocation(const webrtc::BitrateAllocation& allocation, uint32_t framerate)
+	{
+		bitrate_bps_ = allocation.get_sum_bps();
+		framerate_ = framerate;
+		return session_ ? session_->SetRates(this, bitrate_bps_, framerate_) : WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	const char* SharedSessionEncoder::ImplementationName() const
+	{
+		return "SharedSession";
+	}
+
+	webrtc::EncodedImageCallback::Result SharedSessionEncoder::Deliver(const webrtc::EncodedImage& encoded_image,
+		const webrtc::CodecSpecificInfo* codec_specific_info,
+		const webrtc::RTPFragmentationHeader* fragmentation)
+	{
+		webrtc::EncodedImageCallback* callback = encoded_image_callback_;
+		if (!callback)
+		{
+			return webrtc::EncodedImageCallback::Result(webrtc::EncodedImageCallback::Result::ERROR_SEND_FAILED);
+		}
+
+		return callback->OnEncodedImage(encoded_image, codec_specific_info, fragmentation);
+	}
+
+	bool SharedSessionEncoder::TryAcquire(int64_t source_id, int32_t* result)
+	{
+		*result = manager_->Acquire(this, source_id, codec_settings_, number_of_cores_, max_payload_size_, &session_);
+		if (!session_)
+		{
+			return false;
+		}
+
+		// Rates set while queued apply once the session is taken.
+		if (bitrate_bps_ > 0)
+		{
+			session_->SetRates(this, bitrate_bps_, framerate_);
+		}
+
+		return true;
+	}
+
+	void SharedSessionEncoder::ReleaseSession()
+	{
+		manager_->Release(this, session_);
+		session_ = nullptr;
+	}
+
+	std::unique_ptr<webrtc::VideoEncoder> EncoderSessionManager::CreateH264Encoder()
+	{
+		return std::unique_ptr<webrtc::VideoEncoder>(
+			webrtc::H264Encoder::Create(cricket::VideoCodec(cricket::kH264CodecName)));
+	}
+
+	EncoderSessionManager::EncoderSessionManager(const Allocator& allocator, size_t max_sessions, bool share_sessions) :
+		allocator_(allocator),
+		max_sessions_(max_sessions),
+		share_sessions_(share_sessions),
+		closing_(0),
+		peak_sessions_(0)
+	{
+	}
+
+	webrtc::VideoEncoder* EncoderSessionManager::CreateEncoder()
+	{
+		return new SharedSessionEncoder(shared_from_this());
+	}
+
+	void EncoderSessionManager::SetUsageCallback(const UsageCallback& callback)
+	{
+		std::lock_guard<std::mutex> lock(callback_mutex_);
+		usage_callback_ = callback;
+	}
+
+	void EncoderSessionManager::SetEncoderConfig(std::shared_ptr<const NvEncConfig> config)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		encoder_config_ = config;
+		for (const auto& session : sessions_)
+		{
+			session->SetIdrPeriod(GetIdrPeriodLocked(session->key()));
+		}
+	}
+
+	EncoderSessionStats EncoderSessionManager::GetStats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return GetStatsLocked();
+	}
+
+	int32_t EncoderSessionManager::Acquire(SharedSessionEncoder* encoder, int64_t source_id, const webrtc::VideoCodec& codec_settings,
+		int32_t number_of_cores, size_t max_payload_size, std::shared_ptr<EncoderSession>* session)
+	{
+		EncoderSessionKey key = { source_id, codec_settings.width, codec_settings.height,
+			(int)codec_settings.maxFramerate, codec_settings.maxBitrate };
+
+		int32_t result = WEBRTC_VIDEO_CODEC_OK;
+		bool open_session = false;
+		EncoderSessionStats stats;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto shared = sessions_.end();
+			bool opening = false;
+			if (share_sessions_ && key.source_id != 0)
+			{
+				shared = std::find_if(sessions_.begin(), sessions_.end(),
+					[&key](const std::shared_ptr<EncoderSession>& open) { return open->key() == key; });
+
+				opening = std::find(opening_.begin(), opening_.end(), key) != opening_.end();
+			}
+
+			// Sessions are handed out in queue order, but joining a session
+			// doesn't take one.
+			bool queued = std::find(queue_.begin(), queue_.end(), encoder) != queue_.end();
+			bool first_in_line = queue_.empty() || queue_.front() == encoder;
+			if (shared != sessions_.end())
+			{
+				(*shared)->Attach(encoder);
+				*session = *shared;
+			}
+			else if (opening)
+			{
+				// Joins the session being opened at its next frame.
+				return WEBRTC_VIDEO_CODEC_OK;
+			}
+			else if (first_in_line && (max_sessions_ == 0 ||
+				sessions_.size() + opening_.size() + closing_ < max_sessions_))
+			{
+				// Counted until opened, so that the limit holds meanwhile.
+				opening_.push_back(key);
+				open_session = true;
+			}
+			else if (!queued)
+			{
+				LOG(LS_INFO) << "Encoder queued, " << sessions_.size() << " sessions open";
+				queue_.push_back(encoder);
+			}
+			else
+			{
+				// Still waiting, the usage didn't change.
+				return WEBRTC_VIDEO_CODEC_OK;
+			}
+
+			if (*session)
+			{
+				queue_.remove(encoder);
+			}
+
+			stats = GetStatsLocked();
+		}
+
+		if (open_session)
+		{
+			return Open(encoder, key, codec_settings, number_of_cores, max_payload_size, session);
+		}
+
+		NotifyUsage(stats);
+		return result;
+	}
+
+	int32_t EncoderSessionManager::Open(SharedSessionEncoder* encoder, const EncoderSessionKey& key,
+		const webrtc::VideoCodec& codec_settings, int32_t number_of_cores, size_t max_payload_size,
+		std::shared_ptr<EncoderSession>* session)
+	{
+		// Opening an NVENC session takes tens of milliseconds, during which
+		// the other encoders keep their sessions.
+		int32_t result = WEBRTC_VIDEO_CODEC_ERROR;
+		std::shared_ptr<EncoderSession> created;
+		std::unique_ptr<webrtc::VideoEncoder> allocated = allocator_();
+		if (allocated)
+		{
+			created = std::make_shared<EncoderSession>(key, std::move(allocated));
+			result = created->InitEncode(&codec_settings, number_of_cores, max_payload_size);
+			if (result != WEBRTC_VIDEO_CODEC_OK)
+			{
+				created->Close();
+			}
+		}
+
+		EncoderSessionStats stats;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			opening_.erase(std::find(opening_.begin(), opening_.end(), key));
+			if (result != WEBRTC_VIDEO_CODEC_OK)
+			{
+				return result;
+			}
+
+			created->SetIdrPeriod(GetIdrPeriodLocked(key));
+			created->Attach(encoder);
+			sessions_.push_back(created);
+			peak_sessions_ = (std::max)(peak_sessions_, sessions_.size());
+			queue_.remove(encoder);
+			*session = created;
+			stats = GetStatsLocked();
+		}
+
+		NotifyUsage(stats);
+		return result;
+	}
+
+	void EncoderSessionManager::Release(SharedSessionEncoder* encoder, std::shared_ptr<EncoderSession> session)
+	{
+		if (session)
+		{
+			session->Detach(encoder);
+		}
+
+		bool close = false;
+		EncoderSessionStats stats;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			bool queued = std::find(queue_.begin(), queue_.end(), encoder) != queue_.end();
+			if (!session && !queued)
+			{
+				return;
+			}
+
+			queue_.remove(encoder);
+
+			// Encoders may have joined meanwhile, keeping the session open.
+			auto open = std::find(sessions_.begin(), sessions_.end(), session);
+			if (session && open != sessions_.end() && session->encoder_count() == 0)
+			{
+				// Counted until closed, so that the limit holds meanwhile.
+				sessions_.erase(open);
+				closing_++;
+				close = true;
+			}
+
+			stats = GetStatsLocked();
+		}
+
+		if (close)
+		{
+			session->Close();
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			closing_--;
+			stats = GetStatsLocked();
+		}
+
+		NotifyUsage(stats);
+	}
+
+	void EncoderSessionManager::NotifyUsage(const EncoderSessionStats& stats)
+	{
+		// Held while notifying, so that clearing the callback waits for it.
+		std::lock_guard<std::mutex> lock(callback_mutex_);
+		if (usage_callback_)
+		{
+			usage_callback_(stats);
+		}
+	}
+
+	EncoderSessionStats EncoderSessionManager::GetStatsLocked() const
+	{
+		EncoderSessionStats stats;
+		stats.sessions = sessions_.size();
+		stats.max_sessions = max_sessions_;
+		stats.peak_sessions = peak_sessions_;
+		stats.encoders = 0;
+		for (const auto& session : sessions_)
+		{
+			stats.encoders += session->encoder_count();
+		}
+
+		stats.queued = queue_.size();
+		stats.share_sessions = share_sessions_;
+		return stats;
+	}
+
+	uint32_t EncoderSessionManager::GetIdrPeriodLocked(const EncoderSessionKey& key) const
+	{
+		if (!encoder_config_)
+		{
+			return 0;
+		}
+
+		return ConfigParser::GetEncoderProfile(*encoder_config_, key.width, key.height).idr_period;
+	}
+
+	SharedSessionEncoderFactory::SharedSessionEncoderFactory(std::shared_ptr<EncoderSessionManager> manager) :
+		manager_(manager)
+	{
+		cricket::VideoCodec codec(cricket::kH264CodecName);
+		codec.SetParam(cricket::kH264FmtpProfileLevelId, "42e01f");
+		codec.SetParam(cricket::kH264FmtpLevelAsymmetryAllowed, "1");
+		codec.SetParam(cricket::kH264FmtpPacketizationMode, "1");
+		supported_codecs_.push_back(codec);
+	}
+
+	webrtc::VideoEncoder* SharedSessionEncoderFactory::CreateVideoEncoder(const cricket::VideoCodec& codec)
+	{
+		if (!cricket::CodecNamesEq(codec.name, cricket::kH264CodecName))
+		{
+			return nullptr;
+		}
+
+		return manager_->CreateEncoder();
+	}
+
+	const std::vector<cricket::VideoCodec>& SharedSessionEncoderFactory::supported_codecs() const
+	{
+		return supported_codecs_;
+	}
+
+	void SharedSessionEncoderFactory::DestroyVideoEncoder(webrtc::VideoEncoder* encoder)
+	{
+		delete encoder;
+	}
+}
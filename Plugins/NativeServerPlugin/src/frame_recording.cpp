@@ -0,0 +1,400 @@
+#include "pch.h"
+
+#include <string.h>
+
+#include "frame_recording.h"
+#include "webrtc/rtc_base/checks.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+namespace
+{
+	// H.264 NAL unit types used to split an elementary stream into access units.
+	const uint8_t kNalTypeMask = 0x1F;
+	const uint8_t kNalSlice = 1;
+	const uint8_t kNalIdrSlice = 5;
+	const uint8_t kNalSei = 6;
+	const uint8_t kNalSps = 7;
+	const uint8_t kNalPps = 8;
+	const uint8_t kNalAud = 9;
+
+	size_t I420FrameSize(int width, int height)
+	{
+		size_t chroma_width = (width + 1) / 2;
+		size_t chroma_height = (height + 1) / 2;
+		return width * height + 2 * chroma_width * chroma_height;
+	}
+
+	// Returns the offset of the next start code at or after offset, or size.
+	size_t FindStartCode(const uint8_t* data, size_t size, size_t offset, size_t* start_code_length)
+	{
+		for (size_t i = offset; i + 3 <= size; i++)
+		{
+			if (data[i] == 0 && data[i + 1] == 0)
+			{
+				if (data[i + 2] == 1)
+				{
+					*start_code_length = 3;
+					return i;
+				}
+
+				if (i + 4 <= size && data[i + 2] == 0 && data[i + 3] == 1)
+				{
+					*start_code_length = 4;
+					return i;
+				}
+			}
+		}
+
+		*start_code_length = 0;
+		return size;
+	}
+}
+
+namespace StreamingToolkit
+{
+	FrameRecorder::FrameRecorder() :
+		file_(nullptr),
+		format_(FrameRecordingFormat::kI420),
+		width_(0),
+		height_(0),
+		frame_count_(0),
+		first_capture_time_ms_(-1)
+	{
+	}
+
+	FrameRecorder::~FrameRecorder()
+	{
+		Close();
+	}
+
+	bool FrameRecorder::Open(const std::string& path, FrameRecordingFormat format, int width, int height, int fps)
+	{
+		rtc::CritScope cs(&lock_);
+		RTC_DCHECK(!file_);
+
+		file_ = fopen(path.c_str(), "wb");
+		if (!file_)
+		{
+			LOG(LS_ERROR) << "Failed to create frame recording: " << path;
+			return false;
+		}
+
+		FrameRecordingHeader header = { 0 };
+		memcpy(header.magic, kFrameRecordingMagic, sizeof(header.magic));
+		header.version = kFrameRecordingVersion;
+		header.format = format;
+		header.width = width;
+		header.height = height;
+		header.fps = fps;
+		if (fwrite(&header, sizeof(header), 1, file_) != 1)
+		{
+			fclose(file_);
+			file_ = nullptr;
+			return false;
+		}
+
+		format_ = format;
+		width_ = width;
+		height_ = height;
+		frame_count_ = 0;
+		first_capture_time_ms_ = -1;
+		return true;
+	}
+
+	void FrameRecorder::Close()
+	{
+		rtc::CritScope cs(&lock_);
+		if (file_)
+		{
+			fclose(file_);
+			file_ = nullptr;
+		}
+	}
+
+	bool FrameRecorder::IsOpen() const
+	{
+		return file_ != nullptr;
+	}
+
+	bool FrameRecorder::RecordFrame(const webrtc::VideoFrame& video_frame)
+	{
+		rtc::CritScope cs(&lock_);
+		if (!file_ || format_ != FrameRecordingFormat::kI420 ||
+			video_frame.width() != width_ || video_frame.height() != height_)
+		{
+			return false;
+		}
+
+		rtc::scoped_refptr<webrtc::I420BufferInterface> buffer =
+			video_frame.video_frame_buffer()->ToI420();
+
+		int64_t now_ms = rtc::TimeMillis();
+		if (first_capture_time_ms_ < 0)
+		{
+			first_capture_time_ms_ = now_ms;
+		}
+
+		FrameRecordingEntry entry = { 0 };
+		entry.payload_size = static_cast<uint32_t>(I420FrameSize(width_, height_));
+		entry.flags = kFrameRecordingKeyFrameFlag;
+		entry.capture_time_ms = now_ms - first_capture_time_ms_;
+		entry.prediction_timestamp = video_frame.prediction_timestamp();
+		if (!WriteEntry(entry))
+		{
+			return false;
+		}
+
+		// Writes the planes without their stride padding.
+		int chroma_width = (width_ + 1) / 2;
+		int chroma_height = (height_ + 1) / 2;
+		for (int row = 0; row < height_; row++)
+		{
+			fwrite(buffer->DataY() + row * buffer->StrideY(), 1, width_, file_);
+		}
+
+		for (int row = 0; row < chroma_height; row++)
+		{
+			fwrite(buffer->DataU() + row * buffer->StrideU(), 1, chroma_width, file_);
+		}
+
+		for (int row = 0; row < chroma_height; row++)
+		{
+			fwrite(buffer->DataV() + row * buffer->StrideV(), 1, chroma_width, file_);
+		}
+
+		frame_count_++;
+		return ferror(file_) == 0;
+	}
+
+	bool FrameRecorder::RecordEncodedFrame(const uint8_t* data, size_t size, bool key_frame,
+		int64_t capture_time_ms, int64_t prediction_timestamp)
+	{
+		rtc::CritScope cs(&lock_);
+		if (!file_ || format_ != FrameRecordingFormat::kH264 || size == 0)
+		{
+			return false;
+		}
+
+		if (first_capture_time_ms_ < 0)
+		{
+			first_capture_time_ms_ = capture_time_ms;
+		}
+
+		FrameRecordingEntry entry = { 0 };
+		entry.payload_size = static_cast<uint32_t>(size);
+		entry.flags = key_frame ? kFrameRecordingKeyFrameFlag : 0;
+		entry.capture_time_ms = capture_time_ms - first_capture_time_ms_;
+		entry.prediction_timestamp = prediction_timestamp;
+		if (!WriteEntry(entry) || fwrite(data, 1, size, file_) != size)
+		{
+			return false;
+		}
+
+		frame_count_++;
+		return true;
+	}
+
+	size_t FrameRecorder::frame_count() const
+	{
+		return frame_count_;
+	}
+
+	bool FrameRecorder::WriteEntry(const FrameRecordingEntry& entry)
+	{
+		return fwrite(&entry, sizeof(entry), 1, file_) == 1;
+	}
+
+	FrameRecordingReader::FrameRecordingReader() :
+		format_(FrameRecordingFormat::kI420),
+		width_(0),
+		height_(0),
+		fps_(0)
+	{
+	}
+
+	bool FrameRecordingReader::Open(const std::string& path)
+	{
+		frames_.clear();
+		if (!file_.Open(path) || file_.size() < sizeof(FrameRecordingHeader))
+		{
+			LOG(LS_ERROR) << "Failed to open frame recording: " << path;
+			return false;
+		}
+
+		FrameRecordingHeader header;
+		memcpy(&header, file_.data(), sizeof(header));
+		if (memcmp(header.magic, kFrameRecordingMagic, sizeof(header.magic)) != 0 ||
+			header.version != kFrameRecordingVersion)
+		{
+			LOG(LS_ERROR) << "Invalid frame recording: " << path;
+			file_.Close();
+			return false;
+		}
+
+		format_ = header.format;
+		width_ = header.width;
+		height_ = header.height;
+		fps_ = header.fps;
+
+		// Indexes the frames, a truncated last frame is dropped.
+		size_t offset = sizeof(header);
+		while (offset + sizeof(FrameRecordingEntry) <= file_.size())
+		{
+			FrameRecordingEntry entry;
+			memcpy(&entry, file_.data() + offset, sizeof(entry));
+			offset += sizeof(entry);
+			if (entry.payload_size > file_.size() - offset)
+			{
+				break;
+			}
+
+			RecordedFrame frame;
+			frame.data = file_.data() + offset;
+			frame.size = entry.payload_size;
+			frame.key_frame = (entry.flags & kFrameRecordingKeyFrameFlag) != 0;
+			frame.capture_time_ms = entry.capture_time_ms;
+			frame.prediction_timestamp = entry.prediction_timestamp;
+			frames_.push_back(frame);
+			offset += entry.payload_size;
+		}
+
+		if (format_ == FrameRecordingFormat::kI420)
+		{
+			size_t frame_size = I420FrameSize(width_, height_);
+			for (const auto& frame : frames_)
+			{
+				if (frame.size != frame_size)
+				{
+					LOG(LS_ERROR) << "Invalid I420 frame size in frame recording: " << path;
+					frames_.clear();
+					break;
+				}
+			}
+		}
+
+		return !frames_.empty();
+	}
+
+	bool FrameRecordingReader::OpenH264ElementaryStream(const std::string& path, int width, int height, int fps)
+	{
+		RTC_DCHECK_GT(fps, 0);
+
+		frames_.clear();
+		if (!file_.Open(path))
+		{
+			LOG(LS_ERROR) << "Failed to open H.264 elementary stream: " << path;
+			return false;
+		}
+
+		format_ = FrameRecordingFormat::kH264;
+		width_ = width;
+		height_ = height;
+		fps_ = fps;
+
+		// Splits the stream into access units. A new access unit starts on an
+		// AUD, SPS, PPS or SEI following a slice, or on a slice starting at the
+		// first macroblock following a slice.
+		const uint8_t* data = file_.data();
+		size_t size = file_.size();
+		size_t start_code_length = 0;
+		size_t nal_start = FindStartCode(data, size, 0, &start_code_length);
+		size_t access_unit_start = nal_start;
+		bool access_unit_has_slice = false;
+		bool access_unit_is_key_frame = false;
+		while (nal_start < size)
+		{
+			size_t header_offset = nal_start + start_code_length;
+			size_t next_start_code_length = 0;
+			size_t next_nal_start = FindStartCode(data, size, header_offset, &next_start_code_length);
+			if (header_offset >= next_nal_start)
+			{
+				break;
+			}
+
+			uint8_t nal_type = data[header_offset] & kNalTypeMask;
+			bool is_slice = nal_type == kNalSlice || nal_type == kNalIdrSlice;
+
+			// first_mb_in_slice is ue(v) coded, zero is encoded as a single set bit.
+			bool is_first_slice = is_slice && header_offset + 1 < next_nal_start &&
+				(data[header_offset + 1] & 0x80) != 0;
+
+			bool starts_access_unit = access_unit_has_slice &&
+				(nal_type == kNalAud || nal_type == kNalSps || nal_type == kNalPps ||
+				nal_type == kNalSei || is_first_slice);
+
+			if (starts_access_unit)
+			{
+				RecordedFrame frame;
+				frame.data = data + access_unit_start;
+				frame.size = nal_start - access_unit_start;
+				frame.key_frame = access_unit_is_key_frame;
+				frame.capture_time_ms = static_cast<int64_t>(frames_.size()) * 1000 / fps_;
+				frame.prediction_timestamp = -1;
+				frames_.push_back(frame);
+
+				access_unit_start = nal_start;
+				access_unit_has_slice = false;
+				access_unit_is_key_frame = false;
+			}
+
+			access_unit_has_slice |= is_slice;
+			access_unit_is_key_frame |= nal_type == kNalIdrSlice;
+			nal_start = next_nal_start;
+			start_code_length = next_start_code_length;
+		}
+
+		if (access_unit_has_slice)
+		{
+			RecordedFrame frame;
+			frame.data = data + access_unit_start;
+			frame.size = size - access_unit_start;
+			frame.key_frame = access_unit_is_key_frame;
+			frame.capture_time_ms = static_cast<int64_t>(frames_.size()) * 1000 / fps_;
+			frame.prediction_timestamp = -1;
+			frames_.push_back(frame);
+		}
+
+		return !frames_.empty();
+	}
+
+	FrameRecordingFormat FrameRecordingReader::format() const
+	{
+		return format_;
+	}
+
+	int FrameRecordingReader::width() const
+	{
+		return width_;
+	}
+
+	int FrameRecordingReader::height() const
+	{
+		return height_;
+	}
+
+	int FrameRecordingReader::fps() const
+	{
+		return fps_;
+	}
+
+	size_t FrameRecordingReader::frame_count() const
+	{
+		return frames_.size();
+	}
+
+	const RecordedFrame& FrameRecordingReader::frame(size_t index) const
+	{
+		RTC_DCHECK_LT(index, frames_.size());
+		return frames_[index];
+	}
+
+	void FrameRecordingReader::Prefetch(size_t index) const
+	{
+		if (index < frames_.size())
+		{
+			const RecordedFrame& frame = frames_[index];
+			file_.Prefetch(frame.data - file_.data(), frame.size);
+		}
+	}
+}
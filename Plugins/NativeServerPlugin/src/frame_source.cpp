@@ -0,0 +1,81 @@
+#include "pch.h"
+
+#include <mutex>
+#include <unordered_map>
+
+#include "frame_source.h"
+#include "webrtc/rtc_base/refcountedobject.h"
+
+namespace
+{
+	// Source ids of the live buffers, which are unregistered on destruction
+	// so that a new buffer at the same address isn't taken for theirs.
+	std::mutex& SourcesMutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	std::unordered_map<const webrtc::VideoFrameBuffer*, int64_t>& Sources()
+	{
+		static std::unordered_map<const webrtc::VideoFrameBuffer*, int64_t> sources;
+		return sources;
+	}
+
+	// I420 buffer registered with the id of its source.
+	class SourceI420Buffer : public webrtc::I420Buffer
+	{
+	public:
+		SourceI420Buffer(int width, int height, int64_t source_id) :
+			webrtc::I420Buffer(width, height)
+		{
+			std::lock_guard<std::mutex> lock(SourcesMutex());
+			Sources()[this] = source_id;
+		}
+
+	protected:
+		~SourceI420Buffer() override
+		{
+			std::lock_guard<std::mutex> lock(SourcesMutex());
+			Sources().erase(this);
+		}
+	};
+
+	std::atomic<int64_t> next_source_id(1);
+}
+
+namespace StreamingToolkit
+{
+	FrameSource::FrameSource() :
+		id_(next_source_id++)
+	{
+	}
+
+	FrameSource::FrameSource(const FrameSource& other) :
+		id_(other.id())
+	{
+	}
+
+	FrameSource& FrameSource::operator=(const FrameSource& other)
+	{
+		id_ = other.id();
+		return *this;
+	}
+
+	int64_t FrameSource::id() const
+	{
+		return id_;
+	}
+
+	rtc::scoped_refptr<webrtc::I420Buffer> FrameSource::CreateI420Buffer(int width, int height) const
+	{
+		return new rtc::RefCountedObject<SourceI420Buffer>(width, height, id_);
+	}
+
+	int64_t FrameSource::GetSourceId(const webrtc::VideoFrameBuffer* buffer)
+	{
+		std::lock_guard<std::mutex> lock(SourcesMutex());
+		auto source = Sources().find(buffer);
+		return source != Sources().end() ? source->second : 0;
+	}
+}
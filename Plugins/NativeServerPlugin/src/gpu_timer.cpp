@@ -0,0 +1,135 @@
+#include "pch.h"
+
+#include <algorithm>
+
+#include "gpu_timer.h"
+#include "webrtc/rtc_base/logging.h"
+
+namespace StreamingToolkit
+{
+	const int GpuTimer::kQueryFrames;
+	const int GpuTimer::kWindowSize;
+
+	GpuTimer::GpuTimer(ID3D11Device* device) :
+		valid_(true),
+		current_(0),
+		oldest_(0),
+		window_count_(0),
+		window_next_(0),
+		last_us_(0),
+		dropped_(0)
+	{
+		D3D11_QUERY_DESC disjoint_desc = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+		D3D11_QUERY_DESC timestamp_desc = { D3D11_QUERY_TIMESTAMP, 0 };
+		for (int i = 0; i < kQueryFrames && valid_; i++)
+		{
+			frames_[i].pending = false;
+			valid_ =
+				SUCCEEDED(device->CreateQuery(&disjoint_desc, &frames_[i].disjoint)) &&
+				SUCCEEDED(device->CreateQuery(&timestamp_desc, &frames_[i].begin)) &&
+				SUCCEEDED(device->CreateQuery(&timestamp_desc, &frames_[i].end));
+		}
+
+		if (!valid_)
+		{
+			LOG(LS_WARNING) << "Timestamp queries aren't supported, GPU times won't be measured.";
+		}
+	}
+
+	void GpuTimer::Begin(ID3D11DeviceContext* context)
+	{
+		if (!valid_)
+		{
+			return;
+		}
+
+		// The GPU is too far behind, the oldest measurement is dropped rather
+		// than waiting for it.
+		QueryFrame& frame = frames_[current_];
+		if (frame.pending)
+		{
+			ReadBack(context);
+			if (frame.pending)
+			{
+				frame.pending = false;
+				oldest_ = (oldest_ + 1) % kQueryFrames;
+				dropped_++;
+			}
+		}
+
+		context->Begin(frame.disjoint.Get());
+		context->End(frame.begin.Get());
+	}
+
+	void GpuTimer::End(ID3D11DeviceContext* context)
+	{
+		if (!valid_)
+		{
+			return;
+		}
+
+		QueryFrame& frame = frames_[current_];
+		context->End(frame.end.Get());
+		context->End(frame.disjoint.Get());
+		frame.pending = true;
+		current_ = (current_ + 1) % kQueryFrames;
+		ReadBack(context);
+	}
+
+	GpuTimerStats GpuTimer::GetStats() const
+	{
+		GpuTimerStats stats = {};
+		stats.count = window_count_;
+		stats.last_us = last_us_;
+		stats.dropped = dropped_;
+		int64_t total_us = 0;
+		for (size_t i = 0; i < window_count_; i++)
+		{
+			total_us += window_[i];
+			stats.max_us = std::max(stats.max_us, window_[i]);
+		}
+
+		stats.average_us = window_count_ > 0 ? total_us / static_cast<int64_t>(window_count_) : 0;
+		return stats;
+	}
+
+	void GpuTimer::ReadBack(ID3D11DeviceContext* context)
+	{
+		while (frames_[oldest_].pending)
+		{
+			QueryFrame& frame = frames_[oldest_];
+			D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+			UINT64 begin;
+			UINT64 end;
+			if (context->GetData(frame.disjoint.Get(), &disjoint, sizeof(disjoint),
+					D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+				context->GetData(frame.begin.Get(), &begin, sizeof(begin),
+					D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+				context->GetData(frame.end.Get(), &end, sizeof(end),
+					D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			{
+				return;
+			}
+
+			frame.pending = false;
+			oldest_ = (oldest_ + 1) % kQueryFrames;
+
+			// The timestamps are meaningless if the GPU clock changed.
+			if (disjoint.Disjoint || disjoint.Frequency == 0)
+			{
+				dropped_++;
+				continue;
+			}
+
+			AddMeasurement(static_cast<int64_t>((end - begin) * 1000000 / disjoint.Frequency));
+		}
+	}
+
+	void GpuTimer::AddMeasurement(int64_t duration_us)
+	{
+		last_us_ = duration_us;
+		window_[window_next_] = duration_us;
+		window_next_ = (window_next_ + 1) % kWindowSize;
+		window_count_ = std::min<size_t>(window_count_ + 1, kWindowSize);
+	}
+}
@@ -0,0 +1,105 @@
+#include "pch.h"
+
+#include <algorithm>
+
+#include "idle_policy.h"
+
+namespace StreamingToolkit
+{
+	IdlePolicyParams IdlePolicy::DefaultParams()
+	{
+		IdlePolicyParams params;
+		params.idle_timeout_ms = 0;
+		params.keep_alive_fps = 1;
+		return params;
+	}
+
+	IdlePolicy::IdlePolicy(const IdlePolicyParams& params) :
+		params_(params),
+		started_(false),
+		idle_(false),
+		last_input_us_(0),
+		idle_since_us_(0),
+		next_frame_us_(0)
+	{
+		stats_ = IdlePolicyStats();
+	}
+
+	void IdlePolicy::SetParams(const IdlePolicyParams& params)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		params_ = params;
+	}
+
+	void IdlePolicy::OnInput(int64_t time_us)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		last_input_us_ = time_us;
+		if (idle_)
+		{
+			idle_ = false;
+			stats_.idle_time_us += time_us - idle_since_us_;
+			next_frame_us_ = time_us;
+		}
+	}
+
+	IdlePolicy::FrameAction IdlePolicy::GetFrameAction(int64_t time_us, int full_fps)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		// The stream starts as if the client just sent an input.
+		if (!started_)
+		{
+			started_ = true;
+			last_input_us_ = time_us;
+			next_frame_us_ = time_us;
+		}
+
+		int keep_alive_fps = (std::max)((std::min)(params_.keep_alive_fps, full_fps), 1);
+		int64_t keep_alive_interval_us = 1000000 / keep_alive_fps;
+		if (!idle_ && params_.idle_timeout_ms > 0 &&
+			time_us - last_input_us_ >= params_.idle_timeout_ms * 1000LL)
+		{
+			idle_ = true;
+			idle_since_us_ = time_us;
+			next_frame_us_ = time_us + keep_alive_interval_us;
+			stats_.idle_periods++;
+		}
+
+		if (time_us < next_frame_us_)
+		{
+			return FrameAction::kNone;
+		}
+
+		// Catches up with the frames which were late, unless too far behind.
+		int64_t interval_us = idle_ ? keep_alive_interval_us : 1000000 / (std::max)(full_fps, 1);
+		next_frame_us_ += interval_us;
+		if (next_frame_us_ <= time_us - interval_us)
+		{
+			next_frame_us_ = time_us + interval_us;
+		}
+
+		if (!idle_)
+		{
+			return FrameAction::kRender;
+		}
+
+		stats_.keep_alive_frames++;
+		stats_.skipped_frames += full_fps / keep_alive_fps - 1;
+		return FrameAction::kRepeat;
+	}
+
+	bool IdlePolicy::IsIdle() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return idle_;
+	}
+
+	IdlePolicyStats IdlePolicy::GetStats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		IdlePolicyStats stats = stats_;
+		stats.idle = idle_;
+		return stats;
+	}
+}
@@ -0,0 +1,281 @@
+#include "pch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include "latency_tracer.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+namespace
+{
+	// Default window used for the rolling percentiles.
+	const int64_t kDefaultStatsWindowMs = 5000;
+
+	const char* kStageNames[] =
+	{
+		"render_submit",
+		"staging_copy",
+		"map",
+		"color_convert",
+		"encoder_submit",
+		"bitstream_ready",
+		"rtp_send"
+	};
+
+	// Nearest-rank percentile of sorted durations.
+	int64_t Percentile(const std::vector<int64_t>& sorted, int percentile)
+	{
+		size_t rank = (sorted.size() * percentile + 99) / 100;
+		return sorted[rank > 0 ? rank - 1 : 0];
+	}
+}
+
+namespace StreamingToolkit
+{
+	const size_t LatencyTracer::kEventsPerThread;
+
+	static_assert((LatencyTracer::kEventsPerThread & (LatencyTracer::kEventsPerThread - 1)) == 0,
+		"kEventsPerThread must be a power of two.");
+
+	static_assert(sizeof(kStageNames) / sizeof(kStageNames[0]) == static_cast<size_t>(TraceStage::kCount),
+		"Missing trace stage name.");
+
+	LatencyTracer& LatencyTracer::Instance()
+	{
+		static LatencyTracer instance;
+		return instance;
+	}
+
+	LatencyTracer::LatencyTracer() :
+		enabled_(false),
+		stats_window_us_(kDefaultStatsWindowMs * rtc::kNumMicrosecsPerMillisec)
+	{
+	}
+
+	void LatencyTracer::SetEnabled(bool enabled)
+	{
+		enabled_ = enabled;
+	}
+
+	bool LatencyTracer::IsEnabled() const
+	{
+		return enabled_.load(std::memory_order_relaxed);
+	}
+
+	void LatencyTracer::SetStatsWindowMs(int64_t window_ms)
+	{
+		stats_window_us_ = window_ms * rtc::kNumMicrosecsPerMillisec;
+	}
+
+	void LatencyTracer::Record(int32_t peer_id, TraceStage stage, int64_t frame_id, int64_t begin_us, int64_t end_us)
+	{
+		if (!IsEnabled())
+		{
+			return;
+		}
+
+		ThreadBuffer* buffer = GetThreadBuffer();
+
+		// Only the owning thread writes, readers discard the slots which may
+		// have been overwritten while they were copying.
+		uint64_t index = buffer->write_index.load(std::memory_order_relaxed);
+		TraceEvent& event = buffer->events[index & (kEventsPerThread - 1)];
+		event.begin_us = begin_us;
+		event.end_us = end_us;
+		event.frame_id = frame_id;
+		event.peer_id = peer_id;
+		event.thread_id = buffer->thread_id;
+		event.stage = stage;
+		buffer->write_index.store(index + 1, std::memory_order_release);
+	}
+
+	std::vector<StageLatencyStats> LatencyTracer::GetStageStats(int32_t peer_id) const
+	{
+		std::vector<TraceEvent> events;
+		CollectEvents(rtc::TimeMicros() - stats_window_us_, &events);
+
+		std::vector<int64_t> durations[static_cast<size_t>(TraceStage::kCount)];
+		for (const TraceEvent& event : events)
+		{
+			if (event.peer_id == peer_id)
+			{
+				durations[static_cast<size_t>(event.stage)].push_back(event.end_us - event.begin_us);
+			}
+		}
+
+		std::vector<StageLatencyStats> stats;
+		for (size_t i = 0; i < static_cast<size_t>(TraceStage::kCount); i++)
+		{
+			std::vector<int64_t>& stage_durations = durations[i];
+			if (stage_durations.empty())
+			{
+				continue;
+			}
+
+			std::sort(stage_durations.begin(), stage_durations.end());
+
+			StageLatencyStats stage_stats;
+			stage_stats.stage = static_cast<TraceStage>(i);
+			stage_stats.count = stage_durations.size();
+			stage_stats.p50_us = Percentile(stage_durations, 50);
+			stage_stats.p95_us = Percentile(stage_durations, 95);
+			stage_stats.p99_us = Percentile(stage_durations, 99);
+			stats.push_back(stage_stats);
+		}
+
+		return stats;
+	}
+
+	std::vector<int32_t> LatencyTracer::GetPeerIds() const
+	{
+		std::vector<TraceEvent> events;
+		CollectEvents(rtc::TimeMicros() - stats_window_us_, &events);
+
+		std::set<int32_t> peer_ids;
+		for (const TraceEvent& event : events)
+		{
+			peer_ids.insert(event.peer_id);
+		}
+
+		return std::vector<int32_t>(peer_ids.begin(), peer_ids.end());
+	}
+
+	std::string LatencyTracer::ExportChromeTrace() const
+	{
+		std::vector<TraceEvent> events;
+		CollectEvents(0, &events);
+		std::sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b)
+		{
+			return a.begin_us < b.begin_us;
+		});
+
+		std::ostringstream json;
+		json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+		// Each peer is shown as a process, each thread as a track.
+		std::set<int32_t> peer_ids;
+		bool first = true;
+		for (const TraceEvent& event : events)
+		{
+			if (peer_ids.insert(event.peer_id).second)
+			{
+				json << (first ? "" : ",") <<
+					"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << event.peer_id <<
+					",\"args\":{\"name\":\"peer " << event.peer_id << "\"}}";
+
+				first = false;
+			}
+
+			json << (first ? "" : ",") <<
+				"{\"name\":\"" << StageName(event.stage) <<
+				"\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":" << event.begin_us <<
+				",\"dur\":" << event.end_us - event.begin_us <<
+				",\"pid\":" << event.peer_id <<
+				",\"tid\":" << event.thread_id <<
+				",\"args\":{\"frame\":" << event.frame_id << "}}";
+
+			first = false;
+		}
+
+		json << "]}";
+		return json.str();
+	}
+
+	bool LatencyTracer::WriteChromeTrace(const std::string& path) const
+	{
+		std::ofstream file(path, std::ios::out | std::ios::trunc);
+		if (!file.good())
+		{
+			return false;
+		}
+
+		file << ExportChromeTrace();
+		return file.good();
+	}
+
+	void LatencyTracer::Clear()
+	{
+		rtc::CritScope cs(&lock_);
+		for (auto& buffer : buffers_)
+		{
+			buffer->clear_index = buffer->write_index.load(std::memory_order_acquire);
+		}
+	}
+
+	const char* LatencyTracer::StageName(TraceStage stage)
+	{
+		size_t index = static_cast<size_t>(stage);
+		return index < static_cast<size_t>(TraceStage::kCount) ? kStageNames[index] : "unknown";
+	}
+
+	LatencyTracer::ThreadBuffer* LatencyTracer::GetThreadBuffer()
+	{
+		// Buffers are allocated once per thread and kept for the process
+		// lifetime, so exports can still read events of exited threads.
+		thread_local ThreadBuffer* thread_buffer = nullptr;
+		if (!thread_buffer)
+		{
+			std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+			buffer->write_index = 0;
+			buffer->clear_index = 0;
+
+			rtc::CritScope cs(&lock_);
+			buffer->thread_id = static_cast<uint32_t>(buffers_.size() + 1);
+			thread_buffer = buffer.get();
+			buffers_.push_back(std::move(buffer));
+		}
+
+		return thread_buffer;
+	}
+
+	void LatencyTracer::CollectEvents(int64_t since_us, std::vector<TraceEvent>* events) const
+	{
+		rtc::CritScope cs(&lock_);
+		for (auto& buffer : buffers_)
+		{
+			uint64_t end = buffer->write_index.load(std::memory_order_acquire);
+			uint64_t begin = end > kEventsPerThread ? end - kEventsPerThread : 0;
+			begin = std::max(begin, buffer->clear_index.load());
+
+			size_t first_copied = events->size();
+			for (uint64_t i = begin; i < end; i++)
+			{
+				events->push_back(buffer->events[i & (kEventsPerThread - 1)]);
+			}
+
+			// Drops the oldest events if the writer wrapped around meanwhile,
+			// the slot of the event it may be writing included.
+			uint64_t new_end = buffer->write_index.load(std::memory_order_acquire);
+			uint64_t valid_begin = new_end + 1 > kEventsPerThread ? new_end + 1 - kEventsPerThread : 0;
+			if (valid_begin > begin)
+			{
+				size_t overwritten = static_cast<size_t>(std::min(valid_begin, end) - begin);
+				events->erase(events->begin() + first_copied,
+					events->begin() + first_copied + overwritten);
+			}
+		}
+
+		events->erase(std::remove_if(events->begin(), events->end(), [since_us](const TraceEvent& event)
+		{
+			return event.begin_us < since_us;
+		}), events->end());
+	}
+
+	ScopedTraceEvent::ScopedTraceEvent(int32_t peer_id, TraceStage stage, int64_t frame_id) :
+		peer_id_(peer_id),
+		stage_(stage),
+		frame_id_(frame_id),
+		begin_us_(LatencyTracer::Instance().IsEnabled() ? rtc::TimeMicros() : -1)
+	{
+	}
+
+	ScopedTraceEvent::~ScopedTraceEvent()
+	{
+		if (begin_us_ >= 0)
+		{
+			LatencyTracer::Instance().Record(peer_id_, stage_, frame_id_, begin_us_, rtc::TimeMicros());
+		}
+	}
+}
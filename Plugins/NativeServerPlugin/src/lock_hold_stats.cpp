@@ -0,0 +1,41 @@
+#include "pch.h"
+
+#include <algorithm>
+
+#include "lock_hold_stats.h"
+
+namespace StreamingToolkit
+{
+	const int LockHoldWindow::kWindowSize;
+
+	LockHoldWindow::LockHoldWindow() :
+		count_(0),
+		next_(0),
+		last_us_(0)
+	{
+	}
+
+	void LockHoldWindow::Add(int64_t duration_us)
+	{
+		window_[next_] = duration_us;
+		next_ = (next_ + 1) % kWindowSize;
+		count_ = (std::min)(count_ + 1, static_cast<size_t>(kWindowSize));
+		last_us_ = duration_us;
+	}
+
+	LockHoldStats LockHoldWindow::GetStats() const
+	{
+		LockHoldStats stats = {};
+		stats.count = count_;
+		stats.last_us = last_us_;
+		int64_t total_us = 0;
+		for (size_t i = 0; i < count_; i++)
+		{
+			total_us += window_[i];
+			stats.max_us = (std::max)(stats.max_us, window_[i]);
+		}
+
+		stats.average_us = count_ > 0 ? total_us / static_cast<int64_t>(count_) : 0;
+		return stats;
+	}
+}
@@ -0,0 +1,163 @@
+#include "pch.h"
+
+#include "memory_mapped_file.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace StreamingToolkit
+{
+	MemoryMappedFile::MemoryMappedFile() :
+#ifdef _WIN32
+		file_handle_(INVALID_HANDLE_VALUE),
+		mapping_handle_(nullptr),
+#else // _WIN32
+		file_descriptor_(-1),
+#endif // _WIN32
+		data_(nullptr),
+		size_(0)
+	{
+	}
+
+	MemoryMappedFile::~MemoryMappedFile()
+	{
+		Close();
+	}
+
+	bool MemoryMappedFile::Open(const std::string& path)
+	{
+		Close();
+
+#ifdef _WIN32
+		file_handle_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+		if (file_handle_ == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file_handle_, &file_size) || file_size.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+
+		mapping_handle_ = CreateFileMapping(file_handle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping_handle_)
+		{
+			Close();
+			return false;
+		}
+
+		data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_handle_, FILE_MAP_READ, 0, 0, 0));
+		size_ = static_cast<size_t>(file_size.QuadPart);
+#else // _WIN32
+		file_descriptor_ = open(path.c_str(), O_RDONLY);
+		if (file_descriptor_ < 0)
+		{
+			return false;
+		}
+
+		struct stat file_stat;
+		if (fstat(file_descriptor_, &file_stat) != 0 || file_stat.st_size == 0)
+		{
+			Close();
+			return false;
+		}
+
+		void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, file_descriptor_, 0);
+		data_ = data == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(data);
+		size_ = static_cast<size_t>(file_stat.st_size);
+#endif // _WIN32
+
+		if (!data_)
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void MemoryMappedFile::Close()
+	{
+#ifdef _WIN32
+		if (data_)
+		{
+			UnmapViewOfFile(data_);
+		}
+
+		if (mapping_handle_)
+		{
+			CloseHandle(mapping_handle_);
+			mapping_handle_ = nullptr;
+		}
+
+		if (file_handle_ != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file_handle_);
+			file_handle_ = INVALID_HANDLE_VALUE;
+		}
+#else // _WIN32
+		if (data_)
+		{
+			munmap(const_cast<uint8_t*>(data_), size_);
+		}
+
+		if (file_descriptor_ >= 0)
+		{
+			close(file_descriptor_);
+			file_descriptor_ = -1;
+		}
+#endif // _WIN32
+
+		data_ = nullptr;
+		size_ = 0;
+	}
+
+	bool MemoryMappedFile::IsOpen() const
+	{
+		return data_ != nullptr;
+	}
+
+	const uint8_t* MemoryMappedFile::data() const
+	{
+		return data_;
+	}
+
+	size_t MemoryMappedFile::size() const
+	{
+		return size_;
+	}
+
+	void MemoryMappedFile::Prefetch(size_t offset, size_t length) const
+	{
+		if (!data_ || offset >= size_)
+		{
+			return;
+		}
+
+		if (length > size_ - offset)
+		{
+			length = size_ - offset;
+		}
+
+#ifdef _WIN32
+		WIN32_MEMORY_RANGE_ENTRY range;
+		range.VirtualAddress = const_cast<uint8_t*>(data_ + offset);
+		range.NumberOfBytes = length;
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else // _WIN32
+		// madvise() requires a page aligned address.
+		size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		size_t aligned_offset = offset - (offset % page_size);
+		madvise(const_cast<uint8_t*>(data_ + aligned_offset), length + (offset - aligned_offset), MADV_WILLNEED);
+#endif // _WIN32
+	}
+}
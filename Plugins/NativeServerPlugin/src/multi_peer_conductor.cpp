@@ -1,14 +1,23 @@
 #include "pch.h"
 
+#include <algorithm>
+
 #include "defaults.h"
 #include "multi_peer_conductor.h"
+#include "webrtc/rtc_base/logging.h"
 
 MultiPeerConductor::MultiPeerConductor(shared_ptr<FullServerConfig> config,
 	scoped_refptr<PeerConnectionFactoryInterface> peer_factory) :
 	config_(config),
 	main_window_(nullptr),
 	max_capacity_(-1),
-	cur_capacity_(-1)
+	cur_capacity_(-1),
+	reported_capacity_(-1),
+	signed_in_id_(-1),
+	signaling_thread_(nullptr),
+	polling_metrics_(false),
+	peer_pool_([this]() { return AllocatePeerConductor(); },
+		(std::max)(config->server_config->server_config.peer_pool_size, 0))
 {
 	signalling_client_.RegisterObserver(this);
 	signalling_client_.SignalConnected.connect(this, &MultiPeerConductor::HandleSignalConnect);
@@ -25,10 +34,35 @@ MultiPeerConductor::MultiPeerConductor(shared_ptr<FullServerConfig> config,
 	}
 
 	peer_factory_ = peer_factory;
+	if (!peer_factory_)
+	{
+		// the peers are spread over the factories of the configured threads
+		topology_.reset(new PeerFactoryTopology(config_->server_config->server_config));
+		peer_factory_ = topology_->NextFactory();
+
+		// the factories wrap the current thread if needed
+		signaling_thread_ = rtc::Thread::Current();
+		topology_->encoder_sessions()->SetUsageCallback([this](const EncoderSessionStats&)
+		{
+			signaling_thread_->Post(RTC_FROM_HERE, this, kEncoderUsageMessageId);
+		});
+	}
+
+	int metrics_port = config_->server_config->server_config.metrics_port;
+	if (metrics_port > 0)
+	{
+		metrics_endpoint_.reset(new MetricsEndpoint(&MetricsRegistry::Instance()));
+		metrics_endpoint_->Start(rtc::SocketAddress(rtc::IPAddress(INADDR_ANY), metrics_port));
+	}
 }
 
 MultiPeerConductor::~MultiPeerConductor()
 {
+	// waits for a notification in progress on a worker thread
+	if (topology_)
+	{
+		topology_->encoder_sessions()->SetUsageCallback(nullptr);
+	}
 }
 
 const map<int, scoped_refptr<PeerConductor>>& MultiPeerConductor::Peers() const
@@ -58,6 +92,42 @@ void MultiPeerConductor::SetDataChannelMessageHandler(const function<void(int, c
 	data_channel_handler_ = data_channel_handler;
 }
 
+EncoderSessionStats MultiPeerConductor::GetEncoderSessionStats() const
+{
+	if (!topology_)
+	{
+		EncoderSessionStats stats = {};
+		return stats;
+	}
+
+	return topology_->encoder_sessions()->GetStats();
+}
+
+void MultiPeerConductor::SetEncoderConfig(shared_ptr<const NvEncConfig> config)
+{
+	if (topology_)
+	{
+		topology_->encoder_sessions()->SetEncoderConfig(config);
+	}
+}
+
+void MultiPeerConductor::SetMaxCapacity(int max_capacity)
+{
+	int new_max_capacity = max_capacity > 0 ? max_capacity : -1;
+	if (new_max_capacity == max_capacity_)
+	{
+		return;
+	}
+
+	// only the connected peers are tracked in connected_peer_states_
+	max_capacity_ = new_max_capacity;
+	cur_capacity_ = max_capacity_ > -1 ?
+		(std::max)(max_capacity_ - (int)connected_peer_states_.size(), 0) : -1;
+
+	LOG(LS_INFO) << "Max capacity changed to " << max_capacity_;
+	ReportCapacity(cur_capacity_);
+}
+
 void MultiPeerConductor::OnIceConnectionChange(int peer_id, PeerConnectionInterface::IceConnectionState new_state)
 {
 	// if we already know what state you're in, and it hasn't changed, don't do anything
@@ -74,8 +144,9 @@ void MultiPeerConductor::OnIceConnectionChange(int peer_id, PeerConnectionInterf
 		if (cur_capacity_ > -1)
 		{
 			cur_capacity_ -= cur_capacity_ >= 1 ? 1 : 0;
-			signalling_client_.UpdateCapacity(cur_capacity_);
 		}
+
+		ReportCapacity(cur_capacity_);
 	}
 	// peer disconnected
 	else if (new_state == PeerConnectionInterface::IceConnectionState::kIceConnectionDisconnected)
@@ -87,8 +158,9 @@ void MultiPeerConductor::OnIceConnectionChange(int peer_id, PeerConnectionInterf
 		if (cur_capacity_ > -1)
 		{
 			cur_capacity_ += cur_capacity_ < max_capacity_ ? 1 : 0;
-			signalling_client_.UpdateCapacity(cur_capacity_);
 		}
+
+		ReportCapacity(cur_capacity_);
 	}
 
 	if (main_window_ && main_window_->IsWindow())
@@ -107,17 +179,152 @@ void MultiPeerConductor::HandleDataChannelMessage(int peer_id, const string& mes
 	}
 }
 
+void MultiPeerConductor::FillPeerPool()
+{
+	if (peer_factory_ && peer_pool_.GetStats().warm < peer_pool_.size())
+	{
+		rtc::Thread::Current()->Post(RTC_FROM_HERE, this, kFillPeerPoolMessageId);
+	}
+}
+
+scoped_refptr<PeerConnectionFactoryInterface> MultiPeerConductor::NextPeerFactory()
+{
+	// a given factory is used by all the peers, and none is left once closed
+	return topology_ && peer_factory_ ? topology_->NextFactory() : peer_factory_;
+}
+
+PeerConductorPoolStats MultiPeerConductor::GetPeerPoolStats() const
+{
+	return peer_pool_.GetStats();
+}
+
+scoped_refptr<PeerConductor> MultiPeerConductor::SafeAllocatePeerMapEntry(int peer_id)
+{
+	if (connected_peers_.find(peer_id) == connected_peers_.end())
+	{
+		// the pre-warmed peer is replaced once this one is on its way
+		scoped_refptr<PeerConductor> peer = peer_pool_.Acquire();
+		if (peer)
+		{
+			FillPeerPool();
+		}
+		else
+		{
+			peer = AllocatePeerConductor();
+		}
+
+		auto peer_name = signalling_client_.peers().find(peer_id);
+		peer->Assign(peer_id,
+			peer_name != signalling_client_.peers().end() ? peer_name->second : "",
+			[&, peer_id](const string& message)
+			{
+				message_queue_.push(MessageEntry(peer_id, message));
+				rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, 500, this, kSendMessageId);
+			});
+
+		peer->SignalIceConnectionChange.connect(this, &MultiPeerConductor::OnIceConnectionChange);
+		peer->SignalDataChannelMessage.connect(this, &MultiPeerConductor::HandleDataChannelMessage);
+		connected_peers_[peer_id] = peer;
+	}
+
+	return connected_peers_[peer_id];
+}
+
 void MultiPeerConductor::HandleSignalConnect()
 {
-	if (max_capacity_ > -1)
+	// the peers connected before a reconnection still take their share
+	ReportCapacity(cur_capacity_);
+}
+
+int MultiPeerConductor::CapByEncoderSessions(int capacity) const
+{
+	// a peer joining a shared session doesn't take one, so only the
+	// unshared sessions are known to run out
+	EncoderSessionStats stats = GetEncoderSessionStats();
+	if (stats.max_sessions == 0 || stats.share_sessions)
+	{
+		return capacity;
+	}
+
+	// the connected peers which aren't encoding yet will take a session too
+	size_t taken = (std::max)(stats.encoders + stats.queued, connected_peer_states_.size());
+	int sessions_left = (std::max)((int)stats.max_sessions - (int)taken, 0);
+	return capacity > -1 ? (std::min)(capacity, sessions_left) : sessions_left;
+}
+
+void MultiPeerConductor::ReportCapacity(int capacity)
+{
+	capacity = CapByEncoderSessions(capacity);
+	if (capacity > -1)
+	{
+		reported_capacity_ = capacity;
+		signalling_client_.UpdateCapacity(capacity);
+	}
+}
+
+void MultiPeerConductor::PollMetrics()
+{
+	auto& registry = MetricsRegistry::Instance();
+	PeerConductorPoolStats pool_stats = peer_pool_.GetStats();
+	EncoderSessionStats session_stats = GetEncoderSessionStats();
+
+	registry.GetGauge("streaming_peers_connected",
+		"Peers whose ice connection is up")->Set(static_cast<double>(connected_peer_states_.size()));
+	registry.GetGauge("streaming_capacity",
+		"Peers which may still connect, -1 if unlimited")->Set(CapByEncoderSessions(cur_capacity_));
+	registry.GetGauge("streaming_signaling_queue_depth",
+		"Messages waiting to be sent to the signalling server")->Set(static_cast<double>(message_queue_.size()));
+	registry.GetGauge("streaming_peer_pool_warm",
+		"Pre-warmed peer connections waiting for a peer")->Set(static_cast<double>(pool_stats.warm));
+	registry.GetGauge("streaming_encoder_sessions",
+		"Encoder sessions open")->Set(static_cast<double>(session_stats.sessions));
+	registry.GetGauge("streaming_encoder_queue_depth",
+		"Encoders waiting for an encoder session")->Set(static_cast<double>(session_stats.queued));
+
+	// the statistics of the peers come back on this thread
+	for (auto& peer : connected_peers_)
 	{
-		signalling_client_.UpdateCapacity(max_capacity_);
+		peer.second->PollStats();
 	}
 }
 
 void MultiPeerConductor::OnSignedIn()
 {
+	// signed back in under a new id, the negotiations in progress can't reach us
+	// any longer while the connected peers keep their media
+	int id = signalling_client_.id();
+	if (signed_in_id_ != -1 && id != signed_in_id_)
+	{
+		for (auto it = connected_peers_.begin(); it != connected_peers_.end();)
+		{
+			if (connected_peer_states_.find(it->first) == connected_peer_states_.end())
+			{
+				it = connected_peers_.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	signed_in_id_ = id;
 	should_process_queue_.store(true);
+	FillPeerPool();
+
+	// the metrics are polled on the signalling thread, from the first sign in
+	if (metrics_endpoint_ && !polling_metrics_)
+	{
+		polling_metrics_ = true;
+		rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, kMetricsIntervalMs, this, kMetricsMessageId);
+	}
+
+	// sends the messages held during the outage
+	if (!message_queue_.empty())
+	{
+		rtc::Thread::Current()->Post(RTC_FROM_HERE, this, kSendMessageId);
+	}
+
 	if (main_window_ && main_window_->IsWindow())
 	{
 		main_window_->SwitchToPeerList(signalling_client_.peers());
@@ -165,6 +372,33 @@ void MultiPeerConductor::OnServerConnectionFailure() {}
 
 void MultiPeerConductor::OnMessage(Message* msg)
 {
+	if (msg->message_id == kEncoderUsageMessageId)
+	{
+		if (CapByEncoderSessions(cur_capacity_) != reported_capacity_)
+		{
+			ReportCapacity(cur_capacity_);
+		}
+
+		return;
+	}
+
+	if (msg->message_id == kMetricsMessageId)
+	{
+		PollMetrics();
+		rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, kMetricsIntervalMs, this, kMetricsMessageId);
+		return;
+	}
+
+	if (msg->message_id == kFillPeerPoolMessageId)
+	{
+		if (peer_factory_ && peer_pool_.FillOne())
+		{
+			rtc::Thread::Current()->Post(RTC_FROM_HERE, this, kFillPeerPoolMessageId);
+		}
+
+		return;
+	}
+
 	if (!should_process_queue_.load() ||
 		message_queue_.size() == 0)
 	{
@@ -180,7 +414,7 @@ void MultiPeerConductor::OnMessage(Message* msg)
 
 	if (message_queue_.size() > 0)
 	{
-		rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, 500, this, 0);
+		rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, 500, this, kSendMessageId);
 	}
 }
 
@@ -202,10 +436,10 @@ void MultiPeerConductor::DisconnectFromServer() {}
 void MultiPeerConductor::ConnectToPeer(int peer_id)
 {
 	// don't connect to self
-	// don't connect if there is no capacity
+	// don't connect if there is no capacity, or no encoder session left
 	// (note: != 0 will allow -1, which is intentional since -1 is indicates we aren't using capacity)
 	if (peer_id != signalling_client_.id() &&
-		cur_capacity_ != 0)
+		CapByEncoderSessions(cur_capacity_) != 0)
 	{
 		// actually connect
 		auto peer = SafeAllocatePeerMapEntry(peer_id);
@@ -223,5 +457,6 @@ void MultiPeerConductor::UIThreadCallback(int msg_id, void* data) {}
 void MultiPeerConductor::Close()
 {
 	peer_factory_ = NULL;
+	peer_pool_.Clear();
 	connected_peers_.clear();
 }
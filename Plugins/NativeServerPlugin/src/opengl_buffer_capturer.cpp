@@ -21,11 +21,18 @@ void OpenGLBufferCapturer::SendFrame(GLubyte* color_buffer, int width, int heigh
 		return;
 	}
 
+	if (frame_stamp_enabled_)
+	{
+		FrameStamp stamp = { FrameStampCodec::Now(), static_cast<uint32_t>(trace_frame_id_) };
+		FrameStampCodec::WriteRGBA(stamp, (uint8_t*)color_buffer, width * 4, width, height);
+	}
+
 	rtc::scoped_refptr<webrtc::I420Buffer> buffer;
-	buffer = webrtc::I420Buffer::Create(width, height);
+	buffer = frame_source_.CreateI420Buffer(width, height);
 
-	if (use_software_encoder_)
+	if (ShouldConvertToI420())
 	{
+		ScopedTraceEvent trace(trace_peer_id_, TraceStage::kColorConvert, trace_frame_id_);
 		libyuv::ABGRToI420(
 			(uint8_t*)color_buffer,
 			width * 4,
@@ -8,24 +8,11 @@ OpenGLMultiPeerConductor::OpenGLMultiPeerConductor(shared_ptr<FullServerConfig>
 {
 }
 
-scoped_refptr<PeerConductor> OpenGLMultiPeerConductor::SafeAllocatePeerMapEntry(int peer_id)
+scoped_refptr<PeerConductor> OpenGLMultiPeerConductor::AllocatePeerConductor()
 {
-	if (connected_peers_.find(peer_id) == connected_peers_.end())
-	{
-		string peer_name = signalling_client_.peers().at(peer_id);
-		connected_peers_[peer_id] = new RefCountedObject<OpenGLPeerConductor>(peer_id,
-			peer_name,
-			config_->webrtc_config,
-			peer_factory_,
-			[&, peer_id](const string& message)
-		{
-			message_queue_.push(MessageEntry(peer_id, message));
-			rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, 500, this, 0);
-		});
-
-		connected_peers_[peer_id]->SignalIceConnectionChange.connect((MultiPeerConductor*)this, &OpenGLMultiPeerConductor::OnIceConnectionChange);
-		connected_peers_[peer_id]->SignalDataChannelMessage.connect((MultiPeerConductor*)this, &OpenGLMultiPeerConductor::HandleDataChannelMessage);
-	}
-
-	return connected_peers_[peer_id];
+	return new RefCountedObject<OpenGLPeerConductor>(-1,
+		"",
+		config_->webrtc_config,
+		NextPeerFactory(),
+		[](const string&) {});
 }
@@ -19,13 +19,33 @@ void OpenGLPeerConductor::SendFrame(GLubyte* color_buffer, int width, int height
 {
 	if (capturer_)
 	{
+		ScopedTraceEvent trace(Id(), TraceStage::kRenderSubmit, capturer_->trace_frame_id());
 		capturer_->SendFrame(color_buffer, width, height);
 	}
 }
 
+void OpenGLPeerConductor::SetFrameStampEnabled(bool enabled)
+{
+	if (capturer_)
+	{
+		capturer_->SetFrameStampEnabled(enabled);
+	}
+}
+
 unique_ptr<cricket::VideoCapturer> OpenGLPeerConductor::AllocateVideoCapturer()
 {
 	unique_ptr<OpenGLBufferCapturer> owned_ptr(new OpenGLBufferCapturer());
 	capturer_ = owned_ptr.get();
+	capturer_->SetTracePeerId(Id());
+	capturer_->SetStreamMetrics(stream_metrics());
 	return owned_ptr;
 }
+
+void OpenGLPeerConductor::OnAssigned()
+{
+	if (capturer_)
+	{
+		capturer_->SetTracePeerId(Id());
+		capturer_->SetStreamMetrics(stream_metrics());
+	}
+}
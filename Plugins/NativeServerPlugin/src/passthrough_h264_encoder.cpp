@@ -0,0 +1,278 @@
+#include "pch.h"
+
+#include "passthrough_h264_encoder.h"
+#include "latency_tracer.h"
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/media/base/codec.h"
+#include "webrtc/media/base/mediaconstants.h"
+#include "webrtc/modules/include/module_common_types.h"
+#include "webrtc/modules/video_coding/include/video_codec_interface.h"
+#include "webrtc/modules/video_coding/include/video_error_codes.h"
+#include "webrtc/rtc_base/checks.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+namespace
+{
+	// Returns the NAL unit payload ranges of an Annex B access unit.
+	void FindNalUnits(const uint8_t* data, size_t size,
+		std::vector<std::pair<size_t, size_t>>* nal_units)
+	{
+		size_t nal_start = 0;
+		bool in_nal = false;
+		size_t i = 0;
+		while (i + 3 <= size)
+		{
+			if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+			{
+				if (in_nal)
+				{
+					// Trailing zero of a four byte start code belongs to it.
+					size_t nal_end = (i > nal_start && data[i - 1] == 0) ? i - 1 : i;
+					nal_units->push_back(std::make_pair(nal_start, nal_end - nal_start));
+				}
+
+				i += 3;
+				nal_start = i;
+				in_nal = true;
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		if (in_nal && nal_start < size)
+		{
+			nal_units->push_back(std::make_pair(nal_start, size - nal_start));
+		}
+	}
+}
+
+namespace StreamingToolkit
+{
+	EncodedFrameBuffer::EncodedFrameBuffer(int width, int height, const uint8_t* data, size_t size,
+		bool key_frame, const rtc::Callback0<void>& no_longer_used) :
+		width_(width),
+		height_(height),
+		data_(data),
+		size_(size),
+		key_frame_(key_frame),
+		trace_peer_id_(-1),
+		trace_frame_id_(-1),
+		no_longer_used_cb_(no_longer_used)
+	{
+	}
+
+	EncodedFrameBuffer::~EncodedFrameBuffer()
+	{
+		no_longer_used_cb_();
+	}
+
+	webrtc::VideoFrameBuffer::Type EncodedFrameBuffer::type() const
+	{
+		return Type::kNative;
+	}
+
+	int EncodedFrameBuffer::width() const
+	{
+		return width_;
+	}
+
+	int EncodedFrameBuffer::height() const
+	{
+		return height_;
+	}
+
+	rtc::scoped_refptr<webrtc::I420BufferInterface> EncodedFrameBuffer::ToI420()
+	{
+		rtc::scoped_refptr<webrtc::I420Buffer> buffer = webrtc::I420Buffer::Create(width_, height_);
+		webrtc::I420Buffer::SetBlack(buffer);
+		return buffer;
+	}
+
+	const uint8_t* EncodedFrameBuffer::data() const
+	{
+		return data_;
+	}
+
+	size_t EncodedFrameBuffer::size() const
+	{
+		return size_;
+	}
+
+	bool EncodedFrameBuffer::key_frame() const
+	{
+		return key_frame_;
+	}
+
+	void EncodedFrameBuffer::SetTraceInfo(int32_t peer_id, int64_t frame_id)
+	{
+		trace_peer_id_ = peer_id;
+		trace_frame_id_ = frame_id;
+	}
+
+	int32_t EncodedFrameBuffer::trace_peer_id() const
+	{
+		return trace_peer_id_;
+	}
+
+	int64_t EncodedFrameBuffer::trace_frame_id() const
+	{
+		return trace_frame_id_;
+	}
+
+	PassthroughH264Encoder::PassthroughH264Encoder() :
+		encoded_image_callback_(nullptr),
+		key_frame_requested_(true)
+	{
+	}
+
+	int32_t PassthroughH264Encoder::InitEncode(const webrtc::VideoCodec* codec_settings,
+		int32_t number_of_cores, size_t max_payload_size)
+	{
+		if (!codec_settings || codec_settings->codecType != webrtc::kVideoCodecH264)
+		{
+			return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
+		}
+
+		key_frame_requested_ = true;
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t PassthroughH264Encoder::RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback* callback)
+	{
+		encoded_image_callback_ = callback;
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t PassthroughH264Encoder::Release()
+	{
+		encoded_image_callback_ = nullptr;
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t PassthroughH264Encoder::Encode(const webrtc::VideoFrame& frame,
+		const webrtc::CodecSpecificInfo* codec_specific_info,
+		const std::vector<webrtc::FrameType>* frame_types)
+	{
+		int64_t encode_begin_us = rtc::TimeMicros();
+		if (!encoded_image_callback_)
+		{
+			return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+		}
+
+		if (frame.video_frame_buffer()->type() != webrtc::VideoFrameBuffer::Type::kNative)
+		{
+			LOG(LS_ERROR) << "Passthrough encoder only accepts encoded frame buffers.";
+			return WEBRTC_VIDEO_CODEC_ERROR;
+		}
+
+		const EncodedFrameBuffer* buffer =
+			static_cast<const EncodedFrameBuffer*>(frame.video_frame_buffer().get());
+
+		if (frame_types)
+		{
+			for (auto frame_type : *frame_types)
+			{
+				key_frame_requested_ |= frame_type == webrtc::kVideoFrameKey;
+			}
+		}
+
+		// Access units can't be re-encoded, drops delta frames until the
+		// recording reaches a key frame.
+		if (key_frame_requested_ && !buffer->key_frame())
+		{
+			return WEBRTC_VIDEO_CODEC_OK;
+		}
+
+		key_frame_requested_ = false;
+
+		std::vector<std::pair<size_t, size_t>> nal_units;
+		FindNalUnits(buffer->data(), buffer->size(), &nal_units);
+		if (nal_units.empty())
+		{
+			return WEBRTC_VIDEO_CODEC_ERROR;
+		}
+
+		webrtc::RTPFragmentationHeader fragmentation;
+		fragmentation.VerifyAndAllocateFragmentationHeader(nal_units.size());
+		for (size_t i = 0; i < nal_units.size(); i++)
+		{
+			fragmentation.fragmentationOffset[i] = nal_units[i].first;
+			fragmentation.fragmentationLength[i] = nal_units[i].second;
+			fragmentation.fragmentationPlType[i] = 0;
+			fragmentation.fragmentationTimeDiff[i] = 0;
+		}
+
+		// The packetizer only reads from the image buffer.
+		webrtc::EncodedImage encoded_image(const_cast<uint8_t*>(buffer->data()),
+			buffer->size(), buffer->size());
+
+		encoded_image._encodedWidth = buffer->width();
+		encoded_image._encodedHeight = buffer->height();
+		encoded_image._timeStamp = frame.timestamp();
+		encoded_image.ntp_time_ms_ = frame.ntp_time_ms();
+		encoded_image.capture_time_ms_ = frame.render_time_ms();
+		encoded_image.rotation_ = frame.rotation();
+		encoded_image.prediction_timestamp_ = frame.prediction_timestamp();
+		encoded_image._frameType = buffer->key_frame() ? webrtc::kVideoFrameKey : webrtc::kVideoFrameDelta;
+		encoded_image._completeFrame = true;
+
+		webrtc::CodecSpecificInfo codec_info;
+		codec_info.codecType = webrtc::kVideoCodecH264;
+		codec_info.codecSpecific.H264.packetization_mode =
+			webrtc::H264PacketizationMode::NonInterleaved;
+
+		// The bitstream is ready once framed, sending covers packetization
+		// and queueing into the pacer.
+		LatencyTracer::Instance().Record(buffer->trace_peer_id(), TraceStage::kBitstreamReady,
+			buffer->trace_frame_id(), encode_begin_us, rtc::TimeMicros());
+
+		{
+			ScopedTraceEvent trace(buffer->trace_peer_id(), TraceStage::kRtpSend, buffer->trace_frame_id());
+			encoded_image_callback_->OnEncodedImage(encoded_image, &codec_info, &fragmentation);
+		}
+
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t PassthroughH264Encoder::SetChannelParameters(uint32_t packet_loss, int64_t rtt)
+	{
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	const char* PassthroughH264Encoder::ImplementationName() const
+	{
+		return "PassthroughH264";
+	}
+
+	PassthroughVideoEncoderFactory::PassthroughVideoEncoderFactory()
+	{
+		cricket::VideoCodec codec(cricket::kH264CodecName);
+		codec.SetParam(cricket::kH264FmtpProfileLevelId, "42e01f");
+		codec.SetParam(cricket::kH264FmtpLevelAsymmetryAllowed, "1");
+		codec.SetParam(cricket::kH264FmtpPacketizationMode, "1");
+		supported_codecs_.push_back(codec);
+	}
+
+	webrtc::VideoEncoder* PassthroughVideoEncoderFactory::CreateVideoEncoder(const cricket::VideoCodec& codec)
+	{
+		if (!cricket::CodecNamesEq(codec.name, cricket::kH264CodecName))
+		{
+			return nullptr;
+		}
+
+		return new PassthroughH264Encoder();
+	}
+
+	const std::vector<cricket::VideoCodec>& PassthroughVideoEncoderFactory::supported_codecs() const
+	{
+		return supported_codecs_;
+	}
+
+	void PassthroughVideoEncoderFactory::DestroyVideoEncoder(webrtc::VideoEncoder* encoder)
+	{
+		delete encoder;
+	}
+}
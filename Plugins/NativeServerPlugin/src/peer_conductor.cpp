@@ -1,6 +1,11 @@
 #include "pch.h"
 
+#include <algorithm>
+#include <cstdlib>
+
 #include "peer_conductor.h"
+#include "structured_log.h"
+#include "webrtc/rtc_base/timeutils.h"
 
 namespace 
 {
@@ -27,6 +32,67 @@ namespace
 		DummySetSessionDescriptionObserver() {}
 		~DummySetSessionDescriptionObserver() {}
 	};
+
+	// Passes the statistics of the video sender to the metrics of the peer
+	class StreamStatsObserver : public webrtc::StatsObserver
+	{
+	public:
+		static StreamStatsObserver* Create(shared_ptr<StreamMetrics> metrics, int64_t frames_skipped)
+		{
+			return new rtc::RefCountedObject<StreamStatsObserver>(metrics, frames_skipped);
+		}
+
+		virtual void OnComplete(const StatsReports& reports)
+		{
+			StreamStatsSample sample = {};
+			sample.frames_skipped = frames_skipped_;
+
+			for (auto report : reports)
+			{
+				// the ssrc reports of the video senders are the ones counting encoded frames
+				if (report->type() != StatsReport::kStatsReportTypeSsrc ||
+					report->FindValue(StatsReport::kStatsValueNameFramesEncoded) == nullptr)
+				{
+					continue;
+				}
+
+				sample.bytes_sent += GetInt64(report, StatsReport::kStatsValueNameBytesSent);
+				sample.packets_sent += GetInt64(report, StatsReport::kStatsValueNamePacketsSent);
+				sample.packets_lost += GetInt64(report, StatsReport::kStatsValueNamePacketsLost);
+				sample.frames_encoded += GetInt64(report, StatsReport::kStatsValueNameFramesEncoded);
+				sample.avg_encode_ms = (std::max)(sample.avg_encode_ms, GetDouble(report, StatsReport::kStatsValueNameAvgEncodeMs));
+				sample.rtt_ms = (std::max)(sample.rtt_ms, GetDouble(report, StatsReport::kStatsValueNameRtt));
+			}
+
+			metrics_->OnStats(sample);
+		}
+
+	protected:
+		StreamStatsObserver(shared_ptr<StreamMetrics> metrics, int64_t frames_skipped) :
+			metrics_(metrics),
+			frames_skipped_(frames_skipped)
+		{
+		}
+
+		~StreamStatsObserver() {}
+
+	private:
+		// the values are typed by the stats collector, their strings always parse
+		static int64_t GetInt64(const StatsReport* report, StatsReport::StatsValueName name)
+		{
+			auto value = report->FindValue(name);
+			return value ? strtoll(value->ToString().c_str(), nullptr, 10) : 0;
+		}
+
+		static double GetDouble(const StatsReport* report, StatsReport::StatsValueName name)
+		{
+			auto value = report->FindValue(name);
+			return value ? atof(value->ToString().c_str()) : 0;
+		}
+
+		shared_ptr<StreamMetrics> metrics_;
+		int64_t frames_skipped_;
+	};
 }
 
 PeerConductor::PeerConductor(int id,
@@ -38,14 +104,25 @@ PeerConductor::PeerConductor(int id,
 	name_(name),
 	webrtc_config_(webrtc_config),
 	peer_factory_(peer_factory),
-	send_func_(send_func)
+	send_func_(send_func),
+	warm_(false)
 {
+	if (id_ >= 0)
+	{
+		stream_metrics_ = make_shared<StreamMetrics>(&MetricsRegistry::Instance(), id_);
+	}
 }
 
 PeerConductor::~PeerConductor()
 {
 	LOG(INFO) << "dtor";
 
+	if (data_channel_)
+	{
+		data_channel_->UnregisterObserver();
+		data_channel_ = NULL;
+	}
+
 	peer_connection_ = NULL;
 	peer_streams_.clear();
 	peer_factory_ = NULL;
@@ -141,12 +218,63 @@ void PeerConductor::OnDataChannel(
 void PeerConductor::OnMessage(const DataBuffer& buffer)
 {
 	std::string message((const char*)buffer.data.data(), buffer.data.size());
+	idle_policy_.OnInput(rtc::TimeMicros());
 	SignalDataChannelMessage.emit(Id(), message);
 }
 
 void PeerConductor::OnStateChange() {}
 
 void PeerConductor::AllocatePeerConnection(bool create_offer)
+{
+	if (!peer_connection_)
+	{
+		CreatePeerConnection(false);
+	}
+	else if (warm_ && !create_offer && data_channel_)
+	{
+		// the client opens the data channel when it makes the offer
+		data_channel_->UnregisterObserver();
+		data_channel_->Close();
+		data_channel_ = nullptr;
+	}
+
+	warm_ = false;
+	ApplyEncoderProfile();
+
+	// create offer if required
+	if (create_offer)
+	{
+		if (!data_channel_)
+		{
+			CreateDataChannel();
+		}
+
+		peer_connection_->CreateOffer(this, NULL);
+	}
+}
+
+void PeerConductor::Prewarm()
+{
+	if (peer_connection_)
+	{
+		return;
+	}
+
+	CreatePeerConnection(true);
+	CreateDataChannel();
+	warm_ = true;
+}
+
+void PeerConductor::Assign(int id, const string& name, const function<void(const string&)>& send_func)
+{
+	id_ = id;
+	name_ = name;
+	send_func_ = send_func;
+	stream_metrics_ = make_shared<StreamMetrics>(&MetricsRegistry::Instance(), id_);
+	OnAssigned();
+}
+
+void PeerConductor::CreatePeerConnection(bool prewarm)
 {
 	webrtc::PeerConnectionInterface::RTCConfiguration config;
 
@@ -192,6 +320,13 @@ void PeerConductor::AllocatePeerConnection(bool create_offer)
 		}
 	}
 
+	// gathers the candidates before the local description is set, which
+	// otherwise starts the gathering
+	if (prewarm)
+	{
+		config.ice_candidate_pool_size = kIceCandidatePoolSize;
+	}
+
 	webrtc::FakeConstraints constraints;
 
 	// TODO(bengreenier): make optional again for loopback
@@ -217,23 +352,24 @@ void PeerConductor::AllocatePeerConnection(bool create_offer)
 
 	// create a peer stream for this peer
 	peer_streams_.push_back(peerStream);
+}
 
-	// create offer if required
-	if (create_offer)
+void PeerConductor::CreateDataChannel()
+{
+	webrtc::DataChannelInit data_channel_config;
+	data_channel_config.ordered = false;
+	data_channel_config.maxRetransmits = 0;
+	data_channel_ = peer_connection_->CreateDataChannel("inputDataChannel", &data_channel_config);
+	if (data_channel_)
 	{
-		webrtc::DataChannelInit data_channel_config;
-		data_channel_config.ordered = false;
-		data_channel_config.maxRetransmits = 0;
-		auto channel = peer_connection_->CreateDataChannel("inputDataChannel", &data_channel_config);
-		channel->RegisterObserver(this);
-		peer_connection_->CreateOffer(this, NULL);
+		data_channel_->RegisterObserver(this);
 	}
 }
 
 bool PeerConductor::HandlePeerMessage(const string& message)
 {
 	// if we don't know this peer, add it
-	if (peer_connection_.get() == nullptr)
+	if (peer_connection_.get() == nullptr || warm_)
 	{
 		// this is just the init that sets the m_peerConnection value
 		AllocatePeerConnection();
@@ -278,7 +414,8 @@ bool PeerConductor::HandlePeerMessage(const string& message)
 			return false;
 		}
 
-		LOG(INFO) << " Received session description :" << message;
+		SLOG(INFO, "session_description_received").Field("peer_id", id_).Field("type", type).Field("length", sdp.length());
+		SLOG(LS_VERBOSE, "session_description").Field("peer_id", id_).Field("sdp", sdp);
 		peer_connection_->SetRemoteDescription(
 			DummySetSessionDescriptionObserver::Create(),
 			session_description);
@@ -319,15 +456,35 @@ bool PeerConductor::HandlePeerMessage(const string& message)
 			return false;
 		}
 
-		LOG(INFO) << " Received candidate :" << message;
+		// peers trickle many candidates at once
+		SLOG_RATE_LIMITED(INFO, "candidate_received", 10).Field("peer_id", id_).Field("mid", sdp_mid).Field("mline", sdp_mlineindex);
+		SLOG(LS_VERBOSE, "candidate").Field("peer_id", id_).Field("sdp", sdp);
 	}
 
 	return true;
 }
 
+void PeerConductor::PollStats()
+{
+	if (!IsConnected() || !stream_metrics_)
+	{
+		return;
+	}
+
+	peer_connection_->GetStats(
+		StreamStatsObserver::Create(stream_metrics_, idle_policy_.GetStats().skipped_frames),
+		nullptr,
+		PeerConnectionInterface::kStatsOutputLevelStandard);
+}
+
+shared_ptr<StreamMetrics> PeerConductor::stream_metrics() const
+{
+	return stream_metrics_;
+}
+
 const bool PeerConductor::IsConnected() const
 {
-	return peer_connection_ != NULL;
+	return peer_connection_ != NULL && !warm_;
 }
 
 const int PeerConductor::Id() const
@@ -344,3 +501,32 @@ const vector<scoped_refptr<webrtc::MediaStreamInterface>> PeerConductor::Streams
 {
 	return peer_streams_;
 }
+
+IdlePolicy* PeerConductor::idle_policy()
+{
+	return &idle_policy_;
+}
+
+void PeerConductor::SetEncoderProfile(const EncoderProfile& profile)
+{
+	encoder_profile_.reset(new EncoderProfile(profile));
+	ApplyEncoderProfile();
+}
+
+void PeerConductor::ApplyEncoderProfile()
+{
+	if (!peer_connection_ || !encoder_profile_)
+	{
+		return;
+	}
+
+	PeerConnectionInterface::BitrateParameters bitrate;
+	bitrate.min_bitrate_bps = rtc::Optional<int>(encoder_profile_->min_bitrate);
+	bitrate.current_bitrate_bps = rtc::Optional<int>(encoder_profile_->bitrate);
+	bitrate.max_bitrate_bps = rtc::Optional<int>(encoder_profile_->max_bitrate);
+	RTCError error = peer_connection_->SetBitrate(bitrate);
+	if (!error.ok())
+	{
+		LOG(LS_WARNING) << "Failed to set the bitrate of peer " << id_ << ": " << error.message();
+	}
+}
@@ -0,0 +1,63 @@
+#include "pch.h"
+
+#include "peer_conductor_pool.h"
+
+namespace StreamingToolkit
+{
+	PeerConductorPool::PeerConductorPool(const Allocator& allocator, size_t size) :
+		allocator_(allocator),
+		size_(size),
+		prewarmed_(0),
+		hits_(0),
+		misses_(0)
+	{
+	}
+
+	scoped_refptr<PeerConductor> PeerConductorPool::Acquire()
+	{
+		if (warm_.empty())
+		{
+			misses_ += size_ > 0 ? 1 : 0;
+			return nullptr;
+		}
+
+		scoped_refptr<PeerConductor> peer = warm_.front();
+		warm_.pop_front();
+		hits_++;
+		return peer;
+	}
+
+	bool PeerConductorPool::FillOne()
+	{
+		if (warm_.size() >= size_)
+		{
+			return false;
+		}
+
+		scoped_refptr<PeerConductor> peer = allocator_();
+		if (!peer)
+		{
+			return false;
+		}
+
+		peer->Prewarm();
+		warm_.push_back(peer);
+		prewarmed_++;
+		return warm_.size() < size_;
+	}
+
+	void PeerConductorPool::Clear()
+	{
+		warm_.clear();
+	}
+
+	PeerConductorPoolStats PeerConductorPool::GetStats() const
+	{
+		PeerConductorPoolStats stats;
+		stats.warm = warm_.size();
+		stats.prewarmed = prewarmed_;
+		stats.hits = hits_;
+		stats.misses = misses_;
+		return stats;
+	}
+}
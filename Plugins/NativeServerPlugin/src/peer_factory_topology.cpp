@@ -0,0 +1,115 @@
+#include "pch.h"
+
+#include <algorithm>
+#include <string>
+
+#include "peer_factory_topology.h"
+#include "webrtc/rtc_base/logging.h"
+
+namespace StreamingToolkit
+{
+	PeerFactoryTopology::PeerFactoryTopology(const ServerAppConfig& config,
+		const EncoderSessionManager::Allocator& encoder_allocator) :
+		encoder_sessions_(std::make_shared<EncoderSessionManager>(encoder_allocator,
+			(size_t)(std::max)(config.max_encoder_sessions, 0), config.share_encoder_sessions)),
+		next_factory_(0)
+	{
+		network_thread_ = rtc::Thread::CreateWithSocketServer();
+		network_thread_->SetName("pc_network_thread", nullptr);
+		network_thread_->Start();
+		PinThread(network_thread_.get(), config.network_thread_cores);
+
+		// The default encoders are kept unless the sessions are limited or
+		// shared.
+		bool manage_encoders = config.max_encoder_sessions > 0 || config.share_encoder_sessions;
+
+		int worker_count = (std::max)(config.worker_threads, 1);
+		for (int i = 0; i < worker_count; i++)
+		{
+			std::unique_ptr<rtc::Thread> worker_thread = rtc::Thread::Create();
+			worker_thread->SetName("pc_worker_thread_" + std::to_string(i), nullptr);
+			worker_thread->Start();
+
+			// Each worker gets a core of its own, in turn.
+			if (!config.worker_thread_cores.empty())
+			{
+				PinThread(worker_thread.get(), std::vector<int>(1,
+					config.worker_thread_cores[i % config.worker_thread_cores.size()]));
+			}
+
+			rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory =
+				webrtc::CreatePeerConnectionFactory(network_thread_.get(), worker_thread.get(),
+					rtc::Thread::Current(), nullptr,
+					manage_encoders ? new SharedSessionEncoderFactory(encoder_sessions_) : nullptr, nullptr);
+
+			if (!factory)
+			{
+				LOG(LS_ERROR) << "Cannot create the peer connection factory of worker thread " << i;
+				worker_thread->Stop();
+				continue;
+			}
+
+			worker_threads_.push_back(std::move(worker_thread));
+			factories_.push_back(factory);
+		}
+
+		LOG(LS_INFO) << "Created " << factories_.size() << " peer connection factories, with "
+			<< config.max_encoder_sessions << " max encoder sessions";
+	}
+
+	PeerFactoryTopology::~PeerFactoryTopology()
+	{
+		factories_.clear();
+		for (auto& worker_thread : worker_threads_)
+		{
+			worker_thread->Stop();
+		}
+
+		network_thread_->Stop();
+	}
+
+	rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> PeerFactoryTopology::NextFactory()
+	{
+		if (factories_.empty())
+		{
+			return nullptr;
+		}
+
+		return factories_[next_factory_++ % factories_.size()];
+	}
+
+	const std::vector<rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>>& PeerFactoryTopology::factories() const
+	{
+		return factories_;
+	}
+
+	std::shared_ptr<EncoderSessionManager> PeerFactoryTopology::encoder_sessions() const
+	{
+		return encoder_sessions_;
+	}
+
+	void PeerFactoryTopology::PinThread(rtc::Thread* thread, const std::vector<int>& cores)
+	{
+		DWORD_PTR mask = 0;
+		for (int core : cores)
+		{
+			if (core >= 0 && core < (int)(sizeof(DWORD_PTR) * 8))
+			{
+				mask |= (DWORD_PTR)1 << core;
+			}
+		}
+
+		if (mask == 0)
+		{
+			return;
+		}
+
+		thread->Invoke<void>(RTC_FROM_HERE, [mask]()
+		{
+			if (!SetThreadAffinityMask(GetCurrentThread(), mask))
+			{
+				LOG(LS_WARNING) << "Cannot pin the thread to its cores: " << GetLastError();
+			}
+		});
+	}
+}
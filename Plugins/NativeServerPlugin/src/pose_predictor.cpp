@@ -0,0 +1,322 @@
+#include "pch.h"
+
+#include <algorithm>
+#include <math.h>
+
+#include "pose_predictor.h"
+
+namespace
+{
+	// Poses used to estimate the velocities, a longer window smooths the
+	// tracking noise but lags behind accelerations.
+	const int64_t kVelocityWindowUs = 50000;
+
+	// The history is dropped when no pose was received for this long.
+	const int64_t kMaxSampleGapUs = 200000;
+
+	// Fraction of the reported display errors applied to the latency.
+	const int64_t kDisplayErrorGainDivisor = 4;
+
+	struct Vector3
+	{
+		double x, y, z;
+	};
+
+	struct Quaternion
+	{
+		double w, x, y, z;
+	};
+
+	// Rigid transform from world to eye space, with column vectors.
+	struct RigidTransform
+	{
+		Quaternion rotation;
+
+		// The eye position in world space.
+		Vector3 position;
+	};
+
+	Quaternion Multiply(const Quaternion& a, const Quaternion& b)
+	{
+		return
+		{
+			a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+			a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+			a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+			a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w
+		};
+	}
+
+	Quaternion Conjugate(const Quaternion& q)
+	{
+		return { q.w, -q.x, -q.y, -q.z };
+	}
+
+	Quaternion Normalize(const Quaternion& q)
+	{
+		double length = sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+		return { q.w / length, q.x / length, q.y / length, q.z / length };
+	}
+
+	Quaternion FromMatrix(const double r[3][3])
+	{
+		Quaternion q;
+		double trace = r[0][0] + r[1][1] + r[2][2];
+		if (trace > 0)
+		{
+			double s = sqrt(trace + 1.0) * 2;
+			q = { s / 4, (r[2][1] - r[1][2]) / s, (r[0][2] - r[2][0]) / s, (r[1][0] - r[0][1]) / s };
+		}
+		else if (r[0][0] > r[1][1] && r[0][0] > r[2][2])
+		{
+			double s = sqrt(1.0 + r[0][0] - r[1][1] - r[2][2]) * 2;
+			q = { (r[2][1] - r[1][2]) / s, s / 4, (r[0][1] + r[1][0]) / s, (r[0][2] + r[2][0]) / s };
+		}
+		else if (r[1][1] > r[2][2])
+		{
+			double s = sqrt(1.0 + r[1][1] - r[0][0] - r[2][2]) * 2;
+			q = { (r[0][2] - r[2][0]) / s, (r[0][1] + r[1][0]) / s, s / 4, (r[1][2] + r[2][1]) / s };
+		}
+		else
+		{
+			double s = sqrt(1.0 + r[2][2] - r[0][0] - r[1][1]) * 2;
+			q = { (r[1][0] - r[0][1]) / s, (r[0][2] + r[2][0]) / s, (r[1][2] + r[2][1]) / s, s / 4 };
+		}
+
+		return Normalize(q);
+	}
+
+	void ToMatrix(const Quaternion& q, double r[3][3])
+	{
+		r[0][0] = 1 - 2 * (q.y * q.y + q.z * q.z);
+		r[0][1] = 2 * (q.x * q.y - q.z * q.w);
+		r[0][2] = 2 * (q.x * q.z + q.y * q.w);
+		r[1][0] = 2 * (q.x * q.y + q.z * q.w);
+		r[1][1] = 1 - 2 * (q.x * q.x + q.z * q.z);
+		r[1][2] = 2 * (q.y * q.z - q.x * q.w);
+		r[2][0] = 2 * (q.x * q.z - q.y * q.w);
+		r[2][1] = 2 * (q.y * q.z + q.x * q.w);
+		r[2][2] = 1 - 2 * (q.x * q.x + q.y * q.y);
+	}
+
+	// Returns the rotation vector (axis times angle) of a rotation.
+	Vector3 ToRotationVector(Quaternion q)
+	{
+		// Takes the shortest path.
+		if (q.w < 0)
+		{
+			q = { -q.w, -q.x, -q.y, -q.z };
+		}
+
+		double sin_half_angle = sqrt(q.x * q.x + q.y * q.y + q.z * q.z);
+		if (sin_half_angle < 1e-12)
+		{
+			return { 0, 0, 0 };
+		}
+
+		double scale = 2 * atan2(sin_half_angle, q.w) / sin_half_angle;
+		return { q.x * scale, q.y * scale, q.z * scale };
+	}
+
+	Quaternion FromRotationVector(const Vector3& v)
+	{
+		double angle = sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+		if (angle < 1e-12)
+		{
+			return { 1, 0, 0, 0 };
+		}
+
+		double scale = sin(angle / 2) / angle;
+		return { cos(angle / 2), v.x * scale, v.y * scale, v.z * scale };
+	}
+
+	// The clients may send row vector matrices, with the translation in the
+	// last row, or column vector matrices, with the translation in the last
+	// column.
+	bool IsRowVectorMatrix(const float m[4][4])
+	{
+		return fabs(m[3][0]) + fabs(m[3][1]) + fabs(m[3][2]) > 1e-6;
+	}
+
+	RigidTransform ToRigidTransform(const float m[4][4])
+	{
+		bool row_vectors = IsRowVectorMatrix(m);
+		double r[3][3];
+		double t[3];
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				r[i][j] = row_vectors ? m[j][i] : m[i][j];
+			}
+
+			t[i] = row_vectors ? m[3][i] : m[i][3];
+		}
+
+		// The eye position is -R^T * t.
+		RigidTransform transform;
+		transform.rotation = FromMatrix(r);
+		transform.position =
+		{
+			-(r[0][0] * t[0] + r[1][0] * t[1] + r[2][0] * t[2]),
+			-(r[0][1] * t[0] + r[1][1] * t[1] + r[2][1] * t[2]),
+			-(r[0][2] * t[0] + r[1][2] * t[1] + r[2][2] * t[2])
+		};
+
+		return transform;
+	}
+
+	// Writes the transform into a matrix, in the layout of the original matrix.
+	void StoreRigidTransform(const RigidTransform& transform, float m[4][4])
+	{
+		bool row_vectors = IsRowVectorMatrix(m);
+		double r[3][3];
+		ToMatrix(transform.rotation, r);
+		const Vector3& p = transform.position;
+		for (int i = 0; i < 3; i++)
+		{
+			double t = -(r[i][0] * p.x + r[i][1] * p.y + r[i][2] * p.z);
+			for (int j = 0; j < 3; j++)
+			{
+				if (row_vectors)
+				{
+					m[j][i] = static_cast<float>(r[i][j]);
+				}
+				else
+				{
+					m[i][j] = static_cast<float>(r[i][j]);
+				}
+			}
+
+			if (row_vectors)
+			{
+				m[3][i] = static_cast<float>(t);
+			}
+			else
+			{
+				m[i][3] = static_cast<float>(t);
+			}
+		}
+	}
+
+	// Extrapolates a view matrix from an older one over the horizon, with
+	// constant angular and linear velocities.
+	void Extrapolate(const float older[4][4], double interval_us, double horizon_us, float latest[4][4])
+	{
+		RigidTransform from = ToRigidTransform(older);
+		RigidTransform to = ToRigidTransform(latest);
+		double scale = horizon_us / interval_us;
+
+		// The rotation applied since the older pose, in eye space.
+		Vector3 rotation = ToRotationVector(Multiply(to.rotation, Conjugate(from.rotation)));
+		Vector3 step = { rotation.x * scale, rotation.y * scale, rotation.z * scale };
+
+		RigidTransform predicted;
+		predicted.rotation = Normalize(Multiply(FromRotationVector(step), to.rotation));
+		predicted.position =
+		{
+			to.position.x + (to.position.x - from.position.x) * scale,
+			to.position.y + (to.position.y - from.position.y) * scale,
+			to.position.z + (to.position.z - from.position.z) * scale
+		};
+
+		StoreRigidTransform(predicted, latest);
+	}
+}
+
+namespace StreamingToolkit
+{
+	const int64_t PosePredictor::kTicksPerMicrosecond;
+
+	PosePredictor::PosePredictor(size_t history_size, int64_t max_horizon_us) :
+		history_size_(std::max<size_t>(history_size, 2)),
+		max_horizon_us_(max_horizon_us),
+		latency_us_(0)
+	{
+	}
+
+	bool PosePredictor::AddSample(const StereoPose& pose, int64_t receive_time_us)
+	{
+		if (!history_.empty())
+		{
+			const Sample& latest = history_.back();
+			if (pose.timestamp <= latest.pose.timestamp)
+			{
+				return false;
+			}
+
+			// The velocities are stale after a gap.
+			if (receive_time_us - latest.receive_time_us > kMaxSampleGapUs ||
+				pose.timestamp - latest.pose.timestamp > kMaxSampleGapUs * kTicksPerMicrosecond)
+			{
+				history_.clear();
+			}
+		}
+
+		if (history_.size() == history_size_)
+		{
+			history_.pop_front();
+		}
+
+		history_.push_back({ pose, receive_time_us });
+		return true;
+	}
+
+	bool PosePredictor::Predict(int64_t now_us, StereoPose* pose) const
+	{
+		if (history_.empty())
+		{
+			return false;
+		}
+
+		const Sample& latest = history_.back();
+		*pose = latest.pose;
+
+		const Sample* older = GetVelocitySample();
+		if (!older)
+		{
+			return true;
+		}
+
+		int64_t horizon_us = std::min(std::max<int64_t>(
+			now_us - latest.receive_time_us + latency_us_, 0), max_horizon_us_);
+
+		double interval_us = static_cast<double>(
+			latest.pose.timestamp - older->pose.timestamp) / kTicksPerMicrosecond;
+
+		Extrapolate(older->pose.view_left, interval_us, static_cast<double>(horizon_us), pose->view_left);
+		Extrapolate(older->pose.view_right, interval_us, static_cast<double>(horizon_us), pose->view_right);
+		pose->timestamp += horizon_us * kTicksPerMicrosecond;
+		return true;
+	}
+
+	void PosePredictor::AddDisplayError(int64_t error_us)
+	{
+		latency_us_ = std::min(std::max<int64_t>(
+			latency_us_ + error_us / kDisplayErrorGainDivisor, 0), max_horizon_us_);
+	}
+
+	void PosePredictor::Reset()
+	{
+		history_.clear();
+	}
+
+	const PosePredictor::Sample* PosePredictor::GetVelocitySample() const
+	{
+		const Sample& latest = history_.back();
+		const Sample* older = nullptr;
+		for (auto it = history_.rbegin() + 1; it != history_.rend(); ++it)
+		{
+			// The previous pose is used even out of the window, for clients
+			// sending poses at a low rate.
+			if (older && latest.pose.timestamp - it->pose.timestamp > kVelocityWindowUs * kTicksPerMicrosecond)
+			{
+				break;
+			}
+
+			older = &*it;
+		}
+
+		return older;
+	}
+}
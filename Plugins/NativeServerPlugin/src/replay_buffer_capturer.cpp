@@ -0,0 +1,172 @@
+#include "pch.h"
+
+#include "replay_buffer_capturer.h"
+#include "passthrough_h264_encoder.h"
+#include "webrtc/common_video/include/video_frame_buffer.h"
+#include "webrtc/rtc_base/checks.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+namespace
+{
+	// Frame interval used when the recording doesn't specify its frame rate.
+	const int64_t kDefaultFrameIntervalMs = 16;
+}
+
+namespace StreamingToolkit
+{
+	ReplayBufferCapturer::ReplayBufferCapturer(std::shared_ptr<FrameRecordingReader> reader, int fps, bool loop) :
+		reader_(reader),
+		fps_(fps),
+		loop_(loop),
+		replaying_(false)
+	{
+		RTC_DCHECK(reader_);
+
+		// Replayed frames are either already encoded or in I420.
+		use_software_encoder_ = reader_->format() == FrameRecordingFormat::kI420;
+	}
+
+	ReplayBufferCapturer::~ReplayBufferCapturer()
+	{
+		Stop();
+	}
+
+	cricket::CaptureState ReplayBufferCapturer::Start(const cricket::VideoFormat& capture_format)
+	{
+		// An empty recording has nothing to replay.
+		if (reader_->frame_count() == 0)
+		{
+			LOG(LS_ERROR) << "Unable to replay an empty frame recording";
+			SetCaptureState(cricket::CS_FAILED);
+			return cricket::CS_FAILED;
+		}
+
+		cricket::CaptureState state = BufferCapturer::Start(capture_format);
+		if (!replaying_.exchange(true))
+		{
+			// A replay which ran to its end leaves its thread to be joined.
+			if (replay_thread_.joinable())
+			{
+				replay_thread_.join();
+			}
+
+			replay_thread_ = std::thread(&ReplayBufferCapturer::ReplayThread, this);
+		}
+
+		return state;
+	}
+
+	void ReplayBufferCapturer::Stop()
+	{
+		BufferCapturer::Stop();
+		replaying_ = false;
+		if (replay_thread_.joinable())
+		{
+			replay_thread_.join();
+		}
+	}
+
+	bool ReplayBufferCapturer::GetPreferredFourccs(std::vector<uint32_t>* fourccs)
+	{
+		fourccs->push_back(reader_->format() == FrameRecordingFormat::kI420 ?
+			cricket::FOURCC_I420 : cricket::FOURCC_H264);
+
+		return true;
+	}
+
+	void ReplayBufferCapturer::ReplayThread()
+	{
+		const size_t frame_count = reader_->frame_count();
+		const int64_t recorded_interval_ms = reader_->fps() > 0 ?
+			1000 / reader_->fps() : kDefaultFrameIntervalMs;
+
+		const int64_t recording_duration_ms =
+			reader_->frame(frame_count - 1).capture_time_ms + recorded_interval_ms;
+
+		auto start_time = std::chrono::steady_clock::now();
+		int64_t start_time_us = rtc::TimeMicros();
+		int64_t loop_offset_ms = 0;
+		uint64_t sent_count = 0;
+		size_t index = 0;
+
+		reader_->Prefetch(0);
+		while (replaying_)
+		{
+			const RecordedFrame& recorded_frame = reader_->frame(index);
+
+			// Paces at the configured rate, or at the recorded capture times.
+			int64_t due_time_ms = fps_ > 0 ?
+				static_cast<int64_t>(sent_count * 1000 / fps_) :
+				loop_offset_ms + recorded_frame.capture_time_ms;
+
+			std::this_thread::sleep_until(start_time + std::chrono::milliseconds(due_time_ms));
+			if (!replaying_)
+			{
+				break;
+			}
+
+			reader_->Prefetch(index + 1 < frame_count ? index + 1 : 0);
+
+			// Keeps the original spacing between frames in the frame timestamps.
+			int64_t timestamp_us = start_time_us +
+				(loop_offset_ms + recorded_frame.capture_time_ms) * rtc::kNumMicrosecsPerMillisec;
+
+			SendFrame(CreateFrame(index, timestamp_us));
+			sent_count++;
+
+			if (++index == frame_count)
+			{
+				if (!loop_)
+				{
+					break;
+				}
+
+				index = 0;
+				loop_offset_ms += recording_duration_ms;
+			}
+		}
+
+		replaying_ = false;
+	}
+
+	webrtc::VideoFrame ReplayBufferCapturer::CreateFrame(size_t index, int64_t timestamp_us)
+	{
+		const RecordedFrame& recorded_frame = reader_->frame(index);
+		int width = reader_->width();
+		int height = reader_->height();
+
+		// Frames point into the mapping, which is kept alive until the
+		// encoder releases them.
+		std::shared_ptr<FrameRecordingReader> reader = reader_;
+		rtc::Callback0<void> keep_reader_alive([reader]() {});
+
+		rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+		if (reader_->format() == FrameRecordingFormat::kI420)
+		{
+			int chroma_width = (width + 1) / 2;
+			int chroma_height = (height + 1) / 2;
+			const uint8_t* data_y = recorded_frame.data;
+			const uint8_t* data_u = data_y + width * height;
+			const uint8_t* data_v = data_u + chroma_width * chroma_height;
+			buffer = new rtc::RefCountedObject<webrtc::WrappedI420Buffer>(
+				width, height, data_y, width, data_u, chroma_width, data_v, chroma_width,
+				keep_reader_alive);
+		}
+		else
+		{
+			rtc::scoped_refptr<EncodedFrameBuffer> encoded_buffer =
+				new rtc::RefCountedObject<EncodedFrameBuffer>(
+					width, height, recorded_frame.data, recorded_frame.size,
+					recorded_frame.key_frame, keep_reader_alive);
+
+			encoded_buffer->SetTraceInfo(trace_peer_id_, trace_frame_id_);
+			buffer = encoded_buffer;
+		}
+
+		auto frame = webrtc::VideoFrame(buffer, kVideoRotation_0, timestamp_us);
+		frame.set_ntp_time_ms(clock_->CurrentNtpInMilliseconds());
+		frame.set_prediction_timestamp(recorded_frame.prediction_timestamp);
+		return frame;
+	}
+}
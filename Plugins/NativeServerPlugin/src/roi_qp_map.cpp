@@ -0,0 +1,106 @@
+#include "pch.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "roi_qp_map.h"
+
+namespace StreamingToolkit
+{
+	const int RoiQpMap::kMacroblockSize;
+
+	RoiQpMapParams RoiQpMap::DefaultParams()
+	{
+		// Full quality within about 10 degrees of the gaze on a typical HMD
+		// field of view, and the lowest one in the outer periphery.
+		RoiQpMapParams params;
+		params.full_quality_radius = 0.2f;
+		params.falloff_radius = 0.6f;
+		params.max_qp_delta = 8;
+		return params;
+	}
+
+	RoiQpMap::RoiQpMap(const RoiQpMapParams& params) :
+		params_(params),
+		dirty_(true),
+		width_(0),
+		height_(0),
+		stereo_(false)
+	{
+		ResetGaze();
+	}
+
+	void RoiQpMap::SetGaze(const GazePoint& left, const GazePoint& right)
+	{
+		if (left.x != gaze_[0].x || left.y != gaze_[0].y ||
+			right.x != gaze_[1].x || right.y != gaze_[1].y)
+		{
+			gaze_[0] = left;
+			gaze_[1] = right;
+			dirty_ = true;
+		}
+	}
+
+	void RoiQpMap::ResetGaze()
+	{
+		GazePoint center = { 0.5f, 0.5f };
+		SetGaze(center, center);
+	}
+
+	std::shared_ptr<const std::vector<int8_t>> RoiQpMap::Generate(int width, int height, bool stereo)
+	{
+		if (!dirty_ && map_ && width == width_ && height == height_ && stereo == stereo_)
+		{
+			return map_;
+		}
+
+		int width_in_mbs = (width + kMacroblockSize - 1) / kMacroblockSize;
+		int height_in_mbs = (height + kMacroblockSize - 1) / kMacroblockSize;
+		float eye_width = stereo ? width / 2.0f : static_cast<float>(width);
+		float eye_height = static_cast<float>(height);
+
+		// A new map is allocated since the encoder may still hold the previous one.
+		std::shared_ptr<std::vector<int8_t>> map =
+			std::make_shared<std::vector<int8_t>>(width_in_mbs * height_in_mbs);
+
+		for (int mb_y = 0; mb_y < height_in_mbs; mb_y++)
+		{
+			float center_y = mb_y * kMacroblockSize + kMacroblockSize / 2.0f;
+			for (int mb_x = 0; mb_x < width_in_mbs; mb_x++)
+			{
+				// Macroblocks belong to the eye which contains their center.
+				float center_x = mb_x * kMacroblockSize + kMacroblockSize / 2.0f;
+				int eye = stereo && center_x >= eye_width ? 1 : 0;
+				const GazePoint& gaze = gaze_[eye];
+				float dx = (center_x - eye * eye_width - gaze.x * eye_width) / eye_height;
+				float dy = (center_y - gaze.y * eye_height) / eye_height;
+				(*map)[mb_y * width_in_mbs + mb_x] = GetQpDelta(std::sqrt(dx * dx + dy * dy));
+			}
+		}
+
+		map_ = map;
+		width_ = width;
+		height_ = height;
+		stereo_ = stereo;
+		dirty_ = false;
+		return map_;
+	}
+
+	int RoiQpMap::GetMacroblockCount(int width, int height)
+	{
+		return ((width + kMacroblockSize - 1) / kMacroblockSize) *
+			((height + kMacroblockSize - 1) / kMacroblockSize);
+	}
+
+	int8_t RoiQpMap::GetQpDelta(float distance) const
+	{
+		if (distance <= params_.full_quality_radius)
+		{
+			return 0;
+		}
+
+		float falloff = params_.falloff_radius - params_.full_quality_radius;
+		float t = falloff > 0 ? (distance - params_.full_quality_radius) / falloff : 1.0f;
+		return static_cast<int8_t>(std::lround((std::min)(t, 1.0f) * params_.max_qp_delta));
+	}
+}
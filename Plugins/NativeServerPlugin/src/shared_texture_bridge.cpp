@@ -0,0 +1,395 @@
+#include "pch.h"
+
+#include <dxgi.h>
+#include <mutex>
+#include <vector>
+
+#include "plugindefs.h"
+#include "shared_texture_bridge.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
+
+using namespace Microsoft::WRL;
+
+namespace
+{
+	// Keys of the keyed mutexes: the renderer writes a slot released with
+	// the read key, and the capture device releases it with the write one.
+	const UINT64 kWriteKey = 0;
+	const UINT64 kReadKey = 1;
+
+	// The renderer only takes slots which aren't being read, so its lock is
+	// granted once the previous copies out of the slot completed on the GPU.
+	const DWORD kProducerTimeoutMs = 5;
+
+	void EnableMultithreadProtection(ID3D11Device* device)
+	{
+#ifdef MULTITHREAD_PROTECTION
+		ComPtr<ID3D11Multithread> multithread;
+		if (SUCCEEDED(device->QueryInterface(IID_PPV_ARGS(&multithread))))
+		{
+			multithread->SetMultithreadProtected(true);
+		}
+#endif // MULTITHREAD_PROTECTION
+	}
+
+	struct CaptureDevice
+	{
+		LUID adapter_luid;
+		ComPtr<ID3D11Device> device;
+	};
+
+	// Gets the capture device of the adapter, shared by the bridges of every
+	// peer, creating it on first use or once it was removed.
+	ComPtr<ID3D11Device> GetCaptureDevice(IDXGIAdapter* adapter, D3D_FEATURE_LEVEL feature_level)
+	{
+		static std::mutex mutex;
+		static std::vector<CaptureDevice> devices;
+
+		DXGI_ADAPTER_DESC adapter_desc;
+		if (FAILED(adapter->GetDesc(&adapter_desc)))
+		{
+			LOG(LS_ERROR) << "Failed to get the adapter of the render device.";
+			return nullptr;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		CaptureDevice* capture_device = nullptr;
+		for (auto& device : devices)
+		{
+			if (device.adapter_luid.LowPart == adapter_desc.AdapterLuid.LowPart &&
+				device.adapter_luid.HighPart == adapter_desc.AdapterLuid.HighPart)
+			{
+				capture_device = &device;
+				break;
+			}
+		}
+
+		if (capture_device && capture_device->device->GetDeviceRemovedReason() == S_OK)
+		{
+			return capture_device->device;
+		}
+
+		// Textures can only be shared between devices of the same adapter.
+		ComPtr<ID3D11Device> device;
+		HRESULT hr = D3D11CreateDevice(adapter, D3D_DRIVER_TYPE_UNKNOWN, nullptr,
+			D3D11_CREATE_DEVICE_BGRA_SUPPORT, &feature_level, 1, D3D11_SDK_VERSION,
+			&device, nullptr, nullptr);
+
+		if (FAILED(hr))
+		{
+			LOG(LS_ERROR) << "Failed to create the capture device: " << hr;
+			return nullptr;
+		}
+
+		// The capturers of all the peers use its immediate context.
+		EnableMultithreadProtection(device.Get());
+		if (capture_device)
+		{
+			capture_device->device = device;
+		}
+		else
+		{
+			CaptureDevice new_device = { adapter_desc.AdapterLuid, device };
+			devices.push_back(new_device);
+		}
+
+		return device;
+	}
+}
+
+namespace StreamingToolkit
+{
+	const int SharedTextureBridge::kSlotCount;
+
+	std::unique_ptr<SharedTextureBridge> SharedTextureBridge::Create(ID3D11Device* producer_device)
+	{
+		ComPtr<IDXGIDevice> dxgi_device;
+		ComPtr<IDXGIAdapter> adapter;
+		if (FAILED(producer_device->QueryInterface(IID_PPV_ARGS(&dxgi_device))) ||
+			FAILED(dxgi_device->GetAdapter(&adapter)))
+		{
+			LOG(LS_ERROR) << "Failed to get the adapter of the render device.";
+			return nullptr;
+		}
+
+		ComPtr<ID3D11Device> consumer_device =
+			GetCaptureDevice(adapter.Get(), producer_device->GetFeatureLevel());
+		if (!consumer_device)
+		{
+			return nullptr;
+		}
+
+		EnableMultithreadProtection(producer_device);
+		return std::unique_ptr<SharedTextureBridge>(
+			new SharedTextureBridge(producer_device, consumer_device.Get()));
+	}
+
+	SharedTextureBridge::SharedTextureBridge(ID3D11Device* producer_device, ID3D11Device* consumer_device) :
+		producer_device_(producer_device),
+		consumer_device_(consumer_device),
+		sequence_(0),
+		acquired_sequence_(0),
+		reading_slot_(nullptr),
+		reading_since_us_(0),
+		published_(0),
+		dropped_(0)
+	{
+		producer_device_->GetImmediateContext(&producer_context_);
+		for (Slot& slot : slots_)
+		{
+			slot.desc = { 0 };
+			slot.key = kWriteKey;
+			slot.state = SlotState::kFree;
+			slot.sequence = 0;
+			slot.render_time_us = 0;
+			slot.prediction_time_stamp = -1;
+		}
+	}
+
+	bool SharedTextureBridge::Publish(ID3D11Texture2D* left_frame_buffer, ID3D11Texture2D* right_frame_buffer,
+		int64_t render_time_us, int64_t prediction_time_stamp)
+	{
+		D3D11_TEXTURE2D_DESC desc;
+		left_frame_buffer->GetDesc(&desc);
+		bool side_by_side = right_frame_buffer || desc.ArraySize == 2;
+		UINT width = side_by_side ? desc.Width * 2 : desc.Width;
+
+		Slot* slot = TakeSlotForWriting();
+		if (!slot)
+		{
+			return false;
+		}
+
+		bool written = false;
+		int64_t acquire_time_us = 0;
+		if (UpdateSlot(slot, width, desc.Height, desc.Format))
+		{
+			if (slot->producer_mutex->AcquireSync(slot->key, kProducerTimeoutMs) == S_OK)
+			{
+				acquire_time_us = rtc::TimeMicros();
+				if (right_frame_buffer)
+				{
+					producer_context_->CopySubresourceRegion(slot->producer_texture.Get(), 0, 0, 0, 0,
+						left_frame_buffer, 0, nullptr);
+
+					producer_context_->CopySubresourceRegion(slot->producer_texture.Get(), 0, desc.Width, 0, 0,
+						right_frame_buffer, 0, nullptr);
+				}
+				else if (desc.ArraySize == 2)
+				{
+					for (UINT eye = 0; eye < 2; eye++)
+					{
+						producer_context_->CopySubresourceRegion(slot->producer_texture.Get(), 0, desc.Width * eye, 0, 0,
+							left_frame_buffer, D3D11CalcSubresource(0, eye, desc.MipLevels), nullptr);
+					}
+				}
+				else
+				{
+					producer_context_->CopyResource(slot->producer_texture.Get(), left_frame_buffer);
+				}
+
+				slot->producer_mutex->ReleaseSync(kReadKey);
+				slot->key = kReadKey;
+				written = true;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(lock_);
+		if (!written)
+		{
+			slot->state = SlotState::kFree;
+			dropped_++;
+			return false;
+		}
+
+		producer_hold_.Add(rtc::TimeMicros() - acquire_time_us);
+		slot->state = SlotState::kPublished;
+		slot->sequence = ++sequence_;
+		slot->render_time_us = render_time_us;
+		slot->prediction_time_stamp = prediction_time_stamp;
+		published_cond_.notify_one();
+		return true;
+	}
+
+	bool SharedTextureBridge::Acquire(int timeout_ms, ID3D11Texture2D** frame_buffer,
+		int64_t* render_time_us, int64_t* prediction_time_stamp)
+	{
+		Slot* latest = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(lock_);
+			auto has_new_frame = [&]
+			{
+				for (Slot& slot : slots_)
+				{
+					if (slot.state == SlotState::kPublished && slot.sequence > acquired_sequence_ &&
+						(!latest || slot.sequence > latest->sequence))
+					{
+						latest = &slot;
+					}
+				}
+
+				return latest != nullptr;
+			};
+
+			if (!published_cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), has_new_frame))
+			{
+				return false;
+			}
+
+			// Older frames won't be captured anymore, their slots are free.
+			for (Slot& slot : slots_)
+			{
+				if (slot.state == SlotState::kPublished && slot.sequence < latest->sequence)
+				{
+					slot.state = SlotState::kFree;
+					dropped_++;
+				}
+			}
+
+			latest->state = SlotState::kReading;
+		}
+
+		// The frame is left to the next call, which captures it unless a newer
+		// one was published in the meantime.
+		if (latest->consumer_mutex->AcquireSync(kReadKey, timeout_ms) != S_OK)
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			latest->state = SlotState::kPublished;
+			return false;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			acquired_sequence_ = latest->sequence;
+		}
+
+		reading_slot_ = latest;
+		reading_since_us_ = rtc::TimeMicros();
+		*frame_buffer = latest->consumer_texture.Get();
+		*render_time_us = latest->render_time_us;
+		*prediction_time_stamp = latest->prediction_time_stamp;
+		return true;
+	}
+
+	void SharedTextureBridge::Release()
+	{
+		if (!reading_slot_)
+		{
+			return;
+		}
+
+		reading_slot_->consumer_mutex->ReleaseSync(kWriteKey);
+
+		std::lock_guard<std::mutex> lock(lock_);
+		consumer_hold_.Add(rtc::TimeMicros() - reading_since_us_);
+		reading_slot_->key = kWriteKey;
+		reading_slot_->state = SlotState::kFree;
+		reading_slot_ = nullptr;
+	}
+
+	SharedTextureStats SharedTextureBridge::GetStats() const
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		SharedTextureStats stats;
+		stats.producer_hold = producer_hold_.GetStats();
+		stats.consumer_hold = consumer_hold_.GetStats();
+		stats.published = published_;
+		stats.dropped = dropped_;
+		return stats;
+	}
+
+	SharedTextureBridge::Slot* SharedTextureBridge::TakeSlotForWriting()
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		published_++;
+		Slot* oldest = nullptr;
+		for (Slot& slot : slots_)
+		{
+			if (slot.state == SlotState::kFree)
+			{
+				slot.state = SlotState::kWriting;
+				return &slot;
+			}
+
+			if (slot.state == SlotState::kPublished && (!oldest || slot.sequence < oldest->sequence))
+			{
+				oldest = &slot;
+			}
+		}
+
+		// Replaces a frame which was never captured.
+		dropped_++;
+		if (oldest)
+		{
+			oldest->state = SlotState::kWriting;
+		}
+
+		return oldest;
+	}
+
+	bool SharedTextureBridge::UpdateSlot(Slot* slot, UINT width, UINT height, DXGI_FORMAT format)
+	{
+		if (slot->producer_texture && slot->desc.Width == width &&
+			slot->desc.Height == height && slot->desc.Format == format)
+		{
+			return true;
+		}
+
+		// The slot is owned by the renderer, so the capture device doesn't use
+		// its textures while they are replaced.
+		slot->producer_texture.Reset();
+		slot->producer_mutex.Reset();
+		slot->consumer_texture.Reset();
+		slot->consumer_mutex.Reset();
+		slot->key = kWriteKey;
+
+		slot->desc = { 0 };
+		slot->desc.ArraySize = 1;
+		slot->desc.Format = format;
+		slot->desc.Width = width;
+		slot->desc.Height = height;
+		slot->desc.MipLevels = 1;
+		slot->desc.SampleDesc.Count = 1;
+		slot->desc.Usage = D3D11_USAGE_DEFAULT;
+		slot->desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+		slot->desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED_KEYEDMUTEX;
+
+		ComPtr<IDXGIResource> resource;
+		HANDLE shared_handle = nullptr;
+		HRESULT hr = producer_device_->CreateTexture2D(&slot->desc, nullptr, &slot->producer_texture);
+		if (SUCCEEDED(hr))
+		{
+			hr = slot->producer_texture.As(&resource);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = resource->GetSharedHandle(&shared_handle);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = consumer_device_->OpenSharedResource(shared_handle, IID_PPV_ARGS(&slot->consumer_texture));
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = slot->producer_texture.As(&slot->producer_mutex);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = slot->consumer_texture.As(&slot->consumer_mutex);
+		}
+
+		if (FAILED(hr))
+		{
+			LOG(LS_ERROR) << "Failed to create a shared texture: " << hr;
+			slot->producer_texture.Reset();
+			return false;
+		}
+
+		return true;
+	}
+}
@@ -2,13 +2,9 @@
 #define WEBRTC_WIN			1
 
 #define SHOW_CONSOLE 0
-#define ULOG(sev, msg)						\
-	if (s_callbackMap.onLog)				\
-	{										\
-		(*s_callbackMap.onLog)(sev, msg);	\
-	}										\
-											\
-	LOG(sev) << msg							
+
+// Logs through the structured log, which delivers the lines to onLog from its own thread
+#define ULOG(sev, msg) SLOG(sev, "unity_plugin").Field("message", msg)
 
 #include <iostream>
 #include <thread>
@@ -26,6 +22,7 @@
 #include "flagdefs.h"
 #include "directx_multi_peer_conductor.h"
 #include "server_main_window.h"
+#include "structured_log.h"
 
 #include "webrtc/modules/video_coding/codecs/h264/h264_encoder_impl.h"
 #include "webrtc/rtc_base/checks.h"
@@ -74,6 +71,7 @@ static rtc::Thread*					s_rtcMainThread;
 static std::string					s_server				= "signalingserveruri";
 static uint32_t						s_port					= 3000;
 static bool							s_closing				= false;
+static bool							s_useSharedTextures		= false;
 static std::shared_ptr<DirectXMultiPeerConductor> s_cond;
 
 typedef void(__stdcall*NoParamFuncType)();
@@ -247,8 +245,40 @@ struct UnityServerPeerObserver : public PeerConnectionClientObserver,
 
 } s_clientObserver;
 
+// The most log lines handed to onLog every drain of the structured log
+static const size_t					kMaxLogLinesPerBatch	= 64;
+
+// Hands the structured log lines to onLog in bounded batches, so that a burst of
+// logging can't flood Unity.
+struct UnityLogSink : public StructuredLogSink
+{
+	virtual void OnLogBatch(const std::vector<StructuredLogLine>& lines) override
+	{
+		auto onLog = s_callbackMap.onLog;
+		if (!onLog)
+		{
+			return;
+		}
+
+		size_t delivered = (std::min)(lines.size(), kMaxLogLinesPerBatch);
+		for (size_t i = 0; i < delivered; i++)
+		{
+			(*onLog)(lines[i].severity, lines[i].text.c_str());
+		}
+
+		if (delivered < lines.size())
+		{
+			auto skipped = "log_lines_skipped count=" + std::to_string(lines.size() - delivered);
+			(*onLog)(rtc::LS_WARNING, skipped.c_str());
+		}
+	}
+};
+
+static std::shared_ptr<UnityLogSink>	s_logSink				= std::make_shared<UnityLogSink>();
+
 void InitWebRTC()
 {
+	StructuredLog::Instance().AddSink(s_logSink);
 	ULOG(INFO, __FUNCTION__);
 
 	// Setup the config parsers.
@@ -281,7 +311,10 @@ void InitWebRTC()
 	s_port = fullServerConfig->webrtc_config->port;
 
 	// Initializes the conductor.
-	s_cond.reset(new DirectXMultiPeerConductor(fullServerConfig, s_Device.Get()));
+	s_cond.reset(new DirectXMultiPeerConductor(fullServerConfig, s_Device.Get(), s_useSharedTextures));
+
+	// Applies the IDR period of the encoder profiles.
+	s_cond->SetEncoderConfig(nvEncConfig);
 
 	// Registers observer to update Unity's window UI.
 	s_cond->PeerConnection().RegisterObserver(&s_clientObserver);
@@ -291,7 +324,8 @@ void InitWebRTC()
 		int peerId,
 		const std::string& message)
 	{
-		ULOG(INFO, message.c_str());
+		// input messages arrive with every frame
+		SLOG_RATE_LIMITED(INFO, "data_channel_message", 10).Field("peer_id", peerId).Field("message", message);
 
 		if (s_callbackMap.onDataChannelMessage)
 		{
@@ -359,7 +393,7 @@ extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityPluginLoad(IUnit
 	freopen_s(&out, "CONOUT$", "w", stdout);
 
 	std::cout << "Console open..." << std::endl;
-	ULOG(INFO, "Console open...")
+	ULOG(INFO, "Console open...");
 #endif
 
 	s_UnityInterfaces = unityInterfaces;
@@ -379,6 +413,10 @@ extern "C" __declspec(dllexport) void Close()
 	s_cond->Close();
 	rtc::CleanupSSL();
 	s_closing = true;
+
+	// the log thread mustn't outlive the plugin
+	StructuredLog::Instance().RemoveSink(s_logSink);
+	StructuredLog::Instance().Shutdown();
 }
 
 extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UnityPluginUnload()
@@ -393,6 +431,34 @@ extern "C" __declspec(dllexport) void NativeInitWebRTC()
 	s_messageThread = new std::thread(InitWebRTC);
 }
 
+// Reads the frames back on a capture device of its own, so that Unity's
+// immediate context only issues the copies into the shared textures. Must be
+// called before NativeInitWebRTC.
+extern "C" __declspec(dllexport) void SetSharedTextureCapture(bool enabled)
+{
+	s_useSharedTextures = enabled;
+}
+
+// Gets the average lock hold times of the shared textures over the last
+// frames, in microseconds, and the number of frames dropped by a peer.
+extern "C" __declspec(dllexport) bool GetSharedTextureStats(int peerId,
+	int64_t* rendererHoldUs,
+	int64_t* captureHoldUs,
+	int64_t* droppedFrames)
+{
+	auto it = s_cond->Peers().find(peerId);
+	if (it == s_cond->Peers().end())
+	{
+		return false;
+	}
+
+	SharedTextureStats stats = ((DirectXPeerConductor*)it->second.get())->GetSharedTextureStats();
+	*rendererHoldUs = stats.producer_hold.average_us;
+	*captureHoldUs = stats.consumer_hold.average_us;
+	*droppedFrames = static_cast<int64_t>(stats.dropped);
+	return true;
+}
+
 extern "C" __declspec(dllexport) void ConnectToPeer(const int peerId)
 {
 	ULOG(INFO, __FUNCTION__);
@@ -413,6 +479,12 @@ extern "C" __declspec(dllexport) void SendFrame(int peerId, bool isStereo, void*
 		{
 			peer->SendFrame((ID3D11Texture2D*)leftRT);
 		}
+		// A single texture holds both eyes, either as a texture array or side
+		// by side, e.g. for single pass instanced rendering.
+		else if (!rightRT)
+		{
+			peer->SendFrame((ID3D11Texture2D*)leftRT, predictionTimestamp);
+		}
 		else
 		{
 			peer->SendFrame((ID3D11Texture2D*)leftRT, (ID3D11Texture2D*)rightRT, predictionTimestamp);
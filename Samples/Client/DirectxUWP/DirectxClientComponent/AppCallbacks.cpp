@@ -1,7 +1,5 @@
 ﻿#include "pch.h"
 
-#include <algorithm>
-
 #include "AppCallbacks.h"
 #include "DirectXHelper.h"
 
@@ -14,6 +12,17 @@ using namespace Windows::Perception;
 using namespace Windows::Perception::Spatial;
 using namespace Windows::System::Threading;
 
+// Frames older than a second can't be matched anymore.
+const size_t kFrameHistoryCapacity = 120;
+const int64_t kFrameHistoryMaxAge = 10000000;
+
+// Frames extrapolated by the server are matched to the nearest holographic
+// frame within a frame period at 60 fps.
+const int64_t kFrameMatchTolerance = 166667;
+
+// Number of displayed frames averaged in a display error report.
+const int kDisplayErrorReportInterval = 60;
+
 #ifdef SHOW_DEBUG_INFO
 int64_t g_totalDelayTime = 0;
 int64_t g_currentTimestamp = 0;
@@ -21,11 +30,26 @@ int g_latencyCounter = 0;
 int g_latency = 0;
 #endif // SHOW_DEBUG_INFO
 
+// Returns the current time in the unit and epoch of DateTime::UniversalTime.
+static int64_t GetUniversalTime()
+{
+	FILETIME now;
+	GetSystemTimePreciseAsFileTime(&now);
+	return (static_cast<int64_t>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+}
+
 AppCallbacks::AppCallbacks(SendInputDataHandler^ sendInputDataHandler) :
 	m_videoRenderer(nullptr),
 	m_holographicSpace(nullptr),
 	m_sentStereoMode(false),
-	m_sendInputDataHandler(sendInputDataHandler)
+	m_sendInputDataHandler(sendInputDataHandler),
+	m_holographicFrames(kFrameHistoryCapacity, kFrameHistoryMaxAge),
+	m_framePredictionTimestamp(kFrameHistoryCapacity, kFrameHistoryMaxAge),
+	m_latestTargetTime(0),
+	m_displayErrorTotal(0),
+	m_displayErrorCount(0),
+	m_pendingDisplayError(0),
+	m_hasPendingDisplayError(false)
 {
 }
 
@@ -96,45 +120,51 @@ void AppCallbacks::SetMediaStreamSource(Windows::Media::Core::IMediaStreamSource
 			[&](MEPlayer^ mc, int width, int height, Microsoft::WRL::ComPtr<ID3D11Texture2D> texture, int timestampId)
 		{
 			auto lock = m_lock.Lock();
-			if (!m_framePredictionTimestamp.empty())
+			int64_t now = GetUniversalTime();
+			int64_t predictionTimestamp;
+			HolographicFrame^ frame;
+			if (m_framePredictionTimestamp.Take(timestampId, now, &predictionTimestamp) &&
+				m_holographicFrames.TakeNearest(predictionTimestamp, kFrameMatchTolerance, now, &frame))
 			{
-				int64_t predictionTimestamp = m_framePredictionTimestamp[timestampId];
-				std::vector<HolographicFrame^>::iterator it = std::find_if(
-					m_holographicFrames.begin(),
-					m_holographicFrames.end(),
-					[&](HolographicFrame^ frame)
-					{
-						return frame->CurrentPrediction->Timestamp->TargetTime.UniversalTime ==
-							predictionTimestamp;
-					});
-
-				if (it != m_holographicFrames.end())
+				// Reports how far behind the newest pose the server predicted.
+				m_displayErrorTotal += m_latestTargetTime - predictionTimestamp;
+				if (++m_displayErrorCount == kDisplayErrorReportInterval)
 				{
-					m_deviceResources->GetD3DDeviceContext()->CopyResource(
-						m_videoRenderer->GetVideoFrame(), texture.Get());
+					m_pendingDisplayError = m_displayErrorTotal / m_displayErrorCount;
+					m_hasPendingDisplayError = true;
+					m_displayErrorTotal = 0;
+					m_displayErrorCount = 0;
+				}
 
-					HolographicFrame^ frame = *it;
+				m_deviceResources->GetD3DDeviceContext()->CopyResource(
+					m_videoRenderer->GetVideoFrame(), texture.Get());
 
 #ifdef SHOW_DEBUG_INFO
-					if (++g_latencyCounter % 60)
-					{
-						g_totalDelayTime += (g_currentTimestamp - predictionTimestamp) / 10000;
-					}
-					else
-					{
-						g_latency = g_totalDelayTime / 60;
-						g_totalDelayTime = 0;
-					}
-
-					if (m_main->Render(frame, m_player->GetFrameRate(), g_latency))
+				if (++g_latencyCounter % 60)
+				{
+					g_totalDelayTime += (g_currentTimestamp - predictionTimestamp) / 10000;
+				}
+				else
+				{
+					g_latency = g_totalDelayTime / 60;
+					g_totalDelayTime = 0;
+
+					FrameHistoryStats stats = m_holographicFrames.GetStats();
+					std::wstring message = L"Frame history - size: " + std::to_wstring(stats.size) +
+						L", matched: " + std::to_wstring(stats.matched) +
+						L", unmatched: " + std::to_wstring(stats.unmatched) +
+						L", late: " + std::to_wstring(stats.late) +
+						L", evicted: " + std::to_wstring(stats.evicted) + L"\n";
+
+					OutputDebugString(message.c_str());
+				}
+
+				if (m_main->Render(frame, m_player->GetFrameRate(), g_latency))
 #else // SHOW_DEBUG_INFO
-					if (m_main->Render(frame))
+				if (m_main->Render(frame))
 #endif // SHOW_DEBUG_INFO
-					{
-						m_deviceResources->Present(frame);
-					}
-
-					m_holographicFrames.erase(it);
+				{
+					m_deviceResources->Present(frame);
 				}
 			}
 		});
@@ -147,7 +177,7 @@ void AppCallbacks::SetMediaStreamSource(Windows::Media::Core::IMediaStreamSource
 void AppCallbacks::OnPredictionTimestamp(int id, int64_t timestamp)
 {
 	auto lock = m_lock.Lock();
-	m_framePredictionTimestamp[id] = timestamp;
+	m_framePredictionTimestamp.Add(id, timestamp, GetUniversalTime());
 }
 
 uint32 AppCallbacks::FpsReport()
@@ -171,12 +201,41 @@ void AppCallbacks::SendInputData()
 			return;
 		}
 
+		// Lets the server extrapolate the poses, the frames are then matched
+		// to the nearest holographic frame.
+		msg =
+			"{" +
+			"  \"type\":\"pose-prediction\"," +
+			"  \"body\":\"1\"" +
+			"}";
+
+		m_sendInputDataHandler(msg);
 		m_sentStereoMode = true;
 	}
 
 	// Creates a new frame for input data.
 	HolographicFrame^ newFrame = m_main->Update();
-	m_holographicFrames.push_back(newFrame);
+	int64_t displayError = 0;
+	bool hasDisplayError = false;
+	{
+		auto lock = m_lock.Lock();
+		m_latestTargetTime = newFrame->CurrentPrediction->Timestamp->TargetTime.UniversalTime;
+		m_holographicFrames.Add(m_latestTargetTime, newFrame, GetUniversalTime());
+		displayError = m_pendingDisplayError;
+		hasDisplayError = m_hasPendingDisplayError;
+		m_hasPendingDisplayError = false;
+	}
+
+	if (hasDisplayError)
+	{
+		String^ errorMsg =
+			"{" +
+			"  \"type\":\"pose-prediction-error\"," +
+			"  \"body\":\"" + displayError + "\"" +
+			"}";
+
+		m_sendInputDataHandler(errorMsg);
+	}
 
 	// Gets the current camera transformation.
 	XMFLOAT4X4 leftProjectionMatrix;
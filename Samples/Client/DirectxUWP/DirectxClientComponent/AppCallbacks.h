@@ -2,6 +2,7 @@
 
 #include "pch.h"
 #include "DeviceResources.h"
+#include "FrameHistory.h"
 #include "VideoRenderer.h"
 #include "HolographicAppMain.h"
 #include "MediaEnginePlayer.h"
@@ -50,9 +51,18 @@ namespace DirectXClientComponent
 		bool													m_sentStereoMode;
 		ComPtr<ABI::Windows::Media::Core::IMediaStreamSource>	m_mediaSource;
 		
-		// Frame prediction
-		std::vector<HolographicFrame^>							m_holographicFrames;
-		std::map<int, int64_t>									m_framePredictionTimestamp;
+		// Frame prediction, holographic frames keyed by prediction timestamp
+		// and prediction timestamps keyed by id.
+		FrameHistory<HolographicFrame^>							m_holographicFrames;
+		FrameHistory<int64_t>									m_framePredictionTimestamp;
+
+		// Pose prediction, the target time of the newest holographic frame and
+		// the display errors of the frames extrapolated by the server.
+		int64_t													m_latestTargetTime;
+		int64_t													m_displayErrorTotal;
+		int														m_displayErrorCount;
+		int64_t													m_pendingDisplayError;
+		bool													m_hasPendingDisplayError;
 
 		// The holographic space the app will use for rendering.
 		Windows::Graphics::Holographic::HolographicSpace^		m_holographicSpace;
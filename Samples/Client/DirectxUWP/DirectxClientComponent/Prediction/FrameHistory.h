@@ -0,0 +1,216 @@
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace DirectXClientComponent
+{
+	// Frame history metrics.
+	struct FrameHistoryStats
+	{
+		// Number of entries currently kept.
+		size_t size;
+
+		// Number of lookups which found their entry.
+		uint64_t matched;
+
+		// Number of lookups for a key which was never added.
+		uint64_t unmatched;
+
+		// Number of lookups for a key which was already evicted.
+		uint64_t late;
+
+		// Number of entries evicted, by age or capacity, before a lookup.
+		uint64_t evicted;
+	};
+
+	// Bounded history of values keyed by timestamp, such as the holographic
+	// frames keyed by their prediction timestamp. Entries are kept in
+	// insertion order in a ring and indexed by a hash map, so lookups are
+	// O(1) and memory stays bounded over long sessions. Keys are expected to
+	// increase over time. Not thread safe.
+	template <typename T>
+	class FrameHistory
+	{
+	public:
+		// Entries older than maxAge, in the unit of the timestamps passed to
+		// Add and Take, are evicted.
+		FrameHistory(size_t capacity, int64_t maxAge) :
+			m_entries(capacity),
+			m_maxAge(maxAge),
+			m_head(0),
+			m_count(0),
+			m_lastEvictedKey(INT64_MIN)
+		{
+			m_index.reserve(capacity);
+			m_stats = {};
+		}
+
+		// Adds a value, replacing the value with the same key if any.
+		void Add(int64_t key, const T& value, int64_t now)
+		{
+			EvictOlderThan(now - m_maxAge);
+
+			auto it = m_index.find(key);
+			if (it != m_index.end())
+			{
+				m_entries[it->second].valid = false;
+				m_index.erase(it);
+			}
+
+			// Evicts the oldest entry when full.
+			if (m_count == m_entries.size())
+			{
+				EvictFront();
+			}
+
+			size_t slot = (m_head + m_count) % m_entries.size();
+			Entry& entry = m_entries[slot];
+			entry.key = key;
+			entry.time = now;
+			entry.value = value;
+			entry.valid = true;
+			m_count++;
+			m_index[key] = slot;
+		}
+
+		// Removes and returns the value with the given key. Returns false if
+		// the key was never added or was already evicted.
+		bool Take(int64_t key, int64_t now, T* value)
+		{
+			EvictOlderThan(now - m_maxAge);
+
+			auto it = m_index.find(key);
+			if (it == m_index.end())
+			{
+				CountMiss(key);
+				return false;
+			}
+
+			TakeEntry(it->second, value);
+			return true;
+		}
+
+		// Removes and returns the value with the given key, or else with the
+		// key nearest to it within the tolerance. Used for keys extrapolated
+		// by the server which may fall between the added keys. A miss is only
+		// counted when neither is found.
+		bool TakeNearest(int64_t key, int64_t tolerance, int64_t now, T* value)
+		{
+			EvictOlderThan(now - m_maxAge);
+
+			auto it = m_index.find(key);
+			if (it != m_index.end())
+			{
+				TakeEntry(it->second, value);
+				return true;
+			}
+
+			size_t nearest = m_entries.size();
+			int64_t nearestDistance = tolerance;
+			for (size_t i = 0; i < m_count; i++)
+			{
+				size_t slot = (m_head + i) % m_entries.size();
+				const Entry& entry = m_entries[slot];
+				int64_t distance = entry.key > key ? entry.key - key : key - entry.key;
+				if (entry.valid && distance <= nearestDistance)
+				{
+					nearest = slot;
+					nearestDistance = distance;
+				}
+			}
+
+			if (nearest == m_entries.size())
+			{
+				CountMiss(key);
+				return false;
+			}
+
+			TakeEntry(nearest, value);
+			return true;
+		}
+
+		// Evicts the entries added before the given time.
+		void EvictOlderThan(int64_t time)
+		{
+			while (m_count > 0 && m_entries[m_head].time < time)
+			{
+				EvictFront();
+			}
+		}
+
+		FrameHistoryStats GetStats() const
+		{
+			FrameHistoryStats stats = m_stats;
+			stats.size = m_index.size();
+			return stats;
+		}
+
+	private:
+		struct Entry
+		{
+			Entry() : key(0), time(0), value(), valid(false)
+			{
+			}
+
+			int64_t key;
+			int64_t time;
+			T value;
+			bool valid;
+		};
+
+		void TakeEntry(size_t slot, T* value)
+		{
+			Entry& entry = m_entries[slot];
+			*value = entry.value;
+			entry.value = T();
+			entry.valid = false;
+			m_index.erase(entry.key);
+			m_stats.matched++;
+		}
+
+		void CountMiss(int64_t key)
+		{
+			if (key <= m_lastEvictedKey)
+			{
+				m_stats.late++;
+			}
+			else
+			{
+				m_stats.unmatched++;
+			}
+		}
+
+		void EvictFront()
+		{
+			Entry& entry = m_entries[m_head];
+			if (entry.valid)
+			{
+				m_index.erase(entry.key);
+				m_stats.evicted++;
+				if (entry.key > m_lastEvictedKey)
+				{
+					m_lastEvictedKey = entry.key;
+				}
+			}
+
+			entry.value = T();
+			entry.valid = false;
+			m_head = (m_head + 1) % m_entries.size();
+			m_count--;
+		}
+
+		std::vector<Entry> m_entries;
+		std::unordered_map<int64_t, size_t> m_index;
+		const int64_t m_maxAge;
+
+		// Ring position of the oldest entry, and number of slots in use,
+		// including the ones of entries already taken.
+		size_t m_head;
+		size_t m_count;
+
+		int64_t m_lastEvictedKey;
+		FrameHistoryStats m_stats;
+	};
+}
@@ -12,6 +12,7 @@
 #include "client_main_window.h"
 #include "win32_data_channel_handler.h"
 #include "oauth24d_provider.h"
+#include "token_manager.h"
 #include "turn_credential_provider.h"
 #include "config_parser.h"
 
@@ -40,7 +41,6 @@ int WINAPI wWinMain(
 	_In_ int nCmdShow)
 {
 	UNREFERENCED_PARAMETER(hPrevInstance);
-	UNREFERENCED_PARAMETER(lpCmdLine);
 
 	// this must occur before any config access
 	ConfigParser::ConfigureConfigFactories();
@@ -70,11 +70,20 @@ int WINAPI wWinMain(
 	rtc::InitializeSSL();
 
 	std::unique_ptr<OAuth24DProvider> oauth;
+	std::unique_ptr<TokenManager> tokens;
 	if (!webrtcConfig->authentication.code_uri.empty() &&
 		!webrtcConfig->authentication.poll_uri.empty())
 	{
 		oauth.reset(new OAuth24DProvider(
 			webrtcConfig->authentication.code_uri, webrtcConfig->authentication.poll_uri));
+
+		// shares the tokens between signaling and turn, and across runs
+		tokens.reset(new TokenManager(oauth.get(), webrtcConfig->authentication.token_renewal));
+		if (!webrtcConfig->authentication.token_cache_path.empty())
+		{
+			tokens->SetCacheFile(webrtcConfig->authentication.token_cache_path,
+				webrtcConfig->authentication.encrypt_token_cache);
+		}
 	}
 	else
 	{
@@ -101,6 +110,15 @@ int WINAPI wWinMain(
 	wnd.SignalClientWindowMessage.connect(&dcHandler, &Win32DataChannelHandler::ProcessMessage);
 	wnd.SignalDataChannelMessage.connect(&dcHandler, &Win32DataChannelHandler::ProcessMessage);
 
+	// Measures the glass to glass latency and reports it to the server.
+	if (lpCmdLine && wcsstr(lpCmdLine, L"--glassToGlass"))
+	{
+		wnd.EnableGlassToGlassMode([&](const std::string& message)
+		{
+			conductor->SendInputData(message);
+		});
+	}
+
 	// set our client heartbeat interval
 	client.SetHeartbeatMs(webrtcConfig->heartbeat);
 
@@ -170,7 +188,7 @@ int WINAPI wWinMain(
 	// if we have real turn values, configure turn
 	if (turn.get() != nullptr)
 	{
-		turn->SetAuthenticationProvider(oauth.get());
+		turn->SetAuthenticationProvider(tokens.get());
 
 		turn->SignalCredentialsRetrieved.connect(&credentialsRetrieved, &TurnCredentialProvider::CredentialsRetrievedCallback::Handle);
 	}
@@ -179,7 +197,7 @@ int WINAPI wWinMain(
 	if (oauth.get() != nullptr)
 	{
 		oauth->SignalCodeComplete.connect(&codeComplete, &OAuth24DProvider::CodeCompleteCallback::Handle);
-		oauth->SignalAuthenticationComplete.connect(&authComplete, &AuthenticationProvider::AuthenticationCompleteCallback::Handle);
+		tokens->SignalAuthenticationComplete.connect(&authComplete, &AuthenticationProvider::AuthenticationCompleteCallback::Handle);
 
 		wnd.SetConnectButtonState(false);
 		wnd.SetAuthCode(L"Connecting");
@@ -194,7 +212,7 @@ int WINAPI wWinMain(
 		// do auth things
 		if (turn.get() != nullptr)
 		{
-			// this will trigger oauth->Authenticate() under the hood
+			// this will trigger tokens->Authenticate() under the hood
 			if (!turn->RequestCredentials())
 			{
 				wnd.SetAuthCode(L"FAIL");
@@ -202,7 +220,7 @@ int WINAPI wWinMain(
 			}
 		}
 		// if we don't have a turn provider, we just authenticate
-		else if (!oauth->Authenticate())
+		else if (!tokens->Authenticate())
 		{
 			wnd.SetAuthCode(L"FAIL");
 			wnd.SetAuthUri(L"Unable to authenticate");
@@ -19,10 +19,15 @@
 #include "test_runner.h"
 #else // TEST_RUNNER
 #include "config_parser.h"
+#include "config_watcher.h"
 #include "directx_multi_peer_conductor.h"
+#include "directx_render_target_pool.h"
+#include "pose_predictor.h"
 #include "server_main_window.h"
 #include "server_renderer.h"
 #include "service/render_service.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
 #endif // TEST_RUNNER
 
 #include "resource.h"
@@ -436,20 +441,22 @@ struct RemotePeerData
 	// The timestamp used for frame synchronization in stereo mode
 	int64_t							lastTimestamp;
 
-	// The render texture which we use to render
-	ComPtr<ID3D11Texture2D>			renderTexture;
+	// True if the client matches the frames to its nearest pose, the poses
+	// are then extrapolated to the display time
+	bool							isPosePredictionEnabled;
 
-	// The render target view of the render texture
-	ComPtr<ID3D11RenderTargetView>	renderTargetView;
+	// The history of poses used for extrapolation in stereo mode
+	PosePredictor					posePredictor;
 
-	// The depth stencil texture which we use to render
-	ComPtr<ID3D11Texture2D>			depthStencilTexture;
+	// The render target which we use to render, taken from the pool once
+	// the stereo mode is known
+	std::unique_ptr<DirectXRenderTarget>	renderTarget;
 
-	// The depth stencil view of the depth stencil texture
-	ComPtr<ID3D11DepthStencilView>	depthStencilView;
+	// The key the render target was acquired with
+	RenderTargetKey					renderTargetKey;
 
-	// Used for FPS limiter.
-	ULONGLONG						tick;
+	// True while the peer is rendered at the keep-alive rate
+	bool							isIdle;
 
 	// The starting time.
 	ULONGLONG						startTick;
@@ -457,6 +464,9 @@ struct RemotePeerData
 
 std::map<int, std::shared_ptr<RemotePeerData>> g_remotePeersData;
 
+// Keeps the render targets of the disconnected peers for the next ones
+std::unique_ptr<DirectXRenderTargetPool> g_renderTargetPool;
+
 #endif // TEST_RUNNER
 
 //--------------------------------------------------------------------------------------
@@ -516,57 +526,74 @@ inline bool IsRenderDeferred()
 
 #ifndef TEST_RUNNER
 
-void InitializeRenderTexture(RemotePeerData* peerData, int width, int height, bool isStereo)
+void InitializeRenderTarget(RemotePeerData* peerData, int width, int height, bool isStereo)
+{
+	peerData->renderTargetKey = GetDirectXRenderTargetKey(width, height, isStereo);
+	peerData->renderTarget = g_renderTargetPool->Acquire(peerData->renderTargetKey);
+}
+
+// Removes the data of the peers which disconnected, returning their render
+// targets to the pool.
+void ReleaseDisconnectedPeers(const std::map<int, rtc::scoped_refptr<PeerConductor>>& peers)
+{
+	bool released = false;
+	for (auto it = g_remotePeersData.begin(); it != g_remotePeersData.end();)
+	{
+		if (peers.find(it->first) == peers.end())
+		{
+			g_renderTargetPool->Release(it->second->renderTargetKey, std::move(it->second->renderTarget));
+			it = g_remotePeersData.erase(it);
+			released = true;
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	if (released)
+	{
+		RenderTargetPoolStats stats = g_renderTargetPool->GetStats();
+		LOG(LS_INFO) << "Render targets: " << stats.in_use << " in use, " << stats.idle <<
+			" idle, " << stats.resident_bytes / (1024 * 1024) << " MB resident, peak " <<
+			stats.peak_resident << ", allocations " << stats.allocations << ", reuses " <<
+			stats.reuses << ", evictions " << stats.evictions;
+	}
+}
+
+// Logs the transitions of a peer to and from the keep-alive rate.
+void ReportIdleState(PeerConductor* peer, RemotePeerData* peerData)
 {
-	int texWidth = isStereo ? width << 1 : width;
-	int texHeight = height;
-
-	// Creates the render texture.
-	D3D11_TEXTURE2D_DESC texDesc = { 0 };
-	texDesc.ArraySize = 1;
-	texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	texDesc.Width = texWidth;
-	texDesc.Height = texHeight;
-	texDesc.MipLevels = 1;
-	texDesc.SampleDesc.Count = 1;
-	texDesc.Usage = D3D11_USAGE_DEFAULT;
-	texDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
-	DXUTGetD3D11Device()->CreateTexture2D(&texDesc, nullptr, &peerData->renderTexture);
-
-	// Creates the render target view.
-	DXUTGetD3D11Device()->CreateRenderTargetView(peerData->renderTexture.Get(), nullptr, &peerData->renderTargetView);
+	IdlePolicyStats stats = peer->idle_policy()->GetStats();
+	if (stats.idle != peerData->isIdle)
+	{
+		peerData->isIdle = stats.idle;
+		if (stats.idle)
+		{
+			LOG(LS_INFO) << "Peer " << peer->Id() << " is idle, rendering at the keep-alive rate.";
+		}
+		else
+		{
+			LOG(LS_INFO) << "Peer " << peer->Id() << " is active, idle for " <<
+				stats.idle_time_us / 1000 << " ms in total, " << stats.skipped_frames <<
+				" frames skipped.";
+		}
+	}
 }
 
-void InitializeDepthStencilTexture(RemotePeerData* peerData, int width, int height, bool isStereo)
+// Bounds the bitrate of a peer to the encoder profile of its frame size.
+void SetEncoderProfile(PeerConductor* peer, const NvEncConfig& nvEncConfig, int width, int height, bool isStereo)
 {
-	int texWidth = isStereo ? width << 1 : width;
-	int texHeight = height;
-
-	// Creates the depth stencil texture.
-	D3D11_TEXTURE2D_DESC texDesc = { 0 };
-	texDesc.ArraySize = 1;
-	texDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
-	texDesc.Width = texWidth;
-	texDesc.Height = texHeight;
-	texDesc.MipLevels = 1;
-	texDesc.SampleDesc.Count = 1;
-	texDesc.Usage = D3D11_USAGE_DEFAULT;
-	texDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
-	DXUTGetD3D11Device()->CreateTexture2D(&texDesc, nullptr, &peerData->depthStencilTexture);
-
-	// Creates the depth stencil view.
-	D3D11_DEPTH_STENCIL_VIEW_DESC descDSV;
-	descDSV.Format = texDesc.Format;
-	descDSV.Flags = 0;
-	descDSV.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
-	descDSV.Texture2D.MipSlice = 0;
-	DXUTGetD3D11Device()->CreateDepthStencilView(peerData->depthStencilTexture.Get(), &descDSV, &peerData->depthStencilView);
+	peer->SetEncoderProfile(ConfigParser::GetEncoderProfile(nvEncConfig, isStereo ? width << 1 : width, height));
 }
 
 bool AppMain(BOOL stopping)
 {
 	auto fullServerConfig = GlobalObject<FullServerConfig>::Get();
-	auto nvEncConfig = GlobalObject<NvEncConfig>::Get();
+
+	// Watches the configuration files, to apply their changes without
+	// restarting the sessions.
+	ConfigWatcher configWatcher(ConfigParser::GetAbsolutePath(""));
 
 	rtc::EnsureWinsockInit();
 	rtc::Win32SocketServer w32_ss;
@@ -611,6 +638,11 @@ bool AppMain(BOOL stopping)
 	// Initializes SSL.
 	rtc::InitializeSSL();
 
+	// Initializes the pool of the render targets of the peers.
+	g_renderTargetPool = CreateDirectXRenderTargetPool(
+		DXUTGetD3D11Device(),
+		fullServerConfig->server_config->server_config.render_target_pool_size);
+
 	// Initializes the conductor.
 	DirectXMultiPeerConductor cond(fullServerConfig, DXUTGetD3D11Device());
 
@@ -620,6 +652,9 @@ bool AppMain(BOOL stopping)
 	// Registers the handler.
 	wnd.RegisterObserver(&cond);
 
+	// Applies the IDR period of the encoder profiles.
+	cond.SetEncoderConfig(configWatcher.Snapshot()->nvenc_config);
+
 	// Handles data channel messages.
 	std::function<void(int, const string&)> dataChannelMessageHandler([&](
 		int peerId,
@@ -643,18 +678,19 @@ bool AppMain(BOOL stopping)
 			strcpy(body, msg.get("body", "").asCString());
 			std::istringstream datastream(body);
 			std::string token;
-			if (strcmp(type, "stereo-rendering") == 0 && !peerData->renderTexture)
+			if (strcmp(type, "stereo-rendering") == 0 && !peerData->renderTarget)
 			{
 				getline(datastream, token, ',');
 				peerData->isStereo = stoi(token) == 1;
-				InitializeRenderTexture(
+				InitializeRenderTarget(
 					peerData.get(),
 					fullServerConfig->server_config->server_config.width,
 					fullServerConfig->server_config->server_config.height,
 					peerData->isStereo);
 
-				InitializeDepthStencilTexture(
-					peerData.get(),
+				SetEncoderProfile(
+					cond.Peers().at(peerId).get(),
+					*configWatcher.Snapshot()->nvenc_config,
 					fullServerConfig->server_config->server_config.width,
 					fullServerConfig->server_config->server_config.height,
 					peerData->isStereo);
@@ -665,7 +701,6 @@ bool AppMain(BOOL stopping)
 					peerData->eyeVector = s_vDefaultEye;
 					peerData->lookAtVector = s_vDefaultLookAt;
 					peerData->upVector = s_vDefaultUp;
-					peerData->tick = GetTickCount64();
 				}
 			}
 			else if (strcmp(type, "camera-transform-lookat") == 0)
@@ -808,8 +843,27 @@ bool AppMain(BOOL stopping)
 					peerData->projectionMatrixRight = projectionMatrixRight;
 					peerData->viewMatrixRight = viewMatrixRight;
 					peerData->isNew = true;
+
+					StereoPose pose;
+					memcpy(pose.projection_left, projectionMatrixLeft.m, sizeof(pose.projection_left));
+					memcpy(pose.view_left, viewMatrixLeft.m, sizeof(pose.view_left));
+					memcpy(pose.projection_right, projectionMatrixRight.m, sizeof(pose.projection_right));
+					memcpy(pose.view_right, viewMatrixRight.m, sizeof(pose.view_right));
+					pose.timestamp = timestamp;
+					peerData->posePredictor.AddSample(pose, rtc::TimeMicros());
 				}
 			}
+			else if (strcmp(type, "pose-prediction") == 0)
+			{
+				peerData->isPosePredictionEnabled = atoi(body) == 1;
+				peerData->posePredictor.Reset();
+			}
+			else if (strcmp(type, "pose-prediction-error") == 0)
+			{
+				// The display error is reported in client ticks.
+				peerData->posePredictor.AddDisplayError(
+					atoll(body) / PosePredictor::kTicksPerMicrosecond);
+			}
 		}
 	});
 
@@ -823,6 +877,45 @@ bool AppMain(BOOL stopping)
 			fullServerConfig->webrtc_config->port);
 	}
 
+	// Drops the peers which sent no input for a while to the keep-alive rate.
+	IdlePolicyParams idlePolicyParams;
+	idlePolicyParams.idle_timeout_ms = fullServerConfig->server_config->server_config.idle_timeout;
+	idlePolicyParams.keep_alive_fps = fullServerConfig->server_config->server_config.keep_alive_fps;
+
+	// Applies the configuration changes to the live sessions. The watcher is
+	// polled from the main loop, so this runs on the main thread.
+	configWatcher.Subscribe([&](const ConfigSnapshot& previous, const ConfigSnapshot& current)
+	{
+		const ServerAppConfig& previousConfig = previous.server_config->server_config;
+		const ServerAppConfig& currentConfig = current.server_config->server_config;
+		if (currentConfig.system_capacity != previousConfig.system_capacity)
+		{
+			cond.SetMaxCapacity(currentConfig.system_capacity);
+		}
+
+		cond.SetEncoderConfig(current.nvenc_config);
+
+		idlePolicyParams.idle_timeout_ms = currentConfig.idle_timeout;
+		idlePolicyParams.keep_alive_fps = currentConfig.keep_alive_fps;
+		for each (auto pair in cond.Peers())
+		{
+			pair.second->idle_policy()->SetParams(idlePolicyParams);
+
+			// Only the bitrate of the peers follows the new encoder profiles,
+			// their frame size is kept.
+			auto it = g_remotePeersData.find(pair.first);
+			if (it != g_remotePeersData.end() && it->second->renderTarget)
+			{
+				SetEncoderProfile(
+					pair.second.get(),
+					*current.nvenc_config,
+					fullServerConfig->server_config->server_config.width,
+					fullServerConfig->server_config->server_config.height,
+					it->second->isStereo);
+			}
+		}
+	});
+
 	// Main loop.
 	MSG msg = { 0 };
 	while (!stopping && WM_QUIT != msg.message)
@@ -838,6 +931,8 @@ bool AppMain(BOOL stopping)
 		}
 		else
 		{
+			configWatcher.Poll();
+			ReleaseDisconnectedPeers(cond.Peers());
 			for each (auto pair in cond.Peers())
 			{
 				auto peer = (DirectXPeerConductor*)pair.second.get();
@@ -849,6 +944,7 @@ bool AppMain(BOOL stopping)
 				{
 					peerData.reset(new RemotePeerData());
 					peerData->startTick = GetTickCount64();
+					peer->idle_policy()->SetParams(idlePolicyParams);
 					g_remotePeersData[peer->Id()] = peerData;
 				}
 				else
@@ -856,19 +952,20 @@ bool AppMain(BOOL stopping)
 					peerData = it->second;
 				}
 
-				if (!peerData->renderTexture)
+				if (!peerData->renderTarget)
 				{
 					// Forces non-stereo mode initialization.
 					if (GetTickCount64() - peerData->startTick >= STEREO_FLAG_WAIT_TIME)
 					{
-						InitializeRenderTexture(
+						InitializeRenderTarget(
 							peerData.get(),
 							fullServerConfig->server_config->server_config.width,
 							fullServerConfig->server_config->server_config.height,
 							false);
 
-						InitializeDepthStencilTexture(
-							peerData.get(),
+						SetEncoderProfile(
+							peer,
+							*configWatcher.Snapshot()->nvenc_config,
 							fullServerConfig->server_config->server_config.width,
 							fullServerConfig->server_config->server_config.height,
 							false);
@@ -877,7 +974,6 @@ bool AppMain(BOOL stopping)
 						peerData->eyeVector = s_vDefaultEye;
 						peerData->lookAtVector = s_vDefaultLookAt;
 						peerData->upVector = s_vDefaultUp;
-						peerData->tick = GetTickCount64();
 
 						DXUTSetNoSwapChainPresent(true);
 					}
@@ -885,16 +981,17 @@ bool AppMain(BOOL stopping)
 				else
 				{
 					g_CameraResources.SetStereo(peerData->isStereo);
-					DXUTSetD3D11RenderTargetView(peerData->renderTargetView.Get());
-					DXUTSetD3D11DepthStencilView(peerData->depthStencilView.Get());
+					DXUTSetD3D11RenderTargetView(peerData->renderTarget->render_target_view.Get());
+					DXUTSetD3D11DepthStencilView(peerData->renderTarget->depth_stencil_view.Get());
 					if (!peerData->isStereo)
 					{
-						// FPS limiter.
-						const int interval = 1000 / nvEncConfig->capture_fps;
-						ULONGLONG timeElapsed = GetTickCount64() - peerData->tick;
-						if (timeElapsed >= interval)
+						// FPS limiter, down to the keep-alive rate while
+						// the peer is idle.
+						IdlePolicy::FrameAction action = peer->idle_policy()->GetFrameAction(
+							rtc::TimeMicros(), configWatcher.Snapshot()->nvenc_config->capture_fps);
+						ReportIdleState(peer, peerData.get());
+						if (action == IdlePolicy::FrameAction::kRender)
 						{
-							peerData->tick = GetTickCount64() - timeElapsed + interval;
 							g_Camera.SetViewParams(
 								peerData->eyeVector,
 								peerData->lookAtVector,
@@ -902,7 +999,11 @@ bool AppMain(BOOL stopping)
 
 							g_Camera.FrameMove(0);
 							DXUTRender3DEnvironment();
-							peer->SendFrame(peerData->renderTexture.Get());
+							peer->SendFrame(peerData->renderTarget->texture.Get());
+						}
+						else if (action == IdlePolicy::FrameAction::kRepeat)
+						{
+							peer->SendFrame(peerData->renderTarget->texture.Get());
 						}
 					}
 					// In stereo rendering mode, we only update frame whenever
@@ -913,20 +1014,34 @@ bool AppMain(BOOL stopping)
 						XMStoreFloat4x4(&id, XMMatrixIdentity());
 						g_CameraResources.SetViewMatrix(id, id);
 
+						// Late latches the latest poses, extrapolated to the
+						// display time if the client supports it.
+						XMFLOAT4X4 viewMatrixLeft = peerData->viewMatrixLeft;
+						XMFLOAT4X4 viewMatrixRight = peerData->viewMatrixRight;
+						int64_t timestamp = peerData->lastTimestamp;
+						StereoPose pose;
+						if (peerData->isPosePredictionEnabled &&
+							peerData->posePredictor.Predict(rtc::TimeMicros(), &pose))
+						{
+							memcpy(viewMatrixLeft.m, pose.view_left, sizeof(pose.view_left));
+							memcpy(viewMatrixRight.m, pose.view_right, sizeof(pose.view_right));
+							timestamp = pose.timestamp;
+						}
+
 						XMFLOAT4X4 leftProjMatrix;
 						XMStoreFloat4x4(
 							&leftProjMatrix,
-							XMLoadFloat4x4(&peerData->projectionMatrixLeft) * XMLoadFloat4x4(&peerData->viewMatrixLeft));
+							XMLoadFloat4x4(&peerData->projectionMatrixLeft) * XMLoadFloat4x4(&viewMatrixLeft));
 
 						XMFLOAT4X4 rightProjMatrix;
 						XMStoreFloat4x4(
 							&rightProjMatrix,
-							XMLoadFloat4x4(&peerData->projectionMatrixRight) * XMLoadFloat4x4(&peerData->viewMatrixRight));
+							XMLoadFloat4x4(&peerData->projectionMatrixRight) * XMLoadFloat4x4(&viewMatrixRight));
 
 						g_CameraResources.SetProjMatrix(leftProjMatrix, rightProjMatrix);
 						g_Camera.FrameMove(0);
 						DXUTRender3DEnvironment();
-						peer->SendFrame(peerData->renderTexture.Get(), peerData->lastTimestamp);
+						peer->SendFrame(peerData->renderTarget->texture.Get(), timestamp);
 						peerData->isNew = false;
 					}
 				}
@@ -935,6 +1050,8 @@ bool AppMain(BOOL stopping)
 	}
 
 	// Cleanup.
+	g_remotePeersData.clear();
+	g_renderTargetPool.reset();
 	rtc::CleanupSSL();
 
 	return 0;
@@ -12,11 +12,19 @@
 #include "test_runner.h"
 #else // TEST_RUNNER
 #include "config_parser.h"
+#include "config_watcher.h"
+#include "depth_codec.h"
 #include "directx_multi_peer_conductor.h"
+#include "directx_render_target_pool.h"
+#include "frame_stamp.h"
+#include "gpu_timer.h"
+#include "pose_predictor.h"
 #include "server_main_window.h"
 #include "server_renderer.h"
 #include "service/render_service.h"
 #include "webrtc.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
 #endif // TEST_RUNNER
 
 // Position the cube two meters in front of user for image stabilization.
@@ -26,6 +34,9 @@
 // the video stream will start in non-stereo mode.
 #define STEREO_FLAG_WAIT_TIME		5000
 
+// Number of stereo frames between GPU time reports.
+#define GPU_STATS_INTERVAL			300
+
 // Required app libs
 #pragma comment(lib, "d3dcompiler.lib")
 #pragma comment(lib, "dxguid.lib")
@@ -93,81 +104,106 @@ struct RemotePeerData
 	// The timestamp used for frame synchronization in stereo mode
 	int64_t							lastTimestamp;
 
-	// The render texture which we use to render
-	ComPtr<ID3D11Texture2D>			renderTexture;
+	// True if the client matches the frames to its nearest pose, the poses
+	// are then extrapolated to the display time
+	bool							isPosePredictionEnabled;
 
-	// The render target view of the render texture
-	ComPtr<ID3D11RenderTargetView>	renderTargetView;
+	// The history of poses used for extrapolation in stereo mode
+	PosePredictor					posePredictor;
 
-	// The depth stencil texture which we use to render
-	ComPtr<ID3D11Texture2D>			depthStencilTexture;
+	// The render target which we use to render, taken from the pool once
+	// the stereo mode is known
+	std::unique_ptr<DirectXRenderTarget>	renderTarget;
 
-	// The depth stencil view of the depth stencil texture
-	ComPtr<ID3D11DepthStencilView>	depthStencilView;
+	// The key the render target was acquired with
+	RenderTargetKey					renderTargetKey;
 
-	// Used for FPS limiter.
-	ULONGLONG						tick;
+	// True while the peer is rendered at the keep-alive rate
+	bool							isIdle;
 
 	// The starting time.
 	ULONGLONG						startTick;
 };
 
 std::map<int, std::shared_ptr<RemotePeerData>> g_remotePeersData;
+
+// Keeps the render targets of the disconnected peers for the next ones
+std::unique_ptr<DirectXRenderTargetPool> g_renderTargetPool;
 #endif // TESTRUNNER
 
 #ifndef TEST_RUNNER
 
-void InitializeRenderTexture(RemotePeerData* peerData, int width, int height, bool isStereo)
+void InitializeRenderTarget(RemotePeerData* peerData, int width, int height, bool isStereo)
 {
-	int texWidth = isStereo ? width << 1 : width;
-	int texHeight = height;
-
-	// Creates the render texture.
-	D3D11_TEXTURE2D_DESC texDesc = { 0 };
-	texDesc.ArraySize = 1;
-	texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	texDesc.Width = texWidth;
-	texDesc.Height = texHeight;
-	texDesc.MipLevels = 1;
-	texDesc.SampleDesc.Count = 1;
-	texDesc.Usage = D3D11_USAGE_DEFAULT;
-	texDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
-	g_deviceResources->GetD3DDevice()->CreateTexture2D(&texDesc, nullptr, &peerData->renderTexture);
-
-	// Creates the render target view.
-	g_deviceResources->GetD3DDevice()->CreateRenderTargetView(peerData->renderTexture.Get(), nullptr, &peerData->renderTargetView);
+	peerData->renderTargetKey = GetDirectXRenderTargetKey(width, height, isStereo);
+	peerData->renderTarget = g_renderTargetPool->Acquire(peerData->renderTargetKey);
 }
 
-void InitializeDepthStencilTexture(RemotePeerData* peerData, int width, int height, bool isStereo)
+// Removes the data of the peers which disconnected, returning their render
+// targets to the pool.
+void ReleaseDisconnectedPeers(const std::map<int, rtc::scoped_refptr<PeerConductor>>& peers)
 {
-	int texWidth = isStereo ? width << 1 : width;
-	int texHeight = height;
-
-	// Creates the depth stencil texture.
-	D3D11_TEXTURE2D_DESC texDesc = { 0 };
-	texDesc.ArraySize = 1;
-	texDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
-	texDesc.Width = texWidth;
-	texDesc.Height = texHeight;
-	texDesc.MipLevels = 1;
-	texDesc.SampleDesc.Count = 1;
-	texDesc.Usage = D3D11_USAGE_DEFAULT;
-	texDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
-	g_deviceResources->GetD3DDevice()->CreateTexture2D(&texDesc, nullptr, &peerData->depthStencilTexture);
-
-	// Creates the depth stencil view.
-	D3D11_DEPTH_STENCIL_VIEW_DESC descDSV;
-	descDSV.Format = texDesc.Format;
-	descDSV.Flags = 0;
-	descDSV.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
-	descDSV.Texture2D.MipSlice = 0;
-	g_deviceResources->GetD3DDevice()->CreateDepthStencilView(peerData->depthStencilTexture.Get(), &descDSV, &peerData->depthStencilView);
+	bool released = false;
+	for (auto it = g_remotePeersData.begin(); it != g_remotePeersData.end();)
+	{
+		if (peers.find(it->first) == peers.end())
+		{
+			g_renderTargetPool->Release(it->second->renderTargetKey, std::move(it->second->renderTarget));
+			it = g_remotePeersData.erase(it);
+			released = true;
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	if (released)
+	{
+		RenderTargetPoolStats stats = g_renderTargetPool->GetStats();
+		LOG(LS_INFO) << "Render targets: " << stats.in_use << " in use, " << stats.idle <<
+			" idle, " << stats.resident_bytes / (1024 * 1024) << " MB resident, peak " <<
+			stats.peak_resident << ", allocations " << stats.allocations << ", reuses " <<
+			stats.reuses << ", evictions " << stats.evictions;
+	}
+}
+
+// Logs the transitions of a peer to and from the keep-alive rate, with the
+// GPU time recovered by the skipped frames.
+void ReportIdleState(DirectXPeerConductor* peer, RemotePeerData* peerData, const GpuTimer& renderTimer)
+{
+	IdlePolicyStats stats = peer->idle_policy()->GetStats();
+	if (stats.idle != peerData->isIdle)
+	{
+		peerData->isIdle = stats.idle;
+		if (stats.idle)
+		{
+			LOG(LS_INFO) << "Peer " << peer->Id() << " is idle, rendering at the keep-alive rate.";
+		}
+		else
+		{
+			int64_t frameGpuTimeUs = renderTimer.GetStats().average_us + peer->GetCopyGpuStats().average_us;
+			LOG(LS_INFO) << "Peer " << peer->Id() << " is active, idle for " <<
+				stats.idle_time_us / 1000 << " ms in total, " << stats.skipped_frames <<
+				" frames skipped, about " << stats.skipped_frames * frameGpuTimeUs / 1000 <<
+				" ms of GPU time saved.";
+		}
+	}
+}
+
+// Bounds the bitrate of a peer to the encoder profile of its frame size.
+void SetEncoderProfile(PeerConductor* peer, const NvEncConfig& nvEncConfig, int width, int height, bool isStereo)
+{
+	peer->SetEncoderProfile(ConfigParser::GetEncoderProfile(nvEncConfig, isStereo ? width << 1 : width, height));
 }
 
 bool AppMain(BOOL stopping)
 {
 	auto fullServerConfig = GlobalObject<FullServerConfig>::Get();
-	auto nvEncConfig = GlobalObject<NvEncConfig>::Get();
+
+	// Watches the configuration files, to apply their changes without
+	// restarting the sessions.
+	ConfigWatcher configWatcher(ConfigParser::GetAbsolutePath(""));
 
 	rtc::EnsureWinsockInit();
 	rtc::Win32SocketServer w32_ss;
@@ -195,9 +231,22 @@ bool AppMain(BOOL stopping)
 	// Initializes the cube renderer.
 	g_cubeRenderer = new CubeRenderer(g_deviceResources);
 
+	// Measures the GPU time of the stereo frames.
+	GpuTimer stereoRenderTimer(g_deviceResources->GetD3DDevice());
+	int stereoFrameCount = 0;
+
+	// Measures the GPU time of the mono frames, which is saved while the
+	// peers are idle.
+	GpuTimer monoRenderTimer(g_deviceResources->GetD3DDevice());
+
 	// Initializes SSL.
 	rtc::InitializeSSL();
 
+	// Initializes the pool of the render targets of the peers.
+	g_renderTargetPool = CreateDirectXRenderTargetPool(
+		g_deviceResources->GetD3DDevice(),
+		fullServerConfig->server_config->server_config.render_target_pool_size);
+
 	// Initializes the conductor.
 	DirectXMultiPeerConductor cond(fullServerConfig, g_deviceResources->GetD3DDevice());
 
@@ -207,6 +256,9 @@ bool AppMain(BOOL stopping)
 	// Registers the handler.
 	wnd.RegisterObserver(&cond);
 
+	// Applies the IDR period of the encoder profiles.
+	cond.SetEncoderConfig(configWatcher.Snapshot()->nvenc_config);
+
 	// Handles data channel messages.
 	std::function<void(int, const string&)> dataChannelMessageHandler([&](
 		int peerId,
@@ -230,18 +282,19 @@ bool AppMain(BOOL stopping)
 			strcpy(body, msg.get("body", "").asCString());
 			std::istringstream datastream(body);
 			std::string token;
-			if (strcmp(type, "stereo-rendering") == 0 && !peerData->renderTexture)
+			if (strcmp(type, "stereo-rendering") == 0 && !peerData->renderTarget)
 			{
 				getline(datastream, token, ',');
 				peerData->isStereo = stoi(token) == 1;
-				InitializeRenderTexture(
+				InitializeRenderTarget(
 					peerData.get(),
 					fullServerConfig->server_config->server_config.width,
 					fullServerConfig->server_config->server_config.height,
 					peerData->isStereo);
 
-				InitializeDepthStencilTexture(
-					peerData.get(),
+				SetEncoderProfile(
+					cond.Peers().at(peerId).get(),
+					*configWatcher.Snapshot()->nvenc_config,
 					fullServerConfig->server_config->server_config.width,
 					fullServerConfig->server_config->server_config.height,
 					peerData->isStereo);
@@ -251,7 +304,6 @@ bool AppMain(BOOL stopping)
 					peerData->eyeVector = g_cubeRenderer->GetDefaultEyeVector();
 					peerData->lookAtVector = g_cubeRenderer->GetDefaultLookAtVector();
 					peerData->upVector = g_cubeRenderer->GetDefaultUpVector();
-					peerData->tick = GetTickCount64();
 				}
 			}
 			else if (strcmp(type, "camera-transform-lookat") == 0)
@@ -394,6 +446,59 @@ bool AppMain(BOOL stopping)
 					peerData->projectionMatrixRight = projectionMatrixRight;
 					peerData->viewMatrixRight = viewMatrixRight;
 					peerData->isNew = true;
+
+					StereoPose pose;
+					memcpy(pose.projection_left, projectionMatrixLeft.m, sizeof(pose.projection_left));
+					memcpy(pose.view_left, viewMatrixLeft.m, sizeof(pose.view_left));
+					memcpy(pose.projection_right, projectionMatrixRight.m, sizeof(pose.projection_right));
+					memcpy(pose.view_right, viewMatrixRight.m, sizeof(pose.view_right));
+					pose.timestamp = timestamp;
+					peerData->posePredictor.AddSample(pose, rtc::TimeMicros());
+				}
+			}
+			else if (strcmp(type, "pose-prediction") == 0)
+			{
+				peerData->isPosePredictionEnabled = atoi(body) == 1;
+				peerData->posePredictor.Reset();
+			}
+			else if (strcmp(type, "pose-prediction-error") == 0)
+			{
+				// The display error is reported in client ticks.
+				peerData->posePredictor.AddDisplayError(
+					atoll(body) / PosePredictor::kTicksPerMicrosecond);
+			}
+			else if (strcmp(type, "single-pass-stereo") == 0)
+			{
+				// Switches the stereo rendering path to compare their GPU cost.
+				g_cubeRenderer->SetSinglePassStereo(atoi(body) == 1);
+			}
+			else if (strcmp(type, "glass-to-glass") == 0)
+			{
+				// Stamps the frames so the client can measure glass to glass latency.
+				auto peer = cond.Peers().find(peerId);
+				if (peer != cond.Peers().end())
+				{
+					((DirectXPeerConductor*)peer->second.get())->SetFrameStampEnabled(atoi(body) == 1);
+				}
+			}
+			else if (strcmp(type, DepthCodec::kEnableMessageType) == 0)
+			{
+				// Streams the depth buffer below the color for reprojection.
+				auto peer = cond.Peers().find(peerId);
+				if (peer != cond.Peers().end())
+				{
+					((DirectXPeerConductor*)peer->second.get())->SetDepthEnabled(atoi(body) == 1);
+				}
+			}
+			else if (strcmp(type, GlassToGlassStats::kReportMessageType) == 0)
+			{
+				GlassToGlassReport report;
+				if (GlassToGlassStats::ParseReport(body, &report))
+				{
+					LOG(LS_INFO) << "Glass to glass latency of peer " << peerId <<
+						" (us): p50 " << report.p50_us << ", p95 " << report.p95_us <<
+						", p99 " << report.p99_us << ", max " << report.max_us <<
+						", frames " << report.frames << ", dropped " << report.dropped;
 				}
 			}
 		}
@@ -409,6 +514,45 @@ bool AppMain(BOOL stopping)
 			fullServerConfig->webrtc_config->port);
 	}
 
+	// Drops the peers which sent no input for a while to the keep-alive rate.
+	IdlePolicyParams idlePolicyParams;
+	idlePolicyParams.idle_timeout_ms = fullServerConfig->server_config->server_config.idle_timeout;
+	idlePolicyParams.keep_alive_fps = fullServerConfig->server_config->server_config.keep_alive_fps;
+
+	// Applies the configuration changes to the live sessions. The watcher is
+	// polled from the main loop, so this runs on the main thread.
+	configWatcher.Subscribe([&](const ConfigSnapshot& previous, const ConfigSnapshot& current)
+	{
+		const ServerAppConfig& previousConfig = previous.server_config->server_config;
+		const ServerAppConfig& currentConfig = current.server_config->server_config;
+		if (currentConfig.system_capacity != previousConfig.system_capacity)
+		{
+			cond.SetMaxCapacity(currentConfig.system_capacity);
+		}
+
+		cond.SetEncoderConfig(current.nvenc_config);
+
+		idlePolicyParams.idle_timeout_ms = currentConfig.idle_timeout;
+		idlePolicyParams.keep_alive_fps = currentConfig.keep_alive_fps;
+		for each (auto pair in cond.Peers())
+		{
+			pair.second->idle_policy()->SetParams(idlePolicyParams);
+
+			// Only the bitrate of the peers follows the new encoder profiles,
+			// their frame size is kept.
+			auto it = g_remotePeersData.find(pair.first);
+			if (it != g_remotePeersData.end() && it->second->renderTarget)
+			{
+				SetEncoderProfile(
+					pair.second.get(),
+					*current.nvenc_config,
+					fullServerConfig->server_config->server_config.width,
+					fullServerConfig->server_config->server_config.height,
+					it->second->isStereo);
+			}
+		}
+	});
+
 	// Main loop.
 	MSG msg = { 0 };
 	while (!stopping && WM_QUIT != msg.message)
@@ -424,6 +568,8 @@ bool AppMain(BOOL stopping)
 		}
 		else
 		{
+			configWatcher.Poll();
+			ReleaseDisconnectedPeers(cond.Peers());
 			for each (auto pair in cond.Peers())
 			{
 				auto peer = (DirectXPeerConductor*)pair.second.get();
@@ -435,6 +581,7 @@ bool AppMain(BOOL stopping)
 				{
 					peerData.reset(new RemotePeerData());
 					peerData->startTick = GetTickCount64();
+					peer->idle_policy()->SetParams(idlePolicyParams);
 					g_remotePeersData[peer->Id()] = peerData;
 				}
 				else
@@ -442,19 +589,20 @@ bool AppMain(BOOL stopping)
 					peerData = it->second;
 				}
 
-				if (!peerData->renderTexture)
+				if (!peerData->renderTarget)
 				{
 					// Forces non-stereo mode initialization.
 					if (GetTickCount64() - peerData->startTick >= STEREO_FLAG_WAIT_TIME)
 					{
-						InitializeRenderTexture(
+						InitializeRenderTarget(
 							peerData.get(),
 							fullServerConfig->server_config->server_config.width,
 							fullServerConfig->server_config->server_config.height,
 							false);
 
-						InitializeDepthStencilTexture(
-							peerData.get(),
+						SetEncoderProfile(
+							peer,
+							*configWatcher.Snapshot()->nvenc_config,
 							fullServerConfig->server_config->server_config.width,
 							fullServerConfig->server_config->server_config.height,
 							false);
@@ -463,7 +611,6 @@ bool AppMain(BOOL stopping)
 						peerData->eyeVector = g_cubeRenderer->GetDefaultEyeVector();
 						peerData->lookAtVector = g_cubeRenderer->GetDefaultLookAtVector();
 						peerData->upVector = g_cubeRenderer->GetDefaultUpVector();
-						peerData->tick = GetTickCount64();
 					}
 				}
 				else
@@ -471,20 +618,34 @@ bool AppMain(BOOL stopping)
 					g_deviceResources->SetStereo(peerData->isStereo);
 					if (!peerData->isStereo)
 					{
-						// FPS limiter.
-						const int interval = 1000 / nvEncConfig->capture_fps;
-						ULONGLONG timeElapsed = GetTickCount64() - peerData->tick;
-						if (timeElapsed >= interval)
+						// FPS limiter, down to the keep-alive rate while
+						// the peer is idle.
+						IdlePolicy::FrameAction action = peer->idle_policy()->GetFrameAction(
+							rtc::TimeMicros(), configWatcher.Snapshot()->nvenc_config->capture_fps);
+						ReportIdleState(peer, peerData.get(), monoRenderTimer);
+						if (action == IdlePolicy::FrameAction::kRender)
 						{
-							peerData->tick = GetTickCount64() - timeElapsed + interval;
 							g_cubeRenderer->SetPosition(float3({ 0.f, 0.f, 0.f }));
 							g_cubeRenderer->UpdateView(
 								peerData->eyeVector,
 								peerData->lookAtVector,
 								peerData->upVector);
 
-							g_cubeRenderer->Render(peerData->renderTargetView.Get());
-							peer->SendFrame(peerData->renderTexture.Get());
+							monoRenderTimer.Begin(g_deviceResources->GetD3DDeviceContext());
+							g_cubeRenderer->Render(
+								peerData->renderTarget->render_target_view.Get(),
+								peerData->renderTarget->depth_stencil_view.Get());
+
+							monoRenderTimer.End(g_deviceResources->GetD3DDeviceContext());
+							peer->SendFrameWithDepth(
+								peerData->renderTarget->texture.Get(),
+								peerData->renderTarget->depth_stencil_texture.Get());
+						}
+						else if (action == IdlePolicy::FrameAction::kRepeat)
+						{
+							peer->SendFrameWithDepth(
+								peerData->renderTarget->texture.Get(),
+								peerData->renderTarget->depth_stencil_texture.Get());
 						}
 					}
 					// In stereo rendering mode, we only update frame whenever
@@ -493,20 +654,54 @@ bool AppMain(BOOL stopping)
 					{
 						g_cubeRenderer->SetPosition(float3({ 0.f, 0.f, FOCUS_POINT }));
 
+						// Late latches the latest poses, extrapolated to the
+						// display time if the client supports it.
+						DirectX::XMFLOAT4X4 viewMatrixLeft = peerData->viewMatrixLeft;
+						DirectX::XMFLOAT4X4 viewMatrixRight = peerData->viewMatrixRight;
+						int64_t timestamp = peerData->lastTimestamp;
+						StereoPose pose;
+						if (peerData->isPosePredictionEnabled &&
+							peerData->posePredictor.Predict(rtc::TimeMicros(), &pose))
+						{
+							memcpy(viewMatrixLeft.m, pose.view_left, sizeof(pose.view_left));
+							memcpy(viewMatrixRight.m, pose.view_right, sizeof(pose.view_right));
+							timestamp = pose.timestamp;
+						}
+
 						DirectX::XMFLOAT4X4 leftMatrix;
 						XMStoreFloat4x4(
 							&leftMatrix,
-							XMLoadFloat4x4(&peerData->projectionMatrixLeft) * XMLoadFloat4x4(&peerData->viewMatrixLeft));
+							XMLoadFloat4x4(&peerData->projectionMatrixLeft) * XMLoadFloat4x4(&viewMatrixLeft));
 
 						DirectX::XMFLOAT4X4 rightMatrix;
 						XMStoreFloat4x4(
 							&rightMatrix,
-							XMLoadFloat4x4(&peerData->projectionMatrixRight) * XMLoadFloat4x4(&peerData->viewMatrixRight));
+							XMLoadFloat4x4(&peerData->projectionMatrixRight) * XMLoadFloat4x4(&viewMatrixRight));
 
 						g_cubeRenderer->UpdateView(leftMatrix, rightMatrix);
-						g_cubeRenderer->Render(peerData->renderTargetView.Get());
-						peer->SendFrame(peerData->renderTexture.Get(), peerData->lastTimestamp);
+						stereoRenderTimer.Begin(g_deviceResources->GetD3DDeviceContext());
+						g_cubeRenderer->Render(
+							peerData->renderTarget->render_target_view.Get(),
+							peerData->renderTarget->depth_stencil_view.Get());
+
+						stereoRenderTimer.End(g_deviceResources->GetD3DDeviceContext());
+						peer->SendFrameWithDepth(
+							peerData->renderTarget->texture.Get(),
+							peerData->renderTarget->depth_stencil_texture.Get(),
+							timestamp);
 						peerData->isNew = false;
+
+						// Reports the GPU time of rendering and copying the
+						// side by side frames.
+						if (++stereoFrameCount % GPU_STATS_INTERVAL == 0)
+						{
+							GpuTimerStats renderStats = stereoRenderTimer.GetStats();
+							GpuTimerStats copyStats = peer->GetCopyGpuStats();
+							LOG(LS_INFO) << "Stereo GPU time (us), " <<
+								(g_cubeRenderer->IsSinglePassStereo() ? "single pass" : "two passes") <<
+								": render avg " << renderStats.average_us << ", max " << renderStats.max_us <<
+								", copy avg " << copyStats.average_us << ", max " << copyStats.max_us;
+						}
 					}
 				}
 			}
@@ -514,6 +709,8 @@ bool AppMain(BOOL stopping)
 	}
 
 	// Cleanup.
+	g_remotePeersData.clear();
+	g_renderTargetPool.reset();
 	rtc::CleanupSSL();
 	delete g_cubeRenderer;
 	delete g_deviceResources;
@@ -678,6 +875,10 @@ int WINAPI wWinMain(
 	// Initializes the cube renderer.
 	g_cubeRenderer = new CubeRenderer(g_deviceResources);
 
+	// Measures the GPU time of the stereo frames.
+	GpuTimer stereoRenderTimer(g_deviceResources->GetD3DDevice());
+	int stereoFrameCount = 0;
+
 	RECT rc;
 	GetClientRect(g_hWnd, &rc);
 	UINT width = rc.right - rc.left;
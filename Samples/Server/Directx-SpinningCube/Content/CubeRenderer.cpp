@@ -71,10 +71,14 @@ static const unsigned short cubeIndicesRH[] =
 CubeRenderer::CubeRenderer(DeviceResources* deviceResources) :
 	m_degreesPerSecond(45),
 	m_indexCount(0),
+	m_singlePassStereo(true),
+	m_stereoVertexShader(nullptr),
+	m_stereoConstantBuffer(nullptr),
 	m_deviceResources(deviceResources)
 {
 	InitGraphics();
 	InitPipeline();
+	InitStereoPipeline();
 }
 
 void CubeRenderer::InitGraphics()
@@ -192,6 +196,56 @@ void CubeRenderer::InitPipeline()
 		&m_projectionConstantBuffer);
 }
 
+void CubeRenderer::InitStereoPipeline()
+{
+	// Writing the viewport index from the vertex shader is an optional feature.
+	D3D11_FEATURE_DATA_D3D11_OPTIONS3 options = { 0 };
+	if (FAILED(m_deviceResources->GetD3DDevice()->CheckFeatureSupport(
+		D3D11_FEATURE_D3D11_OPTIONS3, &options, sizeof(options))) ||
+		!options.VPAndRTArrayIndexFromAnyShaderFeedingRasterizer)
+	{
+		return;
+	}
+
+	// Creates the single pass stereo vertex shader.
+	FILE* vertexShaderFile = nullptr;
+#ifndef TEST_RUNNER
+	errno_t error = fopen_s(
+		&vertexShaderFile,
+		ConfigParser::GetAbsolutePath("VertexShaderStereo.cso").c_str(),
+		"rb");
+#else // TEST_RUNNER
+	errno_t error = fopen_s(&vertexShaderFile, "VertexShaderStereo.cso", "rb");
+#endif // TEST_RUNNER
+	if (error != 0)
+	{
+		return;
+	}
+
+	fseek(vertexShaderFile, 0, SEEK_END);
+	int vertexShaderFileSize = ftell(vertexShaderFile);
+	char* vertexShaderFileData = new char[vertexShaderFileSize];
+	fseek(vertexShaderFile, 0, SEEK_SET);
+	fread(vertexShaderFileData, 1, vertexShaderFileSize, vertexShaderFile);
+	fclose(vertexShaderFile);
+	m_deviceResources->GetD3DDevice()->CreateVertexShader(
+		vertexShaderFileData,
+		vertexShaderFileSize,
+		nullptr,
+		&m_stereoVertexShader);
+
+	delete []vertexShaderFileData;
+
+	// Creates the stereo constant buffer.
+	CD3D11_BUFFER_DESC stereoConstantBufferDesc(
+		sizeof(StereoConstantBuffer), D3D11_BIND_CONSTANT_BUFFER);
+
+	m_deviceResources->GetD3DDevice()->CreateBuffer(
+		&stereoConstantBufferDesc,
+		nullptr,
+		&m_stereoConstantBuffer);
+}
+
 void CubeRenderer::InternalUpdate()
 {
 	if (m_deviceResources->IsStereo())
@@ -327,7 +381,7 @@ void CubeRenderer::UpdateView(const XMVECTORF32& eye, const XMVECTORF32& at, con
 	InternalUpdate();
 }
 
-void CubeRenderer::Render(ID3D11RenderTargetView* renderTargetView)
+void CubeRenderer::Render(ID3D11RenderTargetView* renderTargetView, ID3D11DepthStencilView* depthStencilView)
 {
 	// Gets the device context.
 	auto context = m_deviceResources->GetD3DDeviceContext();
@@ -340,10 +394,14 @@ void CubeRenderer::Render(ID3D11RenderTargetView* renderTargetView)
 
 	// Sets the render target.
 	ID3D11RenderTargetView* const targets[1] = { renderTargetView };
-	context->OMSetRenderTargets(1, targets, nullptr);
+	context->OMSetRenderTargets(1, targets, depthStencilView);
 
 	// Clear the back buffer.
 	context->ClearRenderTargetView(renderTargetView, Colors::Black);
+	if (depthStencilView)
+	{
+		context->ClearDepthStencilView(depthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
+	}
 
 	// Sets the vertex buffer and index buffer.
 	UINT stride = sizeof(VertexPositionColor);
@@ -366,8 +424,25 @@ void CubeRenderer::Render(ID3D11RenderTargetView* renderTargetView)
 	// Gets the viewport.
 	D3D11_VIEWPORT* viewports = m_deviceResources->GetScreenViewport();
 
-	if (m_deviceResources->IsStereo())
+	if (m_deviceResources->IsStereo() && IsSinglePassStereo())
 	{
+		// Updates view projection matrices for both eyes.
+		StereoConstantBuffer stereoConstantBufferData;
+		stereoConstantBufferData.viewProjection[0] = m_projectionConstantBufferData[0].projection;
+		stereoConstantBufferData.viewProjection[1] = m_projectionConstantBufferData[1].projection;
+		context->UpdateSubresource1(
+			m_stereoConstantBuffer, 0, NULL, &stereoConstantBufferData, 0, 0, 0);
+
+		// Renders the cube for both eyes, one instance per viewport.
+		context->VSSetShader(m_stereoVertexShader, nullptr, 0);
+		context->VSSetConstantBuffers(3, 1, &m_stereoConstantBuffer);
+		context->RSSetViewports(2, viewports);
+		context->DrawIndexedInstanced(m_indexCount, 2, 0, 0, 0);
+	}
+	else if (m_deviceResources->IsStereo())
+	{
+		context->VSSetShader(m_vertexShader, nullptr, 0);
+
 		// Updates view projection matrix for left eye.
 		context->UpdateSubresource1(
 			m_projectionConstantBuffer, 0, NULL, &m_projectionConstantBufferData[0], 0, 0, 0);
@@ -387,6 +462,7 @@ void CubeRenderer::Render(ID3D11RenderTargetView* renderTargetView)
 	else
 	{
 		// Renders the cube.
+		context->VSSetShader(m_vertexShader, nullptr, 0);
 		context->RSSetViewports(1, viewports);
 		context->DrawIndexed(m_indexCount, 0, 0);
 	}
@@ -27,6 +27,13 @@ namespace StreamingToolkitSample
 		DirectX::XMFLOAT4X4 projection;
 	};
 
+	// Constant buffer used to send the view projection matrices of both eyes
+	// to the single pass stereo vertex shader.
+	struct StereoConstantBuffer
+	{
+		DirectX::XMFLOAT4X4 viewProjection[2];
+	};
+
 	// Used to send per-vertex data to the vertex shader.
 	struct VertexPositionColor
 	{
@@ -41,7 +48,12 @@ namespace StreamingToolkitSample
 
 		void									UpdateView(const DirectX::XMFLOAT4X4& viewProjectionLeft, const DirectX::XMFLOAT4X4& viewProjectionRight);
 		void									UpdateView(const DirectX::XMVECTORF32& eye, const DirectX::XMVECTORF32& lookAt, const DirectX::XMVECTORF32& up);
-		void									Render(ID3D11RenderTargetView* renderTargetView = nullptr);
+		void									Render(ID3D11RenderTargetView* renderTargetView = nullptr, ID3D11DepthStencilView* depthStencilView = nullptr);
+
+		// Renders both eyes in a single instanced draw call when the device
+		// can route the instances to the viewports from the vertex shader.
+		void									SetSinglePassStereo(bool enabled) { m_singlePassStereo = enabled; }
+		bool									IsSinglePassStereo() const { return m_singlePassStereo && m_stereoVertexShader; }
 
 		// Property accessors.
 		void									SetPosition(Windows::Foundation::Numerics::float3 pos) { m_position = pos; }
@@ -53,6 +65,7 @@ namespace StreamingToolkitSample
 	private:
 		void									InitGraphics();
 		void									InitPipeline();
+		void									InitStereoPipeline();
 		void									InternalUpdate();
 
 		// Cached pointer to device resources.
@@ -67,12 +80,15 @@ namespace StreamingToolkitSample
 		ID3D11VertexShader*						m_vertexShader;
 		ID3D11PixelShader*						m_pixelShader;
 		ID3D11InputLayout*						m_inputLayout;
+		ID3D11VertexShader*						m_stereoVertexShader;
+		ID3D11Buffer*							m_stereoConstantBuffer;
 
 		// System resources for cube geometry.
 		ModelConstantBuffer						m_modelConstantBufferData;
 		ViewConstantBuffer						m_viewConstantBufferData;
 		ProjectionConstantBuffer				m_projectionConstantBufferData[2];
 		uint32_t								m_indexCount;
+		bool									m_singlePassStereo;
 
 		// Variables used with the rendering loop.
 		float									m_degreesPerSecond;
@@ -0,0 +1,47 @@
+// A constant buffer that stores the model matrix.
+cbuffer ModelConstantBuffer : register(b0)
+{
+	matrix model;
+};
+
+// A constant buffer that stores the view projection matrices of both eyes.
+cbuffer StereoConstantBuffer : register(b3)
+{
+	matrix viewProjection[2];
+};
+
+// Per-vertex data used as input to the vertex shader.
+struct VertexShaderInput
+{
+	float3 pos : POSITION;
+	float3 color : COLOR0;
+	uint instanceId : SV_InstanceID;
+};
+
+// Per-pixel color data passed through the pixel shader.
+struct PixelShaderInput
+{
+	float4 pos : SV_POSITION;
+	float3 color : COLOR0;
+	uint viewportId : SV_ViewportArrayIndex;
+};
+
+// Renders both eyes in a single instanced draw, each instance being routed
+// to the viewport of its eye.
+PixelShaderInput main(VertexShaderInput input)
+{
+	PixelShaderInput output;
+	float4 pos = float4(input.pos, 1.0f);
+
+	// Transform the vertex position into projected space.
+	int eye = input.instanceId % 2;
+	pos = mul(pos, model);
+	pos = mul(pos, viewProjection[eye]);
+	output.pos = pos;
+
+	// Pass the color through without modification.
+	output.color = input.color;
+	output.viewportId = eye;
+
+	return output;
+}
@@ -1,21 +1,41 @@
 #include "pch.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <comdef.h>
 #include <comutil.h>
+#include <functional>
 #include <gtest\gtest.h>
 #include <map>
 #include <thread>
 #include <Wbemidl.h>
 #include <wchar.h>
 
+#include "argb_frame_converter.h"
 #include "client_main_window.h"
 #include "CppUnitTest.h"
+#include "depth_codec.h"
 #include "DeviceResources.h"
 #include "directx_buffer_capturer.h"
 #include "directx_multi_peer_conductor.h"
+#include "encoder_session_manager.h"
+#include "FrameHistory.h"
+#include "frame_source.h"
+#include "frame_stamp.h"
+#include "glass_to_glass_loopback.h"
+#include "i420_texture_renderer.h"
+#include "idle_policy.h"
+#include "latency_tracer.h"
+#include "mapped_frame_generator.h"
 #include "opengl_buffer_capturer.h"
+#include "peer_factory_topology.h"
+#include "pose_predictor.h"
+#include "render_target_pool.h"
+#include "replay_buffer_capturer.h"
+#include "roi_qp_map.h"
 #include "server_main_window.h"
+#include "triple_buffer.h"
 #include "third_party\libyuv\include\libyuv.h"
 #include "third_party\nvpipe\nvpipe.h"
 #include "webrtc.h"
@@ -461,6 +481,2229 @@ TEST(BufferCapturerTests, CaptureFrameStereoUsingDirectXBufferCapturer)
 	}
 }
 
+// Tests out capturing a stereo frame rendered into a texture array, with one
+// slice per eye, using DirectXBufferCapturer.
+TEST(BufferCapturerTests, CaptureFrameFromTextureArrayUsingDirectXBufferCapturer)
+{
+	// Init DirectX device resources.
+	std::shared_ptr<DeviceResources> deviceResources(new DeviceResources());
+
+	// Init texture array desc.
+	D3D11_TEXTURE2D_DESC texDesc = { 0 };
+	texDesc.ArraySize = 2;
+	texDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	texDesc.Width = 1280;
+	texDesc.Height = 720;
+	texDesc.MipLevels = 1;
+	texDesc.SampleDesc.Count = 1;
+	texDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	texDesc.Usage = D3D11_USAGE_STAGING;
+
+	// Init texture array.
+	ComPtr<ID3D11Texture2D> texture = { 0 };
+	deviceResources->GetD3DDevice()->CreateTexture2D(
+		&texDesc, nullptr, &texture);
+
+	// Fills the left eye slice with white color and the right eye slice with
+	// 0xEEEEEE color.
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	const uint8_t colors[] = { 0xFF, 0xEE };
+	for (UINT slice = 0; slice < 2; slice++)
+	{
+		UINT subresource = D3D11CalcSubresource(0, slice, texDesc.MipLevels);
+		if (SUCCEEDED(deviceResources->GetD3DDeviceContext()->Map(
+			texture.Get(), subresource, D3D11_MAP_WRITE, 0, &mapped)))
+		{
+			memset(mapped.pData, colors[slice], mapped.RowPitch * texDesc.Height);
+			deviceResources->GetD3DDeviceContext()->Unmap(texture.Get(), subresource);
+		}
+	}
+
+	// Init capturer.
+	std::shared_ptr<DirectXBufferCapturer> capturer(
+		new DirectXBufferCapturer(deviceResources->GetD3DDevice()));
+
+	// Forces switching to running state to test sending frame.
+	capturer->running_ = true;
+	capturer->SendFrame(texture.Get());
+
+	// Verifies staging buffer, the slices are side by side.
+	ASSERT_TRUE(capturer->staging_frame_buffer_.Get() != nullptr);
+	ASSERT_TRUE(capturer->staging_frame_buffer_desc_.Width == 1280 * 2);
+	ASSERT_TRUE(capturer->staging_frame_buffer_desc_.Height == 720);
+	if (SUCCEEDED(deviceResources->GetD3DDeviceContext()->Map(
+		capturer->staging_frame_buffer_.Get(), 0, D3D11_MAP_READ, 0, &mapped)))
+	{
+		uint8_t* lastRow = (uint8_t*)mapped.pData + mapped.RowPitch * 719;
+		ASSERT_TRUE(*(uint8_t*)mapped.pData == 0xFF);
+		ASSERT_TRUE(*((uint8_t*)mapped.pData + 1280 * 4 - 1) == 0xFF);
+		ASSERT_TRUE(*((uint8_t*)mapped.pData + 1280 * 4) == 0xEE);
+		ASSERT_TRUE(*(lastRow + 1280 * 8 - 1) == 0xEE);
+		deviceResources->GetD3DDeviceContext()->Unmap(
+			capturer->staging_frame_buffer_.Get(), 0);
+	}
+}
+
+// Measures the GPU time of the stereo capture copies, from two textures,
+// from a texture array and from a side by side texture.
+TEST(BufferCapturerTests, MeasuresStereoCopyGpuTime)
+{
+	std::shared_ptr<DeviceResources> deviceResources(new DeviceResources());
+	auto device = deviceResources->GetD3DDevice();
+
+	D3D11_TEXTURE2D_DESC texDesc = { 0 };
+	texDesc.ArraySize = 1;
+	texDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	texDesc.Width = 1280;
+	texDesc.Height = 720;
+	texDesc.MipLevels = 1;
+	texDesc.SampleDesc.Count = 1;
+	texDesc.Usage = D3D11_USAGE_DEFAULT;
+	texDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
+
+	ComPtr<ID3D11Texture2D> leftTexture;
+	ComPtr<ID3D11Texture2D> rightTexture;
+	ASSERT_TRUE(SUCCEEDED(device->CreateTexture2D(&texDesc, nullptr, &leftTexture)));
+	ASSERT_TRUE(SUCCEEDED(device->CreateTexture2D(&texDesc, nullptr, &rightTexture)));
+
+	texDesc.ArraySize = 2;
+	ComPtr<ID3D11Texture2D> arrayTexture;
+	ASSERT_TRUE(SUCCEEDED(device->CreateTexture2D(&texDesc, nullptr, &arrayTexture)));
+
+	texDesc.ArraySize = 1;
+	texDesc.Width = 1280 * 2;
+	ComPtr<ID3D11Texture2D> sideBySideTexture;
+	ASSERT_TRUE(SUCCEEDED(device->CreateTexture2D(&texDesc, nullptr, &sideBySideTexture)));
+
+	const char* names[] = { "two textures", "texture array", "side by side" };
+	for (int path = 0; path < 3; path++)
+	{
+		std::shared_ptr<DirectXBufferCapturer> capturer(new DirectXBufferCapturer(device));
+		capturer->running_ = true;
+		for (int i = 0; i < 60; i++)
+		{
+			switch (path)
+			{
+				case 0:
+					capturer->SendFrame(leftTexture.Get(), rightTexture.Get());
+					break;
+
+				case 1:
+					capturer->SendFrame(arrayTexture.Get());
+					break;
+
+				default:
+					capturer->SendFrame(sideBySideTexture.Get());
+					break;
+			}
+		}
+
+		// Every frame maps the staging buffer, so the queries have completed.
+		GpuTimerStats stats = capturer->GetCopyGpuStats();
+		ASSERT_GT(stats.count, (size_t)0);
+		ASSERT_LE(stats.average_us, stats.max_us);
+
+		std::string msg = "[ GPU TIME ] Stereo copy from " + std::string(names[path]) +
+			" (us): avg " + std::to_string(stats.average_us) + ", max " +
+			std::to_string(stats.max_us) + "\n";
+
+		std::cout << msg.c_str();
+	}
+}
+
+// Tests out capturing a frame with its depth band using DirectXBufferCapturer.
+TEST(BufferCapturerTests, CaptureFrameWithDepthUsingDirectXBufferCapturer)
+{
+	std::shared_ptr<DeviceResources> deviceResources(new DeviceResources());
+	auto device = deviceResources->GetD3DDevice();
+	auto context = deviceResources->GetD3DDeviceContext();
+
+	D3D11_TEXTURE2D_DESC texDesc = { 0 };
+	texDesc.ArraySize = 1;
+	texDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	texDesc.Width = 256;
+	texDesc.Height = 256;
+	texDesc.MipLevels = 1;
+	texDesc.SampleDesc.Count = 1;
+	texDesc.Usage = D3D11_USAGE_DEFAULT;
+	texDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
+	ComPtr<ID3D11Texture2D> texture;
+	ASSERT_TRUE(SUCCEEDED(device->CreateTexture2D(&texDesc, nullptr, &texture)));
+
+	// Clears the depth to the middle of the range.
+	texDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+	texDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+	ComPtr<ID3D11Texture2D> depthTexture;
+	ComPtr<ID3D11DepthStencilView> depthView;
+	ASSERT_TRUE(SUCCEEDED(device->CreateTexture2D(&texDesc, nullptr, &depthTexture)));
+	ASSERT_TRUE(SUCCEEDED(device->CreateDepthStencilView(depthTexture.Get(), nullptr, &depthView)));
+	context->ClearDepthStencilView(depthView.Get(), D3D11_CLEAR_DEPTH, 0.5f, 0);
+
+	std::shared_ptr<DirectXBufferCapturer> capturer(new DirectXBufferCapturer(device));
+	capturer->running_ = true;
+	capturer->SetDepthEnabled(true);
+	capturer->SendFrameWithDepth(texture.Get(), depthTexture.Get());
+
+	// The band is drawn below the color.
+	ASSERT_EQ((UINT)(256 + DepthCodec::GetBandHeight(256)), capturer->staging_frame_buffer_desc_.Height);
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	ASSERT_TRUE(SUCCEEDED(context->Map(capturer->staging_frame_buffer_.Get(), 0, D3D11_MAP_READ, 0, &mapped)));
+	const uint8_t* band = (const uint8_t*)mapped.pData + 256 * mapped.RowPitch;
+	uint8_t levels[3];
+	for (int i = 0; i < 3; i++)
+	{
+		levels[i] = band[i * 64 * 4];
+	}
+
+	context->Unmap(capturer->staging_frame_buffer_.Get(), 0);
+	ASSERT_NEAR(DepthCodec::Quantize(0.5f), DepthCodec::DecodeSample(levels), 16);
+
+	// Without depth streaming, only the color is sent.
+	capturer->SetDepthEnabled(false);
+	capturer->SendFrameWithDepth(texture.Get(), depthTexture.Get());
+	ASSERT_EQ((UINT)256, capturer->staging_frame_buffer_desc_.Height);
+}
+
+// Tests out capturing frames on a capture device of its own, through textures
+// shared with the renderer's device, and measures the lock hold times.
+TEST(BufferCapturerTests, CaptureFrameThroughSharedTexturesUsingDirectXBufferCapturer)
+{
+	class FrameCountingSink : public rtc::VideoSinkInterface<VideoFrame>
+	{
+	public:
+		void OnFrame(const VideoFrame& frame) override
+		{
+			rtc::CritScope cs(&lock);
+			prediction_timestamps.push_back(frame.prediction_timestamp());
+		}
+
+		int64_t last_timestamp()
+		{
+			rtc::CritScope cs(&lock);
+			return prediction_timestamps.empty() ? -1 : prediction_timestamps.back();
+		}
+
+		rtc::CriticalSection lock;
+		std::vector<int64_t> prediction_timestamps;
+	};
+
+	const int kFrameCount = 60;
+
+	std::shared_ptr<DeviceResources> deviceResources(new DeviceResources());
+	auto device = deviceResources->GetD3DDevice();
+
+	D3D11_TEXTURE2D_DESC texDesc = { 0 };
+	texDesc.ArraySize = 1;
+	texDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	texDesc.Width = 1280;
+	texDesc.Height = 720;
+	texDesc.MipLevels = 1;
+	texDesc.SampleDesc.Count = 1;
+	texDesc.Usage = D3D11_USAGE_DEFAULT;
+	texDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
+	ComPtr<ID3D11Texture2D> texture;
+	ComPtr<ID3D11RenderTargetView> renderTargetView;
+	ASSERT_TRUE(SUCCEEDED(device->CreateTexture2D(&texDesc, nullptr, &texture)));
+	ASSERT_TRUE(SUCCEEDED(device->CreateRenderTargetView(texture.Get(), nullptr, &renderTargetView)));
+	const float white[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	deviceResources->GetD3DDeviceContext()->ClearRenderTargetView(renderTargetView.Get(), white);
+
+	std::shared_ptr<DirectXBufferCapturer> capturer(new DirectXBufferCapturer(device, true));
+	ASSERT_TRUE(capturer->use_shared_textures());
+	ASSERT_TRUE(capturer->d3d_device_.Get() != device);
+
+	FrameCountingSink sink;
+	capturer->AddOrUpdateSink(&sink, rtc::VideoSinkWants());
+	capturer->Start(cricket::VideoFormat(1280, 720,
+		cricket::VideoFormat::FpsToInterval(60), cricket::FOURCC_I420));
+
+	for (int i = 0; i < kFrameCount; i++)
+	{
+		capturer->SendFrame(texture.Get(), i);
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+
+	// The latest frame is always captured.
+	for (int i = 0; i < 100 && sink.last_timestamp() != kFrameCount - 1; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	capturer->Stop();
+	capturer->RemoveSink(&sink);
+
+	// Frames may be dropped, but never reordered.
+	ASSERT_EQ(kFrameCount - 1, sink.last_timestamp());
+	for (size_t i = 1; i < sink.prediction_timestamps.size(); i++)
+	{
+		ASSERT_LT(sink.prediction_timestamps[i - 1], sink.prediction_timestamps[i]);
+	}
+
+	// Verifies that the frame was copied across devices.
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	ASSERT_TRUE(SUCCEEDED(capturer->d3d_context_->Map(
+		capturer->staging_frame_buffer_.Get(), 0, D3D11_MAP_READ, 0, &mapped)));
+
+	ASSERT_EQ(0xFF, *(uint8_t*)mapped.pData);
+	capturer->d3d_context_->Unmap(capturer->staging_frame_buffer_.Get(), 0);
+
+	SharedTextureStats stats = capturer->GetSharedTextureStats();
+	ASSERT_EQ((uint64_t)kFrameCount, stats.published);
+	ASSERT_EQ(stats.published, sink.prediction_timestamps.size() + stats.dropped);
+	ASSERT_GT(stats.producer_hold.count, (size_t)0);
+	ASSERT_GT(stats.consumer_hold.count, (size_t)0);
+
+	std::string msg = "[LOCK HOLD ] Renderer (us): avg " + std::to_string(stats.producer_hold.average_us) +
+		", max " + std::to_string(stats.producer_hold.max_us) + "\n" +
+		"[LOCK HOLD ] Capture (us): avg " + std::to_string(stats.consumer_hold.average_us) +
+		", max " + std::to_string(stats.consumer_hold.max_us) + "\n" +
+		"[LOCK HOLD ] Dropped frames: " + std::to_string(stats.dropped) + " of " +
+		std::to_string(kFrameCount) + "\n";
+
+	std::cout << msg.c_str();
+}
+
+// Tests out recording frames and replaying them using ReplayBufferCapturer.
+TEST(BufferCapturerTests, ReplayFramesUsingReplayBufferCapturer)
+{
+	class FrameCountingSink : public rtc::VideoSinkInterface<VideoFrame>
+	{
+	public:
+		void OnFrame(const VideoFrame& frame) override
+		{
+			rtc::CritScope cs(&lock);
+			prediction_timestamps.push_back(frame.prediction_timestamp());
+		}
+
+		rtc::CriticalSection lock;
+		std::vector<int64_t> prediction_timestamps;
+	};
+
+	const int kWidth = 320;
+	const int kHeight = 240;
+	const int kFrameCount = 5;
+	const std::string kRecordingPath = "replay_test.3dsr";
+
+	// Records frames from the square generator.
+	auto frameGen = test::FrameGenerator::CreateSquareGenerator(kWidth, kHeight);
+	VideoFrame firstFrame = *frameGen->NextFrame();
+	{
+		FrameRecorder recorder;
+		ASSERT_TRUE(recorder.Open(kRecordingPath, FrameRecordingFormat::kI420, kWidth, kHeight, 60));
+		for (int i = 0; i < kFrameCount; i++)
+		{
+			VideoFrame frame = i == 0 ? firstFrame : *frameGen->NextFrame();
+			frame.set_prediction_timestamp(1000 + i);
+			ASSERT_TRUE(recorder.RecordFrame(frame));
+		}
+
+		ASSERT_EQ((size_t)kFrameCount, recorder.frame_count());
+	}
+
+	// Verifies the recording.
+	std::shared_ptr<FrameRecordingReader> reader(new FrameRecordingReader());
+	ASSERT_TRUE(reader->Open(kRecordingPath));
+	ASSERT_EQ(kWidth, reader->width());
+	ASSERT_EQ(kHeight, reader->height());
+	ASSERT_EQ((size_t)kFrameCount, reader->frame_count());
+	ASSERT_EQ(1000, reader->frame(0).prediction_timestamp);
+	auto firstBuffer = firstFrame.video_frame_buffer()->ToI420();
+	ASSERT_EQ(0, memcmp(reader->frame(0).data, firstBuffer->DataY(), kWidth));
+
+	// Replays the recording once at a high frame rate.
+	FrameCountingSink sink;
+	std::shared_ptr<ReplayBufferCapturer> capturer(new ReplayBufferCapturer(reader, 200, false));
+	capturer->AddOrUpdateSink(&sink, rtc::VideoSinkWants());
+	capturer->Start(cricket::VideoFormat(kWidth, kHeight,
+		cricket::VideoFormat::FpsToInterval(200), cricket::FOURCC_I420));
+
+	for (int i = 0; i < 100 && capturer->replaying_; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	capturer->Stop();
+	capturer->RemoveSink(&sink);
+
+	// Verifies that all frames were sent with their original timestamps.
+	ASSERT_EQ((size_t)kFrameCount, sink.prediction_timestamps.size());
+	for (int i = 0; i < kFrameCount; i++)
+	{
+		ASSERT_EQ(1000 + i, sink.prediction_timestamps[i]);
+	}
+
+	// Fails to replay a reader without frames.
+	std::shared_ptr<ReplayBufferCapturer> emptyCapturer(
+		new ReplayBufferCapturer(std::make_shared<FrameRecordingReader>(), 200, false));
+
+	ASSERT_EQ(cricket::CS_FAILED, emptyCapturer->Start(cricket::VideoFormat(kWidth, kHeight,
+		cricket::VideoFormat::FpsToInterval(200), cricket::FOURCC_I420)));
+
+	ASSERT_FALSE(emptyCapturer->replaying_);
+
+	capturer.reset();
+	reader.reset();
+	remove(kRecordingPath.c_str());
+}
+
+// --------------------------------------------------------------
+// Frame generator tests
+// --------------------------------------------------------------
+
+// Tests out reading frames from a memory mapped file.
+TEST(FrameGeneratorTests, MappedFileFramesMatchYuvFileFrames)
+{
+	char currentPath[FILENAME_MAX];
+	ASSERT_TRUE(GetCurrentDir(currentPath, sizeof(currentPath)) != nullptr);
+	std::string path = std::string(currentPath) + "\\paris_qcif.yuv";
+
+	auto yuvGenerator = test::FrameGenerator::CreateFromYuvFile({ path }, 176, 144, 1);
+	auto mappedGenerator = test::CreateFromMappedFile(
+		path, test::MappedFrameFormat::kI420, 176, 144);
+
+	ASSERT_TRUE(mappedGenerator != nullptr);
+	for (int i = 0; i < 10; i++)
+	{
+		VideoFrame* yuvFrame = yuvGenerator->NextFrame();
+		VideoFrame* mappedFrame = mappedGenerator->NextFrame();
+		ASSERT_TRUE(mappedFrame != nullptr);
+		ASSERT_TRUE(test::FramesEqual(*yuvFrame, *mappedFrame));
+	}
+}
+
+// Tests out stopping at the end of a memory mapped file without looping.
+TEST(FrameGeneratorTests, MappedFileStopsAtEndWithoutLooping)
+{
+	const int kWidth = 64;
+	const int kHeight = 32;
+	const int kFrameCount = 3;
+	const std::string kPath = "mapped_frames.nv12";
+
+	// Writes frames filled with their index.
+	size_t frameSize = test::MappedFrameSize(test::MappedFrameFormat::kNV12, kWidth, kHeight);
+	std::vector<uint8_t> frame(frameSize);
+	FILE* file = fopen(kPath.c_str(), "wb");
+	ASSERT_TRUE(file != nullptr);
+	for (int i = 0; i < kFrameCount; i++)
+	{
+		memset(frame.data(), i + 1, frameSize);
+		fwrite(frame.data(), 1, frameSize, file);
+	}
+
+	fclose(file);
+
+	{
+		auto generator = test::CreateFromMappedFile(
+			kPath, test::MappedFrameFormat::kNV12, kWidth, kHeight, 1, false);
+
+		ASSERT_TRUE(generator != nullptr);
+		for (int i = 0; i < kFrameCount; i++)
+		{
+			VideoFrame* videoFrame = generator->NextFrame();
+			ASSERT_TRUE(videoFrame != nullptr);
+			ASSERT_EQ(VideoFrameBuffer::Type::kNative, videoFrame->video_frame_buffer()->type());
+			ASSERT_EQ(i + 1, videoFrame->video_frame_buffer()->ToI420()->DataY()[0]);
+		}
+
+		ASSERT_TRUE(generator->NextFrame() == nullptr);
+	}
+
+	remove(kPath.c_str());
+}
+
+// --------------------------------------------------------------
+// Latency tracer tests
+// --------------------------------------------------------------
+
+// Tests out computing the rolling stage percentiles of each peer.
+TEST(LatencyTracerTests, ComputesStagePercentilesPerPeer)
+{
+	LatencyTracer& tracer = LatencyTracer::Instance();
+	tracer.SetEnabled(true);
+	tracer.Clear();
+
+	int64_t now_us = rtc::TimeMicros();
+	for (int i = 1; i <= 100; i++)
+	{
+		tracer.Record(1, TraceStage::kColorConvert, i, now_us, now_us + i);
+	}
+
+	tracer.Record(2, TraceStage::kMap, 1, now_us, now_us + 500);
+
+	auto stats = tracer.GetStageStats(1);
+	ASSERT_EQ((size_t)1, stats.size());
+	ASSERT_EQ(TraceStage::kColorConvert, stats[0].stage);
+	ASSERT_EQ((size_t)100, stats[0].count);
+	ASSERT_EQ(50, stats[0].p50_us);
+	ASSERT_EQ(95, stats[0].p95_us);
+	ASSERT_EQ(99, stats[0].p99_us);
+
+	stats = tracer.GetStageStats(2);
+	ASSERT_EQ((size_t)1, stats.size());
+	ASSERT_EQ(TraceStage::kMap, stats[0].stage);
+	ASSERT_EQ(500, stats[0].p99_us);
+
+	auto peer_ids = tracer.GetPeerIds();
+	ASSERT_EQ((size_t)2, peer_ids.size());
+
+	// Events outside of the window are ignored.
+	tracer.Record(2, TraceStage::kMap, 2, now_us - 60000000, now_us - 59999000);
+	ASSERT_EQ((size_t)1, tracer.GetStageStats(2)[0].count);
+
+	tracer.Clear();
+	ASSERT_TRUE(tracer.GetStageStats(1).empty());
+	tracer.SetEnabled(false);
+}
+
+// Tests out that each thread keeps its latest events and that they are
+// exported as Chrome trace events.
+TEST(LatencyTracerTests, ExportsLatestEventsOfEachThread)
+{
+	LatencyTracer& tracer = LatencyTracer::Instance();
+	tracer.SetEnabled(true);
+	tracer.Clear();
+
+	auto record = [&tracer](TraceStage stage, size_t count)
+	{
+		int64_t now_us = rtc::TimeMicros();
+		for (size_t i = 0; i < count; i++)
+		{
+			tracer.Record(7, stage, i, now_us, now_us + 10);
+		}
+	};
+
+	// Wraps around the ring of the first thread.
+	std::thread first_thread(record, TraceStage::kStagingCopy, LatencyTracer::kEventsPerThread + 10);
+	std::thread second_thread(record, TraceStage::kEncoderSubmit, 3);
+	first_thread.join();
+	second_thread.join();
+
+	{
+		ScopedTraceEvent trace(7, TraceStage::kRenderSubmit, 42);
+	}
+
+	auto stats = tracer.GetStageStats(7);
+	ASSERT_EQ((size_t)3, stats.size());
+	ASSERT_EQ(TraceStage::kRenderSubmit, stats[0].stage);
+	ASSERT_EQ((size_t)1, stats[0].count);
+	ASSERT_EQ(TraceStage::kStagingCopy, stats[1].stage);
+	ASSERT_EQ(LatencyTracer::kEventsPerThread, stats[1].count);
+	ASSERT_EQ(TraceStage::kEncoderSubmit, stats[2].stage);
+	ASSERT_EQ((size_t)3, stats[2].count);
+
+	Json::Reader reader;
+	Json::Value trace;
+	ASSERT_TRUE(reader.parse(tracer.ExportChromeTrace(), trace));
+
+	// One process name metadata event for the peer.
+	const Json::Value& events = trace["traceEvents"];
+	ASSERT_EQ(LatencyTracer::kEventsPerThread + 3 + 1, (size_t)events.size());
+	ASSERT_EQ("process_name", events[0u]["name"].asString());
+	ASSERT_EQ(7, events[0u]["pid"].asInt());
+
+	bool found_render_submit = false;
+	for (const auto& event : events)
+	{
+		if (event["name"].asString() == "render_submit")
+		{
+			found_render_submit = true;
+			ASSERT_EQ("X", event["ph"].asString());
+			ASSERT_EQ(42, event["args"]["frame"].asInt());
+		}
+	}
+
+	ASSERT_TRUE(found_render_submit);
+
+	tracer.Clear();
+	tracer.SetEnabled(false);
+}
+
+// Tests out that nothing is recorded while the tracer is disabled.
+TEST(LatencyTracerTests, IgnoresEventsWhenDisabled)
+{
+	LatencyTracer& tracer = LatencyTracer::Instance();
+	tracer.SetEnabled(false);
+	tracer.Clear();
+
+	{
+		ScopedTraceEvent trace(3, TraceStage::kRtpSend, 1);
+	}
+
+	int64_t now_us = rtc::TimeMicros();
+	tracer.Record(3, TraceStage::kRtpSend, 2, now_us, now_us + 1);
+	ASSERT_TRUE(tracer.GetStageStats(3).empty());
+}
+
+// --------------------------------------------------------------
+// Glass to glass tests
+// --------------------------------------------------------------
+
+// Tests out reading a stamp drawn into a RGBA frame after I420 conversion.
+TEST(GlassToGlassTests, ReadsStampAfterI420Conversion)
+{
+	const int kWidth = 320;
+	const int kHeight = 240;
+	std::vector<uint8_t> rgba(kWidth * kHeight * 4, 100);
+	FrameStamp stamp = { FrameStampCodec::Now(), 1234 };
+	ASSERT_TRUE(FrameStampCodec::WriteRGBA(stamp, rgba.data(), kWidth * 4, kWidth, kHeight));
+
+	rtc::scoped_refptr<I420Buffer> buffer = I420Buffer::Create(kWidth, kHeight);
+	libyuv::ABGRToI420(rgba.data(), kWidth * 4,
+		buffer->MutableDataY(), buffer->StrideY(),
+		buffer->MutableDataU(), buffer->StrideU(),
+		buffer->MutableDataV(), buffer->StrideV(),
+		kWidth, kHeight);
+
+	FrameStamp decoded;
+	ASSERT_TRUE(FrameStampCodec::ReadI420(buffer->DataY(), buffer->StrideY(), kWidth, kHeight, &decoded));
+	ASSERT_EQ(stamp.timestamp_us, decoded.timestamp_us);
+	ASSERT_EQ(stamp.frame_counter, decoded.frame_counter);
+
+	// Flipping a block of the timestamp fails the CRC.
+	uint8_t* block = buffer->MutableDataY() +
+		FrameStampCodec::kBlockSize * buffer->StrideY() + FrameStampCodec::kBlockSize * 8;
+
+	uint8_t flipped = block[0] >= 128 ? 16 : 235;
+	for (int y = 0; y < FrameStampCodec::kBlockSize; y++)
+	{
+		memset(block + y * buffer->StrideY(), flipped, FrameStampCodec::kBlockSize);
+	}
+
+	ASSERT_FALSE(FrameStampCodec::ReadI420(buffer->DataY(), buffer->StrideY(), kWidth, kHeight, &decoded));
+
+	// Frames without a stamp or too small for one are rejected.
+	I420Buffer::SetBlack(buffer);
+	ASSERT_FALSE(FrameStampCodec::ReadI420(buffer->DataY(), buffer->StrideY(), kWidth, kHeight, &decoded));
+	ASSERT_FALSE(FrameStampCodec::WriteRGBA(stamp, rgba.data(), 128 * 4, 128, 16));
+}
+
+// Tests out the latency distribution and the report messages.
+TEST(GlassToGlassTests, ReportsLatencyDistribution)
+{
+	GlassToGlassStats stats(1000000);
+	int64_t now_us = 10000000;
+	for (uint32_t i = 1; i <= 100; i++)
+	{
+		// Skips frames 50 and 51.
+		uint32_t counter = i < 50 ? i : i + 2;
+		FrameStamp stamp = { now_us - i * 1000, counter };
+		stats.AddFrame(stamp, now_us);
+	}
+
+	stats.AddUnstampedFrame();
+	ASSERT_FALSE(stats.IsReportDue(now_us + 999999));
+	ASSERT_TRUE(stats.IsReportDue(now_us + 1000000));
+
+	GlassToGlassReport report = stats.TakeReport(now_us + 1000000);
+	ASSERT_EQ(100u, report.frames);
+	ASSERT_EQ(2u, report.dropped);
+	ASSERT_EQ(1u, report.unstamped);
+	ASSERT_EQ(1000, report.min_us);
+	ASSERT_EQ(50000, report.p50_us);
+	ASSERT_EQ(95000, report.p95_us);
+	ASSERT_EQ(99000, report.p99_us);
+	ASSERT_EQ(100000, report.max_us);
+
+	// The message body parses back into the same report.
+	Json::Reader reader;
+	Json::Value message;
+	ASSERT_TRUE(reader.parse(GlassToGlassStats::ToMessage(report), message));
+	ASSERT_EQ(GlassToGlassStats::kReportMessageType, message["type"].asString());
+
+	GlassToGlassReport parsed;
+	ASSERT_TRUE(GlassToGlassStats::ParseReport(message["body"].asString(), &parsed));
+	ASSERT_EQ(report.frames, parsed.frames);
+	ASSERT_EQ(report.dropped, parsed.dropped);
+	ASSERT_EQ(report.p99_us, parsed.p99_us);
+	ASSERT_EQ(report.max_us, parsed.max_us);
+	ASSERT_FALSE(GlassToGlassStats::ParseReport("1,2,3", &parsed));
+
+	// A new interval starts empty.
+	report = stats.TakeReport(now_us + 2000000);
+	ASSERT_EQ(0u, report.frames);
+	ASSERT_EQ(0u, report.dropped);
+}
+
+// Tests out measuring the glass to glass latency between a server and a
+// client running in the same process.
+TEST(GlassToGlassTests, LoopbackReportsLatency)
+{
+	GlassToGlassLoopback loopback(640, 480, 30);
+	ASSERT_TRUE(loopback.Run(5000));
+	ASSERT_GT(loopback.decoded_frames(), 0);
+
+	auto reports = loopback.reports();
+	ASSERT_FALSE(reports.empty());
+
+	uint32_t stamped_frames = 0;
+	for (const auto& report : reports)
+	{
+		stamped_frames += report.frames;
+		if (report.frames > 0)
+		{
+			ASSERT_GE(report.min_us, 0);
+			ASSERT_LE(report.p50_us, report.p99_us);
+			ASSERT_LE(report.p99_us, report.max_us);
+		}
+	}
+
+	ASSERT_GT(stamped_frames, 0u);
+}
+
+// --------------------------------------------------------------
+// Client renderer tests
+// --------------------------------------------------------------
+
+namespace
+{
+	int64_t GetThreadCpuTimeUs()
+	{
+		FILETIME creation_time, exit_time, kernel_time, user_time;
+		GetThreadTimes(GetCurrentThread(), &creation_time, &exit_time, &kernel_time, &user_time);
+		ULARGE_INTEGER kernel = { kernel_time.dwLowDateTime, kernel_time.dwHighDateTime };
+		ULARGE_INTEGER user = { user_time.dwLowDateTime, user_time.dwHighDateTime };
+		return (kernel.QuadPart + user.QuadPart) / 10;
+	}
+
+	ComPtr<ID3D11Texture2D> CreateRenderTarget(ID3D11Device* device, int width, int height, UINT bind_flags)
+	{
+		D3D11_TEXTURE2D_DESC desc = { 0 };
+		desc.Width = width;
+		desc.Height = height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = bind_flags ? D3D11_USAGE_DEFAULT : D3D11_USAGE_STAGING;
+		desc.BindFlags = bind_flags;
+		desc.CPUAccessFlags = bind_flags ? 0 : D3D11_CPU_ACCESS_READ;
+
+		ComPtr<ID3D11Texture2D> texture;
+		device->CreateTexture2D(&desc, nullptr, &texture);
+		return texture;
+	}
+}
+
+// Tests out rendering the same colors on the GPU and on the CPU.
+TEST(ClientRendererTests, GpuConversionMatchesCpuConversion)
+{
+	const int kWidth = 64;
+	const int kHeight = 32;
+	std::shared_ptr<DeviceResources> deviceResources(new DeviceResources());
+	ID3D11Device* device = deviceResources->GetD3DDevice();
+	ID3D11DeviceContext* context = deviceResources->GetD3DDeviceContext();
+
+	rtc::scoped_refptr<I420Buffer> buffer = I420Buffer::Create(kWidth, kHeight);
+	memset(buffer->MutableDataY(), 81, buffer->StrideY() * kHeight);
+	memset(buffer->MutableDataU(), 90, buffer->StrideU() * buffer->ChromaHeight());
+	memset(buffer->MutableDataV(), 240, buffer->StrideV() * buffer->ChromaHeight());
+
+	ArgbFrameConverter converter;
+	converter.Convert(*buffer, kVideoRotation_0);
+	ASSERT_EQ(kWidth, converter.width());
+	ASSERT_EQ(kHeight, converter.height());
+
+	I420TextureRenderer renderer;
+	ASSERT_TRUE(renderer.Initialize(device));
+	ASSERT_TRUE(renderer.UpdateFrame(context, *buffer));
+
+	ComPtr<ID3D11Texture2D> target = CreateRenderTarget(device, kWidth, kHeight, D3D11_BIND_RENDER_TARGET);
+	ComPtr<ID3D11Texture2D> staging = CreateRenderTarget(device, kWidth, kHeight, 0);
+	ComPtr<ID3D11RenderTargetView> target_view;
+	ASSERT_TRUE(SUCCEEDED(device->CreateRenderTargetView(target.Get(), nullptr, &target_view)));
+
+	D3D11_VIEWPORT viewport = { 0.0f, 0.0f, (FLOAT)kWidth, (FLOAT)kHeight, 0.0f, 1.0f };
+	renderer.Render(context, target_view.Get(), viewport, kVideoRotation_0, false);
+	context->CopyResource(staging.Get(), target.Get());
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	ASSERT_TRUE(SUCCEEDED(context->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mapped)));
+	const uint8_t* gpu_pixel = static_cast<const uint8_t*>(mapped.pData) +
+		(kHeight / 2) * mapped.RowPitch + (kWidth / 2) * 4;
+
+	const uint8_t* cpu_pixel = converter.data() + (kHeight / 2) * converter.stride() + (kWidth / 2) * 4;
+	for (int i = 0; i < 3; i++)
+	{
+		ASSERT_NEAR(cpu_pixel[i], gpu_pixel[i], 2);
+	}
+
+	context->Unmap(staging.Get(), 0);
+
+	// Rotated frames are transposed.
+	converter.Convert(*buffer, kVideoRotation_90);
+	ASSERT_EQ(kHeight, converter.width());
+	ASSERT_EQ(kWidth, converter.height());
+}
+
+// Measures the client CPU time spent per frame by the GPU and the CPU
+// conversion paths, for 1080p mono and side by side stereo frames.
+TEST(ClientRendererTests, MeasuresCpuTimePerFrame)
+{
+	const int kFrameCount = 120;
+	const int kFrameSizes[][2] = { { 1920, 1080 }, { 3840, 1080 } };
+	std::shared_ptr<DeviceResources> deviceResources(new DeviceResources());
+	ID3D11Device* device = deviceResources->GetD3DDevice();
+	ID3D11DeviceContext* context = deviceResources->GetD3DDeviceContext();
+
+	for (const auto& frame_size : kFrameSizes)
+	{
+		int width = frame_size[0];
+		int height = frame_size[1];
+		rtc::scoped_refptr<I420Buffer> buffer = I420Buffer::Create(width, height);
+		I420Buffer::SetBlack(buffer);
+
+		ComPtr<ID3D11Texture2D> target = CreateRenderTarget(device, width, height, D3D11_BIND_RENDER_TARGET);
+		ComPtr<ID3D11RenderTargetView> target_view;
+		ASSERT_TRUE(SUCCEEDED(device->CreateRenderTargetView(target.Get(), nullptr, &target_view)));
+
+		I420TextureRenderer renderer;
+		ASSERT_TRUE(renderer.Initialize(device));
+		D3D11_VIEWPORT viewport = { 0.0f, 0.0f, (FLOAT)width, (FLOAT)height, 0.0f, 1.0f };
+		int64_t begin_us = GetThreadCpuTimeUs();
+		for (int i = 0; i < kFrameCount; i++)
+		{
+			ASSERT_TRUE(renderer.UpdateFrame(context, *buffer));
+			renderer.Render(context, target_view.Get(), viewport, kVideoRotation_0, false);
+			context->Flush();
+		}
+
+		int64_t gpu_path_us = (GetThreadCpuTimeUs() - begin_us) / kFrameCount;
+
+		ArgbFrameConverter converter;
+		begin_us = GetThreadCpuTimeUs();
+		for (int i = 0; i < kFrameCount; i++)
+		{
+			converter.Convert(*buffer, kVideoRotation_0);
+		}
+
+		int64_t cpu_path_us = (GetThreadCpuTimeUs() - begin_us) / kFrameCount;
+
+		std::string msg = "[ RENDERER ] " + std::to_string(width) + "x" + std::to_string(height) +
+			" gpu path: " + std::to_string(gpu_path_us) + " us/frame, cpu path: " +
+			std::to_string(cpu_path_us) + " us/frame\n";
+
+		std::cout << msg.c_str();
+	}
+}
+
+// --------------------------------------------------------------
+// Triple buffer tests
+// --------------------------------------------------------------
+
+namespace
+{
+	struct TestFrame
+	{
+		uint64_t sequence;
+		int64_t publish_time_ns;
+		uint64_t payload[64];
+	};
+}
+
+// Tests out exchanging frames between a producer and a consumer thread.
+// Frames are never torn and every published frame is either consumed
+// or counted as dropped.
+TEST(TripleBufferTests, ExchangesLatestFramesBetweenThreads)
+{
+	const uint64_t kFrameCount = 200000;
+	TripleBuffer<TestFrame> frames;
+	std::atomic<bool> done(false);
+
+	std::thread producer([&]()
+	{
+		for (uint64_t sequence = 1; sequence <= kFrameCount; sequence++)
+		{
+			TestFrame& frame = frames.back();
+			frame.sequence = sequence;
+			std::fill(std::begin(frame.payload), std::end(frame.payload), sequence);
+			frames.Publish();
+		}
+
+		done = true;
+	});
+
+	uint64_t last_sequence = 0;
+	bool torn = false;
+	bool out_of_order = false;
+	while (true)
+	{
+		// Reads the flag first, so that the last frame is taken once done.
+		bool finished = done;
+		if (!frames.Update())
+		{
+			if (finished)
+			{
+				break;
+			}
+
+			std::this_thread::yield();
+			continue;
+		}
+
+		const TestFrame& frame = frames.front();
+		torn |= std::any_of(std::begin(frame.payload), std::end(frame.payload),
+			[&frame](uint64_t value) { return value != frame.sequence; });
+
+		out_of_order |= frame.sequence <= last_sequence;
+		last_sequence = frame.sequence;
+	}
+
+	producer.join();
+	ASSERT_FALSE(torn);
+	ASSERT_FALSE(out_of_order);
+	ASSERT_EQ(kFrameCount, last_sequence);
+	ASSERT_EQ(kFrameCount, frames.published());
+	ASSERT_EQ(frames.published(), frames.consumed() + frames.dropped());
+	ASSERT_FALSE(frames.Update());
+}
+
+// Measures the latency between publishing a frame and the consumer taking it.
+TEST(TripleBufferTests, MeasuresPublishToConsumeLatency)
+{
+	const int kFrameCount = 10000;
+	TripleBuffer<TestFrame> frames;
+	std::vector<int64_t> latencies_ns;
+	latencies_ns.reserve(kFrameCount);
+
+	std::thread producer([&]()
+	{
+		for (int i = 1; i <= kFrameCount; i++)
+		{
+			TestFrame& frame = frames.back();
+			frame.sequence = i;
+			frame.publish_time_ns = rtc::TimeNanos();
+			frames.Publish();
+
+			// Roughly paces the frames so that most are consumed.
+			int64_t next_ns = frame.publish_time_ns + 20 * rtc::kNumNanosecsPerMicrosec;
+			while (rtc::TimeNanos() < next_ns)
+			{
+				std::this_thread::yield();
+			}
+		}
+	});
+
+	uint64_t last_sequence = 0;
+	while (last_sequence < kFrameCount)
+	{
+		if (frames.Update())
+		{
+			latencies_ns.push_back(rtc::TimeNanos() - frames.front().publish_time_ns);
+			last_sequence = frames.front().sequence;
+		}
+	}
+
+	producer.join();
+	ASSERT_FALSE(latencies_ns.empty());
+	ASSERT_EQ(frames.published(), frames.consumed() + frames.dropped());
+
+	std::sort(latencies_ns.begin(), latencies_ns.end());
+	std::string msg = "[ MAILBOX  ] consumed: " + std::to_string(frames.consumed()) +
+		", dropped: " + std::to_string(frames.dropped()) +
+		", p50: " + std::to_string(latencies_ns[latencies_ns.size() / 2]) +
+		" ns, p99: " + std::to_string(latencies_ns[latencies_ns.size() * 99 / 100]) + " ns\n";
+
+	std::cout << msg.c_str();
+}
+
+// --------------------------------------------------------------
+// Frame history tests
+// --------------------------------------------------------------
+
+// Tests out matching values by timestamp.
+TEST(FrameHistoryTests, TakesValuesByTimestamp)
+{
+	DirectXClientComponent::FrameHistory<int> history(8, 1000);
+	for (int i = 1; i <= 5; i++)
+	{
+		history.Add(i * 100, i, 0);
+	}
+
+	int value = 0;
+	ASSERT_TRUE(history.Take(300, 0, &value));
+	ASSERT_EQ(3, value);
+	ASSERT_TRUE(history.Take(100, 0, &value));
+	ASSERT_EQ(1, value);
+
+	// Values are only taken once.
+	ASSERT_FALSE(history.Take(300, 0, &value));
+
+	// Adding an existing timestamp replaces its value.
+	history.Add(500, 50, 0);
+	ASSERT_TRUE(history.Take(500, 0, &value));
+	ASSERT_EQ(50, value);
+
+	auto stats = history.GetStats();
+	ASSERT_EQ((size_t)2, stats.size);
+	ASSERT_EQ(3u, stats.matched);
+	ASSERT_EQ(1u, stats.unmatched);
+	ASSERT_EQ(0u, stats.late);
+	ASSERT_EQ(0u, stats.evicted);
+}
+
+// Tests out bounding the history by capacity and age.
+TEST(FrameHistoryTests, EvictsOldestAndStaleValues)
+{
+	DirectXClientComponent::FrameHistory<int> history(4, 1000);
+	for (int i = 1; i <= 6; i++)
+	{
+		history.Add(i * 100, i, i);
+	}
+
+	// The two oldest values were evicted to keep the capacity.
+	int value = 0;
+	ASSERT_FALSE(history.Take(100, 6, &value));
+	ASSERT_FALSE(history.Take(200, 6, &value));
+	ASSERT_TRUE(history.Take(300, 6, &value));
+	ASSERT_EQ(3, value);
+
+	auto stats = history.GetStats();
+	ASSERT_EQ((size_t)3, stats.size);
+	ASSERT_EQ(2u, stats.evicted);
+	ASSERT_EQ(2u, stats.late);
+
+	// Values older than the maximum age are evicted.
+	history.Add(700, 7, 1006);
+	ASSERT_FALSE(history.Take(400, 1006, &value));
+	ASSERT_TRUE(history.Take(600, 1006, &value));
+	ASSERT_EQ(6, value);
+
+	// Timestamps newer than any evicted value are unmatched rather than late.
+	ASSERT_FALSE(history.Take(800, 1006, &value));
+
+	stats = history.GetStats();
+	ASSERT_EQ((size_t)1, stats.size);
+	ASSERT_EQ(4u, stats.evicted);
+	ASSERT_EQ(3u, stats.late);
+	ASSERT_EQ(1u, stats.unmatched);
+	ASSERT_EQ(2u, stats.matched);
+}
+
+// Tests out keeping the history bounded over a long session where most
+// values are never taken.
+TEST(FrameHistoryTests, StaysBoundedOverLongSessions)
+{
+	const size_t kCapacity = 120;
+	DirectXClientComponent::FrameHistory<int64_t> history(kCapacity, 10000000);
+	int64_t value = 0;
+	for (int64_t i = 0; i < 100000; i++)
+	{
+		history.Add(i, i, i);
+		if (i % 3 == 0)
+		{
+			ASSERT_TRUE(history.Take(i, i, &value));
+		}
+
+		ASSERT_LE(history.GetStats().size, kCapacity);
+	}
+
+	auto stats = history.GetStats();
+	ASSERT_EQ(33334u, stats.matched);
+	ASSERT_EQ(100000u, stats.matched + stats.evicted + stats.size);
+}
+
+// Tests out matching extrapolated timestamps to the nearest value.
+TEST(FrameHistoryTests, TakesNearestValueWithinTolerance)
+{
+	DirectXClientComponent::FrameHistory<int> history(8, 1000);
+	for (int i = 1; i <= 3; i++)
+	{
+		history.Add(i * 100, i, 0);
+	}
+
+	int value = 0;
+	ASSERT_TRUE(history.TakeNearest(240, 50, 0, &value));
+	ASSERT_EQ(2, value);
+
+	// The nearest remaining value is out of the tolerance.
+	ASSERT_FALSE(history.TakeNearest(240, 50, 0, &value));
+	ASSERT_TRUE(history.TakeNearest(280, 50, 0, &value));
+	ASSERT_EQ(3, value);
+
+	// Values taken by nearest key can't be taken again by key.
+	ASSERT_FALSE(history.Take(200, 0, &value));
+
+	// An exact match is taken without counting a miss.
+	ASSERT_TRUE(history.TakeNearest(100, 0, 0, &value));
+	ASSERT_EQ(1, value);
+
+	auto stats = history.GetStats();
+	ASSERT_EQ((size_t)0, stats.size);
+	ASSERT_EQ(3u, stats.matched);
+	ASSERT_EQ(2u, stats.unmatched);
+}
+
+// --------------------------------------------------------------
+// Pose predictor tests
+// --------------------------------------------------------------
+
+// Start of the recorded pose traces, in client ticks.
+const int64_t kPoseTraceStart = 131500000000000000;
+
+// Client pose interval at 60 fps, in client ticks.
+const int64_t kPoseTraceInterval = 166667;
+
+// Stores a view matrix looking from the eye position, turned by the yaw angle
+// around the up axis.
+void StoreViewMatrix(double yaw, double eye_x, bool row_vectors, float m[4][4])
+{
+	double r[3][3] =
+	{
+		{ cos(yaw), 0, -sin(yaw) },
+		{ 0, 1, 0 },
+		{ sin(yaw), 0, cos(yaw) }
+	};
+
+	memset(m, 0, sizeof(float) * 16);
+	for (int i = 0; i < 3; i++)
+	{
+		double t = -r[i][0] * eye_x;
+		for (int j = 0; j < 3; j++)
+		{
+			(row_vectors ? m[j][i] : m[i][j]) = static_cast<float>(r[i][j]);
+		}
+
+		(row_vectors ? m[3][i] : m[i][3]) = static_cast<float>(t);
+	}
+
+	m[3][3] = 1;
+}
+
+// Returns the pose of a head moving sideways with the given yaw, the eyes
+// being 6 cm apart.
+StereoPose CreateTracePose(int64_t timestamp, double yaw, double position, bool row_vectors)
+{
+	StereoPose pose = {};
+	StoreViewMatrix(yaw, position - 0.03, row_vectors, pose.view_left);
+	StoreViewMatrix(yaw, position + 0.03, row_vectors, pose.view_right);
+	for (int i = 0; i < 4; i++)
+	{
+		pose.projection_left[i][i] = 1;
+		pose.projection_right[i][i] = 1;
+	}
+
+	pose.timestamp = timestamp;
+	return pose;
+}
+
+// Returns the pose of a head turning at 90 degrees per second while moving
+// at 0.5 meter per second.
+StereoPose CreateConstantVelocityPose(int64_t timestamp, bool row_vectors)
+{
+	double time = (timestamp - kPoseTraceStart) / 1e7;
+	return CreateTracePose(timestamp, 1.5707963 * time, 0.5 * time, row_vectors);
+}
+
+// Returns the pose of a head shaking by 30 degrees at 0.5 Hz.
+StereoPose CreateHeadShakePose(int64_t timestamp)
+{
+	double time = (timestamp - kPoseTraceStart) / 1e7;
+	return CreateTracePose(timestamp, 0.5235988 * sin(3.1415927 * time), 0, false);
+}
+
+float GetMaxDifference(const StereoPose& a, const StereoPose& b)
+{
+	float difference = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			difference = (std::max)(difference, std::abs(a.view_left[i][j] - b.view_left[i][j]));
+			difference = (std::max)(difference, std::abs(a.view_right[i][j] - b.view_right[i][j]));
+		}
+	}
+
+	return difference;
+}
+
+// Tests out extrapolating constant velocity traces, received with jitter, in
+// both matrix layouts.
+TEST(PosePredictorTests, ExtrapolatesConstantVelocityTraces)
+{
+	// Arrival jitter of the poses, in microseconds.
+	const int64_t kJitterUs[] = { 0, 7000, 1000, 12000, 3000, 0, 9000, 2000 };
+	for (int layout = 0; layout < 2; layout++)
+	{
+		bool row_vectors = layout == 1;
+		PosePredictor predictor;
+
+		// Learns a pipeline latency of 30 ms.
+		predictor.AddDisplayError(120000);
+		ASSERT_EQ(30000, predictor.latency_us());
+
+		for (int i = 0; i < 60; i++)
+		{
+			int64_t timestamp = kPoseTraceStart + i * kPoseTraceInterval;
+			int64_t receive_time_us = i * kPoseTraceInterval / PosePredictor::kTicksPerMicrosecond +
+				kJitterUs[i % 8];
+
+			StereoPose latest = CreateConstantVelocityPose(timestamp, row_vectors);
+			ASSERT_TRUE(predictor.AddSample(latest, receive_time_us));
+			if (i == 0)
+			{
+				continue;
+			}
+
+			// Renders 2 ms after receiving the pose.
+			StereoPose predicted;
+			ASSERT_TRUE(predictor.Predict(receive_time_us + 2000, &predicted));
+			ASSERT_EQ(timestamp + 32000 * PosePredictor::kTicksPerMicrosecond, predicted.timestamp);
+
+			StereoPose expected = CreateConstantVelocityPose(predicted.timestamp, row_vectors);
+			ASSERT_LT(GetMaxDifference(expected, predicted), 1e-3f);
+			ASSERT_GT(GetMaxDifference(expected, latest), 1e-2f);
+			ASSERT_EQ(0, memcmp(latest.projection_left, predicted.projection_left, sizeof(latest.projection_left)));
+		}
+
+		ASSERT_EQ((size_t)8, predictor.size());
+	}
+}
+
+// Tests out the prediction error over a head shake trace, compared to
+// rendering the latest pose.
+TEST(PosePredictorTests, ReducesErrorOfHeadShakeTrace)
+{
+	PosePredictor predictor;
+	predictor.AddDisplayError(120000);
+
+	float predicted_error = 0;
+	float latest_error = 0;
+	for (int i = 0; i < 240; i++)
+	{
+		int64_t timestamp = kPoseTraceStart + i * kPoseTraceInterval;
+		StereoPose latest = CreateHeadShakePose(timestamp);
+		int64_t receive_time_us = i * kPoseTraceInterval / PosePredictor::kTicksPerMicrosecond;
+		ASSERT_TRUE(predictor.AddSample(latest, receive_time_us));
+
+		StereoPose predicted;
+		ASSERT_TRUE(predictor.Predict(receive_time_us, &predicted));
+		StereoPose expected = CreateHeadShakePose(predicted.timestamp);
+		if (i > 0)
+		{
+			predicted_error = (std::max)(predicted_error, GetMaxDifference(expected, predicted));
+			latest_error = (std::max)(latest_error, GetMaxDifference(expected, latest));
+		}
+	}
+
+	std::string msg = "[ PREDICTOR] Max matrix error with 30 ms latency: predicted " +
+		std::to_string(predicted_error) + ", latest " + std::to_string(latest_error) + "\n";
+
+	std::cout << msg.c_str();
+	ASSERT_LT(predicted_error, latest_error / 4);
+}
+
+// Tests out bounding the learned latency and the prediction horizon.
+TEST(PosePredictorTests, BoundsLatencyAndHorizon)
+{
+	PosePredictor predictor(8, 50000);
+	for (int i = 0; i < 100; i++)
+	{
+		predictor.AddDisplayError(100000);
+	}
+
+	ASSERT_EQ(50000, predictor.latency_us());
+
+	predictor.AddSample(CreateConstantVelocityPose(kPoseTraceStart, false), 0);
+	predictor.AddSample(CreateConstantVelocityPose(kPoseTraceStart + kPoseTraceInterval, false), 16667);
+
+	// Poses waiting on the server are extrapolated up to the maximum horizon.
+	StereoPose predicted;
+	ASSERT_TRUE(predictor.Predict(1000000, &predicted));
+	ASSERT_EQ(kPoseTraceStart + kPoseTraceInterval + 50000 * PosePredictor::kTicksPerMicrosecond,
+		predicted.timestamp);
+
+	for (int i = 0; i < 100; i++)
+	{
+		predictor.AddDisplayError(-100000);
+	}
+
+	ASSERT_EQ(0, predictor.latency_us());
+	ASSERT_TRUE(predictor.Predict(16667, &predicted));
+	ASSERT_EQ(kPoseTraceStart + kPoseTraceInterval, predicted.timestamp);
+}
+
+// Tests out ignoring out of order poses and dropping the history after a gap.
+TEST(PosePredictorTests, DropsStaleAndOutOfOrderPoses)
+{
+	PosePredictor predictor;
+	StereoPose predicted;
+	ASSERT_FALSE(predictor.Predict(0, &predicted));
+
+	predictor.AddDisplayError(120000);
+	ASSERT_TRUE(predictor.AddSample(CreateConstantVelocityPose(kPoseTraceStart + kPoseTraceInterval, false), 0));
+	ASSERT_FALSE(predictor.AddSample(CreateConstantVelocityPose(kPoseTraceStart, false), 1000));
+	ASSERT_FALSE(predictor.AddSample(CreateConstantVelocityPose(kPoseTraceStart + kPoseTraceInterval, false), 1000));
+	ASSERT_TRUE(predictor.AddSample(CreateConstantVelocityPose(kPoseTraceStart + 2 * kPoseTraceInterval, false), 16667));
+	ASSERT_EQ((size_t)2, predictor.size());
+
+	// The velocities are unknown after a gap, the latest pose is used as is.
+	int64_t timestamp = kPoseTraceStart + 60 * kPoseTraceInterval;
+	StereoPose latest = CreateConstantVelocityPose(timestamp, false);
+	ASSERT_TRUE(predictor.AddSample(latest, 1000000));
+	ASSERT_EQ((size_t)1, predictor.size());
+	ASSERT_TRUE(predictor.Predict(1002000, &predicted));
+	ASSERT_EQ(timestamp, predicted.timestamp);
+	ASSERT_EQ(0.f, GetMaxDifference(latest, predicted));
+
+	predictor.Reset();
+	ASSERT_EQ((size_t)0, predictor.size());
+}
+
+// --------------------------------------------------------------
+// Foveated encoding tests
+// --------------------------------------------------------------
+
+// Returns the QP delta of the macroblock containing the given pixel.
+int8_t GetQpDeltaAt(const std::vector<int8_t>& map, int width, int x, int y)
+{
+	int width_in_mbs = (width + RoiQpMap::kMacroblockSize - 1) / RoiQpMap::kMacroblockSize;
+	return map[(y / RoiQpMap::kMacroblockSize) * width_in_mbs + x / RoiQpMap::kMacroblockSize];
+}
+
+// Tests out generating a stereo map centered on the view of each eye.
+TEST(RoiQpMapTests, GeneratesStereoMapAroundViewCenters)
+{
+	RoiQpMap roi_qp_map;
+	int8_t max_qp_delta = roi_qp_map.params().max_qp_delta;
+	auto map = roi_qp_map.Generate(2560, 720, true);
+	ASSERT_EQ((size_t)(160 * 45), map->size());
+	ASSERT_EQ(160 * 45, RoiQpMap::GetMacroblockCount(2560, 720));
+
+	// Full quality at the view centers, lowest quality in the corners.
+	ASSERT_EQ(0, GetQpDeltaAt(*map, 2560, 640, 360));
+	ASSERT_EQ(0, GetQpDeltaAt(*map, 2560, 1920, 360));
+	ASSERT_EQ(max_qp_delta, GetQpDeltaAt(*map, 2560, 0, 0));
+	ASSERT_EQ(max_qp_delta, GetQpDeltaAt(*map, 2560, 1279, 719));
+	ASSERT_EQ(max_qp_delta, GetQpDeltaAt(*map, 2560, 1280, 0));
+	ASSERT_EQ(max_qp_delta, GetQpDeltaAt(*map, 2560, 2559, 719));
+
+	// Both eyes get the same map, and the QP rises away from the center.
+	for (int x = 0; x < 1280; x += RoiQpMap::kMacroblockSize)
+	{
+		ASSERT_EQ(GetQpDeltaAt(*map, 2560, x, 360), GetQpDeltaAt(*map, 2560, x + 1280, 360));
+		if (x >= 640)
+		{
+			ASSERT_LE(GetQpDeltaAt(*map, 2560, x - RoiQpMap::kMacroblockSize, 360),
+				GetQpDeltaAt(*map, 2560, x, 360));
+		}
+	}
+
+	ASSERT_TRUE(std::all_of(map->begin(), map->end(), [&](int8_t delta)
+	{
+		return delta >= 0 && delta <= max_qp_delta;
+	}));
+}
+
+// Tests out moving the region of interest with the gaze, and reusing the
+// map while neither the gaze nor the layout change.
+TEST(RoiQpMapTests, FollowsGazeAndReusesUnchangedMaps)
+{
+	RoiQpMap roi_qp_map;
+	auto center_map = roi_qp_map.Generate(1280, 720, false);
+	ASSERT_EQ(center_map, roi_qp_map.Generate(1280, 720, false));
+
+	GazePoint left = { 0.25f, 0.5f };
+	GazePoint right = { 0.75f, 0.5f };
+	roi_qp_map.SetGaze(left, right);
+	auto gaze_map = roi_qp_map.Generate(1280, 720, false);
+	ASSERT_NE(center_map, gaze_map);
+	ASSERT_EQ(0, GetQpDeltaAt(*gaze_map, 1280, 320, 360));
+	ASSERT_LT(0, GetQpDeltaAt(*gaze_map, 1280, 640, 360));
+
+	// The right gaze point is only used in stereo.
+	auto stereo_map = roi_qp_map.Generate(2560, 720, true);
+	ASSERT_EQ(0, GetQpDeltaAt(*stereo_map, 2560, 320, 360));
+	ASSERT_EQ(0, GetQpDeltaAt(*stereo_map, 2560, 1280 + 960, 360));
+	ASSERT_LT(0, GetQpDeltaAt(*stereo_map, 2560, 1280 + 320, 360));
+
+	roi_qp_map.ResetGaze();
+	auto reset_map = roi_qp_map.Generate(1280, 720, false);
+	ASSERT_TRUE(std::equal(center_map->begin(), center_map->end(), reset_map->begin()));
+}
+
+// Tests out a region of interest covering the whole frame.
+TEST(RoiQpMapTests, KeepsFullQualityWithinRadius)
+{
+	RoiQpMapParams params = RoiQpMap::DefaultParams();
+	params.full_quality_radius = 2.0f;
+	params.falloff_radius = 2.0f;
+	RoiQpMap roi_qp_map(params);
+	auto map = roi_qp_map.Generate(1920, 1080, false);
+	ASSERT_EQ((size_t)(120 * 68), map->size());
+	ASSERT_TRUE(std::all_of(map->begin(), map->end(), [](int8_t delta) { return delta == 0; }));
+}
+
+// --------------------------------------------------------------
+// Depth streaming tests
+// --------------------------------------------------------------
+
+// Converts the RGBA depth band to luma as the capturer does before encoding,
+// adding the given error to each pixel.
+std::vector<uint8_t> ConvertDepthBandToLuma(const std::vector<uint8_t>& rgba,
+	int width, int height, const std::function<int(int, int)>& error)
+{
+	std::vector<uint8_t> data_y(width * height);
+	libyuv::ABGRToI420(rgba.data(), width * 4, data_y.data(), width,
+		std::vector<uint8_t>(width * height / 4).data(), width / 2,
+		std::vector<uint8_t>(width * height / 4).data(), width / 2,
+		width, height);
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			int luma = data_y[y * width + x] + error(x, y);
+			data_y[y * width + x] = static_cast<uint8_t>((std::min)((std::max)(luma, 0), 255));
+		}
+	}
+
+	return data_y;
+}
+
+// Streams every quantized depth value through the depth band of a frame and
+// returns the largest decoding error.
+int GetMaxDepthBandError(const std::function<int(int, int)>& error)
+{
+	// A 1024x1024 color frame holds 256x256 depth samples.
+	const int width = 1024;
+	const int height = 1024;
+	DepthFrame depth;
+	depth.width = 256;
+	depth.height = 256;
+	depth.data.resize(depth.width * depth.height);
+	for (size_t i = 0; i < depth.data.size(); i++)
+	{
+		depth.data[i] = static_cast<uint16_t>(i);
+	}
+
+	int band_height = DepthCodec::GetBandHeight(height);
+	std::vector<uint8_t> rgba(width * 4 * band_height);
+	EXPECT_TRUE(DepthCodec::WriteRGBA(depth, rgba.data(), width * 4, width, height));
+	std::vector<uint8_t> data_y = ConvertDepthBandToLuma(rgba, width, band_height, error);
+
+	DepthFrame decoded;
+	EXPECT_TRUE(DepthCodec::HasBand(data_y.data(), width, width, height));
+	EXPECT_TRUE(DepthCodec::ReadI420(data_y.data(), width, width, height, &decoded));
+	EXPECT_EQ(depth.width, decoded.width);
+	EXPECT_EQ(depth.height, decoded.height);
+	int max_error = 0;
+	for (size_t i = 0; i < depth.data.size(); i++)
+	{
+		max_error = (std::max)(max_error, abs(decoded.data[i] - depth.data[i]));
+	}
+
+	return max_error;
+}
+
+// Tests out the precision lost by quantizing and streaming the depth.
+TEST(DepthCodecTests, StreamsDepthWithBoundedPrecisionLoss)
+{
+	int max_error = GetMaxDepthBandError([](int, int) { return 0; });
+	ASSERT_LE(max_error, 16);
+
+	std::string msg = "[  DEPTH   ] Max error without encoding loss: " +
+		std::to_string(max_error) + " of 65535\n";
+
+	// Alternates errors of a few luma levels, as left by the encoder.
+	for (int amplitude = 1; amplitude <= 4; amplitude++)
+	{
+		max_error = GetMaxDepthBandError([=](int x, int y)
+		{
+			return ((x * 7 + y * 13) % (2 * amplitude + 1)) - amplitude;
+		});
+
+		ASSERT_LE(max_error, 20 * (amplitude + 1));
+		msg += "[  DEPTH   ] Max error with +/-" + std::to_string(amplitude) +
+			" luma levels: " + std::to_string(max_error) + " of 65535\n";
+	}
+
+	std::cout << msg.c_str();
+
+	// Quantization keeps the ends of the depth range.
+	ASSERT_EQ(0, DepthCodec::Quantize(-1.0f));
+	ASSERT_EQ(65535, DepthCodec::Quantize(1.0f));
+	ASSERT_NEAR(0.1f, DepthCodec::ToViewDepth(0, 0.1f, 100.0f), 1e-5f);
+	ASSERT_NEAR(100.0f, DepthCodec::ToViewDepth(65535, 0.1f, 100.0f), 1e-2f);
+}
+
+// Tests out keeping the nearest depth of each block when downscaling.
+TEST(DepthCodecTests, DownscalesToNearestDepth)
+{
+	// A 6x5 buffer gives 2x2 samples, the last ones covering partial blocks.
+	const int width = 6;
+	const int height = 5;
+	std::vector<uint32_t> d24s8(width * height, 0xFFFFFFFF);
+	d24s8[1 * width + 2] = 0xAB800000;
+	d24s8[4 * width + 5] = 0x00400000;
+	DepthFrame depth;
+	ASSERT_TRUE(DepthCodec::Downscale(reinterpret_cast<const uint8_t*>(d24s8.data()),
+		width * 4, DepthFormat::kD24S8, width, height, &depth));
+
+	ASSERT_EQ(2, depth.width);
+	ASSERT_EQ(2, depth.height);
+	ASSERT_EQ(DepthCodec::Quantize(0.5f), depth.data[0]);
+	ASSERT_EQ(65535, depth.data[1]);
+	ASSERT_EQ(65535, depth.data[2]);
+	ASSERT_EQ(DepthCodec::Quantize(0.25f), depth.data[3]);
+
+	std::vector<float> d32(width * height, 1.0f);
+	d32[4 * width + 1] = 0.75f;
+	ASSERT_TRUE(DepthCodec::Downscale(reinterpret_cast<const uint8_t*>(d32.data()),
+		width * 4, DepthFormat::kD32Float, width, height, &depth));
+
+	ASSERT_EQ(65535, depth.data[0]);
+	ASSERT_EQ(DepthCodec::Quantize(0.75f), depth.data[2]);
+}
+
+// Tests out the layout of the depth band below the color.
+TEST(DepthCodecTests, LaysOutDepthBandInMacroblocks)
+{
+	ASSERT_EQ(192, DepthCodec::GetBandHeight(720));
+	ASSERT_EQ(272, DepthCodec::GetBandHeight(1080));
+
+	int color_height = 0;
+	ASSERT_TRUE(DepthCodec::GetColorHeight(720 + 192, &color_height));
+	ASSERT_EQ(720, color_height);
+	ASSERT_TRUE(DepthCodec::GetColorHeight(1080 + 272, &color_height));
+	ASSERT_EQ(1080, color_height);
+	ASSERT_FALSE(DepthCodec::GetColorHeight(730, &color_height));
+
+	// The three tiles and the marker must fit in the width of the color.
+	DepthFrame depth = { 1, 1, std::vector<uint16_t>(1) };
+	std::vector<uint8_t> rgba(2 * 4 * 16);
+	ASSERT_FALSE(DepthCodec::WriteRGBA(depth, rgba.data(), 2 * 4, 2, 2));
+
+	// Frames sent before the band was enabled have no marker, even when
+	// their height matches the one of a frame with a band.
+	const int width = 64;
+	depth = { 16, 16, std::vector<uint16_t>(16 * 16) };
+	rgba.assign(width * 4 * DepthCodec::GetBandHeight(64), 255);
+	std::vector<uint8_t> data_y = ConvertDepthBandToLuma(rgba, width, 16, [](int, int) { return 0; });
+	ASSERT_FALSE(DepthCodec::HasBand(data_y.data(), width, width, 64));
+	std::fill(data_y.begin(), data_y.end(), (uint8_t)16);
+	ASSERT_FALSE(DepthCodec::HasBand(data_y.data(), width, width, 64));
+
+	ASSERT_TRUE(DepthCodec::WriteRGBA(depth, rgba.data(), width * 4, width, 64));
+	data_y = ConvertDepthBandToLuma(rgba, width, 16, [](int, int) { return 0; });
+	ASSERT_TRUE(DepthCodec::HasBand(data_y.data(), width, width, 64));
+}
+
+// --------------------------------------------------------------
+// Render target pool tests
+// --------------------------------------------------------------
+
+// Render target of the fake allocator, counting the live ones.
+struct FakeRenderTarget
+{
+	explicit FakeRenderTarget(const RenderTargetKey& key, int* live) :
+		bytes(static_cast<size_t>(key.stereo ? key.width * 2 : key.width) * key.height * 8),
+		live_(live)
+	{
+		(*live_)++;
+	}
+
+	~FakeRenderTarget()
+	{
+		(*live_)--;
+	}
+
+	size_t bytes;
+
+private:
+	int* live_;
+};
+
+RenderTargetKey MakeRenderTargetKey(int width, int height, bool stereo)
+{
+	RenderTargetKey key = { width, height, stereo, 28 };
+	return key;
+}
+
+std::unique_ptr<RenderTargetPool<FakeRenderTarget>> CreateFakeRenderTargetPool(
+	size_t high_water_mark, int* live)
+{
+	return std::unique_ptr<RenderTargetPool<FakeRenderTarget>>(new RenderTargetPool<FakeRenderTarget>(
+		[live](const RenderTargetKey& key)
+	{
+		return std::unique_ptr<FakeRenderTarget>(new FakeRenderTarget(key, live));
+	}, high_water_mark));
+}
+
+// Tests out reusing the render target of a disconnected peer only for a peer
+// with the same key.
+TEST(RenderTargetPoolTests, ReusesReleasedRenderTargetsOfSameKey)
+{
+	int live = 0;
+	auto pool = CreateFakeRenderTargetPool(4, &live);
+	RenderTargetKey mono = MakeRenderTargetKey(1280, 720, false);
+	RenderTargetKey stereo = MakeRenderTargetKey(1280, 720, true);
+
+	auto first = pool->Acquire(mono);
+	FakeRenderTarget* first_ptr = first.get();
+	pool->Release(mono, std::move(first));
+	auto second = pool->Acquire(stereo);
+	auto third = pool->Acquire(mono);
+	ASSERT_EQ(first_ptr, third.get());
+	ASSERT_NE(first_ptr, second.get());
+	ASSERT_EQ(2, live);
+
+	RenderTargetPoolStats stats = pool->GetStats();
+	ASSERT_EQ((size_t)2, stats.in_use);
+	ASSERT_EQ((size_t)0, stats.idle);
+	ASSERT_EQ((uint64_t)2, stats.allocations);
+	ASSERT_EQ((uint64_t)1, stats.reuses);
+	ASSERT_EQ(second->bytes + third->bytes, stats.resident_bytes);
+}
+
+// Tests out keeping the resident render targets under the high-water mark,
+// evicting the least recently released ones.
+TEST(RenderTargetPoolTests, EvictsLeastRecentlyReleasedAboveHighWaterMark)
+{
+	int live = 0;
+	auto pool = CreateFakeRenderTargetPool(2, &live);
+	RenderTargetKey keys[] =
+	{
+		MakeRenderTargetKey(640, 480, false),
+		MakeRenderTargetKey(1280, 720, false),
+		MakeRenderTargetKey(1280, 720, true)
+	};
+
+	// The render targets in use are never evicted.
+	std::unique_ptr<FakeRenderTarget> targets[3];
+	for (int i = 0; i < 3; i++)
+	{
+		targets[i] = pool->Acquire(keys[i]);
+	}
+
+	ASSERT_EQ(3, live);
+	ASSERT_EQ((size_t)3, pool->GetStats().peak_resident);
+
+	for (int i = 0; i < 3; i++)
+	{
+		pool->Release(keys[i], std::move(targets[i]));
+	}
+
+	RenderTargetPoolStats stats = pool->GetStats();
+	ASSERT_EQ(2, live);
+	ASSERT_EQ((size_t)2, stats.idle);
+	ASSERT_EQ((uint64_t)1, stats.evictions);
+	ASSERT_EQ((uint64_t)(1280 * 720 * 8 * 3), stats.resident_bytes);
+
+	// The first released was evicted, and a new key makes room for itself.
+	auto target = pool->Acquire(keys[0]);
+	stats = pool->GetStats();
+	ASSERT_EQ((uint64_t)4, stats.allocations);
+	ASSERT_EQ((uint64_t)0, stats.reuses);
+	ASSERT_EQ((uint64_t)2, stats.evictions);
+	ASSERT_EQ((size_t)1, stats.idle);
+	ASSERT_EQ(2, live);
+
+	// The most recently released is still idle.
+	auto reused = pool->Acquire(keys[2]);
+	ASSERT_TRUE(reused != nullptr);
+	ASSERT_EQ((uint64_t)1, pool->GetStats().reuses);
+}
+
+// Tests out the allocations made under connect and disconnect churn of peers
+// with random stereo modes.
+TEST(RenderTargetPoolTests, BoundsAllocationsUnderChurn)
+{
+	const int kPeers = 4;
+	const int kCycles = 10000;
+	int live = 0;
+	auto pool = CreateFakeRenderTargetPool(kPeers, &live);
+	RenderTargetKey keys[] =
+	{
+		MakeRenderTargetKey(1280, 720, false),
+		MakeRenderTargetKey(1280, 720, true)
+	};
+
+	std::unique_ptr<FakeRenderTarget> targets[kPeers];
+	bool stereo[kPeers] = {};
+	srand(0);
+	for (int i = 0; i < kCycles; i++)
+	{
+		int peer = rand() % kPeers;
+		if (targets[peer])
+		{
+			pool->Release(keys[stereo[peer]], std::move(targets[peer]));
+		}
+		else
+		{
+			stereo[peer] = rand() % 2 == 1;
+			targets[peer] = pool->Acquire(keys[stereo[peer]]);
+		}
+
+		ASSERT_LE(live, kPeers);
+	}
+
+	RenderTargetPoolStats stats = pool->GetStats();
+	std::string msg;
+	msg += "[RT POOL   ] Cycles: " + std::to_string(kCycles) +
+		", allocations: " + std::to_string(stats.allocations) +
+		", reuses: " + std::to_string(stats.reuses) +
+		", evictions: " + std::to_string(stats.evictions) +
+		", peak resident: " + std::to_string(stats.peak_resident) + "\n";
+
+	std::cout << msg.c_str();
+	ASSERT_EQ((size_t)live, stats.in_use + stats.idle);
+	ASSERT_LT(stats.allocations, stats.reuses);
+}
+
+// --------------------------------------------------------------
+// Idle policy tests
+// --------------------------------------------------------------
+
+// Counts the frames due every millisecond of the given time range.
+void CountDueFrames(IdlePolicy* policy, int64_t begin_us, int64_t end_us, int full_fps,
+	int* rendered, int* repeated)
+{
+	*rendered = 0;
+	*repeated = 0;
+	for (int64_t time_us = begin_us; time_us < end_us; time_us += 1000)
+	{
+		IdlePolicy::FrameAction action = policy->GetFrameAction(time_us, full_fps);
+		*rendered += action == IdlePolicy::FrameAction::kRender ? 1 : 0;
+		*repeated += action == IdlePolicy::FrameAction::kRepeat ? 1 : 0;
+	}
+}
+
+// Tests out dropping to the keep-alive rate once the client sent no input
+// for the idle timeout.
+TEST(IdlePolicyTests, DropsToKeepAliveRateAfterTimeout)
+{
+	IdlePolicyParams params = { 1000, 1 };
+	IdlePolicy policy(params);
+	int rendered;
+	int repeated;
+
+	// The stream starts active.
+	CountDueFrames(&policy, 0, 1000000, 60, &rendered, &repeated);
+	ASSERT_EQ(60, rendered);
+	ASSERT_EQ(0, repeated);
+	ASSERT_FALSE(policy.IsIdle());
+
+	// A keep-alive frame is due every second.
+	CountDueFrames(&policy, 1000000, 5000000, 60, &rendered, &repeated);
+	ASSERT_EQ(0, rendered);
+	ASSERT_EQ(3, repeated);
+	ASSERT_TRUE(policy.IsIdle());
+
+	IdlePolicyStats stats = policy.GetStats();
+	ASSERT_TRUE(stats.idle);
+	ASSERT_EQ((uint64_t)1, stats.idle_periods);
+	ASSERT_EQ((uint64_t)3, stats.keep_alive_frames);
+	ASSERT_EQ((uint64_t)(3 * 59), stats.skipped_frames);
+}
+
+// Tests out going back to the full rate on the next input, and staying at
+// it while inputs keep coming.
+TEST(IdlePolicyTests, ResumesFullRateOnInput)
+{
+	IdlePolicyParams params = { 1000, 1 };
+	IdlePolicy policy(params);
+	int rendered;
+	int repeated;
+	CountDueFrames(&policy, 0, 3000000, 30, &rendered, &repeated);
+	ASSERT_TRUE(policy.IsIdle());
+
+	// The input frame is rendered right away.
+	policy.OnInput(3000500);
+	ASSERT_FALSE(policy.IsIdle());
+	ASSERT_EQ(IdlePolicy::FrameAction::kRender, policy.GetFrameAction(3000500, 30));
+	ASSERT_EQ((int64_t)2000500, policy.GetStats().idle_time_us);
+
+	for (int64_t time_us = 3500000; time_us < 8000000; time_us += 500000)
+	{
+		policy.OnInput(time_us);
+		CountDueFrames(&policy, time_us, time_us + 500000, 30, &rendered, &repeated);
+		ASSERT_EQ(0, repeated);
+		ASSERT_GE(rendered, 14);
+	}
+
+	IdlePolicyStats stats = policy.GetStats();
+	ASSERT_FALSE(stats.idle);
+	ASSERT_EQ((uint64_t)1, stats.idle_periods);
+}
+
+// Tests out keeping the full rate when the idle timeout is disabled.
+TEST(IdlePolicyTests, NeverIdlesWithoutTimeout)
+{
+	IdlePolicyParams params = { 0, 1 };
+	IdlePolicy policy(params);
+	int rendered;
+	int repeated;
+	CountDueFrames(&policy, 0, 60000000, 10, &rendered, &repeated);
+	ASSERT_EQ(600, rendered);
+	ASSERT_EQ(0, repeated);
+	ASSERT_EQ((uint64_t)0, policy.GetStats().idle_periods);
+}
+
+// --------------------------------------------------------------
+// Peer pool tests
+// --------------------------------------------------------------
+
+// Waits for the given flag while processing the messages of the current
+// thread, returning the time waited in milliseconds or -1 on timeout.
+static int64_t WaitForFlag(const std::atomic<bool>& flag, int64_t start, int timeOutMs)
+{
+	while (!flag.load())
+	{
+		if ((int64_t)GetTickCount64() - start >= timeOutMs)
+		{
+			return -1;
+		}
+
+		rtc::Thread::Current()->ProcessMessages(1);
+	}
+
+	return (int64_t)GetTickCount64() - start;
+}
+
+// Tests out the time from connecting to a peer to sending it the offer,
+// with and without a pre-warmed peer connection.
+TEST(PeerPoolTests, PrewarmedPeerCutsConnectToOfferLatency)
+{
+	// Constants.
+	const int timeOutMs = 10000;
+	const int prewarmMs = 500;
+
+	rtc::EnsureWinsockInit();
+	rtc::Win32SocketServer w32_ss;
+	rtc::Win32Thread w32_thread(&w32_ss);
+	rtc::ThreadManager::Instance()->SetCurrentThread(&w32_thread);
+	rtc::InitializeSSL();
+
+	std::shared_ptr<DeviceResources> deviceResources(new DeviceResources());
+	scoped_refptr<PeerConnectionFactoryInterface> peerFactory = webrtc::CreatePeerConnectionFactory();
+	ASSERT_TRUE(peerFactory.get() != nullptr);
+
+	// Host candidates only, so that no server is needed.
+	auto webrtcConfig = make_shared<WebRTCConfig>();
+	std::atomic<bool> coldOfferSent(false);
+	std::atomic<bool> warmOfferSent(false);
+
+	// Cold peer, everything is created on connect.
+	scoped_refptr<PeerConductor> coldPeer = new RefCountedObject<DirectXPeerConductor>(1,
+		"cold", webrtcConfig, peerFactory,
+		[&](const string&) { coldOfferSent = true; },
+		deviceResources->GetD3DDevice());
+
+	int64_t tick = GetTickCount64();
+	coldPeer->AllocatePeerConnection(true);
+	int64_t coldMs = WaitForFlag(coldOfferSent, tick, timeOutMs);
+
+	// Warm peer, created and gathering ahead of the connection.
+	scoped_refptr<PeerConductor> warmPeer = new RefCountedObject<DirectXPeerConductor>(-1,
+		"", webrtcConfig, peerFactory,
+		[](const string&) {},
+		deviceResources->GetD3DDevice());
+
+	warmPeer->Prewarm();
+	rtc::Thread::Current()->ProcessMessages(prewarmMs);
+	warmPeer->Assign(2, "warm", [&](const string&) { warmOfferSent = true; });
+
+	tick = GetTickCount64();
+	warmPeer->AllocatePeerConnection(true);
+	int64_t warmMs = WaitForFlag(warmOfferSent, tick, timeOutMs);
+
+	std::string msg =
+		"Connect to offer, cold: " + std::to_string(coldMs) + "ms\n" +
+		"Connect to offer, warm: " + std::to_string(warmMs) + "ms\n";
+
+	std::cout << msg.c_str();
+
+	coldPeer = nullptr;
+	warmPeer = nullptr;
+	peerFactory = nullptr;
+	rtc::CleanupSSL();
+
+	ASSERT_NE(-1, coldMs);
+	ASSERT_NE(-1, warmMs);
+	ASSERT_LT(warmMs, coldMs);
+}
+
+// --------------------------------------------------------------
+// Encoder session tests
+// --------------------------------------------------------------
+
+// Encoder counting the open sessions and the encoded frames, each encoded
+// into a one byte image.
+class CountingVideoEncoder : public webrtc::VideoEncoder
+{
+public:
+	CountingVideoEncoder(std::atomic<int>* open_sessions, std::atomic<int>* encoded_frames) :
+		open_sessions_(open_sessions),
+		encoded_frames_(encoded_frames),
+		callback_(nullptr)
+	{
+	}
+
+	int32_t InitEncode(const VideoCodec* codec_settings, int32_t number_of_cores, size_t max_payload_size) override
+	{
+		(*open_sessions_)++;
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t RegisterEncodeCompleteCallback(EncodedImageCallback* callback) override
+	{
+		callback_ = callback;
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t Release() override
+	{
+		(*open_sessions_)--;
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t Encode(const VideoFrame& frame, const CodecSpecificInfo* codec_specific_info,
+		const std::vector<FrameType>* frame_types) override
+	{
+		(*encoded_frames_)++;
+		EncodedImage image(buffer_, sizeof(buffer_), sizeof(buffer_));
+		image._frameType = frame_types && !frame_types->empty() ? (*frame_types)[0] : kVideoFrameDelta;
+		callback_->OnEncodedImage(image, codec_specific_info, nullptr);
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t SetChannelParameters(uint32_t packet_loss, int64_t rtt) override
+	{
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+	int32_t SetRates(uint32_t bitrate, uint32_t framerate) override
+	{
+		return WEBRTC_VIDEO_CODEC_OK;
+	}
+
+private:
+	std::atomic<int>* open_sessions_;
+	std::atomic<int>* encoded_frames_;
+	EncodedImageCallback* callback_;
+	uint8_t buffer_[1];
+};
+
+// Counts the images sent to a peer.
+class CountingEncodedImageCallback : public EncodedImageCallback
+{
+public:
+	CountingEncodedImageCallback() : images(0), key_frames(0) {}
+
+	Result OnEncodedImage(const EncodedImage& encoded_image, const CodecSpecificInfo* codec_specific_info,
+		const RTPFragmentationHeader* fragmentation) override
+	{
+		images++;
+		key_frames += encoded_image._frameType == kVideoFrameKey ? 1 : 0;
+		return Result(Result::OK);
+	}
+
+	int images;
+	int key_frames;
+};
+
+// Tests out queueing the encoders beyond the max sessions, until one closes.
+TEST(EncoderSessionTests, QueuesEncodersBeyondMaxSessions)
+{
+	std::atomic<int> openSessions(0);
+	std::atomic<int> encodedFrames(0);
+	int usageChanges = 0;
+	auto manager = std::make_shared<EncoderSessionManager>([&]()
+	{
+		return std::unique_ptr<webrtc::VideoEncoder>(new CountingVideoEncoder(&openSessions, &encodedFrames));
+	}, 2, false);
+
+	manager->SetUsageCallback([&](const EncoderSessionStats&) { usageChanges++; });
+
+	VideoCodec codecSettings;
+	SetDefaultCodecSettings(&codecSettings);
+	VideoFrame frame(I420Buffer::Create(codecSettings.width, codecSettings.height), kVideoRotation_0, 0);
+	std::vector<std::unique_ptr<webrtc::VideoEncoder>> encoders;
+	CountingEncodedImageCallback callbacks[3];
+	for (int i = 0; i < 3; i++)
+	{
+		encoders.push_back(std::unique_ptr<webrtc::VideoEncoder>(manager->CreateEncoder()));
+		ASSERT_EQ(WEBRTC_VIDEO_CODEC_OK, encoders[i]->InitEncode(&codecSettings, kNumCores, kMaxPayloadSize));
+		encoders[i]->RegisterEncodeCompleteCallback(&callbacks[i]);
+	}
+
+	auto stats = manager->GetStats();
+	ASSERT_EQ((size_t)2, stats.sessions);
+	ASSERT_EQ((size_t)2, stats.encoders);
+	ASSERT_EQ((size_t)1, stats.queued);
+	ASSERT_EQ(2, openSessions.load());
+	ASSERT_EQ(3, usageChanges);
+
+	// The queued encoder drops its frames.
+	for (auto& encoder : encoders)
+	{
+		ASSERT_EQ(WEBRTC_VIDEO_CODEC_OK, encoder->Encode(frame, nullptr, nullptr));
+	}
+
+	ASSERT_EQ(1, callbacks[0].images);
+	ASSERT_EQ(1, callbacks[1].images);
+	ASSERT_EQ(0, callbacks[2].images);
+
+	// Closing a session lets the queued encoder take it on its next frame.
+	encoders[0]->Release();
+	ASSERT_EQ(1, openSessions.load());
+	ASSERT_EQ(WEBRTC_VIDEO_CODEC_OK, encoders[2]->Encode(frame, nullptr, nullptr));
+	ASSERT_EQ(1, callbacks[2].images);
+
+	stats = manager->GetStats();
+	ASSERT_EQ((size_t)2, stats.sessions);
+	ASSERT_EQ((size_t)2, stats.peak_sessions);
+	ASSERT_EQ((size_t)0, stats.queued);
+	ASSERT_EQ(2, openSessions.load());
+
+	encoders.clear();
+	ASSERT_EQ(0, openSessions.load());
+	ASSERT_EQ((size_t)0, manager->GetStats().sessions);
+}
+
+// Tests out sending the stream of a shared session to the encoders sent the
+// frames of the same source with identical parameters, the others needing a
+// session of their own.
+TEST(EncoderSessionTests, SharesSessionsOfIdenticalEncoders)
+{
+	std::atomic<int> openSessions(0);
+	std::atomic<int> encodedFrames(0);
+	auto manager = std::make_shared<EncoderSessionManager>([&]()
+	{
+		return std::unique_ptr<webrtc::VideoEncoder>(new CountingVideoEncoder(&openSessions, &encodedFrames));
+	}, 1, true);
+
+	VideoCodec codecSettings;
+	SetDefaultCodecSettings(&codecSettings);
+	VideoCodec otherCodecSettings = codecSettings;
+	otherCodecSettings.width = 640;
+	otherCodecSettings.height = 360;
+
+	// A copy of a source sends the same frames, e.g. another capturer of the
+	// same view.
+	FrameSource source;
+	FrameSource sameSource(source);
+	FrameSource otherSource;
+	VideoFrame frame(source.CreateI420Buffer(codecSettings.width, codecSettings.height), kVideoRotation_0, 0);
+	VideoFrame sameFrame(sameSource.CreateI420Buffer(codecSettings.width, codecSettings.height), kVideoRotation_0, 0);
+	VideoFrame otherFrame(otherSource.CreateI420Buffer(codecSettings.width, codecSettings.height), kVideoRotation_0, 0);
+	VideoFrame unknownFrame(I420Buffer::Create(codecSettings.width, codecSettings.height), kVideoRotation_0, 0);
+
+	std::unique_ptr<webrtc::VideoEncoder> first(manager->CreateEncoder());
+	std::unique_ptr<webrtc::VideoEncoder> second(manager->CreateEncoder());
+	std::unique_ptr<webrtc::VideoEncoder> resized(manager->CreateEncoder());
+	std::unique_ptr<webrtc::VideoEncoder> other(manager->CreateEncoder());
+	std::unique_ptr<webrtc::VideoEncoder> unknown(manager->CreateEncoder());
+	CountingEncodedImageCallback firstCallback;
+	CountingEncodedImageCallback secondCallback;
+	CountingEncodedImageCallback resizedCallback;
+	CountingEncodedImageCallback otherCallback;
+	CountingEncodedImageCallback unknownCallback;
+	first->InitEncode(&codecSettings, kNumCores, kMaxPayloadSize);
+	first->RegisterEncodeCompleteCallback(&firstCallback);
+	second->InitEncode(&codecSettings, kNumCores, kMaxPayloadSize);
+	second->RegisterEncodeCompleteCallback(&secondCallback);
+	resized->InitEncode(&otherCodecSettings, kNumCores, kMaxPayloadSize);
+	resized->RegisterEncodeCompleteCallback(&resizedCallback);
+	other->InitEncode(&codecSettings, kNumCores, kMaxPayloadSize);
+	other->RegisterEncodeCompleteCallback(&otherCallback);
+	unknown->InitEncode(&codecSettings, kNumCores, kMaxPayloadSize);
+	unknown->RegisterEncodeCompleteCallback(&unknownCallback);
+
+	// The sessions are taken at the first frame, once its source is known.
+	ASSERT_EQ((size_t)0, manager->GetStats().sessions);
+	first->Encode(frame, nullptr, nullptr);
+	second->Encode(sameFrame, nullptr, nullptr);
+	resized->Encode(frame, nullptr, nullptr);
+	other->Encode(otherFrame, nullptr, nullptr);
+	unknown->Encode(unknownFrame, nullptr, nullptr);
+
+	auto stats = manager->GetStats();
+	ASSERT_EQ((size_t)1, stats.sessions);
+	ASSERT_EQ((size_t)2, stats.encoders);
+	ASSERT_EQ((size_t)3, stats.queued);
+
+	// Only the frames of the first encoder are encoded, starting with a key
+	// frame for the joining one.
+	first->Encode(frame, nullptr, nullptr);
+	second->Encode(sameFrame, nullptr, nullptr);
+	ASSERT_EQ(2, encodedFrames.load());
+	ASSERT_EQ(2, firstCallback.images);
+	ASSERT_EQ(1, secondCallback.images);
+	ASSERT_EQ(1, secondCallback.key_frames);
+	ASSERT_EQ(0, resizedCallback.images);
+	ASSERT_EQ(0, otherCallback.images);
+
+	// The second encoder feeds the session once the first left.
+	first->Release();
+	second->Encode(sameFrame, nullptr, nullptr);
+	ASSERT_EQ(3, encodedFrames.load());
+	ASSERT_EQ(2, secondCallback.images);
+	ASSERT_EQ(1, openSessions.load());
+
+	// The session closes with its last encoder, letting the others in one
+	// at a time, the frames of another source or of no known source never
+	// joining a session.
+	second->Release();
+	resized->Encode(frame, nullptr, nullptr);
+	ASSERT_EQ(1, resizedCallback.images);
+	resized->Release();
+	other->Encode(otherFrame, nullptr, nullptr);
+	unknown->Encode(unknownFrame, nullptr, nullptr);
+	ASSERT_EQ(1, otherCallback.images);
+	ASSERT_EQ(0, unknownCallback.images);
+	other->Release();
+	unknown->Encode(unknownFrame, nullptr, nullptr);
+	ASSERT_EQ(1, unknownCallback.images);
+	ASSERT_EQ(1, openSessions.load());
+	ASSERT_EQ((size_t)0, manager->GetStats().queued);
+}
+
+// Tests out opening the sessions and delivering their images without the
+// locks, which the allocator and the encoded image callbacks can thus take.
+TEST(EncoderSessionTests, OpensAndDeliversOutOfTheLocks)
+{
+	std::atomic<int> openSessions(0);
+	std::atomic<int> encodedFrames(0);
+	std::shared_ptr<EncoderSessionManager> manager;
+	manager = std::make_shared<EncoderSessionManager>([&]()
+	{
+		manager->GetStats();
+		return std::unique_ptr<webrtc::VideoEncoder>(new CountingVideoEncoder(&openSessions, &encodedFrames));
+	}, 1, true);
+
+	VideoCodec codecSettings;
+	SetDefaultCodecSettings(&codecSettings);
+	FrameSource source;
+	VideoFrame frame(source.CreateI420Buffer(codecSettings.width, codecSettings.height), kVideoRotation_0, 0);
+
+	std::unique_ptr<webrtc::VideoEncoder> first(manager->CreateEncoder());
+	std::unique_ptr<webrtc::VideoEncoder> second(manager->CreateEncoder());
+	ASSERT_EQ(WEBRTC_VIDEO_CODEC_OK, first->InitEncode(&codecSettings, kNumCores, kMaxPayloadSize));
+	ASSERT_EQ(WEBRTC_VIDEO_CODEC_OK, second->InitEncode(&codecSettings, kNumCores, kMaxPayloadSize));
+
+	// Drives the other encoder of the session from the delivery, as the
+	// thread of another peer may do meanwhile.
+	class ReentrantCallback : public CountingEncodedImageCallback
+	{
+	public:
+		explicit ReentrantCallback(webrtc::VideoEncoder* other) : other_(other) {}
+
+		Result OnEncodedImage(const EncodedImage& encoded_image, const CodecSpecificInfo* codec_specific_info,
+			const RTPFragmentationHeader* fragmentation) override
+		{
+			BitrateAllocation allocation;
+			allocation.SetBitrate(0, 0, 500000);
+			other_->SetRateAllocation(allocation, 30);
+			other_->SetChannelParameters(0, 0);
+			return CountingEncodedImageCallback::OnEncodedImage(encoded_image, codec_specific_info, fragmentation);
+		}
+
+	private:
+		webrtc::VideoEncoder* other_;
+	} firstCallback(second.get()), secondCallback(first.get());
+
+	first->RegisterEncodeCompleteCallback(&firstCallback);
+	second->RegisterEncodeCompleteCallback(&secondCallback);
+	ASSERT_EQ(WEBRTC_VIDEO_CODEC_OK, first->Encode(frame, nullptr, nullptr));
+	ASSERT_EQ(WEBRTC_VIDEO_CODEC_OK, second->Encode(frame, nullptr, nullptr));
+	ASSERT_EQ((size_t)1, manager->GetStats().sessions);
+	ASSERT_EQ((size_t)2, manager->GetStats().encoders);
+
+	ASSERT_EQ(WEBRTC_VIDEO_CODEC_OK, first->Encode(frame, nullptr, nullptr));
+	ASSERT_EQ(2, firstCallback.images);
+	ASSERT_EQ(1, secondCallback.images);
+
+	// Releasing an encoder waits for its delivery on another thread only.
+	CountingEncodedImageCallback plainCallback;
+	first->RegisterEncodeCompleteCallback(&plainCallback);
+	std::atomic<bool> encoding(true);
+	std::thread encodeThread([&]()
+	{
+		while (encoding)
+		{
+			first->Encode(frame, nullptr, nullptr);
+		}
+	});
+
+	second.reset();
+	encoding = false;
+	encodeThread.join();
+	first.reset();
+	ASSERT_EQ(0, openSessions.load());
+}
+
+// Tests out forcing the IDR frames every idr_period frames of the profile
+// of the session resolution, open sessions following a new configuration.
+TEST(EncoderSessionTests, ForcesIdrFramesOfTheProfile)
+{
+	std::atomic<int> openSessions(0);
+	std::atomic<int> encodedFrames(0);
+	auto manager = std::make_shared<EncoderSessionManager>([&]()
+	{
+		return std::unique_ptr<webrtc::VideoEncoder>(new CountingVideoEncoder(&openSessions, &encodedFrames));
+	}, 0, false);
+
+	VideoCodec codecSettings;
+	SetDefaultCodecSettings(&codecSettings);
+	VideoFrame frame(I420Buffer::Create(codecSettings.width, codecSettings.height), kVideoRotation_0, 0);
+
+	auto config = std::make_shared<NvEncConfig>();
+	config->profile = ConfigParser::GetDefaultEncoderProfile();
+	config->profile.idr_period = 0;
+	EncoderProfileOverride profileOverride = { codecSettings.width, codecSettings.height, config->profile };
+	profileOverride.profile.idr_period = 3;
+	config->profile_overrides.push_back(profileOverride);
+	manager->SetEncoderConfig(config);
+
+	std::unique_ptr<webrtc::VideoEncoder> encoder(manager->CreateEncoder());
+	CountingEncodedImageCallback callback;
+	encoder->InitEncode(&codecSettings, kNumCores, kMaxPayloadSize);
+	encoder->RegisterEncodeCompleteCallback(&callback);
+	for (int i = 0; i < 7; i++)
+	{
+		encoder->Encode(frame, nullptr, nullptr);
+	}
+
+	ASSERT_EQ(7, callback.images);
+	ASSERT_EQ(2, callback.key_frames);
+
+	// The default profile leaves the IDR frames to the encoder.
+	manager->SetEncoderConfig(std::make_shared<NvEncConfig>(NvEncConfig{ 60, config->profile }));
+	for (int i = 0; i < 7; i++)
+	{
+		encoder->Encode(frame, nullptr, nullptr);
+	}
+
+	ASSERT_EQ(14, callback.images);
+	ASSERT_EQ(2, callback.key_frames);
+}
+
+// Tests out creating a factory per worker thread, handed out in turn.
+TEST(EncoderSessionTests, CreatesFactoryPerWorkerThread)
+{
+	rtc::EnsureWinsockInit();
+	rtc::Win32SocketServer w32_ss;
+	rtc::Win32Thread w32_thread(&w32_ss);
+	rtc::ThreadManager::Instance()->SetCurrentThread(&w32_thread);
+	rtc::InitializeSSL();
+
+	ServerAppConfig config = {};
+	config.worker_threads = 2;
+	config.worker_thread_cores.push_back(0);
+	config.max_encoder_sessions = 2;
+	{
+		PeerFactoryTopology topology(config);
+		ASSERT_EQ((size_t)2, topology.factories().size());
+		ASSERT_EQ(topology.factories()[0].get(), topology.NextFactory().get());
+		ASSERT_EQ(topology.factories()[1].get(), topology.NextFactory().get());
+		ASSERT_EQ(topology.factories()[0].get(), topology.NextFactory().get());
+		ASSERT_EQ((size_t)2, topology.encoder_sessions()->GetStats().max_sessions);
+	}
+
+	rtc::CleanupSSL();
+}
+
 // --------------------------------------------------------------
 // Decoder tests
 // --------------------------------------------------------------
@@ -86,6 +86,11 @@ public:
 		return connected_peers_[peer_id];
 	}
 
+	virtual scoped_refptr<PeerConductor> AllocatePeerConductor() override
+	{
+		return new RefCountedObject<IntPeerConductorFixture>(peer_factory_);
+	}
+
 	MOCK_METHOD0(SafeAllocatePeerMapEntry_Counter, void());
 private:
 	struct FullServerConfigFixture : public FullServerConfig
@@ -97,6 +102,36 @@ private:
 	};
 };
 
+// uses the peer allocation of MultiPeerConductor, with a pool of the given size
+class PooledMultiPeerConductorFixture : public MultiPeerConductor
+{
+public:
+	PooledMultiPeerConductorFixture(scoped_refptr<PeerConnectionFactoryInterface> peer_factory, int peer_pool_size) :
+		MultiPeerConductor(MakeConfig(peer_pool_size), peer_factory)
+	{
+	}
+
+	// the messages posted to refill the pool are left to the test
+	virtual void OnMessage(rtc::Message*) override {}
+
+	void Test_FillPeerPool()
+	{
+		while (peer_pool_.FillOne());
+	}
+
+	MOCK_METHOD0(AllocatePeerConductor, scoped_refptr<PeerConductor>());
+
+private:
+	static shared_ptr<FullServerConfig> MakeConfig(int peer_pool_size)
+	{
+		auto config = make_shared<FullServerConfig>();
+		config->server_config = make_shared<ServerConfig>();
+		config->server_config->server_config.peer_pool_size = peer_pool_size;
+		config->webrtc_config = make_shared<WebRTCConfig>();
+		return config;
+	}
+};
+
 class PeerConnectionFactoryInterfaceFixture : public PeerConnectionFactoryInterface
 {
 public:
@@ -196,6 +231,7 @@ public:
 	MOCK_METHOD0(ice_gathering_state, webrtc::PeerConnectionInterface::IceGatheringState());
 	MOCK_METHOD0(Close, void());
 	MOCK_METHOD2(CreateAnswer, void(webrtc::CreateSessionDescriptionObserver*, const webrtc::MediaConstraintsInterface*));
+	MOCK_METHOD2(CreateOffer, void(webrtc::CreateSessionDescriptionObserver*, const webrtc::MediaConstraintsInterface*));
 };
 
 class SessionDescriptionInterfaceFixture : public SessionDescriptionInterface
@@ -403,3 +439,93 @@ TEST(PeerConductorTests, PeerConductor_MultiPeer_Alloc_Success)
 
 	ASSERT_EQ(fixture->Peers().size(), 3);
 }
+
+TEST(PeerConductorTests, PeerConductor_Prewarm_Success)
+{
+	auto factoryFixture = new rtc::RefCountedObject<PeerConnectionFactoryInterfaceFixture>();
+	auto streamFixture = new rtc::RefCountedObject<MediaStreamInterfaceFixture>();
+	auto connFixture = new rtc::RefCountedObject<PeerConnectionInterfaceFixture>();
+	auto fixture = new rtc::RefCountedObject<PeerConductorFixture>(factoryFixture);
+
+	// the connection should be created once, gathering candidates ahead of the offer
+	EXPECT_CALL(*factoryFixture, CreatePeerConnection_RawPtr(_, _, _, _, _))
+		.Times(Exactly(1))
+		.WillOnce(Invoke([&](const PeerConnectionInterface::RTCConfiguration& configuration,
+			const webrtc::MediaConstraintsInterface* constraints,
+			cricket::PortAllocator* allocator,
+			rtc::RTCCertificateGeneratorInterface* cert_generator,
+			PeerConnectionObserver* observer) {
+		EXPECT_LT(0, configuration.ice_candidate_pool_size);
+		return connFixture;
+	}));
+	EXPECT_CALL(*fixture, AllocateVideoCapturer())
+		.Times(Exactly(1));
+	EXPECT_CALL(*factoryFixture, CreateLocalMediaStream(_))
+		.WillOnce(Invoke([&](std::string) {
+		return streamFixture;
+	}));
+	EXPECT_CALL(*connFixture, CreateDataChannel(_, _))
+		.Times(Exactly(1));
+	EXPECT_CALL(*connFixture, CreateOffer(_, _))
+		.Times(Exactly(1));
+
+	// pre-warm the conn, which isn't connected to a peer yet
+	fixture->Prewarm();
+	ASSERT_FALSE(fixture->IsConnected());
+	ASSERT_EQ(fixture->Streams().size(), 1);
+
+	fixture->Assign(1, "test", [](const std::string&) {});
+	ASSERT_EQ(1, fixture->Id());
+	ASSERT_STREQ("test", fixture->Name().c_str());
+
+	// only the offer is left to create
+	fixture->AllocatePeerConnection(true);
+	ASSERT_TRUE(fixture->IsConnected());
+	ASSERT_EQ(fixture->Streams().size(), 1);
+}
+
+TEST(PeerConductorTests, PeerConductor_MultiPeer_Pool_Success)
+{
+	auto factoryFixture = new rtc::RefCountedObject<PeerConnectionFactoryInterfaceFixture>();
+	auto streamFixture = new rtc::RefCountedObject<MediaStreamInterfaceFixture>();
+	auto connFixture = new rtc::RefCountedObject<PeerConnectionInterfaceFixture>();
+	auto fixture = new rtc::RefCountedObject<PooledMultiPeerConductorFixture>(factoryFixture, 2);
+	std::vector<scoped_refptr<PeerConductor>> allocated;
+
+	// two conns pre-warmed, and one for the peer connecting once the pool is empty
+	EXPECT_CALL(*fixture, AllocatePeerConductor())
+		.Times(Exactly(3))
+		.WillRepeatedly(Invoke([&]() {
+		scoped_refptr<PeerConductor> peer = new rtc::RefCountedObject<PeerConductorFixture>(factoryFixture);
+		allocated.push_back(peer);
+		return peer;
+	}));
+	EXPECT_CALL(*factoryFixture, CreatePeerConnection_RawPtr(_, _, _, _, _))
+		.Times(Exactly(3))
+		.WillRepeatedly(Return(connFixture));
+	EXPECT_CALL(*factoryFixture, CreateLocalMediaStream(_))
+		.WillRepeatedly(Return(streamFixture));
+	EXPECT_CALL(*connFixture, CreateOffer(_, _))
+		.Times(Exactly(3));
+
+	fixture->Test_FillPeerPool();
+	ASSERT_EQ((size_t)2, fixture->GetPeerPoolStats().warm);
+
+	// the first peers should get the pre-warmed conns, in order
+	fixture->ConnectToPeer(1);
+	fixture->ConnectToPeer(2);
+	fixture->ConnectToPeer(3);
+
+	ASSERT_EQ(fixture->Peers().size(), 3);
+	ASSERT_EQ(allocated[0].get(), fixture->Peers().at(1).get());
+	ASSERT_EQ(allocated[1].get(), fixture->Peers().at(2).get());
+	ASSERT_EQ(allocated[2].get(), fixture->Peers().at(3).get());
+	ASSERT_EQ(1, fixture->Peers().at(1)->Id());
+	ASSERT_TRUE(fixture->Peers().at(1)->IsConnected());
+
+	auto stats = fixture->GetPeerPoolStats();
+	ASSERT_EQ((size_t)0, stats.warm);
+	ASSERT_EQ((uint64_t)2, stats.prewarmed);
+	ASSERT_EQ((uint64_t)2, stats.hits);
+	ASSERT_EQ((uint64_t)1, stats.misses);
+}
@@ -0,0 +1,429 @@
+#include "pch.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include "glass_to_glass_loopback.h"
+#include "opengl_buffer_capturer.h"
+#include "webrtc/api/test/fakeconstraints.h"
+#include "webrtc/rtc_base/event.h"
+#include "webrtc/rtc_base/json.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/ssladapter.h"
+
+namespace
+{
+	// Time allowed for the peers to connect.
+	const int kConnectionTimeoutMs = 10000;
+
+	// Interval between the requests for stamped frames.
+	const int64_t kStampRequestIntervalUs = 1000000;
+
+	// Grey frame content, so that only the stamp has contrast.
+	const uint8_t kFrameLevel = 128;
+
+	class CreateDescriptionObserver : public webrtc::CreateSessionDescriptionObserver
+	{
+	public:
+		explicit CreateDescriptionObserver(
+			const std::function<void(webrtc::SessionDescriptionInterface*)>& on_success) :
+			on_success_(on_success)
+		{
+		}
+
+		void OnSuccess(webrtc::SessionDescriptionInterface* desc) override
+		{
+			on_success_(desc);
+		}
+
+		void OnFailure(const std::string& error) override
+		{
+			LOG(LS_ERROR) << "Failed to create session description: " << error;
+		}
+
+	private:
+		std::function<void(webrtc::SessionDescriptionInterface*)> on_success_;
+	};
+
+	class SetDescriptionObserver : public webrtc::SetSessionDescriptionObserver
+	{
+	public:
+		static SetDescriptionObserver* Create()
+		{
+			return new rtc::RefCountedObject<SetDescriptionObserver>();
+		}
+
+		void OnSuccess() override
+		{
+		}
+
+		void OnFailure(const std::string& error) override
+		{
+			LOG(LS_ERROR) << "Failed to set session description: " << error;
+		}
+	};
+
+	// Copies a description owned by one peer connection for the other one.
+	webrtc::SessionDescriptionInterface* CopyDescription(const webrtc::SessionDescriptionInterface* desc)
+	{
+		std::string sdp;
+		desc->ToString(&sdp);
+		return webrtc::CreateSessionDescription(desc->type(), sdp, nullptr);
+	}
+}
+
+namespace StreamingToolkit
+{
+	// Peer connection and data channel observer of one side of the loopback.
+	class LoopbackPeer : public webrtc::PeerConnectionObserver, public webrtc::DataChannelObserver
+	{
+	public:
+		LoopbackPeer() :
+			connected_(true, false)
+		{
+		}
+
+		void OnSignalingChange(webrtc::PeerConnectionInterface::SignalingState new_state) override
+		{
+		}
+
+		void OnAddStream(rtc::scoped_refptr<webrtc::MediaStreamInterface> stream) override
+		{
+			if (on_add_stream_)
+			{
+				on_add_stream_(stream);
+			}
+		}
+
+		void OnRemoveStream(rtc::scoped_refptr<webrtc::MediaStreamInterface> stream) override
+		{
+		}
+
+		void OnDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel) override
+		{
+			SetDataChannel(channel);
+		}
+
+		void OnRenegotiationNeeded() override
+		{
+		}
+
+		void OnIceConnectionChange(webrtc::PeerConnectionInterface::IceConnectionState new_state) override
+		{
+			if (new_state == webrtc::PeerConnectionInterface::kIceConnectionConnected ||
+				new_state == webrtc::PeerConnectionInterface::kIceConnectionCompleted)
+			{
+				connected_.Set();
+			}
+		}
+
+		void OnIceGatheringChange(webrtc::PeerConnectionInterface::IceGatheringState new_state) override
+		{
+		}
+
+		void OnIceCandidate(const webrtc::IceCandidateInterface* candidate) override
+		{
+			if (on_ice_candidate_)
+			{
+				on_ice_candidate_(candidate);
+			}
+		}
+
+		void OnStateChange() override
+		{
+		}
+
+		void OnMessage(const webrtc::DataBuffer& buffer) override
+		{
+			if (on_message_)
+			{
+				on_message_(std::string(buffer.data.data<char>(), buffer.data.size()));
+			}
+		}
+
+		void SetDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel)
+		{
+			data_channel_ = channel;
+			data_channel_->RegisterObserver(this);
+		}
+
+		void Send(const std::string& message)
+		{
+			if (data_channel_ && data_channel_->state() == webrtc::DataChannelInterface::kOpen)
+			{
+				data_channel_->Send(webrtc::DataBuffer(message));
+			}
+		}
+
+		void Close()
+		{
+			if (data_channel_)
+			{
+				data_channel_->UnregisterObserver();
+				data_channel_ = nullptr;
+			}
+
+			if (peer_connection_)
+			{
+				peer_connection_->Close();
+				peer_connection_ = nullptr;
+			}
+		}
+
+		rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection_;
+		rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel_;
+		rtc::Event connected_;
+		std::function<void(rtc::scoped_refptr<webrtc::MediaStreamInterface>)> on_add_stream_;
+		std::function<void(const webrtc::IceCandidateInterface*)> on_ice_candidate_;
+		std::function<void(const std::string&)> on_message_;
+	};
+
+	// Client side sink, reads the stamps of the decoded frames the same way
+	// as ClientMainWindow::ClientVideoRenderer.
+	class StampReader : public rtc::VideoSinkInterface<webrtc::VideoFrame>
+	{
+	public:
+		explicit StampReader(LoopbackPeer* client) :
+			client_(client),
+			last_stamp_request_us_(0),
+			decoded_frames_(0)
+		{
+		}
+
+		void OnFrame(const webrtc::VideoFrame& frame) override
+		{
+			rtc::scoped_refptr<webrtc::I420BufferInterface> buffer =
+				frame.video_frame_buffer()->ToI420();
+
+			int64_t present_us = FrameStampCodec::Now();
+			FrameStamp stamp;
+			if (FrameStampCodec::ReadI420(buffer->DataY(), buffer->StrideY(),
+				buffer->width(), buffer->height(), &stamp))
+			{
+				stats_.AddFrame(stamp, present_us);
+			}
+			else
+			{
+				stats_.AddUnstampedFrame();
+				if (present_us - last_stamp_request_us_ >= kStampRequestIntervalUs)
+				{
+					client_->Send(GlassToGlassStats::kRequestMessage);
+					last_stamp_request_us_ = present_us;
+				}
+			}
+
+			if (stats_.IsReportDue(present_us))
+			{
+				client_->Send(GlassToGlassStats::ToMessage(stats_.TakeReport(present_us)));
+			}
+
+			decoded_frames_++;
+		}
+
+		int decoded_frames() const
+		{
+			return decoded_frames_;
+		}
+
+	private:
+		LoopbackPeer* client_;
+		GlassToGlassStats stats_;
+		int64_t last_stamp_request_us_;
+		std::atomic<int> decoded_frames_;
+	};
+
+	GlassToGlassLoopback::GlassToGlassLoopback(int width, int height, int fps) :
+		width_(width),
+		height_(height),
+		fps_(fps),
+		capturer_(nullptr)
+	{
+		rtc::InitializeSSL();
+
+		network_thread_ = rtc::Thread::CreateWithSocketServer();
+		worker_thread_ = rtc::Thread::Create();
+		signaling_thread_ = rtc::Thread::Create();
+		network_thread_->Start();
+		worker_thread_->Start();
+		signaling_thread_->Start();
+
+		peer_factory_ = webrtc::CreatePeerConnectionFactory(network_thread_.get(),
+			worker_thread_.get(), signaling_thread_.get(), nullptr, nullptr, nullptr);
+	}
+
+	GlassToGlassLoopback::~GlassToGlassLoopback()
+	{
+		if (client_)
+		{
+			client_->Close();
+		}
+
+		if (server_)
+		{
+			server_->Close();
+		}
+
+		peer_factory_ = nullptr;
+		signaling_thread_->Stop();
+		worker_thread_->Stop();
+		network_thread_->Stop();
+		rtc::CleanupSSL();
+	}
+
+	bool GlassToGlassLoopback::Run(int duration_ms)
+	{
+		CreatePeerConnections();
+		ConnectPeers();
+		if (!client_->connected_.Wait(kConnectionTimeoutMs))
+		{
+			return false;
+		}
+
+		SendFrames(duration_ms);
+		return true;
+	}
+
+	std::vector<GlassToGlassReport> GlassToGlassLoopback::reports() const
+	{
+		rtc::CritScope cs(&lock_);
+		return reports_;
+	}
+
+	int GlassToGlassLoopback::decoded_frames() const
+	{
+		return stamp_reader_ ? stamp_reader_->decoded_frames() : 0;
+	}
+
+	void GlassToGlassLoopback::CreatePeerConnections()
+	{
+		webrtc::PeerConnectionInterface::RTCConfiguration config;
+		webrtc::FakeConstraints constraints;
+		constraints.AddOptional(webrtc::MediaConstraintsInterface::kEnableDtlsSrtp, "true");
+
+		server_.reset(new LoopbackPeer());
+		client_.reset(new LoopbackPeer());
+		stamp_reader_.reset(new StampReader(client_.get()));
+
+		server_->peer_connection_ = peer_factory_->CreatePeerConnection(
+			config, &constraints, nullptr, nullptr, server_.get());
+
+		client_->peer_connection_ = peer_factory_->CreatePeerConnection(
+			config, &constraints, nullptr, nullptr, client_.get());
+
+		// The server streams the frames of an OpenGL capturer, which stamps
+		// them the same way as the DirectX one.
+		std::unique_ptr<OpenGLBufferCapturer> capturer(new OpenGLBufferCapturer());
+		capturer_ = capturer.get();
+		rtc::scoped_refptr<webrtc::VideoTrackInterface> video_track(
+			peer_factory_->CreateVideoTrack("video_label",
+				peer_factory_->CreateVideoSource(std::move(capturer), nullptr)));
+
+		rtc::scoped_refptr<webrtc::MediaStreamInterface> stream =
+			peer_factory_->CreateLocalMediaStream("stream_label");
+
+		stream->AddTrack(video_track);
+		server_->peer_connection_->AddStream(stream);
+
+		// The client opens the data channel, like the Win32 client.
+		webrtc::DataChannelInit data_channel_config;
+		data_channel_config.ordered = false;
+		data_channel_config.maxRetransmits = 0;
+		client_->SetDataChannel(client_->peer_connection_->CreateDataChannel(
+			"inputDataChannel", &data_channel_config));
+
+		server_->on_message_ = [this](const std::string& message)
+		{
+			HandleServerMessage(message);
+		};
+
+		client_->on_add_stream_ = [this](rtc::scoped_refptr<webrtc::MediaStreamInterface> stream)
+		{
+			if (!stream->GetVideoTracks().empty())
+			{
+				stream->GetVideoTracks()[0]->AddOrUpdateSink(stamp_reader_.get(), rtc::VideoSinkWants());
+			}
+		};
+	}
+
+	void GlassToGlassLoopback::ConnectPeers()
+	{
+		// Both peers share the signaling thread, so candidates are added
+		// before the callback returns.
+		LoopbackPeer* server = server_.get();
+		LoopbackPeer* client = client_.get();
+		server_->on_ice_candidate_ = [client](const webrtc::IceCandidateInterface* candidate)
+		{
+			client->peer_connection_->AddIceCandidate(candidate);
+		};
+
+		client_->on_ice_candidate_ = [server](const webrtc::IceCandidateInterface* candidate)
+		{
+			server->peer_connection_->AddIceCandidate(candidate);
+		};
+
+		rtc::scoped_refptr<webrtc::CreateSessionDescriptionObserver> answer_observer(
+			new rtc::RefCountedObject<CreateDescriptionObserver>(
+				[server, client](webrtc::SessionDescriptionInterface* answer)
+		{
+			server->peer_connection_->SetLocalDescription(SetDescriptionObserver::Create(), answer);
+			client->peer_connection_->SetRemoteDescription(SetDescriptionObserver::Create(),
+				CopyDescription(answer));
+		}));
+
+		rtc::scoped_refptr<webrtc::CreateSessionDescriptionObserver> offer_observer(
+			new rtc::RefCountedObject<CreateDescriptionObserver>(
+				[server, client, answer_observer](webrtc::SessionDescriptionInterface* offer)
+		{
+			client->peer_connection_->SetLocalDescription(SetDescriptionObserver::Create(), offer);
+			server->peer_connection_->SetRemoteDescription(SetDescriptionObserver::Create(),
+				CopyDescription(offer));
+
+			server->peer_connection_->CreateAnswer(answer_observer, nullptr);
+		}));
+
+		webrtc::FakeConstraints offer_constraints;
+		offer_constraints.SetMandatoryReceiveVideo(true);
+		client_->peer_connection_->CreateOffer(offer_observer, &offer_constraints);
+	}
+
+	void GlassToGlassLoopback::HandleServerMessage(const std::string& message)
+	{
+		Json::Reader reader;
+		Json::Value msg;
+		if (!reader.parse(message, msg, false) || !msg.isMember("type") || !msg.isMember("body"))
+		{
+			return;
+		}
+
+		std::string type = msg.get("type", "").asString();
+		std::string body = msg.get("body", "").asString();
+		if (type == "glass-to-glass")
+		{
+			capturer_->SetFrameStampEnabled(body == "1");
+		}
+		else if (type == GlassToGlassStats::kReportMessageType)
+		{
+			GlassToGlassReport report;
+			if (GlassToGlassStats::ParseReport(body, &report))
+			{
+				rtc::CritScope cs(&lock_);
+				reports_.push_back(report);
+			}
+		}
+	}
+
+	void GlassToGlassLoopback::SendFrames(int64_t duration_ms)
+	{
+		std::vector<uint8_t> frame(width_ * height_ * 4, kFrameLevel);
+		auto start_time = std::chrono::steady_clock::now();
+		for (int64_t i = 0; i * 1000 / fps_ < duration_ms; i++)
+		{
+			std::this_thread::sleep_until(start_time + std::chrono::milliseconds(i * 1000 / fps_));
+
+			// The capturer stamps the frame in place once requested.
+			std::fill(frame.begin(), frame.end(), kFrameLevel);
+			capturer_->SendFrame(frame.data(), width_, height_);
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "webrtc/api/peerconnectioninterface.h"
+#include "webrtc/rtc_base/criticalsection.h"
+#include "webrtc/rtc_base/thread.h"
+
+#include "frame_stamp.h"
+
+namespace StreamingToolkit
+{
+	class LoopbackPeer;
+	class OpenGLBufferCapturer;
+	class StampReader;
+
+	// Streams stamped frames from a server to a client peer connection in the
+	// same process, without signaling server, window or GPU. Like the Win32
+	// client, the client requests stamped frames over the data channel, reads
+	// the stamps of the decoded frames and reports the glass to glass latency
+	// back to the server.
+	class GlassToGlassLoopback
+	{
+	public:
+		GlassToGlassLoopback(int width, int height, int fps);
+
+		~GlassToGlassLoopback();
+
+		// Connects the peers and streams frames for the given duration.
+		// Returns false if the peers failed to connect.
+		bool Run(int duration_ms);
+
+		// Returns the reports received by the server.
+		std::vector<GlassToGlassReport> reports() const;
+
+		// Returns the number of frames decoded by the client.
+		int decoded_frames() const;
+
+	private:
+		void CreatePeerConnections();
+
+		void ConnectPeers();
+
+		void HandleServerMessage(const std::string& message);
+
+		void SendFrames(int64_t duration_ms);
+
+		const int width_;
+		const int height_;
+		const int fps_;
+		std::unique_ptr<rtc::Thread> network_thread_;
+		std::unique_ptr<rtc::Thread> worker_thread_;
+		std::unique_ptr<rtc::Thread> signaling_thread_;
+		rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peer_factory_;
+		std::unique_ptr<LoopbackPeer> server_;
+		std::unique_ptr<LoopbackPeer> client_;
+		std::unique_ptr<StampReader> stamp_reader_;
+
+		// Owned by the video source of the server.
+		OpenGLBufferCapturer* capturer_;
+
+		rtc::CriticalSection lock_;
+		std::vector<GlassToGlassReport> reports_;
+	};
+}
@@ -0,0 +1,185 @@
+#include "pch.h"
+
+#include "mapped_frame_generator.h"
+
+#include "libyuv/convert.h"
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/common_video/include/video_frame_buffer.h"
+#include "webrtc/rtc_base/checks.h"
+
+namespace webrtc {
+namespace test {
+namespace {
+
+// Number of frames paged in ahead of the one being returned.
+const size_t kPrefetchFrameCount = 2;
+
+// MappedFileGenerator returns views into a memory mapped raw file instead of
+// reading and copying each frame like YuvFileGenerator.
+class MappedFileGenerator : public FrameGenerator {
+ public:
+  MappedFileGenerator(std::shared_ptr<StreamingToolkit::MemoryMappedFile> file,
+                      MappedFrameFormat format,
+                      size_t width,
+                      size_t height,
+                      int frame_repeat_count,
+                      bool loop)
+      : file_(file),
+        format_(format),
+        width_(static_cast<int>(width)),
+        height_(static_cast<int>(height)),
+        frame_size_(MappedFrameSize(format, width, height)),
+        frame_count_(file->size() / frame_size_),
+        frame_display_count_(frame_repeat_count),
+        current_display_count_(0),
+        next_frame_index_(0),
+        loop_(loop) {
+    RTC_DCHECK_GT(width, 0);
+    RTC_DCHECK_GT(height, 0);
+    RTC_DCHECK_GT(frame_repeat_count, 0);
+    RTC_CHECK_GT(frame_count_, 0);
+    file_->Prefetch(0, frame_size_ * kPrefetchFrameCount);
+  }
+
+  VideoFrame* NextFrame() override {
+    if (current_display_count_ == 0 && !ReadNextFrame())
+      return nullptr;
+    if (++current_display_count_ >= frame_display_count_)
+      current_display_count_ = 0;
+
+    temp_frame_.reset(
+        new VideoFrame(last_read_buffer_, 0, 0, webrtc::kVideoRotation_0));
+
+    // The hardware encoder path reads RGBA directly from the frame buffer.
+    if (format_ == MappedFrameFormat::kRGBA)
+      temp_frame_->set_frame_buffer(const_cast<uint8_t*>(last_read_data_));
+
+    return temp_frame_.get();
+  }
+
+ private:
+  bool ReadNextFrame() {
+    if (next_frame_index_ == frame_count_) {
+      if (!loop_)
+        return false;
+      next_frame_index_ = 0;
+    }
+
+    const uint8_t* data = file_->data() + next_frame_index_ * frame_size_;
+    last_read_data_ = data;
+    if (format_ == MappedFrameFormat::kI420) {
+      int chroma_width = (width_ + 1) / 2;
+      int chroma_height = (height_ + 1) / 2;
+      const uint8_t* data_u = data + width_ * height_;
+      const uint8_t* data_v = data_u + chroma_width * chroma_height;
+      std::shared_ptr<StreamingToolkit::MemoryMappedFile> file = file_;
+      last_read_buffer_ = new rtc::RefCountedObject<WrappedI420Buffer>(
+          width_, height_, data, width_, data_u, chroma_width, data_v,
+          chroma_width, rtc::Callback0<void>([file]() {}));
+    } else {
+      last_read_buffer_ = new rtc::RefCountedObject<MappedFrameBuffer>(
+          file_, format_, width_, height_, data);
+    }
+
+    // Pages in the upcoming frames while this one is being consumed.
+    size_t prefetch_index = (next_frame_index_ + 1) % frame_count_;
+    file_->Prefetch(prefetch_index * frame_size_,
+                    frame_size_ * kPrefetchFrameCount);
+
+    next_frame_index_++;
+    return true;
+  }
+
+  const std::shared_ptr<StreamingToolkit::MemoryMappedFile> file_;
+  const MappedFrameFormat format_;
+  const int width_;
+  const int height_;
+  const size_t frame_size_;
+  const size_t frame_count_;
+  const int frame_display_count_;
+  int current_display_count_;
+  size_t next_frame_index_;
+  const bool loop_;
+  const uint8_t* last_read_data_ = nullptr;
+  rtc::scoped_refptr<VideoFrameBuffer> last_read_buffer_;
+  std::unique_ptr<VideoFrame> temp_frame_;
+};
+
+}  // namespace
+
+MappedFrameBuffer::MappedFrameBuffer(
+    std::shared_ptr<StreamingToolkit::MemoryMappedFile> file,
+    MappedFrameFormat format,
+    int width,
+    int height,
+    const uint8_t* data)
+    : file_(file),
+      format_(format),
+      width_(width),
+      height_(height),
+      data_(data) {}
+
+VideoFrameBuffer::Type MappedFrameBuffer::type() const {
+  return Type::kNative;
+}
+
+int MappedFrameBuffer::width() const {
+  return width_;
+}
+
+int MappedFrameBuffer::height() const {
+  return height_;
+}
+
+rtc::scoped_refptr<I420BufferInterface> MappedFrameBuffer::ToI420() {
+  rtc::scoped_refptr<I420Buffer> buffer = I420Buffer::Create(width_, height_);
+  if (format_ == MappedFrameFormat::kNV12) {
+    const uint8_t* data_uv = data_ + width_ * height_;
+    int stride_uv = ((width_ + 1) / 2) * 2;
+    libyuv::NV12ToI420(data_, width_, data_uv, stride_uv,
+                       buffer->MutableDataY(), buffer->StrideY(),
+                       buffer->MutableDataU(), buffer->StrideU(),
+                       buffer->MutableDataV(), buffer->StrideV(), width_,
+                       height_);
+  } else {
+    libyuv::ABGRToI420(data_, width_ * 4, buffer->MutableDataY(),
+                       buffer->StrideY(), buffer->MutableDataU(),
+                       buffer->StrideU(), buffer->MutableDataV(),
+                       buffer->StrideV(), width_, height_);
+  }
+
+  return buffer;
+}
+
+size_t MappedFrameSize(MappedFrameFormat format, size_t width, size_t height) {
+  size_t chroma_size = ((width + 1) / 2) * ((height + 1) / 2);
+  switch (format) {
+    case MappedFrameFormat::kRGBA:
+      return width * height * 4;
+    case MappedFrameFormat::kI420:
+    case MappedFrameFormat::kNV12:
+    default:
+      return width * height + 2 * chroma_size;
+  }
+}
+
+std::unique_ptr<FrameGenerator> CreateFromMappedFile(
+    const std::string& filename,
+    MappedFrameFormat format,
+    size_t width,
+    size_t height,
+    int frame_repeat_count,
+    bool loop) {
+  std::shared_ptr<StreamingToolkit::MemoryMappedFile> file(
+      new StreamingToolkit::MemoryMappedFile());
+  if (!file->Open(filename) ||
+      file->size() < MappedFrameSize(format, width, height)) {
+    return nullptr;
+  }
+
+  return std::unique_ptr<FrameGenerator>(new MappedFileGenerator(
+      file, format, width, height, frame_repeat_count, loop));
+}
+
+}  // namespace test
+}  // namespace webrtc
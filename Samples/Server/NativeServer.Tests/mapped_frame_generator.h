@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "webrtc/api/video/video_frame_buffer.h"
+#include "webrtc/test/frame_generator.h"
+
+#include "memory_mapped_file.h"
+
+namespace webrtc {
+namespace test {
+
+// Pixel layout of the frames in a raw file read by the mapped frame generator.
+enum class MappedFrameFormat { kI420, kNV12, kRGBA };
+
+// Non-owning view over a packed NV12 or RGBA frame inside a memory mapped
+// file. The frame is only converted when ToI420() is called.
+class MappedFrameBuffer : public VideoFrameBuffer {
+ public:
+  MappedFrameBuffer(std::shared_ptr<StreamingToolkit::MemoryMappedFile> file,
+                    MappedFrameFormat format,
+                    int width,
+                    int height,
+                    const uint8_t* data);
+
+  Type type() const override;
+  int width() const override;
+  int height() const override;
+  rtc::scoped_refptr<I420BufferInterface> ToI420() override;
+
+  MappedFrameFormat format() const { return format_; }
+  const uint8_t* data() const { return data_; }
+
+ private:
+  const std::shared_ptr<StreamingToolkit::MemoryMappedFile> file_;
+  const MappedFrameFormat format_;
+  const int width_;
+  const int height_;
+  const uint8_t* const data_;
+};
+
+// Creates a frame generator that memory maps a raw I420, NV12 or RGBA file
+// and returns zero copy views of its frames. I420 frames are regular I420
+// buffers, NV12 and RGBA frames are MappedFrameBuffer instances. RGBA frames
+// also set the raw frame buffer used by the hardware encoder. Returns null
+// when the file can't be mapped.
+std::unique_ptr<FrameGenerator> CreateFromMappedFile(
+    const std::string& filename,
+    MappedFrameFormat format,
+    size_t width,
+    size_t height,
+    int frame_repeat_count = 1,
+    bool loop = true);
+
+// Returns the size in bytes of a single packed frame.
+size_t MappedFrameSize(MappedFrameFormat format, size_t width, size_t height);
+
+}  // namespace test
+}  // namespace webrtc
@@ -5,12 +5,15 @@
 #include <shellapi.h>
 
 #include "config_parser.h"
+#include "config_watcher.h"
 #include "CubeRenderer.h"
 #include "macros.h"
 #include "opengl_multi_peer_conductor.h"
 #include "server_main_window.h"
 #include "service/render_service.h"
 #include "webrtc.h"
+#include "webrtc/rtc_base/logging.h"
+#include "webrtc/rtc_base/timeutils.h"
 
 // If clients don't send "stereo-rendering" message after this time,
 // the video stream will start in non-stereo mode.
@@ -86,8 +89,8 @@ struct RemotePeerData
 	// The pixel data of the render texture
 	std::shared_ptr<GLubyte>		colorBuffer;
 
-	// Used for FPS limiter.
-	ULONGLONG						tick;
+	// True while the peer is rendered at the keep-alive rate
+	bool							isIdle;
 
 	// The starting time.
 	ULONGLONG						startTick;
@@ -191,10 +194,64 @@ void InitializeRenderBuffer(RemotePeerData* peerData, int width, int height, boo
 	peerData->colorBuffer.reset(new GLubyte[width * height * 4]);
 }
 
+void ReleaseRenderBuffer(RemotePeerData* peerData)
+{
+	glDeleteTextures(1, &peerData->renderTexture);
+	glDeleteRenderbuffers(1, &peerData->depthBuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffersEXT(1, &peerData->frameBuffer);
+}
+
+// Removes the data of the peers which disconnected.
+void ReleaseDisconnectedPeers(const std::map<int, rtc::scoped_refptr<PeerConductor>>& peers)
+{
+	for (auto it = g_remotePeersData.begin(); it != g_remotePeersData.end();)
+	{
+		if (peers.find(it->first) == peers.end())
+		{
+			ReleaseRenderBuffer(it->second.get());
+			it = g_remotePeersData.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+// Logs the transitions of a peer to and from the keep-alive rate.
+void ReportIdleState(PeerConductor* peer, RemotePeerData* peerData)
+{
+	IdlePolicyStats stats = peer->idle_policy()->GetStats();
+	if (stats.idle != peerData->isIdle)
+	{
+		peerData->isIdle = stats.idle;
+		if (stats.idle)
+		{
+			LOG(LS_INFO) << "Peer " << peer->Id() << " is idle, rendering at the keep-alive rate.";
+		}
+		else
+		{
+			LOG(LS_INFO) << "Peer " << peer->Id() << " is active, idle for " <<
+				stats.idle_time_us / 1000 << " ms in total, " << stats.skipped_frames <<
+				" frames skipped.";
+		}
+	}
+}
+
+// Bounds the bitrate of a peer to the encoder profile of its frame size.
+void SetEncoderProfile(PeerConductor* peer, const NvEncConfig& nvEncConfig, int width, int height, bool isStereo)
+{
+	peer->SetEncoderProfile(ConfigParser::GetEncoderProfile(nvEncConfig, isStereo ? width << 1 : width, height));
+}
+
 bool AppMain(BOOL stopping)
 {
 	auto fullServerConfig = GlobalObject<FullServerConfig>::Get();
-	auto nvEncConfig = GlobalObject<NvEncConfig>::Get();
+
+	// Watches the configuration files, to apply their changes without
+	// restarting the sessions.
+	ConfigWatcher configWatcher(ConfigParser::GetAbsolutePath(""));
 
 	rtc::EnsureWinsockInit();
 	rtc::Win32SocketServer w32_ss;
@@ -234,6 +291,9 @@ bool AppMain(BOOL stopping)
 	// Registers the handler.
 	wnd.RegisterObserver(&cond);
 
+	// Applies the IDR period of the encoder profiles.
+	cond.SetEncoderConfig(configWatcher.Snapshot()->nvenc_config);
+
 	// Handles data channel messages.
 	std::function<void(int, const string&)> dataChannelMessageHandler([&](
 		int peerId,
@@ -267,12 +327,18 @@ bool AppMain(BOOL stopping)
 					fullServerConfig->server_config->server_config.height,
 					peerData->isStereo);
 
+				SetEncoderProfile(
+					cond.Peers().at(peerId).get(),
+					*configWatcher.Snapshot()->nvenc_config,
+					fullServerConfig->server_config->server_config.width,
+					fullServerConfig->server_config->server_config.height,
+					peerData->isStereo);
+
 				if (!peerData->isStereo)
 				{
 					peerData->eyeVector = g_cubeRenderer->GetDefaultEyeVector();
 					peerData->lookAtVector = g_cubeRenderer->GetDefaultLookAtVector();
 					peerData->upVector = g_cubeRenderer->GetDefaultUpVector();
-					peerData->tick = GetTickCount64();
 				}
 			}
 			else if (strcmp(type, "camera-transform-lookat") == 0)
@@ -312,6 +378,45 @@ bool AppMain(BOOL stopping)
 	// Sets data channel message handler.
 	cond.SetDataChannelMessageHandler(dataChannelMessageHandler);
 
+	// Drops the peers which sent no input for a while to the keep-alive rate.
+	IdlePolicyParams idlePolicyParams;
+	idlePolicyParams.idle_timeout_ms = fullServerConfig->server_config->server_config.idle_timeout;
+	idlePolicyParams.keep_alive_fps = fullServerConfig->server_config->server_config.keep_alive_fps;
+
+	// Applies the configuration changes to the live sessions. The watcher is
+	// polled from the main loop, so this runs on the main thread.
+	configWatcher.Subscribe([&](const ConfigSnapshot& previous, const ConfigSnapshot& current)
+	{
+		const ServerAppConfig& previousConfig = previous.server_config->server_config;
+		const ServerAppConfig& currentConfig = current.server_config->server_config;
+		if (currentConfig.system_capacity != previousConfig.system_capacity)
+		{
+			cond.SetMaxCapacity(currentConfig.system_capacity);
+		}
+
+		cond.SetEncoderConfig(current.nvenc_config);
+
+		idlePolicyParams.idle_timeout_ms = currentConfig.idle_timeout;
+		idlePolicyParams.keep_alive_fps = currentConfig.keep_alive_fps;
+		for each (auto pair in cond.Peers())
+		{
+			pair.second->idle_policy()->SetParams(idlePolicyParams);
+
+			// Only the bitrate of the peers follows the new encoder profiles,
+			// their frame size is kept.
+			auto it = g_remotePeersData.find(pair.first);
+			if (it != g_remotePeersData.end() && it->second->renderTexture)
+			{
+				SetEncoderProfile(
+					pair.second.get(),
+					*current.nvenc_config,
+					fullServerConfig->server_config->server_config.width,
+					fullServerConfig->server_config->server_config.height,
+					it->second->isStereo);
+			}
+		}
+	});
+
 	// Main loop.
 	MSG msg = { 0 };
 	while (!stopping && WM_QUIT != msg.message)
@@ -327,6 +432,8 @@ bool AppMain(BOOL stopping)
 		}
 		else
 		{
+			configWatcher.Poll();
+			ReleaseDisconnectedPeers(cond.Peers());
 			for each (auto pair in cond.Peers())
 			{
 				auto peer = (OpenGLPeerConductor*)pair.second.get();
@@ -338,6 +445,7 @@ bool AppMain(BOOL stopping)
 				{
 					peerData.reset(new RemotePeerData());
 					peerData->startTick = GetTickCount64();
+					peer->idle_policy()->SetParams(idlePolicyParams);
 					g_remotePeersData[peer->Id()] = peerData;
 				}
 				else
@@ -356,23 +464,30 @@ bool AppMain(BOOL stopping)
 							fullServerConfig->server_config->server_config.height,
 							false);
 
+						SetEncoderProfile(
+							peer,
+							*configWatcher.Snapshot()->nvenc_config,
+							fullServerConfig->server_config->server_config.width,
+							fullServerConfig->server_config->server_config.height,
+							false);
+
 						peerData->isStereo = false;
 						peerData->eyeVector = g_cubeRenderer->GetDefaultEyeVector();
 						peerData->lookAtVector = g_cubeRenderer->GetDefaultLookAtVector();
 						peerData->upVector = g_cubeRenderer->GetDefaultUpVector();
-						peerData->tick = GetTickCount64();
 					}
 				}
 				else
 				{
 					if (!peerData->isStereo)
 					{
-						// FPS limiter.
-						const int interval = 1000 / nvEncConfig->capture_fps;
-						ULONGLONG timeElapsed = GetTickCount64() - peerData->tick;
-						if (timeElapsed >= interval)
+						// FPS limiter, down to the keep-alive rate while
+						// the peer is idle.
+						IdlePolicy::FrameAction action = peer->idle_policy()->GetFrameAction(
+							rtc::TimeMicros(), configWatcher.Snapshot()->nvenc_config->capture_fps);
+						ReportIdleState(peer, peerData.get());
+						if (action == IdlePolicy::FrameAction::kRender)
 						{
-							peerData->tick = GetTickCount64() - timeElapsed + interval;
 
 							// Updates camera based on remote peer's input data.
 							g_cubeRenderer->UpdateView(
@@ -406,6 +521,13 @@ bool AppMain(BOOL stopping)
 								peerData->renderTextureWidth,
 								peerData->renderTextureHeight);
 						}
+						else if (action == IdlePolicy::FrameAction::kRepeat)
+						{
+							peer->SendFrame(
+								peerData->colorBuffer.get(),
+								peerData->renderTextureWidth,
+								peerData->renderTextureHeight);
+						}
 					}
 				}
 			}
@@ -415,11 +537,7 @@ bool AppMain(BOOL stopping)
 	// Cleanup.
 	for each (auto pair in g_remotePeersData)
 	{
-		RemotePeerData* peerData = pair.second.get();
-		glDeleteTextures(1, &peerData->renderTexture);
-		glDeleteRenderbuffers(1, &peerData->depthBuffer);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glDeleteFramebuffersEXT(1, &peerData->frameBuffer);
+		ReleaseRenderBuffer(pair.second.get());
 	}
 
 	rtc::CleanupSSL();
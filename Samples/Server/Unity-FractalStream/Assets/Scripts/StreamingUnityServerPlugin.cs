@@ -40,6 +40,21 @@ namespace Microsoft.Toolkit.ThreeD
 #endif
             public static extern void SendFrame(int peerId, bool isStereo, IntPtr leftRT, IntPtr rightRT, long predictionTimestamp);
 
+#if (UNITY_IPHONE || UNITY_WEBGL) && !UNITY_EDITOR
+            [DllImport ("__Internal")]
+#else
+            [DllImport(PluginName)]
+#endif
+            public static extern void SetSharedTextureCapture(bool enabled);
+
+#if (UNITY_IPHONE || UNITY_WEBGL) && !UNITY_EDITOR
+            [DllImport ("__Internal")]
+#else
+            [DllImport(PluginName)]
+#endif
+            [return: MarshalAs(UnmanagedType.I1)]
+            public static extern bool GetSharedTextureStats(int peerId, out long rendererHoldUs, out long captureHoldUs, out long droppedFrames);
+
 #if (UNITY_IPHONE || UNITY_WEBGL) && !UNITY_EDITOR
             [DllImport ("__Internal")]
 #else
@@ -218,6 +233,30 @@ namespace Microsoft.Toolkit.ThreeD
             yield return null;
         }
 
+        /// <summary>
+        /// Reads the frames back on a capture device of the plugin, through textures shared with
+        /// Unity's device, rather than on Unity's immediate context. Must be called before
+        /// <see cref="NativeInitWebRTC"/>.
+        /// </summary>
+        /// <param name="enabled">True to capture through shared textures.</param>
+        public void SetSharedTextureCapture(bool enabled)
+        {
+            Native.SetSharedTextureCapture(enabled);
+        }
+
+        /// <summary>
+        /// Gets the average time the shared textures are locked over the last frames.
+        /// </summary>
+        /// <param name="peerId">The peer id.</param>
+        /// <param name="rendererHoldUs">The time Unity's device holds a texture, in microseconds.</param>
+        /// <param name="captureHoldUs">The time the capture device holds a texture, in microseconds.</param>
+        /// <param name="droppedFrames">The number of frames replaced before they were captured.</param>
+        /// <returns>False if the peer isn't connected.</returns>
+        public bool GetSharedTextureStats(int peerId, out long rendererHoldUs, out long captureHoldUs, out long droppedFrames)
+        {
+            return Native.GetSharedTextureStats(peerId, out rendererHoldUs, out captureHoldUs, out droppedFrames);
+        }
+
         /// <summary>
         /// Connect to a peer identified by a given id
         /// </summary>
@@ -233,7 +272,8 @@ namespace Microsoft.Toolkit.ThreeD
         /// <param name="peerId">The peer id.</param>
         /// <param name="isStereo">True for stereo output.</param>
         /// <param name="leftRT">The left render texture.</param> 
-        /// <param name="rightRT">The right render texture.</param>
+        /// <param name="rightRT">The right render texture, or null if the left render texture holds
+        /// both eyes, as a texture array or side by side.</param>
         /// <param name="predictionTimestamp">The prediction timestamp.</param>
         public void SendFrame(int peerId, bool isStereo, RenderTexture leftRT, RenderTexture rightRT, long predictionTimestamp)
         {
@@ -252,7 +292,7 @@ namespace Microsoft.Toolkit.ThreeD
                     peerId,
                     isStereo,
                     leftRT.GetNativeTexturePtr(),
-                    rightRT.GetNativeTexturePtr(),
+                    rightRT != null ? rightRT.GetNativeTexturePtr() : IntPtr.Zero,
                     predictionTimestamp);
             }
         }
@@ -81,6 +81,16 @@ namespace Microsoft.Toolkit.ThreeD
         [Tooltip("Flag indicating if we should load the native plugin in the editor")]
         public bool UseEditorNativePlugin = false;
 
+        /// <summary>
+        /// Should the frames be read back on a capture device of the plugin?
+        /// </summary>
+        /// <remarks>
+        /// Unity's immediate context then only copies the frames into textures shared with the
+        /// capture device, which maps them without contending for Unity's context.
+        /// </remarks>
+        [Tooltip("Flag indicating if the frames should be captured through shared textures")]
+        public bool UseSharedTextures = false;
+
         /// <summary>
         /// Instance that represents the underlying native plugin that powers the webrtc experience
         /// </summary>
@@ -142,6 +152,7 @@ namespace Microsoft.Toolkit.ThreeD
             Open();
 
             // Initializes the buffer renderer using render texture.
+            Plugin.SetSharedTextureCapture(UseSharedTextures);
             StartCoroutine(Plugin.NativeInitWebRTC());
         }
 
@@ -7,16 +7,50 @@
 #include "nvFileIO.h"
 #include "nvUtils.h"
 #include "VideoTestRunner.h"
+#include <algorithm>
+#include <cmath>
 #include <string>
 
 using namespace StreamingToolkit;
 
+namespace
+{
+	// Output file for the per-test frame size measurements.
+	const char kFrameSizeStatsFileName[] = "frame_size_stats.csv";
+
+	// Output file for the foveated encoding evaluation.
+	const char kFoveatedEncodingStatsFileName[] = "foveated_encoding_stats.csv";
+
+	// Suffix of the foveated encoding tests, the baseline test has the same
+	// output file name without it.
+	const char kFoveatedEncodingSuffix[] = "-ROI.h264";
+
+	// Returns the size of a file, or -1 if it doesn't exist.
+	long long GetFileSize(const char* fileName)
+	{
+		FILE* file = fopen(fileName, "rb");
+		if (file == NULL)
+		{
+			return -1;
+		}
+
+		_fseeki64(file, 0, SEEK_END);
+		long long size = _ftelli64(file);
+		fclose(file);
+		return size;
+	}
+}
+
 // Constructor for VideoTestRunner.
 VideoTestRunner::VideoTestRunner(ID3D11Device* device, ID3D11DeviceContext* context) :
 	m_d3dDevice(device),
 	m_d3dContext(context),
 	m_initialized(false),
-	m_encoderCreated(false)
+	m_encoderCreated(false),
+	m_constantFrameSizeProfile(false),
+	m_lossRecoveryFrame(-1),
+	m_frameBudgetBytes(0),
+	m_foveatedEncoding(false)
 {
 	if (!m_initialized) 
 	{
@@ -57,6 +91,8 @@ NVENCSTATUS VideoTestRunner::Deinitialize()
 {
 	NVENCSTATUS nvStatus = NV_ENC_SUCCESS;
 	FlushEncoder();
+	ReportFoveatedEncodingSavings();
+	ReportFrameSizeStats();
 	ReleaseIOBuffers();
 	nvStatus = m_pNvHWEncoder->NvEncDestroyEncoder();
 	return nvStatus;
@@ -83,6 +119,9 @@ void VideoTestRunner::StartTestRunner(IDXGISwapChain* swapChain)
 
 	m_currentFrame = 0;
 	m_lastTest = false;
+	m_constantFrameSizeProfile = false;
+	m_foveatedEncoding = false;
+	ResetFrameSizeStats();
 	GetDefaultEncodeConfig();
 	m_minEncodeConfig = m_encodeConfig;
 
@@ -114,6 +153,23 @@ NVENCSTATUS VideoTestRunner::InitializeEncoder()
 	//NV_ENC_H264_PROFILE_HIGH_444_GUID
 	SetEncodeProfile(1);
 
+	// Re-applies the profile since the VBV size depends on the current bitrate step.
+	if (m_constantFrameSizeProfile)
+	{
+		CNvHWEncoder::SetLowLatencyConstantFrameSizeProfile(&m_encodeConfig);
+
+		// Simulates a single loss halfway through the test to include the
+		// recovery frames in the worst case measurement.
+		m_lossRecoveryFrame = (m_encodeConfig.startFrameIdx + m_encodeConfig.endFrameIdx) / 2;
+	}
+	else
+	{
+		m_lossRecoveryFrame = -1;
+	}
+
+	// The QP delta maps are ignored unless enabled at creation.
+	m_encodeConfig.enableExtQPDeltaMap = m_foveatedEncoding;
+
 	m_pNvHWEncoder->Initialize((void*)m_d3dDevice, NV_ENC_DEVICE_TYPE_DIRECTX);
 
 	m_encodeConfig.presetGUID = m_pNvHWEncoder->GetPresetGUID(m_encodeConfig.encoderPreset, m_encodeConfig.codec);
@@ -137,6 +193,11 @@ NVENCSTATUS VideoTestRunner::InitializeEncoder()
 
 	AllocateIOBuffers();
 
+	ResetFrameSizeStats();
+	m_frameSizeStatsLabel = m_encodeConfig.outputFileName ? m_encodeConfig.outputFileName : "";
+	m_frameBudgetBytes = m_encodeConfig.rcMode != NV_ENC_PARAMS_RC_CONSTQP && m_encodeConfig.fps > 0 ?
+		(double)m_encodeConfig.bitrate / m_encodeConfig.fps / 8 : 0;
+
 	return NV_ENC_SUCCESS;
 }
 
@@ -211,7 +272,10 @@ void VideoTestRunner::Capture()
 	if (!pEncodeBuffer)
 	{
 		pEncodeBuffer = m_EncodeBufferQueue.GetPending();
-		m_pNvHWEncoder->ProcessOutput(pEncodeBuffer);
+		if (m_pNvHWEncoder->ProcessOutput(pEncodeBuffer) == NV_ENC_SUCCESS)
+		{
+			RecordFrameSize();
+		}
 
 		// UnMap the input buffer after frame done
 		if (pEncodeBuffer->stInputBfr.hInputSurface)
@@ -241,7 +305,29 @@ void VideoTestRunner::Capture()
 	// Encoding.
 	if (SUCCEEDED(hr))
 	{
-		nvStatus = m_pNvHWEncoder->NvEncEncodeFrame(pEncodeBuffer, NULL, m_encodeConfig.width, m_encodeConfig.height);
+		// Recovers from the simulated loss with an intra refresh wave instead of an IDR.
+		NvEncPictureCommand encPicCommand = { 0 };
+		NvEncPictureCommand* pEncPicCommand = NULL;
+		if (m_currentFrame == m_lossRecoveryFrame)
+		{
+			encPicCommand.bForceIntraRefresh = true;
+			encPicCommand.intraRefreshDuration = m_encodeConfig.intraRefreshDuration;
+			pEncPicCommand = &encPicCommand;
+		}
+
+		// The test runner renders a mono view, the region of interest stays
+		// at the view center.
+		int8_t* qpDeltaMap = NULL;
+		uint32_t qpDeltaMapSize = 0;
+		if (m_foveatedEncoding)
+		{
+			m_qpDeltaMap = m_roiQpMap.Generate(m_encodeConfig.width, m_encodeConfig.height, false);
+			qpDeltaMap = const_cast<int8_t*>(m_qpDeltaMap->data());
+			qpDeltaMapSize = (uint32_t)m_qpDeltaMap->size();
+		}
+
+		nvStatus = m_pNvHWEncoder->NvEncEncodeFrame(pEncodeBuffer, pEncPicCommand, m_encodeConfig.width, m_encodeConfig.height,
+			NV_ENC_PIC_STRUCT_FRAME, qpDeltaMap, qpDeltaMapSize);
 		if (nvStatus != NV_ENC_SUCCESS  && nvStatus != NV_ENC_ERR_NEED_MORE_INPUT)
 		{
 			return;
@@ -399,7 +485,11 @@ NVENCSTATUS VideoTestRunner::FlushEncoder()
 	EncodeBuffer *pEncodeBuffer = m_EncodeBufferQueue.GetPending();
 	while (pEncodeBuffer)
 	{
-		m_pNvHWEncoder->ProcessOutput(pEncodeBuffer);
+		if (m_pNvHWEncoder->ProcessOutput(pEncodeBuffer) == NV_ENC_SUCCESS)
+		{
+			RecordFrameSize();
+		}
+
 		pEncodeBuffer = m_EncodeBufferQueue.GetPending();
 
 		// UnMap the input buffer after frame is done.
@@ -487,12 +577,12 @@ void VideoTestRunner::IncrementTest()
 	
 	switch (m_encodeConfig.rcMode) 
 	{
-		case NV_ENC_PARAMS_RC_CBR_LOWDELAY_HQ:  strcat(m_fileName, "-CBRLLHQ.h264"); break;
+		case NV_ENC_PARAMS_RC_CBR_LOWDELAY_HQ:  strcat(m_fileName, m_constantFrameSizeProfile ? "-CBRLLHQ-CFS.h264" : "-CBRLLHQ.h264"); break;
 		case NV_ENC_PARAMS_RC_CBR:				strcat(m_fileName, "-CBR.h264"); break;
 		case NV_ENC_PARAMS_RC_CONSTQP:			
 			strcat(m_fileName, "-CONSTQP");
 			strcat(m_fileName, std::to_string(m_encodeConfig.qp).c_str());
-			strcat(m_fileName, ".h264");
+			strcat(m_fileName, m_foveatedEncoding ? kFoveatedEncodingSuffix : ".h264");
 			break; 
 		case NV_ENC_PARAMS_RC_CBR_HQ:			strcat(m_fileName, "-CBRHQ.h264"); break;
 		case NV_ENC_PARAMS_RC_VBR_HQ:
@@ -558,6 +648,7 @@ void VideoTestRunner::IncrementTestSuite()
 			m_minEncodeConfig.rcMode = NV_ENC_PARAMS_RC_CONSTQP;
 			m_minEncodeConfig.encoderPreset = "losslessHP";
 		case 1: //Lowlatency CBR
+			m_constantFrameSizeProfile = false;
 			m_minEncodeConfig.rcMode = NV_ENC_PARAMS_RC_CBR_LOWDELAY_HQ;
 			m_minEncodeConfig.encoderPreset = "lowLatencyHQ";
 			break;
@@ -578,6 +669,29 @@ void VideoTestRunner::IncrementTestSuite()
 			m_minEncodeConfig.rcMode = NV_ENC_PARAMS_RC_CONSTQP;
 			m_minEncodeConfig.encoderPreset = "lossless";
 			break;
+		case 6: //Lowlatency constant frame size (intra refresh, infinite GOP, single frame VBV)
+			m_minEncodeConfig.qp = 0;
+			m_constantFrameSizeProfile = true;
+			CNvHWEncoder::SetLowLatencyConstantFrameSizeProfile(&m_minEncodeConfig);
+			break;
+		case 7: //Foveated encoding baseline, low latency preset at constant QP
+			//Undoes the constant frame size profile of the previous suite, which the
+			//foveated suites would otherwise inherit.
+			m_constantFrameSizeProfile = false;
+			m_minEncodeConfig.intraRefreshEnableFlag = true;
+			m_minEncodeConfig.intraRefreshPeriod = 30;
+			m_minEncodeConfig.intraRefreshDuration = 3;
+			m_minEncodeConfig.vbvMaxBitrate = 0;
+			m_minEncodeConfig.vbvSize = 0;
+			m_minEncodeConfig.invalidateRefFramesEnableFlag = true;
+			m_minEncodeConfig.qp = 24;
+			m_minEncodeConfig.rcMode = NV_ENC_PARAMS_RC_CONSTQP;
+			m_minEncodeConfig.encoderPreset = "lowLatencyHQ";
+			break;
+		case 8: //Foveated encoding, same tests with the QP raised away from the view center
+			m_foveatedEncoding = true;
+			m_minEncodeConfig.qp = 24;
+			break;
 		default:
 			m_testRunComplete = true;
 			break;
@@ -597,3 +711,134 @@ bool VideoTestRunner::TestsComplete()
 {
 	return m_testRunComplete;
 }
+
+void VideoTestRunner::ResetFrameSizeStats()
+{
+	memset(&m_frameSizeStats, 0, sizeof(FrameSizeStats));
+}
+
+void VideoTestRunner::RecordFrameSize()
+{
+	uint32_t frameBytes = m_pNvHWEncoder->m_lockBitstreamData.bitstreamSizeInBytes;
+	if (frameBytes == 0)
+	{
+		return;
+	}
+
+	// Welford's online update keeps the variance stable over long runs.
+	m_frameSizeStats.frameCount++;
+	m_frameSizeStats.totalBytes += frameBytes;
+	m_frameSizeStats.maxBytes = max(m_frameSizeStats.maxBytes, frameBytes);
+	double delta = frameBytes - m_frameSizeStats.meanBytes;
+	m_frameSizeStats.meanBytes += delta / m_frameSizeStats.frameCount;
+	m_frameSizeStats.sumSquaredDiff += delta * (frameBytes - m_frameSizeStats.meanBytes);
+}
+
+void VideoTestRunner::ReportFrameSizeStats()
+{
+	if (m_frameSizeStats.frameCount == 0)
+	{
+		return;
+	}
+
+	double variance = m_frameSizeStats.sumSquaredDiff / m_frameSizeStats.frameCount;
+	double stdDev = sqrt(variance);
+
+	double frameBudgetBytes = m_frameBudgetBytes;
+	double maxToBudget = frameBudgetBytes > 0 ? m_frameSizeStats.maxBytes / frameBudgetBytes : 0;
+
+	printf("%s: frames=%u mean=%.0fB stddev=%.0fB max=%uB max/budget=%.2f\n",
+		m_frameSizeStatsLabel.c_str(),
+		m_frameSizeStats.frameCount,
+		m_frameSizeStats.meanBytes,
+		stdDev,
+		m_frameSizeStats.maxBytes,
+		maxToBudget);
+
+	bool writeHeader = access(kFrameSizeStatsFileName, 0) != 0;
+	FILE* file = fopen(kFrameSizeStatsFileName, "a");
+	if (file == NULL)
+	{
+		PRINTERR("Failed to open \"%s\"\n", kFrameSizeStatsFileName);
+		return;
+	}
+
+	if (writeHeader)
+	{
+		fprintf(file, "test,frames,totalBytes,meanBytes,varianceBytes,stdDevBytes,maxBytes,frameBudgetBytes,maxToBudget\n");
+	}
+
+	fprintf(file, "%s,%u,%llu,%.2f,%.2f,%.2f,%u,%.2f,%.3f\n",
+		m_frameSizeStatsLabel.c_str(),
+		m_frameSizeStats.frameCount,
+		(unsigned long long)m_frameSizeStats.totalBytes,
+		m_frameSizeStats.meanBytes,
+		variance,
+		stdDev,
+		m_frameSizeStats.maxBytes,
+		frameBudgetBytes,
+		maxToBudget);
+
+	fclose(file);
+	ResetFrameSizeStats();
+}
+
+void VideoTestRunner::ReportFoveatedEncodingSavings()
+{
+	if (!m_foveatedEncoding || m_frameSizeStats.frameCount == 0)
+	{
+		return;
+	}
+
+	// The center of the view is encoded at the same constant QP in both
+	// tests, so the center quality matches and only the bitrate differs.
+	std::string baselineFileName = m_frameSizeStatsLabel;
+	size_t suffix = baselineFileName.rfind(kFoveatedEncodingSuffix);
+	if (suffix == std::string::npos)
+	{
+		return;
+	}
+
+	baselineFileName.replace(suffix, std::string::npos, ".h264");
+	long long baselineBytes = GetFileSize(baselineFileName.c_str());
+	if (baselineBytes <= 0)
+	{
+		PRINTERR("Missing foveated encoding baseline \"%s\"\n", baselineFileName.c_str());
+		return;
+	}
+
+	double savedRatio = 1.0 - (double)m_frameSizeStats.totalBytes / baselineBytes;
+	int macroblockCount = RoiQpMap::GetMacroblockCount(m_encodeConfig.width, m_encodeConfig.height);
+	int fullQualityCount = m_qpDeltaMap ?
+		(int)std::count(m_qpDeltaMap->begin(), m_qpDeltaMap->end(), 0) : macroblockCount;
+
+	printf("%s: baseline=%lldB foveated=%lluB saved=%.1f%% fullQualityArea=%.1f%%\n",
+		m_frameSizeStatsLabel.c_str(),
+		baselineBytes,
+		(unsigned long long)m_frameSizeStats.totalBytes,
+		savedRatio * 100,
+		fullQualityCount * 100.0 / macroblockCount);
+
+	bool writeHeader = access(kFoveatedEncodingStatsFileName, 0) != 0;
+	FILE* file = fopen(kFoveatedEncodingStatsFileName, "a");
+	if (file == NULL)
+	{
+		PRINTERR("Failed to open \"%s\"\n", kFoveatedEncodingStatsFileName);
+		return;
+	}
+
+	if (writeHeader)
+	{
+		fprintf(file, "test,maxQpDelta,baselineBytes,foveatedBytes,savedRatio,fullQualityArea\n");
+	}
+
+	fprintf(file, "%s,%d,%lld,%llu,%.4f,%.4f\n",
+		m_frameSizeStatsLabel.c_str(),
+		m_roiQpMap.params().max_qp_delta,
+		baselineBytes,
+		(unsigned long long)m_frameSizeStats.totalBytes,
+		savedRatio,
+		(double)fullQualityCount / macroblockCount);
+
+	fclose(file);
+}
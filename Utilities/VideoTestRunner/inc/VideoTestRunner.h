@@ -1,10 +1,12 @@
 #pragma once
 
 #include <d3d11.h>
+#include <string>
 #include "pch.h"
 #include "nvEncodeAPI.h"
 #include "nvCPUOPSys.h"
 #include "NvHWEncoder.h"
+#include "roi_qp_map.h"
 
 namespace StreamingToolkit
 {
@@ -82,6 +84,17 @@ namespace StreamingToolkit
 		uint32_t height;
 	} EncodeFrameConfig;
 
+	// Per-frame encoded size statistics for a single test, used to measure
+	// the variance and the worst case size that drive the tail latency.
+	typedef struct _FrameSizeStats
+	{
+		uint32_t frameCount;
+		uint32_t maxBytes;
+		uint64_t totalBytes;
+		double meanBytes;
+		double sumSquaredDiff;
+	} FrameSizeStats;
+
 	class VideoTestRunner
 	{
 	public:
@@ -123,6 +136,24 @@ namespace StreamingToolkit
 		bool								    m_initialized;
 		char*									m_fileName;
 
+		// Frame size measurement
+		bool									m_constantFrameSizeProfile;
+		int										m_lossRecoveryFrame;
+		FrameSizeStats							m_frameSizeStats;
+		std::string								m_frameSizeStatsLabel;
+
+		// Budget of a single frame at the target bitrate of the test being
+		// measured, zero for constant QP tests. Captured with the encoder,
+		// since the next test is configured before the stats are reported.
+		double									m_frameBudgetBytes;
+
+		// Foveated encoding evaluation, each constant QP test is run without
+		// then with the QP delta map to compare their sizes at the same
+		// center quality.
+		bool									m_foveatedEncoding;
+		RoiQpMap								m_roiQpMap;
+		std::shared_ptr<const std::vector<int8_t>>	m_qpDeltaMap;
+
 		NVENCSTATUS								InitializeEncoder();
 		NVENCSTATUS								AllocateIOBuffers();
 		NVENCSTATUS								ReleaseIOBuffers();
@@ -130,5 +161,9 @@ namespace StreamingToolkit
 		void									GetDefaultEncodeConfig();
 		NVENCSTATUS								SetEncodeProfile(int profileIndex);
 		void									Capture();
+		void									ResetFrameSizeStats();
+		void									RecordFrameSize();
+		void									ReportFrameSizeStats();
+		void									ReportFoveatedEncodingSavings();
 	};
 }